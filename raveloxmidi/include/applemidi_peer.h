@@ -0,0 +1,80 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+#ifndef APPLEMIDI_PEER_H
+#define APPLEMIDI_PEER_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "net_applemidi.h"
+
+/* Large enough for any UDP datagram so that an oversized packet is seen whole */
+#define APPLEMIDI_PEER_BUFFER_SIZE	65536
+
+/* A simulated remote AppleMIDI initiator used by the test tools.
+   Each peer has its own SSRC and its own control and data sockets */
+
+typedef struct applemidi_peer_t {
+	int		control_fd;
+	int		data_fd;
+	uint32_t	ssrc;
+	uint32_t	initiator;
+	uint32_t	remote_ssrc;
+	char		*name;
+	struct sockaddr_storage	control_addr;
+	struct sockaddr_storage	data_addr;
+	socklen_t	addr_len;
+	uint64_t	sync_start_us;
+	uint64_t	sync_rtt_us;
+	unsigned char	buffer[ APPLEMIDI_PEER_BUFFER_SIZE ];
+} applemidi_peer_t;
+
+/* Pointers into the peer buffer for the last RTP-MIDI packet read */
+typedef struct applemidi_peer_rtp_t {
+	size_t		packet_len;
+	uint16_t	seq;
+	uint32_t	timestamp;
+	uint32_t	ssrc;
+	unsigned char	*midi;
+	size_t		midi_len;
+	unsigned char	*journal;
+	size_t		journal_len;
+} applemidi_peer_rtp_t;
+
+/* Return values of applemidi_peer_read() */
+#define APPLEMIDI_PEER_READ_NONE	0
+#define APPLEMIDI_PEER_READ_RTP		1
+#define APPLEMIDI_PEER_READ_SYNC	2
+#define APPLEMIDI_PEER_READ_OTHER	3
+
+applemidi_peer_t *applemidi_peer_create( char *host, int control_port, int data_port, uint32_t ssrc, char *name );
+void applemidi_peer_destroy( applemidi_peer_t **peer );
+int applemidi_peer_invite( applemidi_peer_t *peer, int timeout_ms );
+int applemidi_peer_sync_start( applemidi_peer_t *peer );
+int applemidi_peer_sync( applemidi_peer_t *peer, int timeout_ms, uint64_t *rtt_us );
+int applemidi_peer_feedback( applemidi_peer_t *peer, uint16_t seq );
+int applemidi_peer_end( applemidi_peer_t *peer );
+int applemidi_peer_read( applemidi_peer_t *peer, applemidi_peer_rtp_t *rtp );
+
+int applemidi_local_open( char *host, int local_port );
+uint64_t applemidi_peer_now_us( void );
+
+#endif
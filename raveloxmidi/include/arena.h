@@ -0,0 +1,75 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* Bump allocator for per-packet temporaries.
+   Everything allocated from an arena is released together by arena_reset().
+   Allocations that don't fit in the current block go into overflow blocks.
+   On reset the overflow blocks are freed and the main block is grown to the
+   high water mark, so a steady stream of packets stops touching the heap. */
+
+#define ARENA_DEFAULT_SIZE	65536
+#define ARENA_ALIGN		16
+
+typedef struct arena_block_t {
+	struct arena_block_t	*next;
+	size_t			size;
+	size_t			used;
+	unsigned char		*data;
+} arena_block_t;
+
+typedef struct arena_t {
+	arena_block_t	*head;
+	arena_block_t	*main;
+	size_t		used;
+	size_t		high_water;
+	unsigned long	overflows;
+	void		*last;
+	size_t		last_size;
+} arena_t;
+
+/* Position in an arena that temporaries can later be rewound to */
+typedef struct arena_mark_t {
+	arena_block_t	*block;
+	size_t		block_used;
+	size_t		used;
+} arena_mark_t;
+
+arena_t *arena_create( size_t size );
+void arena_destroy( arena_t **arena );
+void arena_reset( arena_t *arena );
+void arena_mark( arena_t *arena, arena_mark_t *mark );
+void arena_rewind( arena_t *arena, arena_mark_t *mark );
+void arena_dump( arena_t *arena );
+
+/* With a NULL arena these fall back to malloc(), realloc() and free() */
+void *arena_alloc( arena_t *arena, size_t size );
+void *arena_realloc( arena_t *arena, void *ptr, size_t old_size, size_t new_size );
+void arena_free( arena_t *arena, void *ptr );
+
+/* Arena owned by the calling thread, created on first use */
+arena_t *arena_thread( void );
+void arena_thread_release( void );
+
+#endif
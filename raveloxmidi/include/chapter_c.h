@@ -33,23 +33,25 @@ typedef struct controller_log_t {
 
 #define PACKED_CONTROLLER_LOG_SIZE 2
 
+// A controller log is only valid if its bit is set in the active bitmap
 typedef struct chapter_c_t {
 	uint8_t S;
 	uint8_t len;
+	uint32_t active[ MAX_CHAPTER_C_CONTROLLERS / 32 ];
 	controller_log_t controller_log[MAX_CHAPTER_C_CONTROLLERS];
 } chapter_c_t;
 
 #define PACKED_CHAPTER_C_HEADER_SIZE 1
+#define MAX_CHAPTER_C_PACKED_SIZE	( PACKED_CHAPTER_C_HEADER_SIZE + ( MAX_CHAPTER_C_CONTROLLERS * PACKED_CONTROLLER_LOG_SIZE ) )
 
-chapter_c_t *chapter_c_create( void );
-void chapter_c_unpack( unsigned char *packed, size_t size, chapter_c_t **chapter_c );
-void chapter_c_pack( chapter_c_t *chapter_c, unsigned char **packed, size_t *size );
-void chapter_c_destroy( chapter_c_t **chapter_c );
+#define CHAPTER_C_IS_ACTIVE( chapter_c, controller )	( (chapter_c)->active[ (controller) >> 5 ] & ( 1U << ( (controller) & 31 ) ) )
+#define CHAPTER_C_SET_ACTIVE( chapter_c, controller )	( (chapter_c)->active[ (controller) >> 5 ] |= ( 1U << ( (controller) & 31 ) ) )
+
+void chapter_c_unpack( unsigned char *packed, size_t size, chapter_c_t *chapter_c );
+void chapter_c_pack( chapter_c_t *chapter_c, unsigned char *packed, size_t packed_len, size_t *size );
 void chapter_c_reset( chapter_c_t *chapter_c );
 void chapter_c_dump( chapter_c_t *chapter_c );
 
-controller_log_t *controller_log_create( void );
-void controller_log_destroy( controller_log_t **controller_log );
 void controller_log_reset( controller_log_t *controller_log );
 void controller_log_dump( controller_log_t *controller_log );
 
@@ -31,6 +31,7 @@ typedef struct chapter_n_note_t {
 
 #define MAX_CHAPTER_N_NOTES	127
 #define MAX_OFFBITS		16
+#define CHAPTER_N_NOTE_TABLE_SIZE	128
 
 typedef struct chapter_n_header_t {
 	unsigned char	B:1;
@@ -40,28 +41,31 @@ typedef struct chapter_n_header_t {
 } chapter_n_header_t;
 #define CHAPTER_N_HEADER_PACKED_SIZE	2
 
+// Note logs are indexed by note number. A log is only valid if its bit is set in the active bitmap
 typedef struct chapter_n_t {
-	chapter_n_header_t	*header;
+	chapter_n_header_t	header;
 	uint16_t		num_notes;
-	chapter_n_note_t	*notes[MAX_CHAPTER_N_NOTES];
-	unsigned char		*offbits;
+	uint64_t		active[ CHAPTER_N_NOTE_TABLE_SIZE / 64 ];
+	chapter_n_note_t	notes[CHAPTER_N_NOTE_TABLE_SIZE];
+	unsigned char		offbits[MAX_OFFBITS];
 } chapter_n_t;
 
-void chapter_n_header_pack( chapter_n_header_t *header , unsigned char **packed , size_t *size );
-void chapter_n_header_destroy( chapter_n_header_t **header );
-chapter_n_header_t * chapter_n_header_create( void );
-void chapter_n_pack( chapter_n_t *chapter_n, unsigned char **packed, size_t *size );
-chapter_n_t * chapter_n_create( void );
-void chapter_n_destroy( chapter_n_t **chapter_n );
+#define CHAPTER_N_IS_ACTIVE( chapter_n, num )	( (chapter_n)->active[ (num) >> 6 ] & ( 1ULL << ( (num) & 63 ) ) )
+
+// Room for all 128 note logs, which are sent as LEN=127
+#define MAX_CHAPTER_N_PACKED_SIZE	( CHAPTER_N_HEADER_PACKED_SIZE + ( CHAPTER_N_NOTE_TABLE_SIZE * CHAPTER_N_NOTE_PACKED_SIZE ) + MAX_OFFBITS )
+
+void chapter_n_header_pack( chapter_n_header_t *header , unsigned char *packed , size_t packed_len, size_t *size );
+void chapter_n_pack( chapter_n_t *chapter_n, unsigned char *packed, size_t packed_len, size_t *size );
 void chapter_n_header_dump( chapter_n_header_t *header );
 void chapter_n_header_reset( chapter_n_header_t *header );
 void chapter_n_dump( chapter_n_t *chapter_n );
 void chapter_n_reset( chapter_n_t *chapter_n );
+void chapter_n_note_on( chapter_n_t *chapter_n, uint8_t num, uint8_t velocity );
+void chapter_n_note_off( chapter_n_t *chapter_n, uint8_t num );
 
-void chapter_n_note_pack( chapter_n_note_t *note , unsigned char **packed , size_t *size );
-void chapter_n_note_destroy( chapter_n_note_t **note );
-chapter_n_note_t * chapter_n_note_create( void );
+void chapter_n_note_pack( chapter_n_note_t *note , unsigned char *packed , size_t packed_len, size_t *size );
 void chapter_n_note_dump( chapter_n_note_t *note );
-void chapter_n_note_reset( chapter_n_note_t **note );
+void chapter_n_note_reset( chapter_n_note_t *note );
 
 #endif
@@ -21,6 +21,6 @@
 #ifndef CMD_END_HANDLER_H
 #define CMD_END_HANDLER_H
 
-net_response_t * cmd_end_handler( void *data );
+int cmd_end_handler( void *data );
 
 #endif
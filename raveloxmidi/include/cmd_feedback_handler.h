@@ -21,7 +21,7 @@
 #ifndef CMD_feedback_HANDLER_H
 #define CMD_feedback_HANDLER_H
 
-net_response_t * cmd_feedback_handler( void *data );
-net_response_t *cmd_feedback_create( uint32_t ssrc, uint16_t rtp_seq );
+int cmd_feedback_handler( void *data );
+int cmd_feedback_create( uint32_t ssrc, uint16_t rtp_seq, net_response_t *response );
 
 #endif
@@ -21,6 +21,7 @@
 #ifndef CMD_INV_HANDLER_H
 #define CMD_INV_HANDLER_H
 
-net_response_t * cmd_inv_handler( char *ip_address, uint16_t port, void *data );
+void cmd_inv_handler_init( void );
+int cmd_inv_handler( char *ip_address, uint16_t port, void *data, net_response_t *response );
 
 #endif
@@ -21,6 +21,7 @@
 #ifndef CMD_sync_HANDLER_H
 #define CMD_sync_HANDLER_H
 
-net_response_t * cmd_sync_handler( void *data );
+int cmd_sync_handler( void *data, net_response_t *response );
+int cmd_sync_create( net_ctx_t *ctx, net_response_t *response );
 
 #endif
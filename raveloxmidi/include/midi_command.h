@@ -53,13 +53,22 @@ enum midi_message_type_t {
 	MIDI_STOP,
 	MIDI_ACTIVE_SENSING,
 	MIDI_RESET
-} midi_message_type_t;
+};
 
-typedef struct midi_message_t {
-	unsigned char message;
-	enum midi_message_type_t type;
-	char *description;
-} midi_message_t;
+/* Decoding information for a status byte. Indexed directly by the status byte in midi_status_table */
+#define MIDI_STATUS_SYSEX_LEN	0xff
+
+typedef struct midi_status_t {
+	uint8_t		type;
+	uint8_t		data_len;
+	uint8_t		is_channel;
+	uint8_t		reserved;
+	char		*description;
+} midi_status_t;
+
+extern const midi_status_t midi_status_table[256];
+
+#define MIDI_STATUS( status )	( &( midi_status_table[ (uint8_t)(status) ] ) )
 
 typedef struct midi_command_t {
 	uint64_t	delta;
@@ -72,12 +81,37 @@ typedef struct midi_command_t {
 	unsigned char *data;
 } midi_command_t;
 
+/* A command parsed in place from a receive buffer.
+   Messages of up to MIDI_COMMAND_INLINE_SIZE bytes are copied into raw[] so that running status
+   can be expanded. Longer messages (SysEx) are only referenced by data, which points into the buffer */
+#define MIDI_COMMAND_INLINE_SIZE	3
+
+typedef struct midi_command_view_t {
+	unsigned char	*data;
+	uint32_t	delta;
+	uint16_t	data_len;
+	unsigned char	raw[ MIDI_COMMAND_INLINE_SIZE ];
+	unsigned char	has_status;
+} midi_command_view_t;
+
+/* Enough for a full datagram of 2 byte running status messages */
+#define MIDI_COMMAND_LIST_SIZE	1024
+
+typedef struct midi_command_list_t {
+	size_t			num_commands;
+	size_t			dropped;
+	midi_command_view_t	commands[ MIDI_COMMAND_LIST_SIZE ];
+} midi_command_list_t;
+
 midi_command_t *midi_command_create(void);
 void midi_command_destroy( midi_command_t **command );
 void midi_command_reset( midi_command_t *command );
 void midi_command_map( midi_command_t *command , char **description, enum midi_message_type_t *message_type );
 
 void midi_command_dump( midi_command_t *command );
-int midi_note_from_command( midi_command_t *command , midi_note_t **midi_note );
+
+void midi_command_from_view( midi_command_view_t *view, midi_command_t *command );
+void midi_command_view_raw( midi_command_view_t *view, unsigned char **raw, size_t *raw_len );
+int midi_note_from_command( midi_command_t *command , midi_note_t **midi_note, arena_t *arena );
 
 #endif
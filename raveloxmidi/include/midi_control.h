@@ -21,6 +21,9 @@
 #ifndef MIDI_CONTROL_H
 #define MIDI_CONTROL_H
 
+#include "arena.h"
+#include "pool.h"
+
 #include "midi_command.h"
 
 typedef struct midi_control_t {
@@ -28,16 +31,19 @@ typedef struct midi_control_t {
 	unsigned char	command:4;
 	unsigned char	controller_number;
 	char		controller_value;
+	arena_t		*arena;
 } midi_control_t;
 
 #define MIDI_COMMAND_CONTROL_CHANGE	0x0B
 #define PACKED_MIDI_CONTROL_SIZE	3
 
-midi_control_t * midi_control_create( void );
+midi_control_t * midi_control_create( arena_t *arena );
+void midi_control_pool_init( uint32_t capacity );
+void midi_control_pool_teardown( void );
 void midi_control_destroy( midi_control_t **midi_control );
 int midi_control_unpack( midi_control_t **midi_control, unsigned char *packet, size_t packet_len );
 int midi_control_pack( midi_control_t *midi_control, unsigned char **packet, size_t *packet_len );
 void midi_control_dump( midi_control_t *midi_control );
-int midi_control_from_command( midi_command_t *command , midi_control_t **midi_control );
+int midi_control_from_command( midi_command_t *command , midi_control_t **midi_control, arena_t *arena );
 
 #endif
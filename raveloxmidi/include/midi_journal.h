@@ -55,36 +55,39 @@ typedef struct channel_header_t {
 #define CHAPTER_T	0x02
 #define CHAPTER_A	0x01
 
+// All chapters are stored inline. The header bitfield says which of them hold data
 typedef struct channel_t {
-	channel_header_t *header;
-	chapter_p_t *chapter_p;
-	chapter_n_t *chapter_n;
-	chapter_c_t *chapter_c;
+	channel_header_t header;
+	chapter_p_t chapter_p;
+	chapter_c_t chapter_c;
+	chapter_n_t chapter_n;
 } channel_t;
 
 #define MAX_MIDI_CHANNELS	16
 
+#define MAX_CHANNEL_PACKED_SIZE	( CHANNEL_HEADER_PACKED_SIZE + CHAPTER_P_PACKED_SIZE + MAX_CHAPTER_C_PACKED_SIZE + MAX_CHAPTER_N_PACKED_SIZE )
+#define MAX_JOURNAL_PACKED_SIZE	( JOURNAL_HEADER_PACKED_SIZE + ( MAX_MIDI_CHANNELS * MAX_CHANNEL_PACKED_SIZE ) )
+
+// One fixed size block per session. Bit n of channel_mask is set when channels[n] holds data
 typedef struct journal_t {
-	journal_header_t *header;
-	channel_t *channels[MAX_MIDI_CHANNELS];
+	journal_header_t header;
+	uint16_t channel_mask;
+	channel_t channels[MAX_MIDI_CHANNELS];
 } journal_t;
 
+// A handoff copies journal_t as it is held. Bump this when journal_t or any chapter in it changes
+#define JOURNAL_LAYOUT_VERSION	1
+
 #define JOURNAL_HEADER_S_FLAG	0x08
 #define JOURNAL_HEADER_Y_FLAG	0x04
 #define JOURNAL_HEADER_A_FLAG	0x02
 #define JOURNAL_HEADER_H_FLAG	0x01
 
-void channel_header_pack( channel_header_t *header , unsigned char **packed , size_t *size );
-void channel_header_destroy( channel_header_t **header );
-channel_header_t * channel_header_create( void );
-void channel_pack( channel_t *channel, char **packed, size_t *size );
-void channel_destroy( channel_t **channel );
-channel_t * channel_create( void );
-
-void journal_header_pack( journal_header_t *header , char **packed , size_t *size );
-journal_header_t * journal_header_create( void );
-void journal_header_destroy( journal_header_t **header );
-void journal_pack( journal_t *journal, char **packed, size_t *size );
+void channel_header_pack( channel_header_t *header , unsigned char *packed , size_t packed_len, size_t *size );
+void channel_pack( channel_t *channel, unsigned char *packed, size_t packed_len, size_t *size );
+
+void journal_header_pack( journal_header_t *header , unsigned char *packed , size_t packed_len, size_t *size );
+void journal_pack( journal_t *journal, unsigned char *packed, size_t packed_len, size_t *size );
 int journal_init( journal_t **journal );
 void journal_destroy( journal_t **journal );
 void channel_header_dump( channel_header_t *header );
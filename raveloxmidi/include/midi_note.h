@@ -21,11 +21,15 @@
 #ifndef MIDI_NOTE_H
 #define MIDI_NOTE_H
 
+#include "arena.h"
+#include "pool.h"
+
 typedef struct midi_note_t {
 	unsigned char	channel:4;
 	unsigned char	command:4;
 	char		note;
 	char		velocity;
+	arena_t		*arena;
 } midi_note_t;
 
 #define MIDI_COMMAND_NOTE_ON	0x09
@@ -33,7 +37,9 @@ typedef struct midi_note_t {
 
 #define PACKED_MIDI_NOTE_SIZE	3
 
-midi_note_t * midi_note_create( void );
+midi_note_t * midi_note_create( arena_t *arena );
+void midi_note_pool_init( uint32_t capacity );
+void midi_note_pool_teardown( void );
 void midi_note_destroy( midi_note_t **midi_note );
 int midi_note_unpack( midi_note_t **midi_note, unsigned char *packet, size_t packet_len );
 int midi_note_pack( midi_note_t *midi_note, unsigned char **packet, size_t *packet_len );
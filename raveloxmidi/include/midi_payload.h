@@ -21,6 +21,8 @@
 #ifndef MIDI_PAYLOAD_H
 #define MIDI_PAYLOAD_H
 
+#include "arena.h"
+
 typedef struct midi_payload_header_t {
 	unsigned char	B;
 	unsigned char	J;
@@ -35,9 +37,12 @@ typedef struct midi_payload_header_t {
 #define PAYLOAD_HEADER_P	0x10
 #define PAYLOAD_HEADER_LEN	0x0f
 
+/* A payload created from an arena keeps its buffers in that arena.
+   The commands produced from it are also allocated there and must not be passed to midi_command_reset() */
 typedef struct midi_payload_t {
 	midi_payload_header_t *header;
 	unsigned char	*buffer;
+	arena_t		*arena;
 } midi_payload_t;
 
 typedef enum midi_payload_data_t {
@@ -47,7 +52,7 @@ typedef enum midi_payload_data_t {
 
 void midi_payload_destroy( midi_payload_t **payload );
 void midi_payload_reset( midi_payload_t *payload );
-midi_payload_t * midi_payload_create( void );
+midi_payload_t * midi_payload_create( arena_t *arena );
 
 void midi_payload_set_b( midi_payload_t *payload );
 void midi_payload_set_j( midi_payload_t *payload );
@@ -61,7 +66,9 @@ void midi_payload_unset_p( midi_payload_t *payload );
 void midi_payload_set_buffer( midi_payload_t *payload, unsigned char *buffer , size_t *buffer_size);
 void midi_payload_header_dump( midi_payload_header_t *header );
 void midi_payload_pack( midi_payload_t *payload, unsigned char **buffer, size_t *buffer_size);
-void midi_payload_unpack( midi_payload_t **payload, unsigned char *buffer, size_t buffer_size);
+void midi_payload_unpack( midi_payload_t **payload, unsigned char *buffer, size_t buffer_size, arena_t *arena );
+int midi_payload_view( unsigned char *buffer, size_t buffer_len, midi_payload_header_t *header, unsigned char **commands, size_t *commands_len );
+size_t midi_command_list_parse( midi_command_list_t *list, unsigned char *buffer, size_t buffer_len, midi_payload_data_t data_type, int z_flag, unsigned char *stream_status );
 void midi_payload_to_commands( midi_payload_t *payload, midi_payload_data_t data_type, midi_command_t **commands, size_t *num_commands );
-void midi_command_to_payload( midi_command_t *command, midi_payload_t **payload );
+void midi_command_to_payload( midi_command_t *command, midi_payload_t **payload, arena_t *arena );
 #endif
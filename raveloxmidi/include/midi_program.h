@@ -21,6 +21,9 @@
 #ifndef MIDI_PROGRAM_H
 #define MIDI_PROGRAM_H
 
+#include "arena.h"
+#include "pool.h"
+
 #include "midi_command.h"
 
 typedef struct midi_program_t {
@@ -32,16 +35,19 @@ typedef struct midi_program_t {
 	unsigned char	program;
 	unsigned char	bank_msb;
 	unsigned char	bank_lsb;
+	arena_t		*arena;
 } midi_program_t;
 
 #define MIDI_COMMAND_PROGRAM_CHANGE	0x0C
 #define PACKED_MIDI_PROGRAM_SIZE	3
 
-midi_program_t * midi_program_create( void );
+midi_program_t * midi_program_create( arena_t *arena );
+void midi_program_pool_init( uint32_t capacity );
+void midi_program_pool_teardown( void );
 void midi_program_destroy( midi_program_t **midi_program );
 int midi_program_unpack( midi_program_t **midi_program, unsigned char *packet, size_t packet_len );
 int midi_program_pack( midi_program_t *midi_program, unsigned char **packet, size_t *packet_len );
 void midi_program_dump( midi_program_t *midi_program );
-int midi_program_from_command( midi_command_t *command , midi_program_t **midi_program );
+int midi_program_from_command( midi_command_t *command , midi_program_t **midi_program, arena_t *arena );
 
 #endif
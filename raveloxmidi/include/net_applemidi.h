@@ -77,13 +77,37 @@ typedef struct net_applemidi_bitrate {
 	uint32_t	limit;
 } net_applemidi_bitrate;
 
+/* A command decoded in place from a receive buffer. command selects the union member.
+   For IN, OK, NO and BY, inv.name is NULL and the name is name_len bytes at name in the buffer */
+typedef struct net_applemidi_view_t {
+	uint16_t	signature;
+	uint16_t	command;
+	union {
+		net_applemidi_inv	inv;
+		net_applemidi_sync	sync;
+		net_applemidi_feedback	feedback;
+		net_applemidi_bitrate	bitrate;
+	};
+	const char	*name;
+	size_t		name_len;
+} net_applemidi_view_t;
+
 void net_applemidi_command_dump( net_applemidi_command *command);
+uint32_t net_applemidi_command_ssrc( net_applemidi_command *command );
 net_applemidi_inv * net_applemidi_inv_create( void );
 net_applemidi_sync * net_applemidi_sync_create( void );
 net_applemidi_feedback * net_applemidi_feedback_create( void );
 int net_applemidi_cmd_destroy( net_applemidi_command **command );
 int net_applemidi_unpack( net_applemidi_command **command_buffer, unsigned char *in_buffer, size_t in_buffer_len);
+int net_applemidi_view( unsigned char *in_buffer, size_t in_buffer_len, net_applemidi_view_t *view );
+void *net_applemidi_view_data( net_applemidi_view_t *view );
+uint32_t net_applemidi_view_ssrc( net_applemidi_view_t *view );
+void net_applemidi_view_dump( net_applemidi_view_t *view );
 int net_applemidi_pack( net_applemidi_command *command_buffer, unsigned char **out_buffer, size_t *out_buffer_len );
+size_t net_applemidi_inv_write( uint16_t command, net_applemidi_inv *inv, unsigned char *buffer, size_t buffer_size );
+size_t net_applemidi_sync_write( net_applemidi_sync *sync, unsigned char *buffer, size_t buffer_size );
+size_t net_applemidi_feedback_write( net_applemidi_feedback *feedback, unsigned char *buffer, size_t buffer_size );
+size_t net_applemidi_bitrate_write( net_applemidi_bitrate *bitrate, unsigned char *buffer, size_t buffer_size );
 net_applemidi_command * net_applemidi_cmd_create( uint16_t command );
 
 #endif
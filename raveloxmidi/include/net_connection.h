@@ -21,14 +21,39 @@
 #ifndef NET_CONNECTION_H
 #define NET_CONNECTION_H
 
+#include <sys/socket.h>
+
 #include "midi_note.h"
 #include "midi_control.h"
 #include "rtp_packet.h"
 #include "midi_journal.h"
+#include "net_applemidi.h"
 
 // Maximum number of connection entries in the connection table
 #define MAX_CTX 8
 
+// No data worker has handled RTP for the session yet
+#define NET_CTX_NO_OWNER	-1
+
+// Largest transmit queue for a session
+#define NET_CTX_TX_MAX		1024
+
+/* What a queued packet holds, for the drop and coalesce policies.
+   The key is the status byte for real-time messages and the channel and controller number for control changes */
+#define NET_CTX_TX_OTHER	0
+#define NET_CTX_TX_REALTIME	1
+#define NET_CTX_TX_CONTROL	2
+
+// A rate limited session can send this much of its rate at once, and always at least one full packet
+#define NET_CTX_TX_BURST_MS	100
+
+typedef struct net_ctx_tx_t {
+	int		kind;
+	uint16_t	key;
+	size_t		len;
+	unsigned char	data[ NET_APPLEMIDI_UDPSIZE ];
+} net_ctx_tx_t;
+
 typedef struct net_ctx_t {
 	uint32_t	ssrc;
 	uint32_t	send_ssrc;
@@ -37,8 +62,30 @@ typedef struct net_ctx_t {
 	uint16_t	control_port;
 	uint16_t	data_port;
 	time_t		start;
+	time_t		last_heard;
+	int		probed;
 	char * 		ip_address;
 	journal_t	*journal;
+	time_t		journal_time;
+	int		owner;
+	uint16_t	received_seq;
+	int		feedback_pending;
+	/* Packets waiting for the data socket to be writable. Only allocated once a send would have blocked.
+	   tx_order holds the slots in use oldest first and tx_free the slots that aren't */
+	net_ctx_tx_t	*tx_slots;
+	uint16_t	*tx_order;
+	uint16_t	*tx_free;
+	uint32_t	tx_depth;
+	uint32_t	tx_high_water;
+	uint32_t	tx_queued;
+	uint32_t	tx_dropped;
+	uint32_t	tx_coalesced;
+	/* Token bucket for the rate limit. rate_limit is the limit asked for with RL in bits per second.
+	   tx_tokens is in bits and is topped up from tx_refill_us */
+	uint32_t	rate_limit;
+	uint64_t	tx_tokens;
+	uint64_t	tx_refill_us;
+	uint32_t	tx_limited;
 	struct net_ctx_t	*next;
 	struct net_ctx_t	*prev;
 } net_ctx_t;
@@ -57,12 +104,71 @@ void net_ctx_add_journal_control( net_ctx_t *ctx, midi_control_t *midi_control )
 void net_ctx_add_journal_program( net_ctx_t *ctx, midi_program_t *midi_program );
 
 void net_ctx_journal_dump( net_ctx_t *ctx);
-void net_ctx_journal_pack( net_ctx_t *ctx, char **journal_buffer, size_t *journal_buffer_size);
+void net_ctx_journal_pack( net_ctx_t *ctx, unsigned char *journal_buffer, size_t journal_buffer_len, size_t *journal_size );
 void net_ctx_journal_reset( net_ctx_t *ctx );
 void net_ctx_update_rtp_fields( net_ctx_t *ctx, rtp_packet_t *rtp_packet);
-void net_ctx_send( int socket, net_ctx_t *ctx, unsigned char *buffer, size_t buffer_len );
+void net_ctx_address( net_ctx_t *ctx, struct sockaddr_storage *address, socklen_t *addr_len );
+
+/* Sends on the data socket. If it would block, or packets are already waiting, the packet is queued.
+   kind and key are one of the NET_CTX_TX_ kinds and its key. charged is set when the caller has already
+   taken the tokens for the packet with net_ctx_tx_allow(). Called with the lock held */
+void net_ctx_send( int socket, net_ctx_t *ctx, unsigned char *buffer, size_t buffer_len, int kind, uint16_t key, int charged );
+
+/* Queues a packet that was refused after it was handed to io_uring, for the session at this address.
+   Returns -1 if there is no such session or the packet was dropped */
+int net_ctx_tx_requeue( struct sockaddr_storage *address, socklen_t addr_len, unsigned char *buffer, size_t buffer_len );
+
+/* Queues a packet to be sent from the timer, as if the socket had been full. Used for the packets that were waiting when
+   the session was handed over from another instance. Returns -1 if it was dropped. Called with the lock held */
+int net_ctx_tx_queue( net_ctx_t *ctx, unsigned char *buffer, size_t buffer_len, int kind, uint16_t key );
+
+/* Packets queued across every session */
+uint32_t net_ctx_tx_pending( void );
+
+/* Set while a send has found the data socket full and queued packets are waiting for it to be writable */
+int net_ctx_tx_blocked( void );
+
+/* Readable when the data socket first fills up or a rate limit is set, so that the main loop waits for the socket
+   to be writable or starts sending packets held back by the limit */
+int net_ctx_tx_event_fd( void );
+
+/* Sends queued packets until the socket would block, leaving those held back by a rate limit.
+   Returns the number still queued */
+uint32_t net_ctx_tx_drain( int send_socket );
+
+/* Set when sessions have transmit queues. Rate limits are only applied if they do */
+int net_ctx_tx_enabled( void );
+
+/* Sets the rate limit asked for by the remote end in bits per second. 0 removes it. Called with the lock held */
+void net_ctx_tx_rate_set( net_ctx_t *ctx, uint32_t limit );
+
+/* Takes the tokens for a packet of this size from the session's bucket. Returns 0 if the rate limit doesn't allow
+   it to be sent yet. Called with the lock held */
+int net_ctx_tx_allow( net_ctx_t *ctx, size_t buffer_len );
+
+/* Set when network.tx_rate_limit is set or any session has asked for a limit, so that held back packets are sent
+   from a timer */
+int net_ctx_tx_rate_limited( void );
 void net_ctx_increment_seq( net_ctx_t *ctx );
 
+/* Held while the table is changed or iterated, and while a session's journal is used */
+void net_ctx_lock( void );
+void net_ctx_unlock( void );
+
+/* Changes whenever a session is added or removed so that a copy of the table can be checked without the lock */
+uint32_t net_ctx_generation( void );
+
+/* Data worker that owns the session with this SSRC. The first worker to ask becomes the owner.
+   Returns NET_CTX_NO_OWNER if there is no such session */
+int net_ctx_claim_owner( uint32_t ssrc, int worker );
+
+/* Records that the remote end of the session has been heard from. Called with the lock held */
+void net_ctx_heard( net_ctx_t *ctx );
+
+/* Records seq as received from the session with this SSRC, so that a later feedback acknowledges it.
+   Returns -1 if there is no such session */
+int net_ctx_received( uint32_t ssrc, uint16_t seq );
+
 void net_ctx_iter_start_head(void);
 void net_ctx_iter_start_tail(void);
 net_ctx_t *net_ctx_iter_current(void);
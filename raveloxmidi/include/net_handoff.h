@@ -0,0 +1,69 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+#ifndef NET_HANDOFF_H
+#define NET_HANDOFF_H
+
+/* Handoff to a new instance without dropping sessions.
+   When handoff.socket is set, the running instance listens on that Unix socket. A new instance
+   started with the same setting connects to it before opening any ports. The running instance
+   stops reading, passes its bound sockets over with SCM_RIGHTS followed by its session table
+   ( SSRCs, ports, sequence numbers, journals and transmit queues ) and exits. The new instance
+   waits for it to exit, then carries on from where it stopped. Datagrams that arrive in between
+   wait in the sockets' receive buffers */
+
+#define NET_HANDOFF_MAGIC	0x52564c48
+#define NET_HANDOFF_VERSION	2
+
+// Control socket, local socket and one data socket for each data port worker
+#define NET_HANDOFF_FD_CONTROL	0
+#define NET_HANDOFF_FD_LOCAL	1
+#define NET_HANDOFF_FD_DATA	2
+#define NET_HANDOFF_MAX_FDS	( NET_HANDOFF_FD_DATA + 64 )
+
+// Seconds to wait for the running instance to hand over and then exit
+#define NET_HANDOFF_TIMEOUT	10
+
+/* Called by a new instance before the ports are opened. Returns 0 if the sockets and sessions of a running
+   instance have been received, or -1 if there is nothing to take over and the ports should be opened as usual */
+int net_handoff_receive( void );
+
+/* Sockets received from the running instance, in NET_HANDOFF_FD_ order. The caller owns them once it has taken them.
+   If they can't be used they are refused, which closes them so that new sockets can be bound to the ports */
+int net_handoff_fds( int **fds );
+void net_handoff_fds_taken( void );
+void net_handoff_fds_refused( void );
+
+/* Registers the sessions received from the running instance. Called once net_ctx_init() has run */
+void net_handoff_restore( void );
+
+/* Listens on handoff.socket for a new instance. Returns the listening socket or -1 */
+int net_handoff_listen( void );
+
+/* Accepts a new instance and keeps duplicates of the sockets to pass to it. Returns 0 if the main loop should stop */
+int net_handoff_accept( int *fds, int num_fds );
+
+/* Sends the sockets and session table to the accepted instance. Called once nothing is reading the sockets */
+int net_handoff_send( void );
+
+/* Closes the listening socket. The connection to a new instance is closed last so that it sees this process exit */
+void net_handoff_teardown( void );
+
+#endif
@@ -21,12 +21,21 @@
 #ifndef NET_RESPONSE_H
 #define NET_RESPONSE_H
 
+#include <stdint.h>
+#include <stddef.h>
+
+/* size is the capacity of a caller owned buffer set by net_response_init().
+   It is 0 for responses from net_response_create(), whose buffer is on the heap */
 typedef struct net_response_t {
         unsigned char *buffer;
         size_t len;
+        size_t size;
 } net_response_t;
 
 net_response_t * net_response_create( void ); 
 void net_response_destroy( net_response_t **response );
+void net_response_init( net_response_t *response, unsigned char *buffer, size_t size );
+void net_response_pool_init( uint32_t capacity );
+void net_response_pool_teardown( void );
 
 #endif
@@ -36,12 +36,15 @@ int net_socket_fd_loop(void);
 int net_socket_alsa_loop(void);
 void net_socket_wait_for_alsa(void);
 void net_socket_loop_shutdown(int signal);
+void net_socket_reload_signal(int signal);
 
 void net_socket_set_fds( void );
 extern uint8_t _max_ctx;
 
 /* Indicate which socket should be the data port */
+#define CONTROL_PORT 0
 #define DATA_PORT 1
+#define LOCAL_PORT 2
 
 #define BUFFER_32K	32768
 
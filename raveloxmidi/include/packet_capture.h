@@ -0,0 +1,91 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+#ifndef PACKET_CAPTURE_H
+#define PACKET_CAPTURE_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#define CAPTURE_MAGIC		"RAVCAP01"
+#define CAPTURE_VERSION		1
+#define CAPTURE_SLOT_SIZE	1472
+
+#define CAPTURE_INBOUND		0
+#define CAPTURE_OUTBOUND	1
+
+/* Layout of the mmap'd capture file. The header is followed by slot_count records */
+typedef struct capture_header_t {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	slot_count;
+	uint32_t	slot_size;
+	uint32_t	reserved;
+	uint64_t	next;
+} capture_header_t;
+
+typedef struct capture_record_t {
+	uint64_t	tv_sec;
+	uint32_t	tv_usec;
+	uint8_t		direction;
+	uint8_t		family;
+	uint16_t	local_port;
+	uint16_t	peer_port;
+	uint16_t	reserved;
+	uint8_t		local_addr[16];
+	uint8_t		peer_addr[16];
+	uint32_t	len;
+	uint32_t	caplen;
+	unsigned char	data[CAPTURE_SLOT_SIZE];
+} capture_record_t;
+
+/* pcap file format */
+#define PCAP_MAGIC		0xa1b2c3d4
+#define PCAP_VERSION_MAJOR	2
+#define PCAP_VERSION_MINOR	4
+#define PCAP_LINKTYPE_RAW	101
+
+typedef struct pcap_file_header_t {
+	uint32_t	magic;
+	uint16_t	version_major;
+	uint16_t	version_minor;
+	int32_t		thiszone;
+	uint32_t	sigfigs;
+	uint32_t	snaplen;
+	uint32_t	linktype;
+} pcap_file_header_t;
+
+typedef struct pcap_record_header_t {
+	uint32_t	ts_sec;
+	uint32_t	ts_usec;
+	uint32_t	incl_len;
+	uint32_t	orig_len;
+} pcap_record_header_t;
+
+int packet_capture_init( void );
+void packet_capture_teardown( void );
+int packet_capture_enabled( void );
+void packet_capture_record( int direction, int fd, struct sockaddr *peer, unsigned char *buffer, size_t len );
+int packet_capture_dump( void );
+int packet_capture_dump_file( void );
+void packet_capture_signal( int signal );
+void packet_capture_check_signal( void );
+
+#endif
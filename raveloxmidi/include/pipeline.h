@@ -0,0 +1,67 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "queue.h"
+
+/* A pipeline stage is a thread that takes work items from its own bounded queue.
+   Items are pushed without a lock. The stage sleeps on a semaphore while the queue
+   is empty, so an idle stage costs nothing and a push only makes a system call when
+   the stage is asleep. An item that doesn't fit in the queue is handed back to the
+   caller, which decides whether to drop it. */
+
+/* CPU number for a stage that can run anywhere */
+#define PIPELINE_CPU_ANY	-1
+
+typedef void (*pipeline_handler_t)( void *item );
+
+typedef struct pipeline_stage_t {
+	char			*name;
+	queue_t			*queue;
+	sem_t			ready;
+	pthread_t		thread;
+	int			running;
+	int			stop;
+	int			cpu;
+	pipeline_handler_t	handler;
+	uint32_t		processed;
+	uint32_t		dropped;
+} pipeline_stage_t;
+
+pipeline_stage_t *pipeline_stage_create( char *name, uint32_t capacity, int cpu, pipeline_handler_t handler );
+int pipeline_stage_start( pipeline_stage_t *stage );
+void pipeline_stage_stop( pipeline_stage_t *stage );
+void pipeline_stage_dump( pipeline_stage_t *stage );
+
+/* Items still queued when the stage is destroyed are passed to release */
+void pipeline_stage_destroy( pipeline_stage_t **stage, pipeline_handler_t release );
+
+/* Returns -1, and counts a drop, if the stage queue is full */
+int pipeline_stage_push( pipeline_stage_t *stage, void *item );
+
+int pipeline_set_affinity( pthread_t thread, int cpu, char *name );
+
+#endif
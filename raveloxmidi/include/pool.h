@@ -0,0 +1,62 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Fixed size object pool.
+   Free objects are kept on a lock-free list so that any thread can allocate
+   and release without taking a lock. The head of the list carries a tag that
+   changes on every update, which stops a stale compare-and-swap from
+   succeeding. When the pool is empty, objects come from malloc() instead. */
+
+#define POOL_DEFAULT_CAPACITY	64
+#define POOL_MAX_CAPACITY	65535
+#define POOL_ALIGN		16
+
+#define POOL_INDEX_MASK		0x0000ffff
+#define POOL_TAG_MASK		0xffff0000
+#define POOL_TAG_STEP		0x00010000
+
+typedef struct pool_t {
+	char		*name;
+	size_t		object_size;
+	uint32_t	capacity;
+	unsigned char	*objects;
+	uint16_t	*next;
+	uint32_t	head;
+	uint32_t	high_water;
+	uint32_t	exhausted;
+} pool_t;
+
+pool_t *pool_create( char *name, size_t object_size, uint32_t capacity );
+void pool_destroy( pool_t **pool );
+int pool_owns( pool_t *pool, void *object );
+uint32_t pool_in_use( pool_t *pool );
+void pool_dump( pool_t *pool );
+
+/* With a NULL pool, or an empty one, these fall back to malloc() and free() */
+void *pool_alloc( pool_t *pool, size_t size );
+void pool_free( pool_t *pool, void *object );
+
+#endif
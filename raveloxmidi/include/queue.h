@@ -0,0 +1,66 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stdint.h>
+
+/* Bounded queue of pointers.
+   Any number of threads can push and pop without taking a lock. Each cell
+   carries a sequence number that tells a producer whether the cell is free and
+   a consumer whether it has been filled, so the head and tail only need a
+   compare-and-swap to claim a cell. The capacity is rounded up to a power of 2. */
+
+#define QUEUE_DEFAULT_CAPACITY	256
+#define QUEUE_MAX_CAPACITY	65536
+
+/* Keeps the producer and consumer positions on separate cache lines */
+#define QUEUE_CACHE_LINE	64
+
+typedef struct queue_cell_t {
+	uint32_t	sequence;
+	void		*data;
+} queue_cell_t;
+
+typedef struct queue_t {
+	char		*name;
+	uint32_t	capacity;
+	uint32_t	mask;
+	queue_cell_t	*cells;
+	unsigned char	pad0[ QUEUE_CACHE_LINE ];
+	uint32_t	enqueue_pos;
+	unsigned char	pad1[ QUEUE_CACHE_LINE ];
+	uint32_t	dequeue_pos;
+	unsigned char	pad2[ QUEUE_CACHE_LINE ];
+	uint32_t	high_water;
+	uint32_t	full;
+} queue_t;
+
+queue_t *queue_create( char *name, uint32_t capacity );
+void queue_destroy( queue_t **queue );
+uint32_t queue_depth( queue_t *queue );
+void queue_dump( queue_t *queue );
+
+/* queue_push() returns -1 when the queue is full. queue_pop() returns NULL when it is empty */
+int queue_push( queue_t *queue, void *data );
+void *queue_pop( queue_t *queue );
+
+#endif
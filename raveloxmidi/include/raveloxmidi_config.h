@@ -1,18 +1,53 @@
 #ifndef _RAVELOXMIDI_CONFIG_H
 #define _RAVELOXMIDI_CONFIG_H
 
+#include <stdint.h>
+#include <stddef.h>
+
+/* Values are parsed once when they are set. long_value and bool_value hold the atol() and is_yes() results */
 typedef struct raveloxmidi_config_t
 {
 	char *key;
 	char *value;
+	uint32_t hash;
+	long long_value;
+	int bool_value;
 } raveloxmidi_config_t;
 
+/* A handle is resolved once, then reads a value without a key lookup */
+typedef int config_handle_t;
+
+#define CONFIG_HANDLE_INVALID		-1
+#define CONFIG_INDEX_INITIAL_SIZE	64
+
+/* A complete set of config items. A reload builds a new snapshot and swaps it in.
+   Items keep their position from one snapshot to the next so that handles stay valid.
+   Replaced snapshots are kept on the previous list until teardown because readers may still
+   be using them. Keys and values are interned, so callers can hold string values across a reload */
+typedef struct config_store_t
+{
+	int num_items;
+	raveloxmidi_config_t **items;
+	config_handle_t *index;
+	size_t index_size;
+	struct config_store_t *previous;
+} config_store_t;
+
 void config_init( int argc, char *argv[] );
 void config_teardown( void );
+int config_reload( void );
+int config_changed( char *key );
 
 char *config_string_get( char *key );
 int config_int_get( char *key );
 long config_long_get( char *key );
+int config_bool_get( char *key );
+
+config_handle_t config_handle_get( char *key );
+char *config_handle_string( config_handle_t handle );
+int config_handle_int( config_handle_t handle );
+long config_handle_long( config_handle_t handle );
+int config_handle_bool( config_handle_t handle );
 
 void config_add_item(char *key, char *value);
 void config_dump( void );
@@ -0,0 +1,52 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+#ifndef _RAVELOXMIDI_PROBES_H
+#define _RAVELOXMIDI_PROBES_H
+
+#include "config.h"
+
+/* USDT static tracepoints for perf/bpftrace/systemtap under the "raveloxmidi" provider.
+   They are only built in if configure is run with --enable-sdt. Otherwise the macros
+   expand to nothing and the arguments are never evaluated. */
+
+#ifdef HAVE_SDT
+
+#include <sys/sdt.h>
+
+#define RAVELOXMIDI_PROBE1( name, a1 ) \
+	STAP_PROBE1( raveloxmidi, name, a1 )
+#define RAVELOXMIDI_PROBE2( name, a1, a2 ) \
+	STAP_PROBE2( raveloxmidi, name, a1, a2 )
+#define RAVELOXMIDI_PROBE3( name, a1, a2, a3 ) \
+	STAP_PROBE3( raveloxmidi, name, a1, a2, a3 )
+#define RAVELOXMIDI_PROBE4( name, a1, a2, a3, a4 ) \
+	STAP_PROBE4( raveloxmidi, name, a1, a2, a3, a4 )
+
+#else
+
+#define RAVELOXMIDI_PROBE1( name, a1 ) do { } while( 0 )
+#define RAVELOXMIDI_PROBE2( name, a1, a2 ) do { } while( 0 )
+#define RAVELOXMIDI_PROBE3( name, a1, a2, a3 ) do { } while( 0 )
+#define RAVELOXMIDI_PROBE4( name, a1, a2, a3, a4 ) do { } while( 0 )
+
+#endif
+
+#endif
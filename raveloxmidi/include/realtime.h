@@ -0,0 +1,44 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <pthread.h>
+
+/* Real-time mode for live use.
+   When realtime.enabled is set, each thread is given a SCHED_FIFO priority and
+   optionally pinned to a CPU, its stack is touched so that it is already mapped,
+   and all memory is locked once startup is complete. Each setting is logged as
+   it takes effect, or with the reason it didn't, and a summary follows. */
+
+#define REALTIME_DEFAULT_STACK_PREFAULT	131072
+#define REALTIME_MAX_STACK_PREFAULT	1048576
+
+/* Called by the thread that creates the thread. role is the name used in the realtime.<role>.* options */
+int realtime_thread_apply( pthread_t thread, char *role );
+
+/* Called by each thread on itself when it starts */
+void realtime_prefault_stack( void );
+
+/* Called by the main thread once every other thread has started */
+void realtime_start( void );
+
+#endif
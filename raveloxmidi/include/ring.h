@@ -0,0 +1,71 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+
+/* Single producer, single consumer ring of byte chunks.
+   Each chunk is stored as its length followed by its bytes, so the consumer gets
+   back exactly what the producer pushed. The producer only moves the head and the
+   consumer only moves the tail, so neither side needs a lock or a compare-and-swap.
+   A chunk that doesn't fit is dropped and counted as an overflow, so a slow
+   consumer never holds up the producer. The size is rounded up to a power of 2. */
+
+#define RING_DEFAULT_SIZE	65536
+#define RING_MIN_SIZE		4096
+#define RING_MAX_SIZE		16777216
+
+#define RING_HEADER_SIZE	sizeof( uint32_t )
+
+/* Keeps the head and tail on separate cache lines */
+#define RING_CACHE_LINE		64
+
+typedef struct ring_t {
+	char		*name;
+	uint32_t	size;
+	uint32_t	mask;
+	unsigned char	*data;
+	unsigned char	pad0[ RING_CACHE_LINE ];
+	uint32_t	head;
+	unsigned char	pad1[ RING_CACHE_LINE ];
+	uint32_t	tail;
+	unsigned char	pad2[ RING_CACHE_LINE ];
+	/* Only updated by the producer */
+	uint32_t	chunks;
+	uint32_t	high_water;
+	uint32_t	overflows;
+	uint32_t	overflow_bytes;
+} ring_t;
+
+ring_t *ring_create( char *name, uint32_t size );
+void ring_destroy( ring_t **ring );
+uint32_t ring_used( ring_t *ring );
+void ring_dump( ring_t *ring );
+
+/* Producer side. Returns -1, and counts an overflow, if there isn't room for the chunk */
+int ring_push( ring_t *ring, unsigned char *chunk, uint32_t len );
+
+/* Consumer side. Copies the oldest chunk into buffer and returns its length, or 0 if the ring is empty.
+   A chunk bigger than buffer_size is discarded and -1 is returned */
+int ring_pop( ring_t *ring, unsigned char *buffer, uint32_t buffer_size );
+
+#endif
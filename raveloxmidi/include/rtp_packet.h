@@ -21,6 +21,9 @@
 #ifndef RTP_PACKET_H
 #define RTP_PACKET_H
 
+#include "arena.h"
+#include "pool.h"
+
 typedef struct rtp_packet_header_t {
 	unsigned	v:2;
 	unsigned	p:1;
@@ -37,16 +40,23 @@ typedef struct rtp_packet_t {
 	rtp_packet_header_t header;
 	size_t payload_len;
 	void *payload;
+	arena_t *arena;
 } rtp_packet_t;
 
 #define RTP_VERSION 2
 
 #define RTP_DYNAMIC_PAYLOAD_97	97
 
-rtp_packet_t * rtp_packet_create( void );
+// Fixed part of the header. The SSRC is the last 4 bytes
+#define RTP_PACKET_HEADER_SIZE	12
+
+rtp_packet_t * rtp_packet_create( arena_t *arena );
+void rtp_packet_pool_init( uint32_t capacity );
+void rtp_packet_pool_teardown( void );
 void rtp_packet_destroy( rtp_packet_t **packet );
 int rtp_packet_pack( rtp_packet_t *packet, unsigned char **out_buffer, size_t *out_buffer_len );
 void rtp_packet_unpack( unsigned char *buffer, size_t buffer_len, rtp_packet_t *rtp_packet );
+int rtp_packet_view( unsigned char *buffer, size_t buffer_len, rtp_packet_t *rtp_packet );
 void rtp_packet_dump( rtp_packet_t *packet );
 
 #endif
@@ -0,0 +1,81 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+
+/* Hierarchical timer wheel.
+   Time moves in ticks of tick_ms. Level 0 has a slot for each of the next 64 ticks,
+   level 1 a slot for each of the next 64 blocks of 64 ticks, and so on. A timer goes
+   into the slot for its expiry at the lowest level that reaches it, and is moved down
+   a level when the wheel comes round to its slot. Adding and cancelling a timer only
+   link it into or out of a list, so both take the same time however many are pending.
+   The wheel isn't locked. It's only used by the thread that advances it */
+
+#define TIMER_WHEEL_BITS	6
+#define TIMER_WHEEL_SLOTS	( 1 << TIMER_WHEEL_BITS )
+#define TIMER_WHEEL_MASK	( TIMER_WHEEL_SLOTS - 1 )
+#define TIMER_WHEEL_LEVELS	4
+
+/* Later expiries are brought in to this many ticks */
+#define TIMER_WHEEL_MAX_TICKS	( ( 1ULL << ( TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS ) ) - 1 )
+
+typedef void (*timer_wheel_callback_t)( void *data );
+
+/* Owned by the caller, usually as part of the object the timer is for. next is NULL when the timer isn't pending */
+typedef struct timer_wheel_timer_t {
+	struct timer_wheel_timer_t	*next;
+	struct timer_wheel_timer_t	*prev;
+	uint64_t		expires;
+	timer_wheel_callback_t	callback;
+	void			*data;
+	char			*name;
+} timer_wheel_timer_t;
+
+typedef struct timer_wheel_t {
+	uint32_t	tick_ms;
+	uint64_t	start_ms;
+	uint64_t	now;
+	uint32_t	pending;
+	uint32_t	added;
+	uint32_t	cancelled;
+	uint32_t	expired;
+	uint32_t	cascaded;
+	timer_wheel_timer_t	slots[ TIMER_WHEEL_LEVELS ][ TIMER_WHEEL_SLOTS ];
+} timer_wheel_t;
+
+/* now_ms is from any clock that doesn't go backwards. The same clock is passed to timer_wheel_advance() */
+timer_wheel_t *timer_wheel_create( uint32_t tick_ms, uint64_t now_ms );
+void timer_wheel_destroy( timer_wheel_t **wheel );
+void timer_wheel_dump( timer_wheel_t *wheel );
+
+void timer_wheel_timer_init( timer_wheel_timer_t *timer, char *name, timer_wheel_callback_t callback, void *data );
+int timer_wheel_timer_pending( timer_wheel_timer_t *timer );
+
+/* The timer is cancelled first if it's pending. It fires on the first tick at least delay_ms from now */
+void timer_wheel_add( timer_wheel_t *wheel, timer_wheel_timer_t *timer, uint64_t delay_ms );
+void timer_wheel_cancel( timer_wheel_t *wheel, timer_wheel_timer_t *timer );
+
+/* Fires every timer due by now_ms and returns how many fired. A callback may add or cancel any timer */
+uint32_t timer_wheel_advance( timer_wheel_t *wheel, uint64_t now_ms );
+
+#endif
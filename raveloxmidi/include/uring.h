@@ -0,0 +1,94 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+
+/* Minimal io_uring wrapper using the system calls directly.
+   Only one thread may get submission entries and reap completions.
+   Multishot receives pick their buffer from a ring of provided buffers that is
+   registered with the kernel. A buffer is handed back with uring_buffer_return()
+   once the packet in it has been dealt with.
+   uring_create() returns NULL if the running kernel can't do any of this. */
+
+#define URING_MAX_BUFFERS	32768
+
+typedef struct uring_t {
+	char		*name;
+	int		fd;
+	uint32_t	sq_entries;
+	uint32_t	cq_entries;
+
+	void		*ring_map;
+	size_t		ring_map_size;
+	struct io_uring_sqe	*sqes;
+	size_t		sqes_size;
+
+	uint32_t	*sq_head;
+	uint32_t	*sq_tail;
+	uint32_t	*sq_mask;
+	uint32_t	*sq_array;
+	uint32_t	sq_local_tail;
+	uint32_t	sq_flushed;
+
+	uint32_t	*cq_head;
+	uint32_t	*cq_tail;
+	uint32_t	*cq_mask;
+	struct io_uring_cqe	*cqes;
+
+	struct io_uring_buf_ring	*buf_ring;
+	size_t		buf_ring_size;
+	unsigned char	*buffers;
+	uint32_t	buffer_size;
+	uint16_t	buffer_count;
+	uint16_t	buf_tail;
+
+	uint32_t	enters;
+	uint32_t	submitted;
+	uint32_t	completed;
+} uring_t;
+
+uring_t *uring_create( char *name, uint32_t entries, uint16_t buffer_count, uint32_t buffer_size );
+void uring_destroy( uring_t **uring );
+void uring_dump( uring_t *uring );
+
+/* Returns NULL if the submission queue is full. uring_submit() makes room */
+struct io_uring_sqe *uring_get_sqe( uring_t *uring );
+
+/* Submit everything queued and wait for at least wait_nr completions or timeout_ms.
+   Returns 0, or a negative errno. -EINTR and -ETIME are not errors */
+int uring_submit( uring_t *uring, uint32_t wait_nr, int timeout_ms );
+
+/* Returns NULL if there are no completions. Each one must be passed to uring_cqe_seen() */
+struct io_uring_cqe *uring_peek_cqe( uring_t *uring );
+void uring_cqe_seen( uring_t *uring );
+
+unsigned char *uring_buffer( uring_t *uring, uint16_t id );
+void uring_buffer_return( uring_t *uring, uint16_t id );
+
+#endif
+
+#endif
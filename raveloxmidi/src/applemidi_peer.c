@@ -0,0 +1,453 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <errno.h>
+extern int errno;
+
+#include "config.h"
+
+#include "applemidi_peer.h"
+#include "net_applemidi.h"
+#include "midi_command.h"
+#include "midi_payload.h"
+#include "utils.h"
+
+#include "logging.h"
+
+#define RTP_HEADER_SIZE	12
+
+uint64_t applemidi_peer_now_us( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ( (uint64_t)ts.tv_sec * 1000000ULL ) + ( ts.tv_nsec / 1000 );
+}
+
+static int applemidi_peer_socket( int family )
+{
+	int fd = -1;
+	int optionvalue = 0;
+
+	fd = socket( family, SOCK_DGRAM, 0 );
+	if( fd < 0 ) return -1;
+
+	if( family == AF_INET6 )
+	{
+		setsockopt( fd, IPPROTO_IPV6, IPV6_V6ONLY, (char *)&optionvalue, sizeof( optionvalue ) );
+	}
+
+	// A large receive buffer so that bursts aren't dropped by the kernel
+	optionvalue = 4 * 1024 * 1024;
+	setsockopt( fd, SOL_SOCKET, SO_RCVBUF, &optionvalue, sizeof( optionvalue ) );
+
+	fcntl( fd, F_SETFL, O_NONBLOCK );
+
+	return fd;
+}
+
+applemidi_peer_t *applemidi_peer_create( char *host, int control_port, int data_port, uint32_t ssrc, char *name )
+{
+	applemidi_peer_t *peer = NULL;
+	socklen_t addr_len = 0;
+
+	if( ! host ) return NULL;
+
+	peer = ( applemidi_peer_t * )malloc( sizeof( applemidi_peer_t ) );
+	if( ! peer ) return NULL;
+
+	memset( peer, 0, sizeof( applemidi_peer_t ) );
+	peer->control_fd = -1;
+	peer->data_fd = -1;
+	peer->ssrc = ssrc;
+	peer->initiator = ssrc ^ 0x5a5a5a5a;
+	peer->name = strdup( name ? name : "applemidi_peer" );
+
+	if( get_sock_addr( host, control_port, (struct sockaddr *)&(peer->control_addr), &(peer->addr_len) ) != 0 ) goto peer_create_error;
+	if( get_sock_addr( host, data_port, (struct sockaddr *)&(peer->data_addr), &addr_len ) != 0 ) goto peer_create_error;
+
+	peer->control_fd = applemidi_peer_socket( peer->control_addr.ss_family );
+	peer->data_fd = applemidi_peer_socket( peer->control_addr.ss_family );
+
+	if( ( peer->control_fd < 0 ) || ( peer->data_fd < 0 ) ) goto peer_create_error;
+
+	// Connecting the sockets gives each peer its own ephemeral ports
+	if( connect( peer->control_fd, (struct sockaddr *)&(peer->control_addr), peer->addr_len ) != 0 ) goto peer_create_error;
+	if( connect( peer->data_fd, (struct sockaddr *)&(peer->data_addr), addr_len ) != 0 ) goto peer_create_error;
+
+	return peer;
+
+peer_create_error:
+	logging_printf( LOGGING_ERROR, "applemidi_peer_create: Unable to create peer for [%s]:%d: %s\n", host, control_port, strerror( errno ) );
+	applemidi_peer_destroy( &peer );
+	return NULL;
+}
+
+void applemidi_peer_destroy( applemidi_peer_t **peer )
+{
+	if( ! peer ) return;
+	if( ! *peer ) return;
+
+	if( (*peer)->control_fd >= 0 ) close( (*peer)->control_fd );
+	if( (*peer)->data_fd >= 0 ) close( (*peer)->data_fd );
+	if( (*peer)->name ) free( (*peer)->name );
+
+	FREENULL( "applemidi_peer", (void **)peer );
+}
+
+static int applemidi_peer_send_command( int fd, net_applemidi_command *command )
+{
+	unsigned char *buffer = NULL;
+	size_t buffer_len = 0;
+	ssize_t bytes_sent = 0;
+
+	if( net_applemidi_pack( command, &buffer, &buffer_len ) != 0 )
+	{
+		if( buffer ) free( buffer );
+		return -1;
+	}
+
+	bytes_sent = send( fd, buffer, buffer_len, 0 );
+	free( buffer );
+
+	return ( bytes_sent == (ssize_t)buffer_len ? 0 : -1 );
+}
+
+/* Wait for an AppleMIDI command on fd. Anything else that arrives is discarded */
+static net_applemidi_command *applemidi_peer_wait_command( applemidi_peer_t *peer, int fd, uint16_t expected, int timeout_ms )
+{
+	struct pollfd pfd;
+	net_applemidi_command *command = NULL;
+	ssize_t recv_len = 0;
+	uint64_t deadline = applemidi_peer_now_us() + ( (uint64_t)timeout_ms * 1000 );
+	uint64_t now = 0;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	while( ( now = applemidi_peer_now_us() ) < deadline )
+	{
+		pfd.revents = 0;
+		if( poll( &pfd, 1, (int)( ( deadline - now ) / 1000 ) + 1 ) <= 0 ) continue;
+
+		recv_len = recv( fd, peer->buffer, sizeof( peer->buffer ), 0 );
+		if( recv_len < NET_APPLEMIDI_COMMAND_SIZE ) continue;
+		if( peer->buffer[0] != 0xff ) continue;
+
+		net_applemidi_unpack( &command, peer->buffer, recv_len );
+		if( ! command ) continue;
+
+		if( ( command->command == expected ) || ( command->command == NET_APPLEMIDI_CMD_REJECT ) )
+		{
+			return command;
+		}
+
+		net_applemidi_cmd_destroy( &command );
+	}
+
+	return NULL;
+}
+
+static int applemidi_peer_invite_port( applemidi_peer_t *peer, int fd, int timeout_ms )
+{
+	net_applemidi_command *command = NULL;
+	net_applemidi_inv *inv = NULL;
+	int ret = -1;
+
+	command = net_applemidi_cmd_create( NET_APPLEMIDI_CMD_INV );
+	if( ! command ) return -1;
+
+	inv = net_applemidi_inv_create();
+	if( ! inv )
+	{
+		net_applemidi_cmd_destroy( &command );
+		return -1;
+	}
+
+	inv->ssrc = peer->ssrc;
+	inv->version = 2;
+	inv->initiator = peer->initiator;
+	inv->name = strdup( peer->name );
+	command->data = inv;
+
+	ret = applemidi_peer_send_command( fd, command );
+	net_applemidi_cmd_destroy( &command );
+
+	if( ret != 0 ) return -1;
+
+	command = applemidi_peer_wait_command( peer, fd, NET_APPLEMIDI_CMD_ACCEPT, timeout_ms );
+	if( ! command ) return -1;
+
+	if( command->command == NET_APPLEMIDI_CMD_ACCEPT )
+	{
+		peer->remote_ssrc = ((net_applemidi_inv *)command->data)->ssrc;
+		ret = 0;
+	} else {
+		ret = -1;
+	}
+
+	net_applemidi_cmd_destroy( &command );
+
+	return ret;
+}
+
+/* Invite on the control port and then on the data port */
+int applemidi_peer_invite( applemidi_peer_t *peer, int timeout_ms )
+{
+	if( ! peer ) return -1;
+
+	if( applemidi_peer_invite_port( peer, peer->control_fd, timeout_ms ) != 0 ) return -1;
+	if( applemidi_peer_invite_port( peer, peer->data_fd, timeout_ms ) != 0 ) return -1;
+
+	return 0;
+}
+
+/* Send the first CK of the three step exchange on the data port */
+int applemidi_peer_sync_start( applemidi_peer_t *peer )
+{
+	net_applemidi_command *command = NULL;
+	net_applemidi_sync *sync = NULL;
+	int ret = -1;
+
+	if( ! peer ) return -1;
+
+	command = net_applemidi_cmd_create( NET_APPLEMIDI_CMD_SYNC );
+	if( ! command ) return -1;
+
+	sync = net_applemidi_sync_create();
+	if( ! sync )
+	{
+		net_applemidi_cmd_destroy( &command );
+		return -1;
+	}
+
+	peer->sync_start_us = applemidi_peer_now_us();
+	sync->ssrc = peer->ssrc;
+	sync->count = 0;
+	sync->timestamp1 = peer->sync_start_us;
+	command->data = sync;
+
+	ret = applemidi_peer_send_command( peer->data_fd, command );
+	net_applemidi_cmd_destroy( &command );
+
+	return ret;
+}
+
+/* Complete the exchange when the daemon's CK (count=1) arrives */
+static int applemidi_peer_sync_reply( applemidi_peer_t *peer, net_applemidi_command *command )
+{
+	net_applemidi_sync *sync = NULL;
+
+	sync = (net_applemidi_sync *)command->data;
+	if( ( command->command != NET_APPLEMIDI_CMD_SYNC ) || ! sync || ( sync->count != 1 ) ) return -1;
+
+	peer->sync_rtt_us = applemidi_peer_now_us() - peer->sync_start_us;
+
+	sync->ssrc = peer->ssrc;
+	sync->count = 2;
+	sync->timestamp3 = applemidi_peer_now_us();
+
+	return applemidi_peer_send_command( peer->data_fd, command );
+}
+
+/* Run the three step CK exchange on the data port and wait for it to finish */
+int applemidi_peer_sync( applemidi_peer_t *peer, int timeout_ms, uint64_t *rtt_us )
+{
+	net_applemidi_command *command = NULL;
+	int ret = -1;
+
+	if( applemidi_peer_sync_start( peer ) != 0 ) return -1;
+
+	command = applemidi_peer_wait_command( peer, peer->data_fd, NET_APPLEMIDI_CMD_SYNC, timeout_ms );
+	if( ! command ) return -1;
+
+	ret = applemidi_peer_sync_reply( peer, command );
+	net_applemidi_cmd_destroy( &command );
+
+	if( ( ret == 0 ) && rtt_us ) *rtt_us = peer->sync_rtt_us;
+
+	return ret;
+}
+
+/* Send an RS acknowledging all RTP packets up to and including seq */
+int applemidi_peer_feedback( applemidi_peer_t *peer, uint16_t seq )
+{
+	net_applemidi_command *command = NULL;
+	net_applemidi_feedback *feedback = NULL;
+	int ret = 0;
+
+	if( ! peer ) return -1;
+
+	command = net_applemidi_cmd_create( NET_APPLEMIDI_CMD_FEEDBACK );
+	if( ! command ) return -1;
+
+	feedback = net_applemidi_feedback_create();
+	if( ! feedback )
+	{
+		net_applemidi_cmd_destroy( &command );
+		return -1;
+	}
+
+	feedback->ssrc = peer->ssrc;
+	feedback->apple_seq = ( (uint32_t)seq ) << 16;
+	command->data = feedback;
+
+	ret = applemidi_peer_send_command( peer->control_fd, command );
+	net_applemidi_cmd_destroy( &command );
+
+	return ret;
+}
+
+int applemidi_peer_end( applemidi_peer_t *peer )
+{
+	net_applemidi_command *command = NULL;
+	net_applemidi_inv *inv = NULL;
+	int ret = 0;
+
+	if( ! peer ) return -1;
+
+	command = net_applemidi_cmd_create( NET_APPLEMIDI_CMD_END );
+	if( ! command ) return -1;
+
+	inv = net_applemidi_inv_create();
+	if( ! inv )
+	{
+		net_applemidi_cmd_destroy( &command );
+		return -1;
+	}
+
+	inv->ssrc = peer->ssrc;
+	inv->version = 2;
+	inv->initiator = peer->initiator;
+	command->data = inv;
+
+	ret = applemidi_peer_send_command( peer->control_fd, command );
+	net_applemidi_cmd_destroy( &command );
+
+	return ret;
+}
+
+/* Non-blocking read of one datagram from the data socket.
+   A CK from the daemon is answered here so that syncs can run alongside RTP traffic */
+int applemidi_peer_read( applemidi_peer_t *peer, applemidi_peer_rtp_t *rtp )
+{
+	ssize_t recv_len = 0;
+	unsigned char *p = NULL;
+	size_t remaining = 0;
+	size_t midi_len = 0;
+
+	if( ! peer ) return -1;
+	if( ! rtp ) return -1;
+
+	recv_len = recv( peer->data_fd, peer->buffer, sizeof( peer->buffer ), 0 );
+
+	if( recv_len < 0 )
+	{
+		return ( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) ? APPLEMIDI_PEER_READ_NONE : -1 );
+	}
+
+	if( ( recv_len >= NET_APPLEMIDI_COMMAND_SIZE ) && ( peer->buffer[0] == 0xff ) )
+	{
+		net_applemidi_command *command = NULL;
+		int ret = APPLEMIDI_PEER_READ_OTHER;
+
+		net_applemidi_unpack( &command, peer->buffer, recv_len );
+		if( ! command ) return APPLEMIDI_PEER_READ_OTHER;
+
+		if( ( command->command == NET_APPLEMIDI_CMD_SYNC ) && ( applemidi_peer_sync_reply( peer, command ) == 0 ) )
+		{
+			ret = APPLEMIDI_PEER_READ_SYNC;
+		}
+
+		net_applemidi_cmd_destroy( &command );
+		return ret;
+	}
+
+	if( recv_len < RTP_HEADER_SIZE + 1 ) return APPLEMIDI_PEER_READ_OTHER;
+	if( ( peer->buffer[0] >> 6 ) != 2 ) return APPLEMIDI_PEER_READ_OTHER;
+
+	memset( rtp, 0, sizeof( applemidi_peer_rtp_t ) );
+	rtp->packet_len = recv_len;
+
+	p = peer->buffer + 2;
+	remaining = recv_len - 2;
+	get_uint16( &(rtp->seq), &p, &remaining );
+	get_uint32( &(rtp->timestamp), &p, &remaining );
+	get_uint32( &(rtp->ssrc), &p, &remaining );
+
+	// MIDI command section header. See section 3.1 of RFC6295
+	midi_len = p[0] & PAYLOAD_HEADER_LEN;
+	if( p[0] & PAYLOAD_HEADER_B )
+	{
+		if( remaining < 2 ) return APPLEMIDI_PEER_READ_OTHER;
+		midi_len = ( midi_len << 8 ) | p[1];
+		rtp->midi = p + 2;
+		remaining -= 2;
+	} else {
+		rtp->midi = p + 1;
+		remaining -= 1;
+	}
+
+	if( midi_len > remaining ) return APPLEMIDI_PEER_READ_OTHER;
+	rtp->midi_len = midi_len;
+
+	if( p[0] & PAYLOAD_HEADER_J )
+	{
+		rtp->journal = rtp->midi + midi_len;
+		rtp->journal_len = remaining - midi_len;
+	}
+
+	return APPLEMIDI_PEER_READ_RTP;
+}
+
+/* Open a socket connected to the local MIDI port of the daemon */
+int applemidi_local_open( char *host, int local_port )
+{
+	struct sockaddr_storage local_addr;
+	socklen_t addr_len = 0;
+	int fd = -1;
+
+	if( get_sock_addr( host, local_port, (struct sockaddr *)&local_addr, &addr_len ) != 0 ) return -1;
+
+	fd = socket( local_addr.ss_family, SOCK_DGRAM, 0 );
+	if( fd < 0 ) return -1;
+
+	if( connect( fd, (struct sockaddr *)&local_addr, addr_len ) != 0 )
+	{
+		close( fd );
+		return -1;
+	}
+
+	return fd;
+}
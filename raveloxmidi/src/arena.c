@@ -0,0 +1,317 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "config.h"
+
+#include "arena.h"
+#include "utils.h"
+
+#include "logging.h"
+
+#define ARENA_ROUND( x )	( ( (x) + ARENA_ALIGN - 1 ) & ~( (size_t)ARENA_ALIGN - 1 ) )
+#define ARENA_BLOCK_HEADER	ARENA_ROUND( sizeof( arena_block_t ) )
+
+static pthread_key_t arena_key;
+static pthread_once_t arena_key_once = PTHREAD_ONCE_INIT;
+
+static arena_block_t *arena_block_create( size_t size )
+{
+	arena_block_t *block = NULL;
+
+	block = ( arena_block_t * ) malloc( ARENA_BLOCK_HEADER + size );
+
+	if( ! block )
+	{
+		logging_printf( LOGGING_ERROR, "arena_block_create: Insufficient memory for %zu bytes\n", size );
+		return NULL;
+	}
+
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+	block->data = (unsigned char *)block + ARENA_BLOCK_HEADER;
+
+	return block;
+}
+
+arena_t *arena_create( size_t size )
+{
+	arena_t *arena = NULL;
+
+	arena = ( arena_t * ) malloc( sizeof( arena_t ) );
+
+	if( ! arena ) return NULL;
+
+	memset( arena, 0, sizeof( arena_t ) );
+
+	arena->main = arena_block_create( ARENA_ROUND( size > 0 ? size : ARENA_DEFAULT_SIZE ) );
+	if( ! arena->main )
+	{
+		free( arena );
+		return NULL;
+	}
+	arena->head = arena->main;
+
+	return arena;
+}
+
+void arena_destroy( arena_t **arena )
+{
+	arena_block_t *block = NULL;
+	arena_block_t *next = NULL;
+
+	if( ! arena ) return;
+	if( ! *arena ) return;
+
+	block = (*arena)->head;
+	while( block )
+	{
+		next = block->next;
+		free( block );
+		block = next;
+	}
+
+	FREENULL( "arena", (void **)arena );
+}
+
+void arena_reset( arena_t *arena )
+{
+	arena_block_t *block = NULL;
+	arena_block_t *next = NULL;
+	size_t new_size = 0;
+
+	if( ! arena ) return;
+
+	if( arena->used > arena->high_water )
+	{
+		arena->high_water = arena->used;
+	}
+
+	/* Drop the overflow blocks. These are always in front of the main block */
+	block = arena->head;
+	while( block && block != arena->main )
+	{
+		next = block->next;
+		free( block );
+		block = next;
+	}
+	arena->head = arena->main;
+
+	/* Grow the main block so that the next packet of this size fits in it */
+	if( arena->high_water > arena->main->size )
+	{
+		new_size = ( arena->high_water + 4095 ) & ~( (size_t) 4095 );
+		block = arena_block_create( new_size );
+		if( block )
+		{
+			logging_printf( LOGGING_DEBUG, "arena_reset: main block grown from %zu to %zu bytes\n", arena->main->size, new_size );
+			free( arena->main );
+			arena->main = block;
+			arena->head = block;
+		}
+	}
+
+	arena->main->used = 0;
+	arena->used = 0;
+	arena->last = NULL;
+	arena->last_size = 0;
+}
+
+void arena_mark( arena_t *arena, arena_mark_t *mark )
+{
+	if( ! mark ) return;
+
+	memset( mark, 0, sizeof( arena_mark_t ) );
+
+	if( ! arena ) return;
+
+	mark->block = arena->head;
+	mark->block_used = arena->head->used;
+	mark->used = arena->used;
+}
+
+/* Release everything allocated since the mark was taken */
+void arena_rewind( arena_t *arena, arena_mark_t *mark )
+{
+	arena_block_t *block = NULL;
+	arena_block_t *next = NULL;
+
+	if( ! arena ) return;
+	if( ! mark ) return;
+	if( ! mark->block ) return;
+
+	if( arena->used > arena->high_water )
+	{
+		arena->high_water = arena->used;
+	}
+
+	block = arena->head;
+	while( block && block != mark->block )
+	{
+		next = block->next;
+		free( block );
+		block = next;
+	}
+
+	arena->head = mark->block;
+	arena->head->used = mark->block_used;
+	arena->used = mark->used;
+	arena->last = NULL;
+	arena->last_size = 0;
+}
+
+void *arena_alloc( arena_t *arena, size_t size )
+{
+	arena_block_t *block = NULL;
+	size_t aligned_size = 0;
+	void *ptr = NULL;
+
+	if( ! arena ) return malloc( size );
+
+	aligned_size = ARENA_ROUND( size > 0 ? size : 1 );
+	block = arena->head;
+
+	if( block->size - block->used < aligned_size )
+	{
+		/* Overflow blocks are at least as big as the main block */
+		block = arena_block_create( aligned_size > arena->main->size ? aligned_size : arena->main->size );
+		if( ! block ) return NULL;
+
+		block->next = arena->head;
+		arena->head = block;
+		arena->overflows++;
+	}
+
+	ptr = block->data + block->used;
+	block->used += aligned_size;
+	arena->used += aligned_size;
+	arena->last = ptr;
+	arena->last_size = aligned_size;
+
+	return ptr;
+}
+
+void *arena_realloc( arena_t *arena, void *ptr, size_t old_size, size_t new_size )
+{
+	arena_block_t *block = NULL;
+	size_t aligned_size = 0;
+	void *new_ptr = NULL;
+
+	if( ! arena ) return realloc( ptr, new_size );
+
+	if( ! ptr ) return arena_alloc( arena, new_size );
+
+	/* The most recent allocation can be extended in place */
+	block = arena->head;
+	aligned_size = ARENA_ROUND( new_size > 0 ? new_size : 1 );
+	if( ptr == arena->last )
+	{
+		if( aligned_size <= arena->last_size )
+		{
+			return ptr;
+		}
+
+		if( block->size - block->used >= aligned_size - arena->last_size )
+		{
+			block->used += aligned_size - arena->last_size;
+			arena->used += aligned_size - arena->last_size;
+			arena->last_size = aligned_size;
+			return ptr;
+		}
+	}
+
+	new_ptr = arena_alloc( arena, new_size );
+	if( new_ptr )
+	{
+		memcpy( new_ptr, ptr, old_size < new_size ? old_size : new_size );
+	}
+
+	return new_ptr;
+}
+
+void arena_free( arena_t *arena, void *ptr )
+{
+	/* Arena memory is only released by arena_reset() */
+	if( arena ) return;
+
+	free( ptr );
+}
+
+void arena_dump( arena_t *arena )
+{
+	DEBUG_ONLY;
+	if( ! arena ) return;
+
+	logging_printf( LOGGING_DEBUG, "arena_dump: arena=%p,size=%zu,used=%zu,high_water=%zu,overflows=%lu\n",
+		arena, arena->main->size, arena->used, arena->high_water, arena->overflows );
+}
+
+static void arena_thread_destructor( void *data )
+{
+	arena_t *arena = ( arena_t * )data;
+
+	arena_destroy( &arena );
+}
+
+static void arena_key_create( void )
+{
+	pthread_key_create( &arena_key, arena_thread_destructor );
+}
+
+arena_t *arena_thread( void )
+{
+	arena_t *arena = NULL;
+
+	pthread_once( &arena_key_once, arena_key_create );
+
+	arena = ( arena_t * ) pthread_getspecific( arena_key );
+
+	if( ! arena )
+	{
+		arena = arena_create( ARENA_DEFAULT_SIZE );
+		if( ! arena ) return NULL;
+
+		pthread_setspecific( arena_key, arena );
+		logging_printf( LOGGING_DEBUG, "arena_thread: created arena=%p\n", arena );
+	}
+
+	return arena;
+}
+
+/* Thread-specific destructors are not run for the main thread, so it releases its arena explicitly */
+void arena_thread_release( void )
+{
+	arena_t *arena = NULL;
+
+	pthread_once( &arena_key_once, arena_key_create );
+
+	arena = ( arena_t * ) pthread_getspecific( arena_key );
+	if( ! arena ) return;
+
+	pthread_setspecific( arena_key, NULL );
+	arena_destroy( &arena );
+}
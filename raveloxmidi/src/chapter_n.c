@@ -31,214 +31,84 @@
 
 #include "logging.h"
 
-void chapter_n_header_pack( chapter_n_header_t *header , unsigned char **packed , size_t *size )
+void chapter_n_header_pack( chapter_n_header_t *header , unsigned char *packed , size_t packed_len, size_t *size )
 {
-	unsigned char *p = NULL;
-
-	*packed = NULL;
 	*size = 0;
 
 	if( ! header ) return;
-
-	chapter_n_header_dump( header );
-	*packed = ( unsigned char *)malloc( CHAPTER_N_HEADER_PACKED_SIZE );
-
 	if( ! packed ) return;
-	memset( *packed, 0 , CHAPTER_N_HEADER_PACKED_SIZE );
-
-	p = *packed;
+	if( packed_len < CHAPTER_N_HEADER_PACKED_SIZE ) return;
 
-	*p |= ( ( header->B & 0x01 ) << 7 );
-	*p |= ( header->len & 0x7f ) ;
-
-	p += sizeof( char );
-	*size += sizeof( char );
-
-	*p |= ( ( header->low & 0x0f ) << 4 );
-	*p |= ( header->high & 0x0f );
-
-	*size += sizeof( char );
-}
-
-void chapter_n_header_destroy( chapter_n_header_t **header )
-{
-	FREENULL( "chapter_n_header",(void **)header);
-}
-
-chapter_n_header_t * chapter_n_header_create( void )
-{
-	chapter_n_header_t *header = NULL;
+	chapter_n_header_dump( header );
 
-	header = ( chapter_n_header_t *) malloc( sizeof( chapter_n_header_t ) );
+	packed[0] = ( ( header->B & 0x01 ) << 7 ) | ( header->len & 0x7f );
+	packed[1] = ( ( header->low & 0x0f ) << 4 ) | ( header->high & 0x0f );
 
-	if( header )
-	{
-		memset( header, 0 , sizeof( chapter_n_header_t) );
-		header->low = 0x0f;
-		header->high = 0x00;
-	}
-
-	return header;
+	*size = CHAPTER_N_HEADER_PACKED_SIZE;
 }
 
-void chapter_n_pack( chapter_n_t *chapter_n, unsigned char **packed, size_t *size )
+void chapter_n_pack( chapter_n_t *chapter_n, unsigned char *packed, size_t packed_len, size_t *size )
 {
-	unsigned char *packed_header = NULL;
-	unsigned char *packed_note = NULL;
-	unsigned char *note_buffer = NULL;
-	unsigned char *offbits_buffer = NULL;
+	chapter_n_header_t header;
 	unsigned char *p = NULL;
+	size_t item_size = 0;
+	size_t needed = 0;
+	uint64_t word = 0;
+	int offbits_size = 0;
+	int packed_notes = 0;
+	int num_logs = 0;
 	int i = 0;
-	size_t header_size, note_size, note_buffer_size;
-	int offbits_size;
 
-	*packed = NULL;
 	*size = 0;
 
-	header_size = note_size = note_buffer_size = 0;
-
 	if( ! chapter_n ) return;
+	if( ! packed ) return;
 
-	chapter_n->header->len = chapter_n->num_notes;
-
-	chapter_n_header_pack( chapter_n->header, &packed_header, &header_size) ;
-
-	if( packed_header )
-	{
-		*size += header_size;
-	}
-
-	if( chapter_n->num_notes > 0 )
-	{
-		note_buffer_size = CHAPTER_N_NOTE_PACKED_SIZE * chapter_n->num_notes;
-		note_buffer = ( unsigned char * ) malloc( note_buffer_size );
-		if( note_buffer ) 
-		{
-			memset( note_buffer, 0 , note_buffer_size);
-			p = note_buffer;
-
-			for( i = 0 ; i < chapter_n->num_notes ; i++ )
-			{
-				chapter_n_note_pack( chapter_n->notes[i], &packed_note, &note_size );
-				memcpy( p, packed_note, note_size );
-				p += note_size;
-				*size += note_size;
-				free( packed_note );
-			}
-		} else {
-			logging_printf(LOGGING_ERROR, "chapter_n_pack: Insufficient memory to create note buffer\n");
-			goto chapter_n_pack_cleanup;
-		}
-			
-	}
-
-	
-	offbits_size = ( chapter_n->header->high - chapter_n->header->low ) + 1;
-	if( offbits_size > 0 )
-	{
-		offbits_buffer = ( unsigned char * )malloc( offbits_size );
-		p = chapter_n->offbits + chapter_n->header->low;
-		memcpy( offbits_buffer, p, offbits_size );
-		*size += offbits_size;
-	}
-
-	// Now pack it all together
-	*packed = ( unsigned char * ) malloc( *size );
-
-	if( ! packed ) goto chapter_n_pack_cleanup;
-
-	p = *packed;
-
-	memcpy( p , packed_header, header_size );
-	p += header_size;
+	/* LEN is 7 bits wide. All 128 notes are sent as LEN=127 LOW=15 HIGH=0, see Appendix A.6 of RFC6295.
+	   Every note is sounding then, so there are no offbits */
+	num_logs = MIN( chapter_n->num_notes, CHAPTER_N_NOTE_TABLE_SIZE );
+	chapter_n->header.len = MIN( num_logs, MAX_CHAPTER_N_NOTES );
 
-	if( note_buffer )
+	header = chapter_n->header;
+	if( num_logs == CHAPTER_N_NOTE_TABLE_SIZE )
 	{
-		memcpy( p, note_buffer, note_buffer_size );
-		p+= note_buffer_size;
+		header.low = 0x0f;
+		header.high = 0x00;
 	}
 
-	if( offbits_buffer )
-	{
-		memcpy( p, offbits_buffer, offbits_size );
-	}
-
-chapter_n_pack_cleanup:
-	FREENULL( "chapter_n:packed_header", (void **)&packed_header );
-	FREENULL( "chapter_n:note_buffer", (void **)&note_buffer );
-	FREENULL( "chapter_n:offbits_buffer",(void **)&offbits_buffer );
-}
-
-chapter_n_t * chapter_n_create( void )
-{
-	chapter_n_t *chapter_n = NULL;
-	unsigned int i = 0;
-
-	chapter_n = ( chapter_n_t * ) malloc( sizeof( chapter_n_t ) );
+	offbits_size = ( header.high - header.low ) + 1;
+	if( offbits_size < 0 ) offbits_size = 0;
 
-	if( chapter_n )
+	needed = CHAPTER_N_HEADER_PACKED_SIZE + ( num_logs * CHAPTER_N_NOTE_PACKED_SIZE ) + offbits_size;
+	if( packed_len < needed )
 	{
-		chapter_n_header_t *header = chapter_n_header_create();
-
-		memset( chapter_n, 0, sizeof( chapter_n_t ) );
-		if( ! header )
-		{
-			free( chapter_n );
-			return NULL;
-		}
-
-		chapter_n->header = header;
-
-		chapter_n->num_notes = 0;
-		for( i = 0 ; i < MAX_CHAPTER_N_NOTES ; i++ )
-		{
-			chapter_n->notes[i] = NULL;
-		}
-		
-		chapter_n->offbits = ( unsigned char *)malloc( MAX_OFFBITS );
-		if (! chapter_n->offbits )
-		{
-			chapter_n_destroy( &chapter_n );
-			return NULL;
-		}
-			
-		memset( chapter_n->offbits, 0, MAX_OFFBITS );
+		logging_printf(LOGGING_ERROR, "chapter_n_pack: Insufficient space to pack chapter_n\n");
+		return;
 	}
 
-	return chapter_n;
-}
+	p = packed;
 
-void chapter_n_destroy( chapter_n_t **chapter_n )
-{
-	int i;
-	if( ! chapter_n ) return;
-	if( ! *chapter_n ) return;
+	chapter_n_header_pack( &header, p, packed_len, &item_size );
+	p += item_size;
 
-	for( i = 0 ; i < MAX_CHAPTER_N_NOTES ; i++ )
+	// Walk the active notes in ascending order
+	for( i = 0 ; i < CHAPTER_N_NOTE_TABLE_SIZE / 64 ; i++ )
 	{
-		if( (*chapter_n)->notes[i] )
+		for( word = chapter_n->active[i]; word && ( packed_notes < num_logs ); word &= word - 1 )
 		{
-			chapter_n_note_destroy( &( (*chapter_n)->notes[i] ) );
+			chapter_n_note_pack( &(chapter_n->notes[ ( i * 64 ) + __builtin_ctzll( word ) ]), p, CHAPTER_N_NOTE_PACKED_SIZE, &item_size );
+			p += item_size;
+			packed_notes++;
 		}
 	}
 
-	if( (*chapter_n)->offbits )
-	{
-		free( (*chapter_n)->offbits );
-		(*chapter_n)->offbits = NULL;
-	}
-
-	if( (*chapter_n)->header )
+	if( offbits_size > 0 )
 	{
-		chapter_n_header_destroy( &( (*chapter_n)->header ) );
-		(*chapter_n)->header = NULL;
+		memcpy( p, chapter_n->offbits + header.low, offbits_size );
+		p += offbits_size;
 	}
 
-	free( *chapter_n );
-
-	*chapter_n = NULL;
-
-	return;
+	*size = p - packed;
 }
 
 void chapter_n_header_dump( chapter_n_header_t *header )
@@ -253,10 +123,11 @@ void chapter_n_header_reset( chapter_n_header_t *header )
 {
 	if( ! header ) return;
 
+	/* No offbits. LOW=15 HIGH=0 would mean 128 note logs when LEN is 127, see Appendix A.6 of RFC6295 */
 	header->B = 0;
 	header->len = 0;
-	header->high = 0;
-	header->low = 0;
+	header->low = 0x0f;
+	header->high = 0x01;
 }
 
 void chapter_n_dump( chapter_n_t *chapter_n )
@@ -266,12 +137,15 @@ void chapter_n_dump( chapter_n_t *chapter_n )
 	DEBUG_ONLY;
 	if( ! chapter_n ) return;
 
-	for( i = 0 ; i < chapter_n->num_notes ; i++ )
+	chapter_n_header_dump( &(chapter_n->header) );
+
+	for( i = 0 ; i < CHAPTER_N_NOTE_TABLE_SIZE ; i++ )
 	{
-		chapter_n_note_dump( chapter_n->notes[i] );
+		if( ! CHAPTER_N_IS_ACTIVE( chapter_n, i ) ) continue;
+		chapter_n_note_dump( &(chapter_n->notes[i]) );
 	}
 	
-	for( i = chapter_n->header->low; i <= chapter_n->header->high ; i++ )
+	for( i = chapter_n->header.low; i <= chapter_n->header.high ; i++ )
 	{
 		logging_printf( LOGGING_DEBUG, "Offbits[%d]=%02x\n", i, chapter_n->offbits[i]);
 	}
@@ -279,63 +153,77 @@ void chapter_n_dump( chapter_n_t *chapter_n )
 
 void chapter_n_reset( chapter_n_t *chapter_n )
 {
-	uint16_t i = 0;
-
 	if( ! chapter_n ) return;
 
-	for( i = 0 ; i < chapter_n->num_notes ; i++ )
-	{
-		chapter_n_note_reset( &chapter_n->notes[i] );
-	}
 	chapter_n->num_notes = 0;
+	memset( chapter_n->active, 0, sizeof( chapter_n->active ) );
 	memset( chapter_n->offbits, 0, MAX_OFFBITS );
-	chapter_n_header_reset( chapter_n->header );
+	chapter_n_header_reset( &(chapter_n->header) );
 }
 
-void chapter_n_note_pack( chapter_n_note_t *note , unsigned char **packed , size_t *size )
+/* Record the most recent Note On for a note number. See Appendix A.6 of RFC6295 */
+void chapter_n_note_on( chapter_n_t *chapter_n, uint8_t num, uint8_t velocity )
 {
-	unsigned char *p = NULL;
+	if( ! chapter_n ) return;
 
-	*packed = NULL;
-	*size = 0;
+	num &= 0x7f;
 
-	if( ! note ) return;
+	if( ! CHAPTER_N_IS_ACTIVE( chapter_n, num ) )
+	{
+		chapter_n->active[ num >> 6 ] |= ( 1ULL << ( num & 63 ) );
+		chapter_n->num_notes++;
+	}
 
-	*packed = ( unsigned char *)malloc( CHAPTER_N_NOTE_PACKED_SIZE );
+	chapter_n->notes[num].S = 0;
+	chapter_n->notes[num].num = num;
+	chapter_n->notes[num].Y = 0;
+	chapter_n->notes[num].velocity = velocity & 0x7f;
 
-	if( ! packed ) return;
+	// The note is sounding again so it's no longer off
+	chapter_n->offbits[ num >> 3 ] &= ~( 0x80 >> ( num & 7 ) );
+}
 
-	memset( *packed, 0, CHAPTER_N_NOTE_PACKED_SIZE );
-	p = *packed;
+/* A Note Off removes the note log and sets the note's offbit. The MSB of each offbits byte is the lowest note */
+void chapter_n_note_off( chapter_n_t *chapter_n, uint8_t num )
+{
+	uint8_t offset = 0;
 
-	*p = ( note->S << 7 ) | ( note->num & 0x7f );
+	if( ! chapter_n ) return;
 
-	p += sizeof( char );
-	*size += sizeof( char );
+	num &= 0x7f;
+	offset = num >> 3;
 
-	*p = ( note->Y << 7 ) | ( note->velocity & 0x7f );
+	if( CHAPTER_N_IS_ACTIVE( chapter_n, num ) )
+	{
+		chapter_n->active[ num >> 6 ] &= ~( 1ULL << ( num & 63 ) );
+		chapter_n->num_notes--;
+	}
 
-	*size += sizeof( char );
-}
+	chapter_n->offbits[ offset ] |= ( 0x80 >> ( num & 7 ) );
 
-void chapter_n_note_destroy( chapter_n_note_t **note )
-{
-	FREENULL( "chapter_n:note",(void **)note );
+	// An empty range is low=15 high=1 so the first offbit sets both
+	if( chapter_n->header.low > chapter_n->header.high )
+	{
+		chapter_n->header.low = offset;
+		chapter_n->header.high = offset;
+	} else {
+		chapter_n->header.low = MIN( offset, chapter_n->header.low );
+		chapter_n->header.high = MAX( offset, chapter_n->header.high );
+	}
 }
 
-chapter_n_note_t * chapter_n_note_create( void )
+void chapter_n_note_pack( chapter_n_note_t *note , unsigned char *packed , size_t packed_len, size_t *size )
 {
-	chapter_n_note_t *note = NULL;
-	
-	note = ( chapter_n_note_t * ) malloc( sizeof( chapter_n_note_t ) );
+	*size = 0;
 
-	if( note )
-	{
-		memset( note , 0 , sizeof( chapter_n_note_t ) );
-		logging_printf(LOGGING_DEBUG,"chapter_n_note_create:note=%p\n", note);
-	}
+	if( ! note ) return;
+	if( ! packed ) return;
+	if( packed_len < CHAPTER_N_NOTE_PACKED_SIZE ) return;
+
+	packed[0] = ( note->S << 7 ) | ( note->num & 0x7f );
+	packed[1] = ( note->Y << 7 ) | ( note->velocity & 0x7f );
 
-	return note;
+	*size = CHAPTER_N_NOTE_PACKED_SIZE;
 }
 
 void chapter_n_note_dump( chapter_n_note_t *note )
@@ -346,13 +234,12 @@ void chapter_n_note_dump( chapter_n_note_t *note )
 	logging_printf( LOGGING_DEBUG, "chapter_n_note: S=%d num=%u Y=%d velocity=%u\n", note->S, note->num, note->Y, note->velocity);
 }
 
-void chapter_n_note_reset( chapter_n_note_t **note )
+void chapter_n_note_reset( chapter_n_note_t *note )
 {
 	if( ! note ) return;
 
-	(*note)->S = 0;
-	(*note)->num = 0;
-	(*note)->Y = 0;
-	(*note)->velocity = 0;
-	chapter_n_note_destroy( note );
+	note->S = 0;
+	note->num = 0;
+	note->Y = 0;
+	note->velocity = 0;
 }
@@ -0,0 +1,61 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+
+#include "net_applemidi.h"
+#include "net_connection.h"
+
+#include "logging.h"
+
+/* RL from the remote end. The limit, in bits per second, is how fast it wants to be sent RTP MIDI */
+int cmd_bitrate_handler( void *data )
+{
+	net_applemidi_bitrate *bitrate;
+	net_ctx_t *ctx = NULL;
+
+	if( ! data ) return -1;
+
+	bitrate = ( net_applemidi_bitrate *) data;
+
+	ctx = net_ctx_find_by_ssrc( bitrate->ssrc );
+
+	if( ! ctx )
+	{
+		logging_printf(LOGGING_DEBUG,"cmd_bitrate_handler: No context found (ssrc=0x%08x)\n", bitrate->ssrc );
+		return -1;
+	}
+
+	logging_printf( LOGGING_INFO, "cmd_bitrate_handler: ssrc=0x%08x host=%s limit=%u bits/s\n", ctx->ssrc, ctx->ip_address, bitrate->limit );
+	net_ctx_heard( ctx );
+	net_ctx_tx_rate_set( ctx, bitrate->limit );
+
+	if( bitrate->limit > 0 && ! net_ctx_tx_enabled() )
+	{
+		logging_printf( LOGGING_WARN, "cmd_bitrate_handler: ssrc=0x%08x limit is ignored because transmit queues are disabled\n", ctx->ssrc );
+	}
+
+	return 0;
+}
@@ -42,12 +42,12 @@ extern int errno;
 
 #include "logging.h"
 
-net_response_t * cmd_end_handler( void *data )
+int cmd_end_handler( void *data )
 {
 	net_applemidi_inv *inv = NULL;
 	net_ctx_t *ctx = NULL;
 
-	if( ! data ) return NULL;
+	if( ! data ) return -1;
 
 	inv = ( net_applemidi_inv *) data;
 
@@ -56,11 +56,11 @@ net_response_t * cmd_end_handler( void *data )
 	if( ! ctx )
 	{
 		logging_printf( LOGGING_WARN, "cmd_end_handler:No existing connection found\n");
-		return NULL;
+		return -1;
 	}
 
 	net_ctx_dump( ctx );
 	net_ctx_destroy( &ctx );
 
-	return NULL;
+	return 0;
 }
@@ -45,12 +45,12 @@ extern int errno;
 
 #include "logging.h"
 
-net_response_t * cmd_feedback_handler( void *data )
+int cmd_feedback_handler( void *data )
 {
 	net_applemidi_feedback  *feedback;
 	net_ctx_t *ctx = NULL;
 
-	if( ! data ) return NULL;
+	if( ! data ) return -1;
 
 	feedback = ( net_applemidi_feedback *) data;
 
@@ -59,49 +59,33 @@ net_response_t * cmd_feedback_handler( void *data )
 	if( ! ctx )
 	{
 		logging_printf(LOGGING_DEBUG,"cmd_feedback_handler: No context found (search=%u)\n", feedback->rtp_seq[1]);
-		return NULL;
+		return -1;
 	}
 
 	logging_printf( LOGGING_DEBUG, "cmd_feedback_handler: Context found ( search=%u, found=%u )\n", feedback->rtp_seq[1], ctx->seq );
+	net_ctx_heard( ctx );
+
 	if( feedback->rtp_seq[1] >= ctx->seq )
 	{
 		logging_printf( LOGGING_DEBUG, "cmd_feedback_handler: Resetting journal\n" );
-		journal_reset( ctx->journal );
+		net_ctx_journal_reset( ctx );
 	}
 
-	return NULL;
+	return 0;
 }
 
-net_response_t *cmd_feedback_create( uint32_t ssrc, uint16_t rtp_seq )
+/* Build the RS acknowledging rtp_seq in the caller's response buffer */
+int cmd_feedback_create( uint32_t ssrc, uint16_t rtp_seq, net_response_t *response )
 {
-	net_applemidi_command *cmd = NULL;
-	net_applemidi_feedback *feedback = NULL;
-	net_response_t *response = NULL;
-
-	feedback = net_applemidi_feedback_create();
-
-	if( ! feedback ) return NULL;
+	net_applemidi_feedback feedback;
 
-	cmd = net_applemidi_cmd_create( NET_APPLEMIDI_CMD_FEEDBACK );
+	if( ! response ) return -1;
 
-	if( ! cmd )
-	{
-		free( feedback );
-		return NULL;
-	}
-	
-	feedback->ssrc = ssrc;
-	feedback->rtp_seq[1] = rtp_seq;
-
-	cmd->data = feedback;
-
-	response = net_response_create();
-	if( response )
-	{
-		net_applemidi_pack( cmd, &(response->buffer), &(response->len) );
-	}
+	memset( &feedback, 0, sizeof( feedback ) );
+	feedback.ssrc = ssrc;
+	feedback.rtp_seq[1] = rtp_seq;
 
-	net_applemidi_cmd_destroy( &cmd );
+	response->len = net_applemidi_feedback_write( &feedback, response->buffer, response->size );
 
-	return response;
+	return ( response->len > 0 ? 0 : -1 );
 }
@@ -43,16 +43,24 @@ extern int errno;
 #include "raveloxmidi_config.h"
 #include "logging.h"
 
-net_response_t * cmd_inv_handler( char *ip_address, uint16_t port, void *data )
+static config_handle_t service_name_handle = CONFIG_HANDLE_INVALID;
+
+void cmd_inv_handler_init( void )
+{
+	service_name_handle = config_handle_get("service.name");
+}
+
+/* The ACCEPT reply is written into the caller's response buffer */
+int cmd_inv_handler( char *ip_address, uint16_t port, void *data, net_response_t *response )
 {
-	net_applemidi_command *cmd = NULL;
 	net_applemidi_inv *inv = NULL;
-	net_applemidi_inv *accept_inv = NULL;
+	net_applemidi_inv accept_reply;
+	net_applemidi_inv *accept_inv = &accept_reply;
 	net_ctx_t *ctx = NULL;
-	net_response_t *response;
 	char *service_name = NULL;
 
-	if( ! data ) return NULL;
+	if( ! data ) return -1;
+	if( ! response ) return -1;
 
 	inv = ( net_applemidi_inv *) data;
 
@@ -70,57 +78,27 @@ net_response_t * cmd_inv_handler( char *ip_address, uint16_t port, void *data )
 		if( ! ctx ) 
 		{
 			logging_printf( LOGGING_ERROR, "cmd_inv_handler: Error registering connection\n");
+			return -1;
 		}
 	/* Otherwise, we assume that the current port is the data port */
 	} else {
 		ctx->data_port = port;
 	}
 
-	cmd = net_applemidi_cmd_create( NET_APPLEMIDI_CMD_ACCEPT );
-
-	if( ! cmd )
-	{
-		logging_printf( LOGGING_ERROR, "cmd_inv_handler: Unable to allocate memory for accept_inv command\n");
-		net_ctx_destroy( &ctx );
-		return NULL;
-	}
-
-	accept_inv = net_applemidi_inv_create();
-	
-	if( ! accept_inv ) {
-		logging_printf( LOGGING_ERROR, "cmd_inv_handler: Unable to allocate memory for accept_inv command data\n");
-		free( cmd );
-		net_ctx_destroy( &ctx );
-		return NULL;
-	}
+	memset( accept_inv, 0, sizeof( net_applemidi_inv ) );
 
 	accept_inv->ssrc = ctx->send_ssrc;
 	accept_inv->version = 2;
 	accept_inv->initiator = ctx->initiator;
-	service_name = config_string_get("service.name");
-	if( service_name )
-	{
-		accept_inv->name = (char *)strdup( service_name );
-	} else {
-		accept_inv->name = (char *)strdup( "RaveloxMIDI" );
-	}
-
-	cmd->data = accept_inv;
+	service_name = config_handle_string( service_name_handle );
+	accept_inv->name = ( service_name ? service_name : "RaveloxMIDI" );
 
-	response = net_response_create();
-
-	if( response )
+	response->len = net_applemidi_inv_write( NET_APPLEMIDI_CMD_ACCEPT, accept_inv, response->buffer, response->size );
+	if( response->len == 0 )
 	{
-		int ret = 0;
-		ret = net_applemidi_pack( cmd , &(response->buffer), &(response->len) );
-		if( ret != 0 )
-		{
-			logging_printf( LOGGING_ERROR, "cmd_inv_handler: Unable to pack response to inv command\n");
-			net_response_destroy( &response );
-		}
+		logging_printf( LOGGING_ERROR, "cmd_inv_handler: Unable to pack response to inv command\n");
+		return -1;
 	}
 
-	net_applemidi_cmd_destroy( &cmd );
-
-	return response;
+	return 0;
 }
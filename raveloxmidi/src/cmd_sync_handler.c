@@ -43,38 +43,27 @@ extern int errno;
 
 #include "logging.h"
 
-net_response_t * cmd_sync_handler( void *data )
+/* The reply is written into the caller's response buffer */
+int cmd_sync_handler( void *data, net_response_t *response )
 {
-	net_applemidi_command *cmd = NULL;
 	net_applemidi_sync *sync = NULL;
-	net_applemidi_sync *sync_resp = NULL;
+	net_applemidi_sync sync_reply;
+	net_applemidi_sync *sync_resp = &sync_reply;
 	net_ctx_t *ctx = NULL;
-	net_response_t *response = NULL;
 	uint32_t delta = 0;
 
-	if( ! data ) return NULL;
+	if( ! data ) return -1;
+	if( ! response ) return -1;
 
 	sync = ( net_applemidi_sync *) data;
 
 	ctx = net_ctx_find_by_ssrc( sync->ssrc);
 
-	if( ! ctx ) return NULL;
+	if( ! ctx ) return -1;
 
-	cmd = net_applemidi_cmd_create( NET_APPLEMIDI_CMD_SYNC );
+	net_ctx_heard( ctx );
 
-	if( ! cmd )
-	{
-		logging_printf( LOGGING_ERROR, "cmd_sync_handler: Unable to allocate memory for sync command\n");
-		return NULL;
-	}
-
-	sync_resp = net_applemidi_sync_create();
-	
-	if( ! sync_resp ) {
-		logging_printf( LOGGING_ERROR, "cmd_sync_handler: Unable to allocate memory for sync_resp command data\n");
-		free( cmd );
-		return NULL;
-	}
+	memset( sync_resp, 0, sizeof( net_applemidi_sync ) );
 
 	sync_resp->ssrc = ctx->send_ssrc;
 	sync_resp->count = ( sync->count < 2 ? sync->count + 1 : 0 );
@@ -99,22 +88,31 @@ net_response_t * cmd_sync_handler( void *data )
 			break;
 	}
 
-	cmd->data = sync_resp;
-
-	response = net_response_create();
-
-	if( response )
+	response->len = net_applemidi_sync_write( sync_resp, response->buffer, response->size );
+	if( response->len == 0 )
 	{
-		int ret = 0;
-		ret = net_applemidi_pack( cmd , &(response->buffer), &(response->len) );
-		if( ret != 0 )
-		{
-			logging_printf( LOGGING_ERROR, "cmd_sync_handler: Unable to pack response to sync command\n");
-			net_response_destroy( &response );
-		}
+		logging_printf( LOGGING_ERROR, "cmd_sync_handler: Unable to pack response to sync command\n");
+		return -1;
 	}
 
-	net_applemidi_cmd_destroy( &cmd );
+	return 0;
+}
+
+/* Build the CK0 that starts a sync with the session in the caller's response buffer.
+   The remote end answers with CK1, which cmd_sync_handler() completes with CK2 */
+int cmd_sync_create( net_ctx_t *ctx, net_response_t *response )
+{
+	net_applemidi_sync sync;
+
+	if( ! ctx ) return -1;
+	if( ! response ) return -1;
+
+	memset( &sync, 0, sizeof( sync ) );
+	sync.ssrc = ctx->send_ssrc;
+	sync.count = 0;
+	sync.timestamp1 = time( NULL ) - ctx->start;
+
+	response->len = net_applemidi_sync_write( &sync, response->buffer, response->size );
 
-	return response;
+	return ( response->len > 0 ? 0 : -1 );
 }
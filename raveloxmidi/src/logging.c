@@ -158,13 +158,18 @@ logging_end:
 	pthread_mutex_unlock( &logging_mutex );
 }
 
-void logging_init(void)
+/* Apply the logging items from the current config. Called with logging_mutex held */
+static void logging_configure( void )
 {
 	char *name = NULL;
 
-	pthread_mutex_init( &logging_mutex, NULL );
+	if( logging_file_name )
+	{
+		free( logging_file_name );
+		logging_file_name = NULL;
+	}
 
-	pthread_mutex_lock( &logging_mutex );
+	logging_enabled = 0;
 
 	if( is_yes( config_string_get("logging.enabled") ) )
 	{
@@ -187,7 +192,22 @@ void logging_init(void)
 		
 		logging_enabled = 1;
 	}
+}
 
+void logging_init(void)
+{
+	pthread_mutex_init( &logging_mutex, NULL );
+
+	pthread_mutex_lock( &logging_mutex );
+	logging_configure();
+	pthread_mutex_unlock( &logging_mutex );
+}
+
+/* The log file is opened for every event so picking up the new name is enough to reopen it */
+void logging_reload(void)
+{
+	pthread_mutex_lock( &logging_mutex );
+	logging_configure();
 	pthread_mutex_unlock( &logging_mutex );
 }
 
@@ -31,31 +31,44 @@
 
 #include "logging.h"
 
-static midi_message_t midi_message_map[] = {
-        { 0x8, MIDI_NOTE_OFF, "Note Off"},
-        { 0x9, MIDI_NOTE_ON, "Note On"},
-        { 0xa, MIDI_POLY_PRESSURE, "Polyphonic Key Pressure (Aftertouch)" },
-        { 0xb, MIDI_CONTROL_CHANGE, "Control Change" },
-        { 0xc, MIDI_PROGRAM_CHANGE, "Program Change" },
-        { 0xd, MIDI_CHANNEL_PRESSURE, "Channel Pressure (Aftertouch)" },
-        { 0xe, MIDI_PITCH_BEND, "Pitch Bend Change" },
-        { 0xf0, MIDI_SYSEX, "System Exclusive" },
-        { 0xf1, MIDI_TIME_CODE_QF, "Midi Time Code QF" },
-        { 0xf2, MIDI_SONG_POSITION, "Song Position" },
-        { 0xf3, MIDI_SONG_SELECT, "Song Select" },
-        { 0xf4, MIDI_NULL, "Reserved" },
-        { 0xf5, MIDI_NULL, "Reserved" },
-        { 0xf6, MIDI_TUNE_REQUEST, "Tune Request" },
-        { 0xf7, MIDI_END_SYSEX,"End SysEx" },
-        { 0xf8, MIDI_TIMING_CLOCK, "Timing Clock" },
-        { 0xf9, MIDI_NULL, "Reserved" },
-        { 0xfa, MIDI_START, "Start" },
-        { 0xfb, MIDI_CONTINUE, "Continue" },
-        { 0xfc, MIDI_STOP, "Stop" },
-        { 0xfd, MIDI_NULL, "Reserved" },
-        { 0xfe, MIDI_ACTIVE_SENSING, "Active Sensing" },
-        { 0xff, MIDI_RESET, "RESET" },
-        { 0x00, MIDI_NULL, "NULL" }
+#define MIDI_CHANNEL_STATUS( status, type, len, description ) \
+	[ status | 0x0 ] = { type, len, 1, 0, description }, [ status | 0x1 ] = { type, len, 1, 0, description }, \
+	[ status | 0x2 ] = { type, len, 1, 0, description }, [ status | 0x3 ] = { type, len, 1, 0, description }, \
+	[ status | 0x4 ] = { type, len, 1, 0, description }, [ status | 0x5 ] = { type, len, 1, 0, description }, \
+	[ status | 0x6 ] = { type, len, 1, 0, description }, [ status | 0x7 ] = { type, len, 1, 0, description }, \
+	[ status | 0x8 ] = { type, len, 1, 0, description }, [ status | 0x9 ] = { type, len, 1, 0, description }, \
+	[ status | 0xa ] = { type, len, 1, 0, description }, [ status | 0xb ] = { type, len, 1, 0, description }, \
+	[ status | 0xc ] = { type, len, 1, 0, description }, [ status | 0xd ] = { type, len, 1, 0, description }, \
+	[ status | 0xe ] = { type, len, 1, 0, description }, [ status | 0xf ] = { type, len, 1, 0, description }
+
+#define MIDI_SYSTEM_STATUS( status, type, len, description ) \
+	[ status ] = { type, len, 0, 0, description }
+
+/* Data bytes (0x00-0x7f) are left as MIDI_NULL with no description */
+const midi_status_t midi_status_table[256] = {
+	MIDI_CHANNEL_STATUS( 0x80, MIDI_NOTE_OFF, 2, "Note Off" ),
+	MIDI_CHANNEL_STATUS( 0x90, MIDI_NOTE_ON, 2, "Note On" ),
+	MIDI_CHANNEL_STATUS( 0xa0, MIDI_POLY_PRESSURE, 2, "Polyphonic Key Pressure (Aftertouch)" ),
+	MIDI_CHANNEL_STATUS( 0xb0, MIDI_CONTROL_CHANGE, 2, "Control Change" ),
+	MIDI_CHANNEL_STATUS( 0xc0, MIDI_PROGRAM_CHANGE, 1, "Program Change" ),
+	MIDI_CHANNEL_STATUS( 0xd0, MIDI_CHANNEL_PRESSURE, 1, "Channel Pressure (Aftertouch)" ),
+	MIDI_CHANNEL_STATUS( 0xe0, MIDI_PITCH_BEND, 2, "Pitch Bend Change" ),
+	MIDI_SYSTEM_STATUS( 0xf0, MIDI_SYSEX, MIDI_STATUS_SYSEX_LEN, "System Exclusive" ),
+	MIDI_SYSTEM_STATUS( 0xf1, MIDI_TIME_CODE_QF, 1, "Midi Time Code QF" ),
+	MIDI_SYSTEM_STATUS( 0xf2, MIDI_SONG_POSITION, 2, "Song Position" ),
+	MIDI_SYSTEM_STATUS( 0xf3, MIDI_SONG_SELECT, 1, "Song Select" ),
+	MIDI_SYSTEM_STATUS( 0xf4, MIDI_NULL, 0, "Reserved" ),
+	MIDI_SYSTEM_STATUS( 0xf5, MIDI_NULL, 0, "Reserved" ),
+	MIDI_SYSTEM_STATUS( 0xf6, MIDI_TUNE_REQUEST, 0, "Tune Request" ),
+	MIDI_SYSTEM_STATUS( 0xf7, MIDI_END_SYSEX, MIDI_STATUS_SYSEX_LEN, "End SysEx" ),
+	MIDI_SYSTEM_STATUS( 0xf8, MIDI_TIMING_CLOCK, 0, "Timing Clock" ),
+	MIDI_SYSTEM_STATUS( 0xf9, MIDI_NULL, 0, "Reserved" ),
+	MIDI_SYSTEM_STATUS( 0xfa, MIDI_START, 0, "Start" ),
+	MIDI_SYSTEM_STATUS( 0xfb, MIDI_CONTINUE, 0, "Continue" ),
+	MIDI_SYSTEM_STATUS( 0xfc, MIDI_STOP, 0, "Stop" ),
+	MIDI_SYSTEM_STATUS( 0xfd, MIDI_NULL, 0, "Reserved" ),
+	MIDI_SYSTEM_STATUS( 0xfe, MIDI_ACTIVE_SENSING, 0, "Active Sensing" ),
+	MIDI_SYSTEM_STATUS( 0xff, MIDI_RESET, 0, "RESET" )
 };
 
 midi_command_t *midi_command_create(void)
@@ -96,29 +109,10 @@ void midi_command_reset( midi_command_t *command )
 
 void midi_command_map( midi_command_t *command, char **description, enum midi_message_type_t *message_type)
 {
-	uint32_t i;
-	uint8_t status = 0;
+	const midi_status_t *status = MIDI_STATUS( command->status );
 
-	*description = "Unknown";
-	*message_type = MIDI_NULL;
-
-	for( i = 0; midi_message_map[i].message != 0x00; i++ )
-	{
-		if( command->status >= 0xf0 )
-		{
-			if( midi_message_map[i].message == command->status ) break;
-			continue;
-		}
-
-		status = ( (command->status & 0xf0) >> 4 );
-		if( status == midi_message_map[i].message ) break;
-	}
-
-	if( midi_message_map[i].message != 0x00 )
-	{
-		*description = midi_message_map[i].description;
-		*message_type = midi_message_map[i].type;
-	}
+	*description = ( status->description ? status->description : "Unknown" );
+	*message_type = status->type;
 }
 
 void midi_command_dump( midi_command_t *command )
@@ -136,3 +130,49 @@ void midi_command_dump( midi_command_t *command )
 	logging_printf(LOGGING_DEBUG, "\tsystem_message: message=0x%0x\n", command->system_message.message); 
 	logging_printf(LOGGING_DEBUG, "\tdelta=%zu, data_len=%u\n", command->delta, command->data_len);
 }
+
+/* Fill in a midi_command_t that refers to the view's data. Nothing is allocated so
+   the command must not be passed to midi_command_reset() */
+void midi_command_from_view( midi_command_view_t *view, midi_command_t *command )
+{
+	if( ! command ) return;
+
+	memset( command, 0, sizeof( midi_command_t ) );
+
+	if( ! view ) return;
+
+	command->delta = view->delta;
+	command->status = view->raw[0];
+	command->data_len = view->data_len;
+	if( view->data_len == 0 )
+	{
+		command->data = NULL;
+	} else if( view->data_len < MIDI_COMMAND_INLINE_SIZE ) {
+		command->data = view->raw + 1;
+	} else {
+		command->data = view->data;
+	}
+}
+
+/* Get the complete MIDI message for writing out without copying it.
+   A long message that follows its status byte in the buffer is returned in place.
+   A long message that relied on running status (a SysEx continuation) is returned without the status */
+void midi_command_view_raw( midi_command_view_t *view, unsigned char **raw, size_t *raw_len )
+{
+	*raw = NULL;
+	*raw_len = 0;
+
+	if( ! view ) return;
+
+	if( view->data_len < MIDI_COMMAND_INLINE_SIZE )
+	{
+		*raw = view->raw;
+		*raw_len = 1 + view->data_len;
+	} else if( view->has_status ) {
+		*raw = view->data - 1;
+		*raw_len = 1 + view->data_len;
+	} else {
+		*raw = view->data;
+		*raw_len = view->data_len;
+	}
+}
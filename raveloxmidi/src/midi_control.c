@@ -32,22 +32,54 @@
 
 #include "logging.h"
 
-midi_control_t * midi_control_create( void )
+/* Objects created without an arena come from this pool */
+static pool_t *midi_control_pool = NULL;
+
+void midi_control_pool_init( uint32_t capacity )
+{
+	if( midi_control_pool ) return;
+	midi_control_pool = pool_create( "midi_control", sizeof( midi_control_t ), capacity );
+}
+
+void midi_control_pool_teardown( void )
+{
+	pool_dump( midi_control_pool );
+	pool_destroy( &midi_control_pool );
+}
+
+midi_control_t * midi_control_create( arena_t *arena )
 {
 	midi_control_t *new_control;
 
-	new_control = (midi_control_t *) malloc( sizeof( midi_control_t ) );
+	if( arena )
+	{
+		new_control = (midi_control_t *) arena_alloc( arena, sizeof( midi_control_t ) );
+	} else {
+		new_control = (midi_control_t *) pool_alloc( midi_control_pool, sizeof( midi_control_t ) );
+	}
 
 	if( ! new_control )  return NULL;
 
 	memset( new_control, 0, sizeof( midi_control_t ) );
+	new_control->arena = arena;
 
 	return new_control;
 }
 
 void midi_control_destroy( midi_control_t **midi_control )
 {
-	FREENULL( "midi_control", (void **)midi_control );
+	if( ! midi_control ) return;
+	if( ! *midi_control ) return;
+
+	/* Objects from an arena are released by arena_reset() */
+	if( (*midi_control)->arena )
+	{
+		*midi_control = NULL;
+		return;
+	}
+
+	pool_free( midi_control_pool, *midi_control );
+	*midi_control = NULL;
 }
 
 int midi_control_unpack( midi_control_t **midi_control, unsigned char *buffer, size_t buffer_len )
@@ -59,13 +91,13 @@ int midi_control_unpack( midi_control_t **midi_control, unsigned char *buffer, s
 
 	if( ! buffer ) return -1;
 
-	if( buffer_len != sizeof( midi_control_t ) )
+	if( buffer_len != PACKED_MIDI_CONTROL_SIZE )
 	{
-		logging_printf( LOGGING_DEBUG, "midi_control_unpack: Expecting %d, got %zd\n", sizeof( midi_control_t ), buffer_len );
+		logging_printf( LOGGING_DEBUG, "midi_control_unpack: Expecting %d, got %zd\n", PACKED_MIDI_CONTROL_SIZE, buffer_len );
 		return -1;
 	}
 
-	*midi_control = midi_control_create();
+	*midi_control = midi_control_create( NULL );
 	
 	if( ! *midi_control ) return -1;
 
@@ -111,13 +143,13 @@ void midi_control_dump( midi_control_t *midi_control )
 		midi_control->command, midi_control->channel, midi_control->controller_number, midi_control->controller_value);
 }
 
-int midi_control_from_command( midi_command_t *command , midi_control_t **midi_control )
+int midi_control_from_command( midi_command_t *command , midi_control_t **midi_control, arena_t *arena )
 {
 	int ret = 0;
 
 	if( ! command ) return -1;
 
-	*midi_control = midi_control_create();
+	*midi_control = midi_control_create( arena );
 	
 	if( ! *midi_control ) return -1;
 
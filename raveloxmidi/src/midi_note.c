@@ -32,22 +32,54 @@
 
 #include "logging.h"
 
-midi_note_t * midi_note_create( void )
+/* Objects created without an arena come from this pool */
+static pool_t *midi_note_pool = NULL;
+
+void midi_note_pool_init( uint32_t capacity )
+{
+	if( midi_note_pool ) return;
+	midi_note_pool = pool_create( "midi_note", sizeof( midi_note_t ), capacity );
+}
+
+void midi_note_pool_teardown( void )
+{
+	pool_dump( midi_note_pool );
+	pool_destroy( &midi_note_pool );
+}
+
+midi_note_t * midi_note_create( arena_t *arena )
 {
 	midi_note_t *new_note;
 
-	new_note = (midi_note_t *) malloc( sizeof( midi_note_t ) );
+	if( arena )
+	{
+		new_note = (midi_note_t *) arena_alloc( arena, sizeof( midi_note_t ) );
+	} else {
+		new_note = (midi_note_t *) pool_alloc( midi_note_pool, sizeof( midi_note_t ) );
+	}
 
 	if( ! new_note )  return NULL;
 
 	memset( new_note, 0, sizeof( midi_note_t ) );
+	new_note->arena = arena;
 
 	return new_note;
 }
 
 void midi_note_destroy( midi_note_t **midi_note )
 {
-	FREENULL( "midi_note", (void **)midi_note );
+	if( ! midi_note ) return;
+	if( ! *midi_note ) return;
+
+	/* Objects from an arena are released by arena_reset() */
+	if( (*midi_note)->arena )
+	{
+		*midi_note = NULL;
+		return;
+	}
+
+	pool_free( midi_note_pool, *midi_note );
+	*midi_note = NULL;
 }
 
 int midi_note_unpack( midi_note_t **midi_note, unsigned char *buffer, size_t buffer_len )
@@ -59,13 +91,13 @@ int midi_note_unpack( midi_note_t **midi_note, unsigned char *buffer, size_t buf
 
 	if( ! buffer ) return -1;
 
-	if( buffer_len != sizeof( midi_note_t ) )
+	if( buffer_len != PACKED_MIDI_NOTE_SIZE )
 	{
-		logging_printf( LOGGING_DEBUG, "midi_note_unpack: Expecting %d, got %zd\n", sizeof( midi_note_t ), buffer_len );
+		logging_printf( LOGGING_DEBUG, "midi_note_unpack: Expecting %d, got %zd\n", PACKED_MIDI_NOTE_SIZE, buffer_len );
 		return -1;
 	}
 
-	*midi_note = midi_note_create();
+	*midi_note = midi_note_create( NULL );
 	
 	if( ! *midi_note ) return -1;
 
@@ -111,13 +143,13 @@ void midi_note_dump( midi_note_t *midi_note )
 		midi_note->command, midi_note->channel, midi_note->note, midi_note->velocity);
 }
 
-int midi_note_from_command( midi_command_t *command , midi_note_t **midi_note )
+int midi_note_from_command( midi_command_t *command , midi_note_t **midi_note, arena_t *arena )
 {
 	int ret = 0;
 
 	if( ! command ) return -1;
 
-	*midi_note = midi_note_create();
+	*midi_note = midi_note_create( arena );
 	
 	if( ! *midi_note ) return -1;
 
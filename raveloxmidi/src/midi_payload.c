@@ -26,25 +26,25 @@
 
 #include "config.h"
 
+#include "arena.h"
 #include "midi_command.h"
 #include "midi_payload.h"
 #include "utils.h"
 
 #include "logging.h"
 
-// Sec 3.2 of RFC6295
-// As we note above, the first channel command in the MIDI list MUST
-// include a status octet.  However, the corresponding command in the
-//original MIDI source data stream might not have a status octet (in
-// this case, the source would be coding the command using running
-// status)
-static unsigned char running_status = 0;
-
 void midi_payload_destroy( midi_payload_t **payload )
 {
 	if( ! payload ) return;
 	if( ! *payload ) return;
 
+	/* Payloads from an arena are released by arena_reset() */
+	if( (*payload)->arena )
+	{
+		*payload = NULL;
+		return;
+	}
+
 	if( (*payload)->buffer )
 	{
 		FREENULL( "midi_payload:payload->buffer",(void **)&((*payload)->buffer) );
@@ -62,7 +62,7 @@ void midi_payload_reset( midi_payload_t *payload )
 {
 	if( ! payload ) return;
 
-	if( payload->buffer ) free( payload->buffer );
+	if( payload->buffer ) arena_free( payload->arena, payload->buffer );
 	payload->buffer = NULL;
 
 	if( payload->header )
@@ -75,21 +75,22 @@ void midi_payload_reset( midi_payload_t *payload )
 	}
 }
 
-midi_payload_t * midi_payload_create( void )
+midi_payload_t * midi_payload_create( arena_t *arena )
 {
 	midi_payload_t *payload = NULL;
 
-	payload = ( midi_payload_t * )malloc( sizeof( midi_payload_t ) );
+	payload = ( midi_payload_t * )arena_alloc( arena, sizeof( midi_payload_t ) );
 
 	if( ! payload ) return NULL;
 
 	memset( payload, 0, sizeof(midi_payload_t ) );
+	payload->arena = arena;
 
-	payload->header = ( midi_payload_header_t *)malloc( sizeof( midi_payload_header_t ) );
+	payload->header = ( midi_payload_header_t *)arena_alloc( arena, sizeof( midi_payload_header_t ) );
 	if( ! payload->header )
 	{
 		logging_printf( LOGGING_ERROR, "midi_payload_create: Not enough memory\n");
-		free( payload );
+		arena_free( arena, payload );
 		return NULL;
 	}
 	midi_payload_reset( payload );
@@ -154,34 +155,26 @@ void midi_payload_unset_p( midi_payload_t *payload )
 }
 
 
+/* Sec 3.2 of RFC6295: the first channel command in the MIDI list MUST include a status octet.
+   Running status isn't carried from one packet to the next, so the caller must supply it */
 void midi_payload_set_buffer( midi_payload_t *payload, unsigned char *buffer , size_t *buffer_size)
 {
-	int status_present = 0;
 	if( ! payload ) return;
 
 	logging_printf( LOGGING_DEBUG, "midi_payload_set_buffer: payload=%p,buffer=%p,buffer_size=%u\n", payload, buffer, *buffer_size);
 
-	status_present = buffer[0] & 0x80;
-
-	/* If the first byte doesn't include a status then add one */
-	if( ! status_present )
+	if( ! ( buffer[0] & 0x80 ) )
 	{
-		*buffer_size += 1;
+		logging_printf( LOGGING_WARN, "midi_payload_set_buffer: First command has no status byte\n");
 	}
 
 	payload->header->len = *buffer_size;
-	payload->buffer = (unsigned char *)malloc( *buffer_size );
+	payload->buffer = (unsigned char *)arena_alloc( payload->arena, *buffer_size );
 	if( ! payload->buffer )
 	{
 		payload->header->len = 0;
 	} else {
-		if( status_present )
-		{
-			memcpy( payload->buffer, buffer, *buffer_size );
-		} else {
-			memcpy( payload->buffer + 1, buffer, *buffer_size - 1 );
-			payload->buffer[0] = running_status;
-		}
+		memcpy( payload->buffer, buffer, *buffer_size );
 	}
 }
 
@@ -211,10 +204,11 @@ void midi_payload_pack( midi_payload_t *payload, unsigned char **buffer, size_t
 	midi_payload_header_dump( payload->header );
 
 	*buffer_size = 1 + payload->header->len + (payload->header->len > 15 ? 1 : 0);
-	*buffer = (unsigned char *)malloc( *buffer_size );
+	*buffer = (unsigned char *)arena_alloc( payload->arena, *buffer_size );
 
 	if( ! *buffer )
 	{
+		*buffer_size = 0;
 		logging_printf(LOGGING_ERROR, "midi_payload_pack: Insufficient memory\n");
 		return;
 	}
@@ -245,39 +239,43 @@ void midi_payload_pack( midi_payload_t *payload, unsigned char **buffer, size_t
 	logging_printf(LOGGING_DEBUG, "midi_payload_pack: buffer=%p,len=%u\n", payload->buffer, payload->header->len );
 }
 
-void midi_payload_unpack( midi_payload_t **payload, unsigned char *buffer, size_t buffer_len )
+/* Parse the MIDI command section header in place. On success *commands points into buffer */
+int midi_payload_view( unsigned char *buffer, size_t buffer_len, midi_payload_header_t *header, unsigned char **commands, size_t *commands_len )
 {
 	unsigned char *p;
 	uint16_t temp_len;
 	size_t current_len;
 
-	if( !buffer ) return;
-	if( buffer_len == 0 ) return;
+	*commands = NULL;
+	*commands_len = 0;
 
-	*payload = midi_payload_create();
-	if( ! *payload ) return;
+	if( ! buffer ) return -1;
+	if( ! header ) return -1;
+	if( buffer_len == 0 ) return -1;
+
+	memset( header, 0, sizeof( midi_payload_header_t ) );
 
 	p = buffer;
 	current_len = buffer_len;
 
 	/* Get the flags */
-	if( *p & PAYLOAD_HEADER_B ) midi_payload_set_b( *payload );
-	if( *p & PAYLOAD_HEADER_J ) midi_payload_set_j( *payload );
-	if( *p & PAYLOAD_HEADER_Z ) midi_payload_set_z( *payload );
-	if( *p & PAYLOAD_HEADER_P ) midi_payload_set_p( *payload );
+	header->B = ( *p & PAYLOAD_HEADER_B ? 1 : 0 );
+	header->J = ( *p & PAYLOAD_HEADER_J ? 1 : 0 );
+	header->Z = ( *p & PAYLOAD_HEADER_Z ? 1 : 0 );
+	header->P = ( *p & PAYLOAD_HEADER_P ? 1 : 0 );
 
 	/* Check that there's enough buffer if the B flag indicates the length field is 12 bits */
-	if( (*payload)->header->B && ( current_len == 1 ) )
+	if( header->B && ( current_len == 1 ) )
 	{
-		logging_printf(LOGGING_ERROR, "midi_payload_unpack: B flag set but insufficent buffer data\n" );
-		goto midi_payload_unpack_error;
-	} 
+		logging_printf(LOGGING_ERROR, "midi_payload_view: B flag set but insufficent buffer data\n" );
+		return -1;
+	}
 
 	temp_len = ( *p & 0x0f );
 	current_len--;
 
 	/* If the B flag is set, get the next octet */
-	if( (*payload)->header->B )
+	if( header->B )
 	{
 		p++;
 		current_len--;
@@ -285,235 +283,263 @@ void midi_payload_unpack( midi_payload_t **payload, unsigned char *buffer, size_
 		temp_len += *p;
 	}
 
-	(*payload)->header->len = temp_len;
+	header->len = temp_len;
 	p++;
 
 	/* Check that there's enough buffer for the defined length */
-	if( current_len < temp_len ) 
+	if( current_len < temp_len )
 	{
-		logging_printf(LOGGING_ERROR, "midi_payload_unpack: Insufficent buffer data : current_len=%zu temp_len=%u\n", current_len, temp_len );
-		goto midi_payload_unpack_error;
+		logging_printf(LOGGING_ERROR, "midi_payload_view: Insufficent buffer data : current_len=%zu temp_len=%u\n", current_len, temp_len );
+		return -1;
 	}
 
-	(*payload)->buffer = (unsigned char *)malloc( temp_len );
-	if( ! (*payload)->buffer ) goto midi_payload_unpack_error;
+	*commands = p;
+	*commands_len = temp_len;
 
-	memcpy( (*payload)->buffer, p, temp_len );
-	midi_payload_header_dump( (*payload)->header );
+	return 0;
+}
 
-	goto midi_payload_unpack_success;
+void midi_payload_unpack( midi_payload_t **payload, unsigned char *buffer, size_t buffer_len, arena_t *arena )
+{
+	midi_payload_header_t header;
+	unsigned char *commands = NULL;
+	size_t commands_len = 0;
 
-midi_payload_unpack_error:
-	midi_payload_destroy( payload );
 	*payload = NULL;
 
-midi_payload_unpack_success:
-	return;
+	if( midi_payload_view( buffer, buffer_len, &header, &commands, &commands_len ) != 0 ) return;
+
+	*payload = midi_payload_create( arena );
+	if( ! *payload ) return;
+
+	memcpy( (*payload)->header, &header, sizeof( midi_payload_header_t ) );
+
+	(*payload)->buffer = (unsigned char *)arena_alloc( arena, commands_len );
+	if( ! (*payload)->buffer )
+	{
+		midi_payload_destroy( payload );
+		*payload = NULL;
+		return;
+	}
+
+	memcpy( (*payload)->buffer, commands, commands_len );
+	midi_payload_header_dump( (*payload)->header );
 }
 
-void midi_payload_to_commands( midi_payload_t *payload, midi_payload_data_t data_type, midi_command_t **commands, size_t *num_commands )
+/* Parse a MIDI command section into views that point into the buffer. Nothing is allocated or copied
+   other than the inline bytes of short messages. Returns the number of commands parsed.
+   Running status starts from *stream_status and is left there for the next call on the same stream.
+   With stream_status NULL, as for RTP MIDI, it starts empty */
+size_t midi_command_list_parse( midi_command_list_t *list, unsigned char *buffer, size_t buffer_len, midi_payload_data_t data_type, int z_flag, unsigned char *stream_status )
 {
+	unsigned char running_status = ( stream_status ? *stream_status : 0 );
 	unsigned char *p;
 	size_t current_len;
-	uint64_t current_delta;
+	uint32_t current_delta;
 	unsigned char data_byte;
-	char *command_description;
+	const midi_status_t *status = NULL;
 	enum midi_message_type_t message_type;
-	size_t index, sysex_len;
-	unsigned char *sysex_start_byte = NULL;
-	
+	size_t data_len;
+	int status_present = 0;
+	midi_command_t command;
+	midi_command_view_t *view = NULL;
 
-	*commands = NULL;
-	*num_commands = 0;
+	if( ! list ) return 0;
 
-	if( ! payload ) return;
+	list->num_commands = 0;
+	list->dropped = 0;
 
-	if( ! payload->header ) return;
-	if( ! payload->buffer ) return;
+	if( ! buffer ) return 0;
 
-	p = payload->buffer;
-	current_len = payload->header->len;
+	p = buffer;
+	current_len = buffer_len;
 
-	logging_printf( LOGGING_DEBUG, "midi_payload_to_commands: payload->header->len=%zu\n", payload->header->len);
+	logging_printf( LOGGING_DEBUG, "midi_command_list_parse: buffer_len=%zu\n", buffer_len );
 	hex_dump( p, current_len );
-	
-	do 
+
+	while( current_len > 0 )
 	{
-		logging_printf( LOGGING_DEBUG, "midi_payload_to_commands: current_len=%zu\n", current_len );
 		current_delta = 0;
 		if( data_type == MIDI_PAYLOAD_RTP )
 		{
 			/* If the Z flag == 0 then no delta time is present for the first midi command */
-			if( ( payload->header->Z == 0 ) && ( *num_commands == 0 ) )
-			{ 
+			if( ( z_flag == 0 ) && ( list->num_commands == 0 ) )
+			{
 				/*Do nothing*/
 			} else {
 				// Get the delta
 				do
 				{
 					data_byte = *p;
-					current_delta <<= 8;
+					current_delta <<= 7;
 					current_delta += ( data_byte & 0x7f );
 					p++;
 					current_len--;
 				} while ( ( data_byte & 0x80 ) && current_len > 0 );
-			}	
+
+				if( current_len == 0 ) break;
+			}
 		}
 
-		(*num_commands)++;
+		if( list->num_commands == MIDI_COMMAND_LIST_SIZE )
+		{
+			list->dropped++;
+			view = NULL;
+		} else {
+			view = &( list->commands[ list->num_commands ] );
+		}
+
+		// Get the status byte. If bit 7 is not set, use the running status
+		status_present = ( *p & 0x80 );
+		if( status_present )
+		{
+			running_status = *p;
+			p++;
+			current_len--;
+		}
+
+		status = MIDI_STATUS( running_status );
+		message_type = status->type;
+		data_len = status->data_len;
 
-		hex_dump( p, current_len );
-		midi_command_t *temp_commands = (midi_command_t * ) realloc( *commands, sizeof(midi_command_t) * (*num_commands) );
+		if( data_len == MIDI_STATUS_SYSEX_LEN )
+		{
+			// Read until the end of the SYSEX block
+			// RFC6295 sec 3.2 indicates that the following may occur
+			// 0xF0-0xF0 == first block of multiple SysEx segments
+			// 0xF7-0xF0 == middle block
+			// 0xF7-0xF7 == end block
+			// 0xF7-0xF4 == cancel ( FIXME: Need to code for this )
+			data_len = 0;
+			data_byte = 0;
+			while( ( data_len < current_len ) && ( data_byte != 0xF7 ) && ( data_byte != 0xF0 ) && ( data_byte != 0xF4 ) )
+			{
+				data_byte = p[ data_len ];
+				data_len++;
+			}
+			logging_printf( LOGGING_DEBUG, "SysEx end: 0x%02X\n", data_byte);
+			if( ( message_type == MIDI_SYSEX ) && ( data_byte == 0xF0 ) )
+			{
+				logging_printf(LOGGING_DEBUG, "MIDI SYSEX first block\n");
+			}
+			if( ( message_type == MIDI_END_SYSEX ) && ( data_byte == 0xF0 ) )
+			{
+				logging_printf(LOGGING_DEBUG, "MIDI SYSEX middle block\n");
+			}
+			if( ( message_type == MIDI_END_SYSEX ) && ( data_byte == 0xF7 ) )
+			{
+				logging_printf(LOGGING_DEBUG, "MIDI SYSEX last block\n");
+			}
+			if( ( message_type == MIDI_END_SYSEX ) && ( data_byte == 0xF4 ) ) // FIXME: Need to code for this
+			{
+				logging_printf(LOGGING_DEBUG, "MIDI SYSEX cancel block\n");
+			}
+		}
 
-		if( ! temp_commands ) break;
-		*commands = temp_commands;
-		index = (*num_commands) - 1;
+		/* A data byte that the running status gives no meaning to is skipped */
+		if( ! status_present && data_len == 0 )
+		{
+			logging_printf( LOGGING_DEBUG, "midi_command_list_parse: Skipping data byte 0x%02x (running status=0x%02x)\n", *p, running_status );
+			p++;
+			current_len--;
+			continue;
+		}
 
-		(*commands)[index].delta = current_delta;
-		(*commands)[index].data_len = 0;
-		(*commands)[index].data = NULL;
+		if( data_len > current_len )
+		{
+			logging_printf( LOGGING_DEBUG, "midi_command_list_parse: Truncated command (status=0x%02x,need=%zu,have=%zu)\n", running_status, data_len, current_len );
+			break;
+		}
 
-		// Get the status byte. If bit 7 is not set, use the running status
-		if( current_len > 0 )
+		if( view )
 		{
-			data_byte = *p;
+			view->delta = current_delta;
+			view->has_status = ( status_present ? 1 : 0 );
+			view->data = p;
+			view->data_len = data_len;
+			view->raw[0] = running_status;
+			if( data_len < MIDI_COMMAND_INLINE_SIZE )
+			{
+				memcpy( view->raw + 1, p, data_len );
+			}
+			list->num_commands++;
 
-			if( data_byte & 0x80 )
+			if( logging_threshold == LOGGING_DEBUG )
 			{
-				running_status = data_byte;
-				p++;
-				current_len--;
+				midi_command_from_view( view, &command );
+				midi_command_dump( &command );
 			}
-			(*commands)[index].status = running_status;
 		}
 
-		midi_command_map( &((*commands)[index]) , &command_description, &message_type );
-		midi_command_dump( &((*commands)[index]));
-
-		switch( message_type )
+		if( status->is_channel )
 		{
-			case MIDI_NOTE_OFF:
-			case MIDI_NOTE_ON:
-			case MIDI_POLY_PRESSURE:
-			case MIDI_CONTROL_CHANGE:
-			case MIDI_PITCH_BEND:
-			case MIDI_SONG_POSITION:
-				if( current_len >= 2 )
-				{
-					(*commands)[index].data = ( unsigned char * ) malloc( 2 );
-					if( (*commands)[index].data )
-					{
-						memcpy( (*commands)[index].data, p, 2 );
-						(*commands)[index].data_len = 2;
-					}
-					current_len -= 2;
-					p+=2;
-				}
-				break;
-			case MIDI_PROGRAM_CHANGE:
-			case MIDI_CHANNEL_PRESSURE:
-			case MIDI_TIME_CODE_QF:
-			case MIDI_SONG_SELECT:
-				if( current_len >= 1 )
-				{
-					(*commands)[index].data = ( unsigned char * ) malloc( 2 );
-					memset( (*commands)[index].data, 0, 2 );
-					if( (*commands)[index].data )
-					{
-						memcpy( (*commands)[index].data, p, 1);
-						(*commands)[index].data_len = 1;
-					}
-					current_len -= 1;
-					p+=1;
-				}
-				break;
-			case MIDI_SYSEX:
-			case MIDI_END_SYSEX:
-				// Read until the end of the SYSEX block
-				// RFC6295 sec 3.2 indicates that the following may occur
-				// 0xF0-0xF0 == first block of multiple SysEx segments
-				// 0xF7-0xF0 == middle block
-				// 0xF7-0xF7 == end block
-				// 0xF7-0xF4 == cancel ( FIXME: Need to code for this )
-				sysex_start_byte = p;
-				sysex_len = 0;
-				do {
-					data_byte = *p;
-					sysex_len++;
-					p++;
-					current_len--;
-				} while( ( current_len > 0 ) && ( (data_byte != 0xF7 )  && (data_byte != 0xF0) && (data_byte != 0xF4) ) );
-				logging_printf( LOGGING_DEBUG, "SysEx end: 0x%02X\n", data_byte);
-				if( ( message_type == MIDI_SYSEX ) && ( data_byte == 0xF0 ) )
-				{
-					logging_printf(LOGGING_DEBUG, "MIDI SYSEX first block\n");
-				}
-				if( ( message_type == MIDI_END_SYSEX ) && ( data_byte == 0xF0 ) )
-				{
-					logging_printf(LOGGING_DEBUG, "MIDI SYSEX middle block\n");
-				}
-				if( ( message_type == MIDI_END_SYSEX ) && ( data_byte == 0xF7 ) )
-				{
-					logging_printf(LOGGING_DEBUG, "MIDI SYSEX last block\n");
-				}
-				if( ( message_type == MIDI_END_SYSEX ) && ( data_byte == 0xF4 ) ) // FIXME: Need to code for this
-				{
-					logging_printf(LOGGING_DEBUG, "MIDI SYSEX cancel block\n");
-				}
-				if( sysex_len > 0 )
-				{
-					(*commands)[index].data = (unsigned char *) malloc( sysex_len );
-					if( (*commands)[index].data ) 
-					{
-						memcpy( (*commands)[index].data, sysex_start_byte, sysex_len );
-						(*commands)[index].data_len = sysex_len;
-					}
-				}
-				break;
-			case MIDI_TUNE_REQUEST:
-			case MIDI_TIMING_CLOCK:
-			case MIDI_START:
-			case MIDI_CONTINUE:
-			case MIDI_STOP:
-			case MIDI_ACTIVE_SENSING:
-			case MIDI_RESET:
-			case MIDI_NULL:
-				break;
+			logging_printf( LOGGING_INFO, "\tChannel: %u\n", running_status & 0x0f );
 		}
-		
-		switch( message_type )
+
+		p += data_len;
+		current_len -= data_len;
+	}
+
+	if( stream_status ) *stream_status = running_status;
+
+	if( list->dropped > 0 )
+	{
+		logging_printf( LOGGING_WARN, "midi_command_list_parse: %zu commands dropped, more than %u in one packet\n", list->dropped, MIDI_COMMAND_LIST_SIZE );
+	}
+
+	return list->num_commands;
+}
+
+void midi_payload_to_commands( midi_payload_t *payload, midi_payload_data_t data_type, midi_command_t **commands, size_t *num_commands )
+{
+	midi_command_list_t list;
+	size_t index = 0;
+	arena_t *arena = NULL;
+
+	*commands = NULL;
+	*num_commands = 0;
+
+	if( ! payload ) return;
+
+	if( ! payload->header ) return;
+	if( ! payload->buffer ) return;
+
+	arena = payload->arena;
+
+	logging_printf( LOGGING_DEBUG, "midi_payload_to_commands: payload->header->len=%zu\n", payload->header->len);
+
+	midi_command_list_parse( &list, payload->buffer, payload->header->len, data_type, payload->header->Z, NULL );
+	if( list.num_commands == 0 ) return;
+
+	/* Copy the views out so that the commands don't depend on the payload buffer */
+	*commands = (midi_command_t *)arena_alloc( arena, sizeof( midi_command_t ) * list.num_commands );
+	if( ! *commands ) return;
+
+	for( index = 0; index < list.num_commands; index++ )
+	{
+		midi_command_from_view( &( list.commands[index] ), &( (*commands)[index] ) );
+
+		if( (*commands)[index].data_len > 0 )
 		{
-			case MIDI_NOTE_OFF:
-			case MIDI_NOTE_ON:
-			case MIDI_POLY_PRESSURE:
-			case MIDI_CONTROL_CHANGE:
-			case MIDI_PITCH_BEND:
-			case MIDI_PROGRAM_CHANGE:
-			case MIDI_CHANNEL_PRESSURE:
-				logging_printf( LOGGING_INFO, "\tChannel: %u\n", (*commands)[index].status & 0x0f );
-				break;
-			case MIDI_SYSEX:
-			case MIDI_TIME_CODE_QF:
-			case MIDI_SONG_POSITION:
-			case MIDI_SONG_SELECT:
-			case MIDI_TUNE_REQUEST:
-			case MIDI_END_SYSEX:
-			case MIDI_TIMING_CLOCK:
-			case MIDI_START:
-			case MIDI_CONTINUE:
-			case MIDI_STOP:
-			case MIDI_ACTIVE_SENSING:
-			case MIDI_RESET:
-			case MIDI_NULL:
-				break;
+			unsigned char *data = (unsigned char *)arena_alloc( arena, (*commands)[index].data_len );
+
+			if( data )
+			{
+				memcpy( data, (*commands)[index].data, (*commands)[index].data_len );
+			} else {
+				(*commands)[index].data_len = 0;
+			}
+			(*commands)[index].data = data;
 		}
+	}
 
-	} while( current_len > 0 );
+	*num_commands = list.num_commands;
 }
 
-void midi_command_to_payload( midi_command_t *command, midi_payload_t **payload )
+void midi_command_to_payload( midi_command_t *command, midi_payload_t **payload, arena_t *arena )
 {
 	size_t new_payload_size = 0;
+	size_t data_len = 0;
 	unsigned char *new_payload_buffer = NULL;
 
 	if( ! command ) {
@@ -521,27 +547,35 @@ void midi_command_to_payload( midi_command_t *command, midi_payload_t **payload
 		return;
 	}
 
-	*payload = midi_payload_create();
+	*payload = midi_payload_create( arena );
 	if( ! *payload )
 	{
 		logging_printf(LOGGING_ERROR, "midi_command_to_payload: Unable to allocate memory for new payload\n");
 		return;
 	}
 
-	new_payload_size = command->data_len + 1;
-	new_payload_buffer = (unsigned char *)malloc( new_payload_size );
+	/* Fixed length messages are sent with the number of data bytes the status byte calls for */
+	data_len = MIDI_STATUS( command->status )->data_len;
+	if( ( data_len == MIDI_STATUS_SYSEX_LEN ) || ( data_len > command->data_len ) )
+	{
+		data_len = command->data_len;
+	}
+
+	new_payload_size = data_len + 1;
+	new_payload_buffer = (unsigned char *)arena_alloc( arena, new_payload_size );
 
 	if( ! new_payload_buffer )
 	{
 		logging_printf(LOGGING_ERROR,"midi_command_to_payload: Unable to allocate memory for new payload buffer\n");
 		midi_payload_destroy( &(*payload) );
 		*payload = NULL;
+		return;
 	}
 
 	new_payload_buffer[0] = command->status;
-	memcpy( new_payload_buffer + 1 , command->data, command->data_len );
+	memcpy( new_payload_buffer + 1 , command->data, data_len );
 
 	midi_payload_set_buffer( *payload, new_payload_buffer, &new_payload_size );
 
-	free( new_payload_buffer );
+	arena_free( arena, new_payload_buffer );
 }
@@ -32,11 +32,31 @@
 
 #include "logging.h"
 
-midi_program_t * midi_program_create( void )
+/* Objects created without an arena come from this pool */
+static pool_t *midi_program_pool = NULL;
+
+void midi_program_pool_init( uint32_t capacity )
+{
+	if( midi_program_pool ) return;
+	midi_program_pool = pool_create( "midi_program", sizeof( midi_program_t ), capacity );
+}
+
+void midi_program_pool_teardown( void )
+{
+	pool_dump( midi_program_pool );
+	pool_destroy( &midi_program_pool );
+}
+
+midi_program_t * midi_program_create( arena_t *arena )
 {
 	midi_program_t *new_program = NULL;
 
-	new_program = (midi_program_t *) malloc( sizeof( midi_program_t ) );
+	if( arena )
+	{
+		new_program = (midi_program_t *) arena_alloc( arena, sizeof( midi_program_t ) );
+	} else {
+		new_program = (midi_program_t *) pool_alloc( midi_program_pool, sizeof( midi_program_t ) );
+	}
 
 	if( ! new_program )
 	{
@@ -45,12 +65,24 @@ midi_program_t * midi_program_create( void )
 	}
 
 	memset( new_program, 0, sizeof( midi_program_t ) );
+	new_program->arena = arena;
 	return new_program;
 }
 
 void midi_program_destroy( midi_program_t **midi_program )
 {
-	FREENULL( "midi_program", (void **)midi_program );
+	if( ! midi_program ) return;
+	if( ! *midi_program ) return;
+
+	/* Objects from an arena are released by arena_reset() */
+	if( (*midi_program)->arena )
+	{
+		*midi_program = NULL;
+		return;
+	}
+
+	pool_free( midi_program_pool, *midi_program );
+	*midi_program = NULL;
 }
 
 int midi_program_unpack( midi_program_t **midi_program, unsigned char *buffer, size_t buffer_len )
@@ -68,7 +100,7 @@ int midi_program_unpack( midi_program_t **midi_program, unsigned char *buffer, s
 		return -1;
 	}
 
-	*midi_program = midi_program_create();
+	*midi_program = midi_program_create( NULL );
 	
 	if( ! *midi_program ) return -1;
 
@@ -116,7 +148,7 @@ void midi_program_dump( midi_program_t *midi_program )
 		midi_program->command, midi_program->channel, midi_program->S, midi_program->program, midi_program->B, midi_program->bank_msb, midi_program->X, midi_program->bank_lsb );
 }
 
-int midi_program_from_command( midi_command_t *command , midi_program_t **midi_program )
+int midi_program_from_command( midi_command_t *command , midi_program_t **midi_program, arena_t *arena )
 {
 	int ret = 0;
 
@@ -124,7 +156,7 @@ int midi_program_from_command( midi_command_t *command , midi_program_t **midi_p
 
 	if( ! command ) return -1;
 
-	*midi_program = midi_program_create();
+	*midi_program = midi_program_create( arena );
 	
 	if( ! *midi_program ) return -1;
 
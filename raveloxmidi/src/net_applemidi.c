@@ -32,12 +32,9 @@
 #include "utils.h"
 #include "logging.h"
 
-void net_applemidi_command_dump( net_applemidi_command *command)
+static void net_applemidi_data_dump( uint16_t command, void *data, const char *name, int name_len )
 {
-
-	if( ! command ) return;
-
-	switch( command->command )
+	switch( command )
 	{
 		case NET_APPLEMIDI_CMD_INV:
 			logging_printf(LOGGING_INFO,"Command: IN\n");
@@ -62,40 +59,88 @@ void net_applemidi_command_dump( net_applemidi_command *command)
 			break;
 	}
 
-	if( command->command == NET_APPLEMIDI_CMD_INV )
+	if( ! data ) return;
+
+	if( command == NET_APPLEMIDI_CMD_INV )
 	{
 		net_applemidi_inv	*inv_data;
-		inv_data = (net_applemidi_inv *)command->data;
-		logging_printf(LOGGING_DEBUG,"inv_data:version=%u,initiator=0x%08x,ssrc=0x%08x,name=\"%s\"\n",
-			inv_data->version, inv_data->initiator,inv_data->ssrc,inv_data->name);
+		inv_data = (net_applemidi_inv *)data;
+		logging_printf(LOGGING_DEBUG,"inv_data:version=%u,initiator=0x%08x,ssrc=0x%08x,name=\"%.*s\"\n",
+			inv_data->version, inv_data->initiator,inv_data->ssrc,name_len,( name ? name : "" ));
 	}
 
-	if( command->command == NET_APPLEMIDI_CMD_END )
+	if( command == NET_APPLEMIDI_CMD_END )
 	{
 		net_applemidi_inv	*end_data;
-		end_data = (net_applemidi_inv *)command->data;
-		logging_printf(LOGGING_DEBUG,"end_data(version=%u,initiator=0x%08x,ssrc=0x%08x,name=\"%s\"\n",
-			end_data->version, end_data->initiator,end_data->ssrc,end_data->name);
+		end_data = (net_applemidi_inv *)data;
+		logging_printf(LOGGING_DEBUG,"end_data(version=%u,initiator=0x%08x,ssrc=0x%08x,name=\"%.*s\"\n",
+			end_data->version, end_data->initiator,end_data->ssrc,name_len,( name ? name : "" ));
 	}
 
-	if( command->command == NET_APPLEMIDI_CMD_SYNC )
+	if( command == NET_APPLEMIDI_CMD_SYNC )
 	{
 		net_applemidi_sync	*sync_data;
-		sync_data = (net_applemidi_sync *)command->data;
+		sync_data = (net_applemidi_sync *)data;
 		logging_printf(LOGGING_DEBUG,"sync_data(ssrc=0x%08x,count=%d,padding=0x%02x%02x%02x,timestamp1=0x%016llx,timestamp2=0x%016llx,timestamp3=0x%016llx)\n",
 			sync_data->ssrc, sync_data->count, sync_data->padding[0], sync_data->padding[1], sync_data->padding[2],
 			sync_data->timestamp1, sync_data->timestamp2, sync_data->timestamp3);
 	}
 
-	if( command->command == NET_APPLEMIDI_CMD_FEEDBACK )
+	if( command == NET_APPLEMIDI_CMD_FEEDBACK )
 	{
 		net_applemidi_feedback	*feedback_data;
-		feedback_data = (net_applemidi_feedback *)command->data;
+		feedback_data = (net_applemidi_feedback *)data;
 		logging_printf(LOGGING_DEBUG,"feedback_data(ssrc=0x%08x,apple_seq=%u,rtp_seq=%u)\n",
 			feedback_data->ssrc, feedback_data->apple_seq, feedback_data->rtp_seq[1]);
 	}
 }
 
+void net_applemidi_command_dump( net_applemidi_command *command)
+{
+	char *name = NULL;
+
+	if( ! command ) return;
+
+	switch( command->command )
+	{
+		case NET_APPLEMIDI_CMD_INV:
+		case NET_APPLEMIDI_CMD_END:
+			if( command->data ) name = ((net_applemidi_inv *)command->data)->name;
+			break;
+	}
+
+	net_applemidi_data_dump( command->command, command->data, name, ( name ? (int)strlen( name ) : 0 ) );
+}
+
+static uint32_t net_applemidi_data_ssrc( uint16_t command, void *data )
+{
+	if( ! data ) return 0;
+
+	switch( command )
+	{
+		case NET_APPLEMIDI_CMD_INV:
+		case NET_APPLEMIDI_CMD_ACCEPT:
+		case NET_APPLEMIDI_CMD_REJECT:
+		case NET_APPLEMIDI_CMD_END:
+			return ((net_applemidi_inv *)data)->ssrc;
+		case NET_APPLEMIDI_CMD_SYNC:
+			return ((net_applemidi_sync *)data)->ssrc;
+		case NET_APPLEMIDI_CMD_FEEDBACK:
+			return ((net_applemidi_feedback *)data)->ssrc;
+		case NET_APPLEMIDI_CMD_BITRATE:
+			return ((net_applemidi_bitrate *)data)->ssrc;
+	}
+
+	return 0;
+}
+
+uint32_t net_applemidi_command_ssrc( net_applemidi_command *command )
+{
+	if( ! command ) return 0;
+
+	return net_applemidi_data_ssrc( command->command, command->data );
+}
+
 net_applemidi_inv * net_applemidi_inv_create( void )
 {
 	net_applemidi_inv *inv = NULL;
@@ -185,299 +230,351 @@ int net_applemidi_cmd_destroy( net_applemidi_command **command )
 		return NET_APPLEMIDI_DONE;
 	}
 
+	/* Unknown commands carry no data */
+	free( *command );
+	*command = NULL;
+
 	return NET_APPLEMIDI_DONE;
 }
 
-int net_applemidi_unpack( net_applemidi_command **command_buffer, unsigned char *in_buffer, size_t in_buffer_len)
+/* Decode a command without allocating. Nothing in the view needs to be freed but
+   the name refers to in_buffer, so the view is only valid while in_buffer is */
+int net_applemidi_view( unsigned char *in_buffer, size_t in_buffer_len, net_applemidi_view_t *view )
 {
-
 	unsigned char *p;
 
-	if( ! in_buffer )
-	{
-		*command_buffer = NULL;
-		return NET_APPLEMIDI_NEED_DATA;
-	}
-		
-	if( in_buffer_len < NET_APPLEMIDI_COMMAND_SIZE )
-	{
-		*command_buffer = NULL;
-		return NET_APPLEMIDI_NEED_DATA;
-	}
+	if( ! view ) return NET_APPLEMIDI_NEED_DATA;
+
+	memset( view, 0, sizeof( net_applemidi_view_t ) );
+
+	if( ! in_buffer ) return NET_APPLEMIDI_NEED_DATA;
+	if( in_buffer_len < NET_APPLEMIDI_COMMAND_SIZE ) return NET_APPLEMIDI_NEED_DATA;
 
 	p = in_buffer;
 
-	*command_buffer = (net_applemidi_command *)malloc( sizeof( net_applemidi_command ) );
+	get_uint16( &( view->signature ), &p, &in_buffer_len );
+	get_uint16( &( view->command ), &p, &in_buffer_len );
 
-	if( ! *command_buffer )
-	{
-		return NET_APPLEMIDI_NO_MEMORY;
-	}
-	
-	/* Copy the known header data */
-	get_uint16( &( (*command_buffer)->signature ), &p, &in_buffer_len );
-	get_uint16( &( (*command_buffer)->command ), &p, &in_buffer_len );
-
-	if( 	(*command_buffer)->command == NET_APPLEMIDI_CMD_INV ||
-		(*command_buffer)->command == NET_APPLEMIDI_CMD_ACCEPT ||
-		(*command_buffer)->command == NET_APPLEMIDI_CMD_REJECT ||
-		(*command_buffer)->command == NET_APPLEMIDI_CMD_END )
+	switch( view->command )
 	{
-		if( in_buffer_len < ( NET_APPLEMIDI_INV_STATIC_SIZE - sizeof( char * ) ) )
-		{
-			free( *command_buffer );
-			*command_buffer = NULL;
-			return NET_APPLEMIDI_NEED_DATA;
-		}
+		case NET_APPLEMIDI_CMD_INV:
+		case NET_APPLEMIDI_CMD_ACCEPT:
+		case NET_APPLEMIDI_CMD_REJECT:
+		case NET_APPLEMIDI_CMD_END:
+			// NET_APPLEMIDI_INV_STATIC_SIZE includes the command header
+			if( in_buffer_len < ( NET_APPLEMIDI_INV_STATIC_SIZE - NET_APPLEMIDI_COMMAND_SIZE ) ) return NET_APPLEMIDI_NEED_DATA;
 
-		net_applemidi_inv *inv = net_applemidi_inv_create();
-		if( ! inv )
-		{
-			free( *command_buffer );
-			*command_buffer = NULL;
-			return NET_APPLEMIDI_NO_MEMORY;
-		}
-		(*command_buffer)->data = (net_applemidi_inv *)inv;
+			get_uint32( &(view->inv.version), &p, &in_buffer_len );
+			get_uint32( &(view->inv.initiator), &p, &in_buffer_len );
+			get_uint32( &(view->inv.ssrc), &p, &in_buffer_len );
 
-		get_uint32( &(inv->version), &p, &in_buffer_len );
-		get_uint32( &(inv->initiator), &p, &in_buffer_len );
-		get_uint32( &(inv->ssrc), &p, &in_buffer_len );
+			if( in_buffer_len > 0 )
+			{
+				view->name = (const char *)p;
+				view->name_len = strnlen( (const char *)p, in_buffer_len );
+			}
+			break;
 
-		if( in_buffer_len > 0 )
-		{
-			inv->name = strndup( (const char *)p, in_buffer_len );
-		} else {
-			inv->name = NULL;
-		}
-		return NET_APPLEMIDI_DONE;
-	}
+		case NET_APPLEMIDI_CMD_FEEDBACK:
+			if( in_buffer_len < NET_APPLEMIDI_FEEDBACK_SIZE ) return NET_APPLEMIDI_NEED_DATA;
 
-	if( (*command_buffer)->command == NET_APPLEMIDI_CMD_FEEDBACK )
-	{
-		if( in_buffer_len < sizeof( net_applemidi_feedback ) )
-		{
-			free( *command_buffer );
-			*command_buffer = NULL;
-			return NET_APPLEMIDI_NEED_DATA;
-		}
+			get_uint32( &(view->feedback.ssrc), &p, &in_buffer_len );
+			get_uint32( &(view->feedback.apple_seq), &p, &in_buffer_len );
+			break;
 
-		net_applemidi_feedback *feedback;
-		feedback = (net_applemidi_feedback *)malloc( sizeof( net_applemidi_feedback ) );
+		case NET_APPLEMIDI_CMD_BITRATE:
+			if( in_buffer_len < NET_APPLEMIDI_BITRATE_SIZE ) return NET_APPLEMIDI_NEED_DATA;
 
-		if( ! feedback )
-		{
-			free(*command_buffer );
-			*command_buffer = NULL;
-			return NET_APPLEMIDI_NO_MEMORY;
-		}
-		(*command_buffer)->data = (net_applemidi_feedback *)feedback;
+			get_uint32( &(view->bitrate.ssrc), &p, &in_buffer_len );
+			get_uint32( &(view->bitrate.limit), &p, &in_buffer_len );
+			break;
 
-		get_uint32( &(feedback->ssrc), &p, &in_buffer_len );
-		get_uint32( &(feedback->apple_seq), &p, &in_buffer_len );
-		
-		return NET_APPLEMIDI_DONE;
-	}
+		case NET_APPLEMIDI_CMD_SYNC:
+			// NET_APPLEMIDI_SYNC_SIZE includes the command header
+			if( in_buffer_len < ( NET_APPLEMIDI_SYNC_SIZE - NET_APPLEMIDI_COMMAND_SIZE ) ) return NET_APPLEMIDI_NEED_DATA;
 
-	if( (*command_buffer)->command == NET_APPLEMIDI_CMD_BITRATE )
-	{
-		if( in_buffer_len < sizeof( net_applemidi_bitrate ) )
-		{
-			free( *command_buffer );
-			*command_buffer = NULL;
-			return NET_APPLEMIDI_NEED_DATA;
-		}
+			get_uint32( &(view->sync.ssrc), &p, &in_buffer_len );
 
-		net_applemidi_bitrate *bitrate;
-		bitrate = (net_applemidi_bitrate *)malloc( sizeof( net_applemidi_bitrate ) );
+			memcpy( &(view->sync.count), p, 1 );
+			p += 1;
+			in_buffer_len--;
 
-		if( ! bitrate )
-		{
-			free(*command_buffer );
-			*command_buffer = NULL;
-			return NET_APPLEMIDI_NO_MEMORY;
-		}
-		(*command_buffer)->data = (net_applemidi_bitrate *)bitrate;
+			memcpy( &(view->sync.padding), p, sizeof(view->sync.padding) );
+			p += sizeof( view->sync.padding );
+			in_buffer_len -= sizeof( view->sync.padding );
 
-		get_uint32( &(bitrate->ssrc), &p, &in_buffer_len );
-		get_uint32( &(bitrate->limit), &p, &in_buffer_len );
-		
-		return NET_APPLEMIDI_DONE;
+			get_uint64( &(view->sync.timestamp1), &p, &in_buffer_len );
+			get_uint64( &(view->sync.timestamp2), &p, &in_buffer_len );
+			get_uint64( &(view->sync.timestamp3), &p, &in_buffer_len );
+			break;
 	}
 
-	if( (*command_buffer)->command == NET_APPLEMIDI_CMD_SYNC )
-	{
-		if( in_buffer_len <  sizeof( net_applemidi_sync ) )
-		{
-			free( *command_buffer );
-			*command_buffer = NULL;
-			return NET_APPLEMIDI_NEED_DATA;
-		}
+	return NET_APPLEMIDI_DONE;
+}
 
-		net_applemidi_sync *sync;
-		sync = (net_applemidi_sync *)malloc( sizeof (net_applemidi_sync) );
-		if( ! sync )
-		{
-			free( *command_buffer );
-			*command_buffer = NULL;
-			return NET_APPLEMIDI_NO_MEMORY;
-		}
-		(*command_buffer)->data = (net_applemidi_sync *)sync;
+/* The union member for the command, in the form the cmd_*_handler functions take. NULL for unknown commands */
+void *net_applemidi_view_data( net_applemidi_view_t *view )
+{
+	if( ! view ) return NULL;
 
-		get_uint32( &(sync->ssrc), &p, &in_buffer_len );
+	switch( view->command )
+	{
+		case NET_APPLEMIDI_CMD_INV:
+		case NET_APPLEMIDI_CMD_ACCEPT:
+		case NET_APPLEMIDI_CMD_REJECT:
+		case NET_APPLEMIDI_CMD_END:
+			return &( view->inv );
+		case NET_APPLEMIDI_CMD_SYNC:
+			return &( view->sync );
+		case NET_APPLEMIDI_CMD_FEEDBACK:
+			return &( view->feedback );
+		case NET_APPLEMIDI_CMD_BITRATE:
+			return &( view->bitrate );
+	}
 
-		memcpy( &(sync->count), p, 1 );
-		p += 1;
-		in_buffer_len--;
+	return NULL;
+}
 
-		memcpy( &(sync->padding), p, sizeof(sync->padding) );
-		p += sizeof( sync->padding );
-		in_buffer_len -= sizeof( sync->padding );
+uint32_t net_applemidi_view_ssrc( net_applemidi_view_t *view )
+{
+	if( ! view ) return 0;
 
-		get_uint64( &(sync->timestamp1), &p, &in_buffer_len );
-		get_uint64( &(sync->timestamp2), &p, &in_buffer_len );
-		get_uint64( &(sync->timestamp3), &p, &in_buffer_len );
+	return net_applemidi_data_ssrc( view->command, net_applemidi_view_data( view ) );
+}
 
-		return NET_APPLEMIDI_DONE;
-	}
+void net_applemidi_view_dump( net_applemidi_view_t *view )
+{
+	if( ! view ) return;
 
-	return NET_APPLEMIDI_DONE;
+	net_applemidi_data_dump( view->command, net_applemidi_view_data( view ), view->name, (int)view->name_len );
 }
 
-int net_applemidi_pack( net_applemidi_command *command_buffer, unsigned char **out_buffer, size_t *out_buffer_len )
+/* Heap copy of a decoded command for callers that keep it beyond the receive buffer */
+int net_applemidi_unpack( net_applemidi_command **command_buffer, unsigned char *in_buffer, size_t in_buffer_len)
 {
-	unsigned char *p;
+	net_applemidi_view_t view;
+	void *data = NULL;
+	size_t data_size = 0;
+	int ret = 0;
 
-	*out_buffer_len = 0;
+	*command_buffer = NULL;
 
-	if( ! command_buffer )
+	ret = net_applemidi_view( in_buffer, in_buffer_len, &view );
+	if( ret != NET_APPLEMIDI_DONE ) return ret;
+
+	switch( view.command )
 	{
-		return NET_APPLEMIDI_NEED_DATA;
+		case NET_APPLEMIDI_CMD_INV:
+		case NET_APPLEMIDI_CMD_ACCEPT:
+		case NET_APPLEMIDI_CMD_REJECT:
+		case NET_APPLEMIDI_CMD_END:
+			data_size = sizeof( net_applemidi_inv );
+			break;
+		case NET_APPLEMIDI_CMD_SYNC:
+			data_size = sizeof( net_applemidi_sync );
+			break;
+		case NET_APPLEMIDI_CMD_FEEDBACK:
+			data_size = sizeof( net_applemidi_feedback );
+			break;
+		case NET_APPLEMIDI_CMD_BITRATE:
+			data_size = sizeof( net_applemidi_bitrate );
+			break;
 	}
 
-	*out_buffer = ( unsigned char * ) malloc( NET_APPLEMIDI_COMMAND_SIZE );
+	*command_buffer = (net_applemidi_command *)malloc( sizeof( net_applemidi_command ) );
 
-	if( ! *out_buffer )
+	if( ! *command_buffer )
 	{
 		return NET_APPLEMIDI_NO_MEMORY;
 	}
-	
-	p = *out_buffer;
 
-	put_uint16( &p , command_buffer->signature, out_buffer_len );
-	put_uint16( &p , command_buffer->command, out_buffer_len );
+	(*command_buffer)->signature = view.signature;
+	(*command_buffer)->command = view.command;
+	(*command_buffer)->data = NULL;
+
+	if( data_size == 0 ) return NET_APPLEMIDI_DONE;
 
-	if(	command_buffer->command == NET_APPLEMIDI_CMD_INV  ||
-		command_buffer->command == NET_APPLEMIDI_CMD_ACCEPT ||
-		command_buffer->command == NET_APPLEMIDI_CMD_REJECT ||
-		command_buffer->command == NET_APPLEMIDI_CMD_END )
+	data = malloc( data_size );
+	if( ! data )
 	{
+		FREENULL( "net_applemidi_unpack: command", (void **)command_buffer );
+		return NET_APPLEMIDI_NO_MEMORY;
+	}
 
-		net_applemidi_inv *inv = ( net_applemidi_inv *) command_buffer->data;
+	memcpy( data, net_applemidi_view_data( &view ), data_size );
+	(*command_buffer)->data = data;
 
-		if( ! inv )
-		{
-			free( *out_buffer );
-			*out_buffer = NULL;
-			*out_buffer_len = 0;
-			return NET_APPLEMIDI_NEED_DATA;
-		}
+	if( view.name )
+	{
+		((net_applemidi_inv *)data)->name = strndup( view.name, view.name_len );
+	}
 
-		*out_buffer = ( unsigned char * ) realloc( *out_buffer, NET_APPLEMIDI_COMMAND_SIZE + NET_APPLEMIDI_INV_STATIC_SIZE );
-		p = *out_buffer + *out_buffer_len;
+	return NET_APPLEMIDI_DONE;
+}
 
-		put_uint32( &p, inv->version, out_buffer_len );
-		put_uint32( &p, inv->initiator, out_buffer_len );
-		put_uint32( &p, inv->ssrc, out_buffer_len );
+/* The serialisers below write one command into a caller buffer.
+   Each returns the number of bytes written, or 0 if the buffer is too small */
 
-		if( inv->name )
-		{
-			*out_buffer = ( unsigned char * ) realloc( *out_buffer, *out_buffer_len + strlen( inv->name ) + 1 );
+static size_t net_applemidi_header_write( uint16_t command, unsigned char **p )
+{
+	size_t len = 0;
 
-			if( ! *out_buffer )
-			{
-				*out_buffer_len = 0;
-				return NET_APPLEMIDI_NO_MEMORY;
-			}
+	put_uint16( p, 0xffff, &len );
+	put_uint16( p, command, &len );
 
-			p = *out_buffer + *out_buffer_len;
-			memcpy( p , inv->name, strlen( inv->name ) );
-			p += strlen( inv->name );
-			*out_buffer_len += strlen( inv->name );
-			*p = '\0';
-			*out_buffer_len += 1;
-		}
-	}
+	return len;
+}
 
-	if( command_buffer->command ==  NET_APPLEMIDI_CMD_FEEDBACK )
-	{
+size_t net_applemidi_inv_write( uint16_t command, net_applemidi_inv *inv, unsigned char *buffer, size_t buffer_size )
+{
+	unsigned char *p = buffer;
+	size_t len = 0;
+	size_t name_len = 0;
 
-		net_applemidi_feedback *feedback = ( net_applemidi_feedback *) command_buffer->data;
+	if( ! inv || ! buffer ) return 0;
 
-		if( ! feedback )
-		{
-			free( *out_buffer );
-			*out_buffer = NULL;
-			*out_buffer_len = 0;
-			return NET_APPLEMIDI_NEED_DATA;
-		}
+	if( inv->name ) name_len = strlen( inv->name ) + 1;
+	if( buffer_size < NET_APPLEMIDI_COMMAND_SIZE + NET_APPLEMIDI_INV_STATIC_SIZE + name_len ) return 0;
 
-		*out_buffer = ( unsigned char * ) realloc( *out_buffer, NET_APPLEMIDI_COMMAND_SIZE + NET_APPLEMIDI_FEEDBACK_SIZE );
-		p = *out_buffer + *out_buffer_len;
+	len = net_applemidi_header_write( command, &p );
+	put_uint32( &p, inv->version, &len );
+	put_uint32( &p, inv->initiator, &len );
+	put_uint32( &p, inv->ssrc, &len );
 
-		put_uint32( &p, feedback->ssrc ,  out_buffer_len );
-		put_uint32( &p, feedback->apple_seq ,  out_buffer_len );
+	if( name_len > 0 )
+	{
+		memcpy( p, inv->name, name_len );
+		len += name_len;
 	}
 
-	if( command_buffer->command ==  NET_APPLEMIDI_CMD_BITRATE )
-	{
+	return len;
+}
 
-		net_applemidi_bitrate *bitrate = ( net_applemidi_bitrate *) command_buffer->data;
+size_t net_applemidi_sync_write( net_applemidi_sync *sync, unsigned char *buffer, size_t buffer_size )
+{
+	unsigned char *p = buffer;
+	size_t len = 0;
 
-		if( ! bitrate )
-		{
-			free( *out_buffer );
-			*out_buffer = NULL;
-			*out_buffer_len = 0;
-			return NET_APPLEMIDI_NEED_DATA;
-		}
+	if( ! sync || ! buffer ) return 0;
+	if( buffer_size < NET_APPLEMIDI_COMMAND_SIZE + NET_APPLEMIDI_SYNC_SIZE ) return 0;
 
-		*out_buffer = ( unsigned char * ) realloc( *out_buffer, NET_APPLEMIDI_COMMAND_SIZE + NET_APPLEMIDI_BITRATE_SIZE );
-		p = *out_buffer + *out_buffer_len;
+	len = net_applemidi_header_write( NET_APPLEMIDI_CMD_SYNC, &p );
+	put_uint32( &p , sync->ssrc, &len );
 
-		put_uint32( &p, bitrate->ssrc ,  out_buffer_len );
-		put_uint32( &p, bitrate->limit ,  out_buffer_len );
-	}
+	memcpy( p, &(sync->count), 1 );
+	p += 1;
+	len += 1;
 
-	if( command_buffer->command == NET_APPLEMIDI_CMD_SYNC )
-	{
-		net_applemidi_sync *sync;
+	memcpy( p, &(sync->padding), sizeof(sync->padding) );
+	p += sizeof( sync->padding );
+	len += sizeof( sync->padding );
 
-		sync = (net_applemidi_sync *)command_buffer->data;
+	put_uint64( &p, sync->timestamp1 , &len );
+	put_uint64( &p, sync->timestamp2 , &len );
+	put_uint64( &p, sync->timestamp3 , &len );
 
-		*out_buffer = ( unsigned char * ) realloc( *out_buffer, NET_APPLEMIDI_COMMAND_SIZE + NET_APPLEMIDI_SYNC_SIZE );
+	return len;
+}
 
-		if( ! *out_buffer )
-		{
-			*out_buffer_len = 0;
-			return NET_APPLEMIDI_NO_MEMORY;
-		}
+size_t net_applemidi_feedback_write( net_applemidi_feedback *feedback, unsigned char *buffer, size_t buffer_size )
+{
+	unsigned char *p = buffer;
+	size_t len = 0;
+
+	if( ! feedback || ! buffer ) return 0;
+	if( buffer_size < NET_APPLEMIDI_COMMAND_SIZE + NET_APPLEMIDI_FEEDBACK_SIZE ) return 0;
+
+	len = net_applemidi_header_write( NET_APPLEMIDI_CMD_FEEDBACK, &p );
+	put_uint32( &p, feedback->ssrc , &len );
+	put_uint32( &p, feedback->apple_seq , &len );
+
+	return len;
+}
+
+size_t net_applemidi_bitrate_write( net_applemidi_bitrate *bitrate, unsigned char *buffer, size_t buffer_size )
+{
+	unsigned char *p = buffer;
+	size_t len = 0;
 
-		p = *out_buffer + *out_buffer_len;
+	if( ! bitrate || ! buffer ) return 0;
+	if( buffer_size < NET_APPLEMIDI_COMMAND_SIZE + NET_APPLEMIDI_BITRATE_SIZE ) return 0;
 
-		put_uint32( &p , sync->ssrc, out_buffer_len );
+	len = net_applemidi_header_write( NET_APPLEMIDI_CMD_BITRATE, &p );
+	put_uint32( &p, bitrate->ssrc , &len );
+	put_uint32( &p, bitrate->limit , &len );
 
-		memcpy( p, &(sync->count), 1 );
-		p += 1;
-		*out_buffer_len += 1;
+	return len;
+}
+
+/* General case: a heap buffer of the exact size for any command */
+int net_applemidi_pack( net_applemidi_command *command_buffer, unsigned char **out_buffer, size_t *out_buffer_len )
+{
+	size_t size = NET_APPLEMIDI_COMMAND_SIZE;
+	unsigned char *p = NULL;
+
+	*out_buffer_len = 0;
+
+	if( ! command_buffer )
+	{
+		return NET_APPLEMIDI_NEED_DATA;
+	}
+
+	switch( command_buffer->command )
+	{
+		case NET_APPLEMIDI_CMD_INV:
+		case NET_APPLEMIDI_CMD_ACCEPT:
+		case NET_APPLEMIDI_CMD_REJECT:
+		case NET_APPLEMIDI_CMD_END:
+			if( ! command_buffer->data ) return NET_APPLEMIDI_NEED_DATA;
+			size += NET_APPLEMIDI_INV_STATIC_SIZE;
+			if( ( ( net_applemidi_inv *) command_buffer->data )->name )
+			{
+				size += strlen( ( ( net_applemidi_inv *) command_buffer->data )->name ) + 1;
+			}
+			break;
+		case NET_APPLEMIDI_CMD_SYNC:
+			if( ! command_buffer->data ) return NET_APPLEMIDI_NEED_DATA;
+			size += NET_APPLEMIDI_SYNC_SIZE;
+			break;
+		case NET_APPLEMIDI_CMD_FEEDBACK:
+			if( ! command_buffer->data ) return NET_APPLEMIDI_NEED_DATA;
+			size += NET_APPLEMIDI_FEEDBACK_SIZE;
+			break;
+		case NET_APPLEMIDI_CMD_BITRATE:
+			if( ! command_buffer->data ) return NET_APPLEMIDI_NEED_DATA;
+			size += NET_APPLEMIDI_BITRATE_SIZE;
+			break;
+	}
 
-		memcpy( p, &(sync->padding), sizeof(sync->padding) );
-		p += sizeof( sync->padding );
-		*out_buffer_len += sizeof( sync->padding );
+	*out_buffer = ( unsigned char * ) malloc( size );
 
-		put_uint64( &p, sync->timestamp1 , out_buffer_len );
-		put_uint64( &p, sync->timestamp2 , out_buffer_len );
-		put_uint64( &p, sync->timestamp3 , out_buffer_len );
+	if( ! *out_buffer )
+	{
+		return NET_APPLEMIDI_NO_MEMORY;
+	}
 
+	switch( command_buffer->command )
+	{
+		case NET_APPLEMIDI_CMD_INV:
+		case NET_APPLEMIDI_CMD_ACCEPT:
+		case NET_APPLEMIDI_CMD_REJECT:
+		case NET_APPLEMIDI_CMD_END:
+			*out_buffer_len = net_applemidi_inv_write( command_buffer->command, command_buffer->data, *out_buffer, size );
+			break;
+		case NET_APPLEMIDI_CMD_SYNC:
+			*out_buffer_len = net_applemidi_sync_write( command_buffer->data, *out_buffer, size );
+			break;
+		case NET_APPLEMIDI_CMD_FEEDBACK:
+			*out_buffer_len = net_applemidi_feedback_write( command_buffer->data, *out_buffer, size );
+			break;
+		case NET_APPLEMIDI_CMD_BITRATE:
+			*out_buffer_len = net_applemidi_bitrate_write( command_buffer->data, *out_buffer, size );
+			break;
+		default:
+			p = *out_buffer;
+			put_uint16( &p , command_buffer->signature, out_buffer_len );
+			put_uint16( &p , command_buffer->command, out_buffer_len );
+			break;
 	}
 
 	return NET_APPLEMIDI_DONE;
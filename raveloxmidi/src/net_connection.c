@@ -28,6 +28,10 @@
 
 #include <arpa/inet.h>
 
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
 #include <errno.h>
 extern int errno;
 
@@ -39,6 +43,8 @@ extern int errno;
 #include "utils.h"
 
 #include "raveloxmidi_config.h"
+#include "raveloxmidi_probes.h"
+#include "packet_capture.h"
 #include "logging.h"
 
 static net_ctx_t *_ctx_head = NULL;
@@ -46,6 +52,87 @@ static unsigned int _max_ctx = 0;
 
 static net_ctx_t *_iterator_current = NULL;
 
+/* The table and the iterator are shared by every thread that handles packets */
+static pthread_mutex_t _ctx_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t _ctx_generation = 0;
+
+/* Transmit queues. The depth is read when the main loop decides whether to wait for the socket, so it's atomic */
+static uint32_t _tx_size = 0;
+static uint32_t _tx_pending = 0;
+static int _tx_blocked = 0;
+static int _tx_event_fd = -1;
+static config_handle_t _tx_coalesce_cc_handle = CONFIG_HANDLE_INVALID;
+static config_handle_t _tx_drop_realtime_handle = CONFIG_HANDLE_INVALID;
+
+/* Rate limits. The cap from the configuration is read through a handle on every send */
+static config_handle_t _tx_rate_handle = CONFIG_HANDLE_INVALID;
+static uint32_t _tx_rate_sessions = 0;
+
+void net_ctx_lock( void )
+{
+	pthread_mutex_lock( &_ctx_mutex );
+}
+
+void net_ctx_unlock( void )
+{
+	pthread_mutex_unlock( &_ctx_mutex );
+}
+
+uint32_t net_ctx_generation( void )
+{
+	return __atomic_load_n( &_ctx_generation, __ATOMIC_ACQUIRE );
+}
+
+int net_ctx_claim_owner( uint32_t ssrc, int worker )
+{
+	net_ctx_t *ctx = NULL;
+	int owner = NET_CTX_NO_OWNER;
+
+	net_ctx_lock();
+	ctx = net_ctx_find_by_ssrc( ssrc );
+	if( ctx )
+	{
+		if( ctx->owner == NET_CTX_NO_OWNER )
+		{
+			ctx->owner = worker;
+			logging_printf( LOGGING_DEBUG, "net_ctx_claim_owner: ssrc=0x%08x owner=%d\n", ssrc, worker );
+		}
+		owner = ctx->owner;
+	}
+	net_ctx_unlock();
+
+	return owner;
+}
+
+void net_ctx_heard( net_ctx_t *ctx )
+{
+	if( ! ctx ) return;
+
+	ctx->last_heard = time( NULL );
+	ctx->probed = 0;
+}
+
+int net_ctx_received( uint32_t ssrc, uint16_t seq )
+{
+	net_ctx_t *ctx = NULL;
+
+	net_ctx_lock();
+	ctx = net_ctx_find_by_ssrc( ssrc );
+	if( ctx )
+	{
+		// Only a later sequence number moves the acknowledgement on
+		if( ! ctx->feedback_pending || (int16_t)( seq - ctx->received_seq ) > 0 )
+		{
+			ctx->received_seq = seq;
+		}
+		ctx->feedback_pending = 1;
+		net_ctx_heard( ctx );
+	}
+	net_ctx_unlock();
+
+	return ( ctx ? 0 : -1 );
+}
+
 void net_ctx_destroy( net_ctx_t **ctx )
 {
 	net_ctx_t *next_ctx = NULL;
@@ -54,6 +141,19 @@ void net_ctx_destroy( net_ctx_t **ctx )
 	if( ! ctx ) return;
 	if( ! *ctx ) return;
 
+	RAVELOXMIDI_PROBE3( session_destroy, (*ctx)->ssrc, (*ctx)->send_ssrc, (*ctx)->seq );
+	__atomic_add_fetch( &_ctx_generation, 1, __ATOMIC_RELEASE );
+
+	if( (*ctx)->tx_depth > 0 )
+	{
+		logging_printf( LOGGING_DEBUG, "net_ctx_destroy: ssrc=0x%08x %u queued packets dropped\n", (*ctx)->ssrc, (*ctx)->tx_depth );
+		__atomic_sub_fetch( &_tx_pending, (*ctx)->tx_depth, __ATOMIC_RELAXED );
+	}
+	if( (*ctx)->rate_limit > 0 ) __atomic_sub_fetch( &_tx_rate_sessions, 1, __ATOMIC_RELAXED );
+	FREENULL( "tx_slots",(void **)&((*ctx)->tx_slots) );
+	FREENULL( "tx_order",(void **)&((*ctx)->tx_order) );
+	FREENULL( "tx_free",(void **)&((*ctx)->tx_free) );
+
 	FREENULL( "ip_address",(void **)&((*ctx)->ip_address) );
 	journal_destroy( &((*ctx)->journal) );
 
@@ -87,8 +187,9 @@ void net_ctx_dump( net_ctx_t *ctx )
 {
 	if( ! ctx ) return;
 	
-	logging_printf( LOGGING_DEBUG, "net_ctx: ssrc=0x%08x,send_ssrc=0x%08x,initiator=0x%08x,seq=0x%08x,host=%s,control=%u,data=%u\n",
-		ctx->ssrc, ctx->send_ssrc, ctx->initiator, ctx->seq, ctx->ip_address, ctx->control_port, ctx->data_port);
+	logging_printf( LOGGING_DEBUG, "net_ctx: ssrc=0x%08x,send_ssrc=0x%08x,initiator=0x%08x,seq=0x%08x,host=%s,control=%u,data=%u,owner=%d,last_heard=%ld,tx_depth=%u,tx_high_water=%u,tx_dropped=%u,tx_coalesced=%u,rate_limit=%u,tx_limited=%u\n",
+		ctx->ssrc, ctx->send_ssrc, ctx->initiator, ctx->seq, ctx->ip_address, ctx->control_port, ctx->data_port, ctx->owner, (long)ctx->last_heard,
+		ctx->tx_depth, ctx->tx_high_water, ctx->tx_dropped, ctx->tx_coalesced, ctx->rate_limit, ctx->tx_limited);
 }
 
 static void net_ctx_set( net_ctx_t *ctx, uint32_t ssrc, uint32_t initiator, uint32_t send_ssrc, uint32_t seq, uint16_t port, char *ip_address )
@@ -101,6 +202,12 @@ static void net_ctx_set( net_ctx_t *ctx, uint32_t ssrc, uint32_t initiator, uint
 	ctx->seq = seq;
 	ctx->control_port = port;
 	ctx->start = time( NULL );
+	ctx->journal_time = ctx->start;
+	ctx->last_heard = ctx->start;
+	ctx->probed = 0;
+	ctx->owner = NET_CTX_NO_OWNER;
+	ctx->feedback_pending = 0;
+	__atomic_add_fetch( &_ctx_generation, 1, __ATOMIC_RELEASE );
 
 	if( ctx->ip_address )
 	{
@@ -124,6 +231,7 @@ static net_ctx_t * net_ctx_create( void )
 
 	memset( new_ctx, 0, sizeof( net_ctx_t ) );
 	new_ctx->seq = 0x0000;
+	new_ctx->owner = NET_CTX_NO_OWNER;
 
 	journal_init( &journal );
 
@@ -141,6 +249,31 @@ void net_ctx_init( void )
 	if( _max_ctx == 0 ) _max_ctx = 1;
 
 	_ctx_head = NULL;
+
+	_tx_size = config_int_get("network.tx_queue_size");
+	if( _tx_size > NET_CTX_TX_MAX ) _tx_size = NET_CTX_TX_MAX;
+	_tx_pending = 0;
+	_tx_blocked = 0;
+	_tx_coalesce_cc_handle = config_handle_get("network.tx_queue.coalesce_cc");
+	_tx_drop_realtime_handle = config_handle_get("network.tx_queue.drop_realtime");
+	_tx_rate_sessions = 0;
+	_tx_rate_handle = config_handle_get("network.tx_rate_limit");
+
+	if( _tx_size > 0 )
+	{
+		_tx_event_fd = eventfd( 0, EFD_NONBLOCK );
+		if( _tx_event_fd < 0 )
+		{
+			logging_printf( LOGGING_ERROR, "net_ctx_init: Unable to create transmit queue event: %s. Transmit queues are disabled\n", strerror( errno ) );
+			_tx_size = 0;
+		}
+	}
+
+	// Traffic over a limit waits in the transmit queue, so there is nothing to limit without one
+	if( _tx_size == 0 && config_handle_long( _tx_rate_handle ) > 0 )
+	{
+		logging_printf( LOGGING_WARN, "net_ctx_init: network.tx_rate_limit is ignored because transmit queues are disabled\n");
+	}
 }
 
 
@@ -157,6 +290,9 @@ void net_ctx_teardown( void )
 		net_ctx_destroy( &current_ctx );
 		current_ctx = prev_ctx;
 	}
+
+	if( _tx_event_fd >= 0 ) close( _tx_event_fd );
+	_tx_event_fd = -1;
 }
 
 net_ctx_t * net_ctx_find_by_ssrc( uint32_t ssrc)
@@ -224,6 +360,8 @@ net_ctx_t * net_ctx_register( uint32_t ssrc, uint32_t initiator, char *ip_addres
 
 	if( last_ctx ) last_ctx->next = new_ctx;
 
+	RAVELOXMIDI_PROBE3( session_register, ssrc, send_ssrc, port );
+
 	for( net_ctx_iter_start_head(); net_ctx_iter_has_next(); net_ctx_iter_next() )
 	{
 		current_ctx = net_ctx_iter_current();
@@ -266,14 +404,13 @@ void net_ctx_journal_dump( net_ctx_t *ctx )
 	journal_dump( ctx->journal );
 }
 
-void net_ctx_journal_pack( net_ctx_t *ctx, char **journal_buffer, size_t *journal_buffer_size)
+void net_ctx_journal_pack( net_ctx_t *ctx, unsigned char *journal_buffer, size_t journal_buffer_len, size_t *journal_size )
 {
-	*journal_buffer = NULL;
-	*journal_buffer_size = 0;
+	*journal_size = 0;
 
 	if( ! ctx) return;
 
-	journal_pack( ctx->journal, journal_buffer, journal_buffer_size );
+	journal_pack( ctx->journal, journal_buffer, journal_buffer_len, journal_size );
 }
 	
 void net_ctx_journal_reset( net_ctx_t *ctx )
@@ -282,6 +419,7 @@ void net_ctx_journal_reset( net_ctx_t *ctx )
 
 	logging_printf(LOGGING_DEBUG,"net_ctx_journal_reset:ssrc=0x%08x\n", ctx->ssrc );
 	journal_reset( ctx->journal);
+	ctx->journal_time = time( NULL );
 }
 
 void net_ctx_update_rtp_fields( net_ctx_t *ctx, rtp_packet_t *rtp_packet)
@@ -301,9 +439,235 @@ void net_ctx_increment_seq( net_ctx_t *ctx )
 	ctx->seq += 1;
 }
 
-void net_ctx_send( int send_socket, net_ctx_t *ctx, unsigned char *buffer, size_t buffer_len )
+/* Data port address of the remote end of the session */
+void net_ctx_address( net_ctx_t *ctx, struct sockaddr_storage *address, socklen_t *addr_len )
+{
+	if( ! ctx ) return;
+	if( ! address ) return;
+	if( ! addr_len ) return;
+
+	memset( (char *)address, 0, sizeof( struct sockaddr_storage ) );
+	get_sock_addr( ctx->ip_address, ctx->data_port, (struct sockaddr *)address, addr_len );
+}
+
+static int net_ctx_tx_create( net_ctx_t *ctx )
 {
-	struct sockaddr_in6 send_address;
+	uint32_t i = 0;
+
+	if( ctx->tx_slots ) return 0;
+
+	ctx->tx_slots = ( net_ctx_tx_t * ) malloc( _tx_size * sizeof( net_ctx_tx_t ) );
+	ctx->tx_order = ( uint16_t * ) malloc( _tx_size * sizeof( uint16_t ) );
+	ctx->tx_free = ( uint16_t * ) malloc( _tx_size * sizeof( uint16_t ) );
+
+	if( ! ctx->tx_slots || ! ctx->tx_order || ! ctx->tx_free )
+	{
+		logging_printf( LOGGING_ERROR, "net_ctx_tx_create: Insufficient memory for transmit queue for ssrc=0x%08x\n", ctx->ssrc );
+		FREENULL( "tx_slots",(void **)&(ctx->tx_slots) );
+		FREENULL( "tx_order",(void **)&(ctx->tx_order) );
+		FREENULL( "tx_free",(void **)&(ctx->tx_free) );
+		return -1;
+	}
+
+	for( i = 0; i < _tx_size; i++ )
+	{
+		ctx->tx_free[i] = _tx_size - 1 - i;
+	}
+	ctx->tx_depth = 0;
+
+	return 0;
+}
+
+/* Remove the packet at position in the queue. The rest stay in order */
+static void net_ctx_tx_remove( net_ctx_t *ctx, uint32_t position )
+{
+	uint16_t slot = ctx->tx_order[ position ];
+
+	memmove( &( ctx->tx_order[ position ] ), &( ctx->tx_order[ position + 1 ] ), ( ctx->tx_depth - position - 1 ) * sizeof( uint16_t ) );
+	ctx->tx_depth--;
+	ctx->tx_free[ _tx_size - ctx->tx_depth - 1 ] = slot;
+
+	__atomic_sub_fetch( &_tx_pending, 1, __ATOMIC_RELAXED );
+}
+
+/* Position of the oldest queued packet of this kind, and key if one is given, or -1 */
+static int net_ctx_tx_find( net_ctx_t *ctx, int kind, int key )
+{
+	net_ctx_tx_t *tx = NULL;
+	uint32_t i = 0;
+
+	for( i = 0; i < ctx->tx_depth; i++ )
+	{
+		tx = &( ctx->tx_slots[ ctx->tx_order[i] ] );
+		if( tx->kind == kind && ( key < 0 || tx->key == key ) ) return (int)i;
+	}
+
+	return -1;
+}
+
+static uint64_t net_ctx_now_us( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+
+	return ( (uint64_t)ts.tv_sec * 1000000 ) + ( ts.tv_nsec / 1000 );
+}
+
+/* The lower of the limit the remote end asked for and the cap in the configuration, or 0 */
+static uint32_t net_ctx_tx_rate( net_ctx_t *ctx )
+{
+	long cap = config_handle_long( _tx_rate_handle );
+	uint32_t rate = ctx->rate_limit;
+
+	if( cap > 0 && ( rate == 0 || (uint32_t)cap < rate ) ) rate = (uint32_t)cap;
+
+	return rate;
+}
+
+int net_ctx_tx_allow( net_ctx_t *ctx, size_t buffer_len )
+{
+	uint64_t rate = 0;
+	uint64_t burst = 0;
+	uint64_t now = 0;
+	uint64_t bits = (uint64_t)buffer_len * 8;
+
+	if( ! ctx ) return 0;
+	if( _tx_size == 0 ) return 1;
+
+	rate = net_ctx_tx_rate( ctx );
+	if( rate == 0 ) return 1;
+
+	burst = ( rate * NET_CTX_TX_BURST_MS ) / 1000;
+	if( burst < NET_APPLEMIDI_UDPSIZE * 8 ) burst = NET_APPLEMIDI_UDPSIZE * 8;
+
+	// A new bucket starts full
+	now = net_ctx_now_us();
+	if( ctx->tx_refill_us == 0 )
+	{
+		ctx->tx_tokens = burst;
+	} else {
+		ctx->tx_tokens += ( ( now - ctx->tx_refill_us ) * rate ) / 1000000;
+		if( ctx->tx_tokens > burst ) ctx->tx_tokens = burst;
+	}
+	ctx->tx_refill_us = now;
+
+	if( ctx->tx_tokens < bits ) return 0;
+
+	ctx->tx_tokens -= bits;
+	return 1;
+}
+
+void net_ctx_tx_rate_set( net_ctx_t *ctx, uint32_t limit )
+{
+	uint64_t event = 1;
+
+	if( ! ctx ) return;
+	if( ctx->rate_limit == limit ) return;
+
+	logging_printf( LOGGING_DEBUG, "net_ctx_tx_rate_set: ssrc=0x%08x rate_limit=%u\n", ctx->ssrc, limit );
+
+	if( ctx->rate_limit == 0 )
+	{
+		__atomic_add_fetch( &_tx_rate_sessions, 1, __ATOMIC_RELAXED );
+	} else if( limit == 0 ) {
+		__atomic_sub_fetch( &_tx_rate_sessions, 1, __ATOMIC_RELAXED );
+	}
+	ctx->rate_limit = limit;
+
+	// Wake the main loop so that it starts, or stops, the timer that sends held back packets
+	if( _tx_event_fd >= 0 && write( _tx_event_fd, &event, sizeof( event ) ) < 0 && errno != EAGAIN )
+	{
+		logging_printf( LOGGING_WARN, "net_ctx_tx_rate_set: Unable to signal main loop: %s\n", strerror( errno ) );
+	}
+}
+
+int net_ctx_tx_enabled( void )
+{
+	return ( _tx_size > 0 );
+}
+
+int net_ctx_tx_rate_limited( void )
+{
+	if( _tx_size == 0 ) return 0;
+
+	return ( config_handle_long( _tx_rate_handle ) > 0 || __atomic_load_n( &_tx_rate_sessions, __ATOMIC_RELAXED ) > 0 );
+}
+
+/* The data socket is full. The first send to find it full wakes the main loop so that it waits for it to be writable */
+static void net_ctx_tx_block( void )
+{
+	uint64_t event = 1;
+
+	if( __atomic_exchange_n( &_tx_blocked, 1, __ATOMIC_RELAXED ) != 0 ) return;
+
+	if( write( _tx_event_fd, &event, sizeof( event ) ) < 0 && errno != EAGAIN )
+	{
+		logging_printf( LOGGING_WARN, "net_ctx_tx_block: Unable to signal main loop: %s\n", strerror( errno ) );
+	}
+}
+
+static int net_ctx_tx_push( net_ctx_t *ctx, unsigned char *buffer, size_t buffer_len, int kind, uint16_t key )
+{
+	net_ctx_tx_t *tx = NULL;
+	uint16_t slot = 0;
+	int position = -1;
+
+	if( buffer_len > sizeof( tx->data ) ) return -1;
+	if( net_ctx_tx_create( ctx ) != 0 ) return -1;
+
+	// A newer value for the same controller, or a newer active sensing, makes the queued one stale.
+	// A rate limited session only gets the latest clock as well
+	if( kind == NET_CTX_TX_CONTROL && config_handle_bool( _tx_coalesce_cc_handle ) )
+	{
+		position = net_ctx_tx_find( ctx, kind, key );
+	} else if( kind == NET_CTX_TX_REALTIME && ( key == 0xfe || net_ctx_tx_rate( ctx ) > 0 ) && config_handle_bool( _tx_drop_realtime_handle ) ) {
+		position = net_ctx_tx_find( ctx, kind, key );
+	}
+
+	if( position >= 0 )
+	{
+		net_ctx_tx_remove( ctx, position );
+		ctx->tx_coalesced++;
+	}
+
+	// When full, a queued clock or active sensing message is dropped first. Otherwise the new packet is
+	if( ctx->tx_depth == _tx_size && config_handle_bool( _tx_drop_realtime_handle ) )
+	{
+		position = net_ctx_tx_find( ctx, NET_CTX_TX_REALTIME, -1 );
+		if( position >= 0 )
+		{
+			net_ctx_tx_remove( ctx, position );
+			ctx->tx_dropped++;
+		}
+	}
+
+	if( ctx->tx_depth == _tx_size )
+	{
+		ctx->tx_dropped++;
+		RAVELOXMIDI_PROBE2( tx_drop, ctx->ssrc, ctx->tx_depth );
+		return -1;
+	}
+
+	slot = ctx->tx_free[ _tx_size - ctx->tx_depth - 1 ];
+	tx = &( ctx->tx_slots[ slot ] );
+	tx->kind = kind;
+	tx->key = key;
+	tx->len = buffer_len;
+	memcpy( tx->data, buffer, buffer_len );
+
+	ctx->tx_order[ ctx->tx_depth ] = slot;
+	ctx->tx_depth++;
+	ctx->tx_queued++;
+	if( ctx->tx_depth > ctx->tx_high_water ) ctx->tx_high_water = ctx->tx_depth;
+	__atomic_add_fetch( &_tx_pending, 1, __ATOMIC_RELAXED );
+
+	return 0;
+}
+
+void net_ctx_send( int send_socket, net_ctx_t *ctx, unsigned char *buffer, size_t buffer_len, int kind, uint16_t key, int charged )
+{
+	struct sockaddr_storage send_address;
 	ssize_t bytes_sent = 0;
 	socklen_t addr_len = 0;
 
@@ -314,19 +678,141 @@ void net_ctx_send( int send_socket, net_ctx_t *ctx, unsigned char *buffer, size_
 	net_ctx_dump( ctx );
 	net_ctx_journal_dump( ctx );
 
+	// Packets already waiting go first
+	if( ctx->tx_depth > 0 )
+	{
+		net_ctx_tx_push( ctx, buffer, buffer_len, kind, key );
+		return;
+	}
+
+	// Traffic over the rate limit is held back and sent from the timer
+	if( ! charged && ! net_ctx_tx_allow( ctx, buffer_len ) )
+	{
+		logging_printf( LOGGING_DEBUG, "net_ctx_send: Rate limited. Queueing %u bytes for [%s]:%u\n", buffer_len, ctx->ip_address, ctx->data_port );
+		ctx->tx_limited++;
+		net_ctx_tx_push( ctx, buffer, buffer_len, kind, key );
+		return;
+	}
+
 	/* Set up the destination address */
-	memset((char *)&send_address, 0, sizeof( send_address));
-	get_sock_addr( ctx->ip_address, ctx->data_port, (struct sockaddr *)&send_address, &addr_len);
+	net_ctx_address( ctx, &send_address, &addr_len );
 
 	logging_printf(LOGGING_DEBUG, "net_ctx_send: send_address size=%d\n", sizeof( send_address ) );
 	bytes_sent = sendto( send_socket, buffer, buffer_len , 0 , (struct sockaddr *)&send_address, addr_len);
 
-	if( bytes_sent < 0 )
+	if( bytes_sent < 0 && _tx_size > 0 && ( errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS ) )
 	{
+		logging_printf( LOGGING_DEBUG, "net_ctx_send: Socket full. Queueing %u bytes for [%s]:%u\n", buffer_len, ctx->ip_address, ctx->data_port );
+		// The tokens are taken again when the queue is drained
+		ctx->tx_tokens += (uint64_t)buffer_len * 8;
+		if( net_ctx_tx_push( ctx, buffer, buffer_len, kind, key ) == 0 ) net_ctx_tx_block();
+	} else if( bytes_sent < 0 ) {
 		logging_printf( LOGGING_ERROR, "net_ctx_send: Failed to send %u bytes to [%s]:%u\t%s\n", buffer_len, ctx->ip_address, ctx->data_port, strerror( errno ));
 	} else {
 		logging_printf( LOGGING_DEBUG, "net_ctx_send: write( bytes=%u,host=%s,port=%u)\n", bytes_sent, ctx->ip_address, ctx->data_port );
+		packet_capture_record( CAPTURE_OUTBOUND, send_socket, (struct sockaddr *)&send_address, buffer, bytes_sent );
+	}
+}
+
+int net_ctx_tx_requeue( struct sockaddr_storage *address, socklen_t addr_len, unsigned char *buffer, size_t buffer_len )
+{
+	struct sockaddr_storage ctx_address;
+	socklen_t ctx_addr_len = 0;
+	net_ctx_t *ctx = NULL;
+	int ret = -1;
+
+	if( ! address ) return -1;
+	if( ! buffer ) return -1;
+	if( _tx_size == 0 ) return -1;
+
+	net_ctx_lock();
+	for( ctx = _ctx_head; ctx; ctx = ctx->next )
+	{
+		net_ctx_address( ctx, &ctx_address, &ctx_addr_len );
+		if( ctx_addr_len != addr_len || memcmp( &ctx_address, address, addr_len ) != 0 ) continue;
+		// The tokens taken before the packet was handed to io_uring are taken again when the queue is drained
+		ctx->tx_tokens += (uint64_t)buffer_len * 8;
+		ret = net_ctx_tx_push( ctx, buffer, buffer_len, NET_CTX_TX_OTHER, 0 );
+		if( ret == 0 ) net_ctx_tx_block();
+		break;
+	}
+	net_ctx_unlock();
+
+	return ret;
+}
+
+int net_ctx_tx_queue( net_ctx_t *ctx, unsigned char *buffer, size_t buffer_len, int kind, uint16_t key )
+{
+	if( ! ctx ) return -1;
+	if( ! buffer ) return -1;
+	if( _tx_size == 0 ) return -1;
+
+	return net_ctx_tx_push( ctx, buffer, buffer_len, kind, key );
+}
+
+uint32_t net_ctx_tx_pending( void )
+{
+	return __atomic_load_n( &_tx_pending, __ATOMIC_RELAXED );
+}
+
+int net_ctx_tx_blocked( void )
+{
+	return __atomic_load_n( &_tx_blocked, __ATOMIC_RELAXED );
+}
+
+int net_ctx_tx_event_fd( void )
+{
+	return _tx_event_fd;
+}
+
+uint32_t net_ctx_tx_drain( int send_socket )
+{
+	struct sockaddr_storage send_address;
+	socklen_t addr_len = 0;
+	net_ctx_tx_t *tx = NULL;
+	net_ctx_t *ctx = NULL;
+	ssize_t bytes_sent = 0;
+	int blocked = 0;
+
+	net_ctx_lock();
+	for( ctx = _ctx_head; ctx && ! blocked; ctx = ctx->next )
+	{
+		if( ctx->tx_depth == 0 ) continue;
+
+		net_ctx_address( ctx, &send_address, &addr_len );
+
+		while( ctx->tx_depth > 0 )
+		{
+			tx = &( ctx->tx_slots[ ctx->tx_order[0] ] );
+
+			// The rest of this session's queue waits for more tokens
+			if( ! net_ctx_tx_allow( ctx, tx->len ) ) break;
+
+			bytes_sent = sendto( send_socket, tx->data, tx->len, 0, (struct sockaddr *)&send_address, addr_len );
+
+			if( bytes_sent < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS ) )
+			{
+				ctx->tx_tokens += (uint64_t)tx->len * 8;
+				blocked = 1;
+				break;
+			}
+
+			if( bytes_sent < 0 )
+			{
+				logging_printf( LOGGING_ERROR, "net_ctx_tx_drain: Failed to send %u bytes to [%s]:%u\t%s\n", tx->len, ctx->ip_address, ctx->data_port, strerror( errno ));
+			} else {
+				packet_capture_record( CAPTURE_OUTBOUND, send_socket, (struct sockaddr *)&send_address, tx->data, bytes_sent );
+			}
+
+			net_ctx_tx_remove( ctx, 0 );
+		}
 	}
+
+	// Stop waiting for the socket to be writable once it has taken everything it can
+	__atomic_store_n( &_tx_blocked, blocked, __ATOMIC_RELAXED );
+	net_ctx_unlock();
+
+	return net_ctx_tx_pending();
 }
 
 void net_ctx_iter_start_head(void)
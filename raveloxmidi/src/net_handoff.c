@@ -0,0 +1,683 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+#include <errno.h>
+extern int errno;
+
+#include "config.h"
+
+#include "midi_journal.h"
+#include "net_applemidi.h"
+#include "net_connection.h"
+#include "net_handoff.h"
+#include "utils.h"
+
+#include "raveloxmidi_config.h"
+#include "logging.h"
+
+// Sent with the sockets: magic, version, journal layout, number of sockets and length of the session table that follows
+#define NET_HANDOFF_HEADER_SIZE	( 5 * sizeof( uint32_t ) )
+
+// Everything in a session's entry apart from its address, journal and queued packets
+#define NET_HANDOFF_SESSION_SIZE	128
+
+/* The running instance: the listening socket, the accepted instance and duplicates of the sockets to pass to it.
+   A new instance: the sockets and session table it has been passed */
+static int handoff_listen_fd = -1;
+static int handoff_conn_fd = -1;
+static int handoff_fds[ NET_HANDOFF_MAX_FDS ];
+static int handoff_num_fds = 0;
+static int handoff_fds_taken = 0;
+static int handoff_sent = 0;
+static unsigned char *handoff_state = NULL;
+static size_t handoff_state_len = 0;
+static uint32_t handoff_journal_layout = 0;
+
+static void net_handoff_fds_close( void )
+{
+	int i = 0;
+
+	for( i = 0; i < handoff_num_fds; i++ )
+	{
+		close( handoff_fds[i] );
+	}
+	handoff_num_fds = 0;
+}
+
+static int net_handoff_address( char *path, struct sockaddr_un *address )
+{
+	memset( address, 0, sizeof( struct sockaddr_un ) );
+	address->sun_family = AF_UNIX;
+
+	if( strlen( path ) >= sizeof( address->sun_path ) )
+	{
+		logging_printf( LOGGING_ERROR, "net_handoff_address: handoff.socket is too long: %s\n", path );
+		return -1;
+	}
+	strcpy( address->sun_path, path );
+
+	return 0;
+}
+
+static void net_handoff_timeout( int fd )
+{
+	struct timeval tv;
+
+	memset( &tv, 0, sizeof( tv ) );
+	tv.tv_sec = NET_HANDOFF_TIMEOUT;
+	setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof( tv ) );
+	setsockopt( fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof( tv ) );
+}
+
+/* Reads exactly len bytes. Returns -1 on error, timeout or if the other end closes first */
+static int net_handoff_read( int fd, unsigned char *buffer, size_t len )
+{
+	ssize_t ret = 0;
+	size_t done = 0;
+
+	while( done < len )
+	{
+		ret = recv( fd, buffer + done, len - done, 0 );
+		if( ret < 0 && errno == EINTR ) continue;
+		if( ret <= 0 ) return -1;
+		done += ret;
+	}
+
+	return 0;
+}
+
+static int net_handoff_write( int fd, unsigned char *buffer, size_t len )
+{
+	ssize_t ret = 0;
+	size_t done = 0;
+
+	while( done < len )
+	{
+		ret = send( fd, buffer + done, len - done, MSG_NOSIGNAL );
+		if( ret < 0 && errno == EINTR ) continue;
+		if( ret <= 0 ) return -1;
+		done += ret;
+	}
+
+	return 0;
+}
+
+int net_handoff_receive( void )
+{
+	struct sockaddr_un address;
+	unsigned char header[ NET_HANDOFF_HEADER_SIZE ];
+	char control[ CMSG_SPACE( NET_HANDOFF_MAX_FDS * sizeof( int ) ) ];
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg = NULL;
+	unsigned char *p = NULL;
+	size_t len = 0;
+	uint32_t magic = 0;
+	uint32_t version = 0;
+	uint32_t journal_layout = 0;
+	uint32_t num_fds = 0;
+	uint32_t state_len = 0;
+	unsigned char eof = 0;
+	char *path = NULL;
+	int fd = -1;
+	ssize_t ret = 0;
+
+	path = config_string_get("handoff.socket");
+	if( ! path ) return -1;
+	if( net_handoff_address( path, &address ) != 0 ) return -1;
+
+	fd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+	if( fd < 0 )
+	{
+		logging_printf( LOGGING_ERROR, "net_handoff_receive: Unable to create socket: %s\n", strerror( errno ) );
+		return -1;
+	}
+
+	// Nothing is listening. This is the only instance
+	if( connect( fd, (struct sockaddr *)&address, sizeof( address ) ) != 0 )
+	{
+		if( errno != ENOENT && errno != ECONNREFUSED )
+		{
+			logging_printf( LOGGING_WARN, "net_handoff_receive: Unable to connect to %s: %s\n", path, strerror( errno ) );
+		}
+		close( fd );
+		return -1;
+	}
+
+	logging_printf( LOGGING_NORMAL, "Taking over from the running instance on %s\n", path );
+	net_handoff_timeout( fd );
+
+	memset( &msg, 0, sizeof( msg ) );
+	memset( control, 0, sizeof( control ) );
+	iov.iov_base = header;
+	iov.iov_len = sizeof( header );
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof( control );
+
+	do {
+		ret = recvmsg( fd, &msg, MSG_WAITALL );
+	} while( ret < 0 && errno == EINTR );
+
+	// The sockets arrive with the first byte of the header
+	handoff_num_fds = 0;
+	for( cmsg = CMSG_FIRSTHDR( &msg ); cmsg; cmsg = CMSG_NXTHDR( &msg, cmsg ) )
+	{
+		if( cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ) continue;
+		handoff_num_fds = ( cmsg->cmsg_len - CMSG_LEN( 0 ) ) / sizeof( int );
+		if( handoff_num_fds > NET_HANDOFF_MAX_FDS ) handoff_num_fds = NET_HANDOFF_MAX_FDS;
+		memcpy( handoff_fds, CMSG_DATA( cmsg ), handoff_num_fds * sizeof( int ) );
+	}
+
+	if( ret != sizeof( header ) || ( msg.msg_flags & MSG_CTRUNC ) )
+	{
+		logging_printf( LOGGING_WARN, "net_handoff_receive: The running instance didn't hand over. Starting as usual\n");
+		goto receive_fail;
+	}
+
+	p = header;
+	len = sizeof( header );
+	get_uint32( &magic, &p, &len );
+	get_uint32( &version, &p, &len );
+	get_uint32( &journal_layout, &p, &len );
+	get_uint32( &num_fds, &p, &len );
+	get_uint32( &state_len, &p, &len );
+
+	if( magic != NET_HANDOFF_MAGIC || version != NET_HANDOFF_VERSION || num_fds != (uint32_t)handoff_num_fds || num_fds <= NET_HANDOFF_FD_DATA )
+	{
+		logging_printf( LOGGING_WARN, "net_handoff_receive: Unable to take over. magic=0x%08x version=%u sockets=%u received=%d\n", magic, version, num_fds, handoff_num_fds );
+		goto receive_fail;
+	}
+
+	handoff_journal_layout = journal_layout;
+	if( journal_layout != JOURNAL_LAYOUT_VERSION )
+	{
+		logging_printf( LOGGING_WARN, "net_handoff_receive: Journal layout %u is not %u. Journals will be reset\n", journal_layout, JOURNAL_LAYOUT_VERSION );
+	}
+
+	handoff_state = ( unsigned char * ) malloc( state_len > 0 ? state_len : 1 );
+	if( ! handoff_state )
+	{
+		logging_printf( LOGGING_ERROR, "net_handoff_receive: Insufficient memory for %u bytes of session state\n", state_len );
+		goto receive_fail;
+	}
+
+	if( net_handoff_read( fd, handoff_state, state_len ) != 0 )
+	{
+		logging_printf( LOGGING_WARN, "net_handoff_receive: Session state incomplete: %s. Sessions will not be resumed\n", strerror( errno ) );
+		FREENULL( "net_handoff_receive: handoff_state", (void **)&handoff_state );
+		state_len = 0;
+	}
+	handoff_state_len = state_len;
+
+	/* The running instance closes the connection as it exits. Until then it still has the ALSA devices,
+	   the service registration and the pid file */
+	do {
+		ret = recv( fd, &eof, sizeof( eof ), 0 );
+	} while( ret < 0 && errno == EINTR );
+
+	if( ret != 0 )
+	{
+		logging_printf( LOGGING_WARN, "net_handoff_receive: The running instance hasn't exited after %d seconds\n", NET_HANDOFF_TIMEOUT );
+	}
+
+	close( fd );
+
+	logging_printf( LOGGING_INFO, "net_handoff_receive: sockets=%d state_len=%zu\n", handoff_num_fds, handoff_state_len );
+
+	return 0;
+
+receive_fail:
+	net_handoff_fds_close();
+	close( fd );
+	return -1;
+}
+
+int net_handoff_fds( int **fds )
+{
+	if( ! fds ) return 0;
+
+	*fds = handoff_fds;
+	return ( handoff_fds_taken ? 0 : handoff_num_fds );
+}
+
+void net_handoff_fds_taken( void )
+{
+	if( handoff_num_fds > 0 ) handoff_fds_taken = 1;
+}
+
+void net_handoff_fds_refused( void )
+{
+	if( handoff_fds_taken ) return;
+	if( handoff_num_fds == 0 && ! handoff_state ) return;
+
+	logging_printf( LOGGING_WARN, "net_handoff_fds_refused: Sessions will not be resumed\n");
+	net_handoff_fds_close();
+	FREENULL( "net_handoff_fds_refused: handoff_state", (void **)&handoff_state );
+	handoff_state_len = 0;
+}
+
+static int net_handoff_get16( uint16_t *value, unsigned char **p, size_t *len )
+{
+	if( *len < sizeof( uint16_t ) ) return -1;
+	get_uint16( value, p, len );
+	return 0;
+}
+
+static int net_handoff_get32( uint32_t *value, unsigned char **p, size_t *len )
+{
+	if( *len < sizeof( uint32_t ) ) return -1;
+	get_uint32( value, p, len );
+	return 0;
+}
+
+static int net_handoff_get64( uint64_t *value, unsigned char **p, size_t *len )
+{
+	if( *len < sizeof( uint64_t ) ) return -1;
+	get_uint64( value, p, len );
+	return 0;
+}
+
+/* One session from the table. Returns -1 if the table is cut short */
+static int net_handoff_restore_session( unsigned char **p, size_t *len )
+{
+	char ip_address[ INET6_ADDRSTRLEN ];
+	net_ctx_t *ctx = NULL;
+	uint32_t ssrc = 0, send_ssrc = 0, initiator = 0, seq = 0;
+	uint16_t control_port = 0, data_port = 0, received_seq = 0, ip_len = 0;
+	uint64_t start = 0, last_heard = 0, journal_time = 0;
+	uint32_t feedback_pending = 0, probed = 0, rate_limit = 0;
+	uint32_t journal_len = 0, tx_depth = 0, kind = 0;
+	uint16_t key = 0, tx_len = 0;
+	unsigned char *journal = NULL;
+	uint32_t queued = 0;
+	uint32_t i = 0;
+
+	if( net_handoff_get32( &ssrc, p, len ) || net_handoff_get32( &send_ssrc, p, len ) ||
+		net_handoff_get32( &initiator, p, len ) || net_handoff_get32( &seq, p, len ) ||
+		net_handoff_get16( &control_port, p, len ) || net_handoff_get16( &data_port, p, len ) ||
+		net_handoff_get64( &start, p, len ) || net_handoff_get64( &last_heard, p, len ) ||
+		net_handoff_get64( &journal_time, p, len ) || net_handoff_get16( &received_seq, p, len ) ||
+		net_handoff_get32( &feedback_pending, p, len ) || net_handoff_get32( &probed, p, len ) ||
+		net_handoff_get32( &rate_limit, p, len ) || net_handoff_get16( &ip_len, p, len ) ) return -1;
+
+	if( ip_len >= sizeof( ip_address ) || *len < ip_len ) return -1;
+	memcpy( ip_address, *p, ip_len );
+	ip_address[ ip_len ] = '\0';
+	*p += ip_len;
+	*len -= ip_len;
+
+	if( net_handoff_get32( &journal_len, p, len ) || *len < journal_len ) return -1;
+	journal = *p;
+	*p += journal_len;
+	*len -= journal_len;
+
+	ctx = net_ctx_register( ssrc, initiator, ip_address, control_port );
+	if( ! ctx ) return -1;
+
+	ctx->send_ssrc = send_ssrc;
+	ctx->seq = seq;
+	ctx->data_port = data_port;
+	ctx->start = (time_t)start;
+	ctx->last_heard = (time_t)last_heard;
+	ctx->journal_time = (time_t)journal_time;
+	ctx->received_seq = received_seq;
+	ctx->feedback_pending = (int)feedback_pending;
+	ctx->probed = (int)probed;
+
+	// The journal is passed as it is held, so it can only be used by a build with the same layout
+	if( handoff_journal_layout == JOURNAL_LAYOUT_VERSION && journal_len == sizeof( journal_t ) )
+	{
+		memcpy( ctx->journal, journal, journal_len );
+	} else {
+		logging_printf( LOGGING_WARN, "net_handoff_restore_session: ssrc=0x%08x journal layout has changed. Journal reset\n", ssrc );
+		net_ctx_journal_reset( ctx );
+	}
+
+	net_ctx_tx_rate_set( ctx, rate_limit );
+
+	if( net_handoff_get32( &tx_depth, p, len ) ) return -1;
+	for( i = 0; i < tx_depth; i++ )
+	{
+		if( net_handoff_get32( &kind, p, len ) || net_handoff_get16( &key, p, len ) ||
+			net_handoff_get16( &tx_len, p, len ) || *len < tx_len ) return -1;
+
+		if( net_ctx_tx_queue( ctx, *p, tx_len, (int)kind, key ) == 0 ) queued++;
+		*p += tx_len;
+		*len -= tx_len;
+	}
+
+	if( queued < tx_depth )
+	{
+		logging_printf( LOGGING_WARN, "net_handoff_restore_session: ssrc=0x%08x %u queued packets dropped\n", ssrc, tx_depth - queued );
+	}
+
+	logging_printf( LOGGING_NORMAL, "Resumed session ssrc=0x%08x host=%s control=%u data=%u seq=%u queued=%u\n",
+		ctx->ssrc, ctx->ip_address, ctx->control_port, ctx->data_port, ctx->seq, queued );
+
+	return 0;
+}
+
+void net_handoff_restore( void )
+{
+	unsigned char *p = NULL;
+	size_t len = 0;
+	uint32_t num_sessions = 0;
+	uint32_t i = 0;
+
+	// The sessions can only carry on over the sockets that were passed over
+	if( ! handoff_fds_taken ) net_handoff_fds_refused();
+	if( ! handoff_state ) return;
+
+	p = handoff_state;
+	len = handoff_state_len;
+
+	if( net_handoff_get32( &num_sessions, &p, &len ) == 0 )
+	{
+		net_ctx_lock();
+		for( i = 0; i < num_sessions; i++ )
+		{
+			if( net_handoff_restore_session( &p, &len ) != 0 )
+			{
+				logging_printf( LOGGING_WARN, "net_handoff_restore: Session state is incomplete. %u of %u sessions resumed\n", i, num_sessions );
+				break;
+			}
+		}
+		net_ctx_unlock();
+	}
+
+	FREENULL( "net_handoff_restore: handoff_state", (void **)&handoff_state );
+	handoff_state_len = 0;
+}
+
+int net_handoff_listen( void )
+{
+	struct sockaddr_un address;
+	char *path = NULL;
+	int fd = -1;
+
+	path = config_string_get("handoff.socket");
+	if( ! path ) return -1;
+	if( net_handoff_address( path, &address ) != 0 ) return -1;
+
+	fd = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+	if( fd < 0 )
+	{
+		logging_printf( LOGGING_ERROR, "net_handoff_listen: Unable to create socket: %s\n", strerror( errno ) );
+		return -1;
+	}
+
+	// Left behind by an instance that didn't exit cleanly. A running instance would have been taken over by now
+	unlink( path );
+
+	if( bind( fd, (struct sockaddr *)&address, sizeof( address ) ) != 0 ||
+		chmod( path, S_IRUSR | S_IWUSR ) != 0 ||
+		listen( fd, 1 ) != 0 )
+	{
+		logging_printf( LOGGING_ERROR, "net_handoff_listen: Unable to listen on %s: %s\n", path, strerror( errno ) );
+		close( fd );
+		return -1;
+	}
+
+	handoff_listen_fd = fd;
+	handoff_sent = 0;
+
+	logging_printf( LOGGING_INFO, "net_handoff_listen: Listening on %s\n", path );
+
+	return fd;
+}
+
+int net_handoff_accept( int *fds, int num_fds )
+{
+	struct ucred cred;
+	socklen_t cred_len = sizeof( cred );
+	int fd = -1;
+	int i = 0;
+
+	if( handoff_listen_fd < 0 ) return -1;
+	if( ! fds ) return -1;
+
+	fd = accept4( handoff_listen_fd, NULL, NULL, SOCK_CLOEXEC );
+	if( fd < 0 )
+	{
+		if( errno != EAGAIN && errno != EWOULDBLOCK )
+		{
+			logging_printf( LOGGING_WARN, "net_handoff_accept: Unable to accept: %s\n", strerror( errno ) );
+		}
+		return -1;
+	}
+
+	// Only this user, or root, can take the sockets over
+	if( handoff_conn_fd >= 0 || getsockopt( fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len ) != 0 ||
+		( cred.uid != getuid() && cred.uid != 0 ) )
+	{
+		logging_printf( LOGGING_WARN, "net_handoff_accept: Handoff refused\n");
+		close( fd );
+		return -1;
+	}
+
+	if( num_fds > NET_HANDOFF_MAX_FDS ) num_fds = NET_HANDOFF_MAX_FDS;
+
+	// The originals are closed by the usual teardown before the new instance is told this one has exited
+	for( i = 0; i < num_fds; i++ )
+	{
+		handoff_fds[i] = fcntl( fds[i], F_DUPFD_CLOEXEC, 0 );
+		if( handoff_fds[i] < 0 )
+		{
+			logging_printf( LOGGING_ERROR, "net_handoff_accept: Unable to duplicate socket %d: %s\n", fds[i], strerror( errno ) );
+			handoff_num_fds = i;
+			net_handoff_fds_close();
+			close( fd );
+			return -1;
+		}
+	}
+	handoff_num_fds = num_fds;
+
+	net_handoff_timeout( fd );
+	handoff_conn_fd = fd;
+
+	logging_printf( LOGGING_NORMAL, "Handing over to new instance pid=%d\n", (int)cred.pid );
+
+	return 0;
+}
+
+int net_handoff_send( void )
+{
+	unsigned char header[ NET_HANDOFF_HEADER_SIZE ];
+	char control[ CMSG_SPACE( NET_HANDOFF_MAX_FDS * sizeof( int ) ) ];
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg = NULL;
+	net_ctx_tx_t *tx = NULL;
+	net_ctx_t *ctx = NULL;
+	unsigned char *state = NULL;
+	unsigned char *p = NULL;
+	size_t state_size = sizeof( uint32_t );
+	size_t state_len = 0;
+	size_t len = 0;
+	uint32_t num_sessions = 0;
+	uint16_t ip_len = 0;
+	uint32_t i = 0;
+	ssize_t ret = 0;
+
+	if( handoff_conn_fd < 0 ) return -1;
+
+	// Nothing is reading the sockets or changing the sessions now
+	net_ctx_lock();
+
+	for( net_ctx_iter_start_head(); net_ctx_iter_has_current(); net_ctx_iter_next() )
+	{
+		ctx = net_ctx_iter_current();
+		state_size += NET_HANDOFF_SESSION_SIZE + strlen( ctx->ip_address ) + sizeof( journal_t );
+		state_size += ctx->tx_depth * ( NET_HANDOFF_SESSION_SIZE + NET_APPLEMIDI_UDPSIZE );
+	}
+
+	state = ( unsigned char * ) malloc( state_size );
+	if( ! state )
+	{
+		net_ctx_unlock();
+		logging_printf( LOGGING_ERROR, "net_handoff_send: Insufficient memory for %zu bytes of session state\n", state_size );
+		goto send_fail;
+	}
+
+	p = state + sizeof( uint32_t );
+	state_len = sizeof( uint32_t );
+
+	for( net_ctx_iter_start_head(); net_ctx_iter_has_current(); net_ctx_iter_next() )
+	{
+		ctx = net_ctx_iter_current();
+		ip_len = strlen( ctx->ip_address );
+
+		put_uint32( &p, ctx->ssrc, &state_len );
+		put_uint32( &p, ctx->send_ssrc, &state_len );
+		put_uint32( &p, ctx->initiator, &state_len );
+		put_uint32( &p, ctx->seq, &state_len );
+		put_uint16( &p, ctx->control_port, &state_len );
+		put_uint16( &p, ctx->data_port, &state_len );
+		put_uint64( &p, (uint64_t)ctx->start, &state_len );
+		put_uint64( &p, (uint64_t)ctx->last_heard, &state_len );
+		put_uint64( &p, (uint64_t)ctx->journal_time, &state_len );
+		put_uint16( &p, ctx->received_seq, &state_len );
+		put_uint32( &p, (uint32_t)ctx->feedback_pending, &state_len );
+		put_uint32( &p, (uint32_t)ctx->probed, &state_len );
+		put_uint32( &p, ctx->rate_limit, &state_len );
+
+		put_uint16( &p, ip_len, &state_len );
+		memcpy( p, ctx->ip_address, ip_len );
+		p += ip_len;
+		state_len += ip_len;
+
+		put_uint32( &p, sizeof( journal_t ), &state_len );
+		memcpy( p, ctx->journal, sizeof( journal_t ) );
+		p += sizeof( journal_t );
+		state_len += sizeof( journal_t );
+
+		put_uint32( &p, ctx->tx_depth, &state_len );
+		for( i = 0; i < ctx->tx_depth; i++ )
+		{
+			tx = &( ctx->tx_slots[ ctx->tx_order[i] ] );
+			put_uint32( &p, (uint32_t)tx->kind, &state_len );
+			put_uint16( &p, tx->key, &state_len );
+			put_uint16( &p, (uint16_t)tx->len, &state_len );
+			memcpy( p, tx->data, tx->len );
+			p += tx->len;
+			state_len += tx->len;
+		}
+
+		num_sessions++;
+	}
+
+	net_ctx_unlock();
+
+	p = state;
+	len = 0;
+	put_uint32( &p, num_sessions, &len );
+
+	p = header;
+	len = 0;
+	put_uint32( &p, NET_HANDOFF_MAGIC, &len );
+	put_uint32( &p, NET_HANDOFF_VERSION, &len );
+	put_uint32( &p, JOURNAL_LAYOUT_VERSION, &len );
+	put_uint32( &p, (uint32_t)handoff_num_fds, &len );
+	put_uint32( &p, (uint32_t)state_len, &len );
+
+	memset( &msg, 0, sizeof( msg ) );
+	memset( control, 0, sizeof( control ) );
+	iov.iov_base = header;
+	iov.iov_len = sizeof( header );
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = CMSG_SPACE( handoff_num_fds * sizeof( int ) );
+
+	cmsg = CMSG_FIRSTHDR( &msg );
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN( handoff_num_fds * sizeof( int ) );
+	memcpy( CMSG_DATA( cmsg ), handoff_fds, handoff_num_fds * sizeof( int ) );
+
+	do {
+		ret = sendmsg( handoff_conn_fd, &msg, MSG_NOSIGNAL );
+	} while( ret < 0 && errno == EINTR );
+
+	if( ret != sizeof( header ) || net_handoff_write( handoff_conn_fd, state, state_len ) != 0 )
+	{
+		logging_printf( LOGGING_ERROR, "net_handoff_send: Unable to hand over to the new instance: %s\n", strerror( errno ) );
+		goto send_fail;
+	}
+
+	logging_printf( LOGGING_NORMAL, "Handed %u sessions over to the new instance\n", num_sessions );
+
+	FREENULL( "net_handoff_send: state", (void **)&state );
+	net_handoff_fds_close();
+	handoff_sent = 1;
+
+	return 0;
+
+send_fail:
+	FREENULL( "net_handoff_send: state", (void **)&state );
+	net_handoff_fds_close();
+	close( handoff_conn_fd );
+	handoff_conn_fd = -1;
+	return -1;
+}
+
+void net_handoff_teardown( void )
+{
+	char *path = NULL;
+
+	if( handoff_listen_fd >= 0 )
+	{
+		close( handoff_listen_fd );
+		handoff_listen_fd = -1;
+
+		// Once handed over, the new instance listens on the path itself
+		path = config_string_get("handoff.socket");
+		if( path && ! handoff_sent ) unlink( path );
+	}
+
+	net_handoff_fds_close();
+	FREENULL( "net_handoff_teardown: handoff_state", (void **)&handoff_state );
+
+	if( handoff_conn_fd >= 0 )
+	{
+		close( handoff_conn_fd );
+		handoff_conn_fd = -1;
+	}
+}
@@ -32,25 +32,51 @@
 #include <pthread.h>
 
 #include "net_response.h"
+#include "pool.h"
 #include "utils.h"
 #include "logging.h"
 #include "config.h"
 
+static pool_t *net_response_pool = NULL;
+
+void net_response_pool_init( uint32_t capacity )
+{
+	if( net_response_pool ) return;
+	net_response_pool = pool_create( "net_response", sizeof( net_response_t ), capacity );
+}
+
+void net_response_pool_teardown( void )
+{
+	pool_dump( net_response_pool );
+	pool_destroy( &net_response_pool );
+}
+
 net_response_t * net_response_create( void )
 {
 	net_response_t *response = NULL;
 
-	response =( net_response_t *) malloc( sizeof( net_response_t ) );
+	response =( net_response_t *) pool_alloc( net_response_pool, sizeof( net_response_t ) );
 
 	if( response )
 	{
 		response->buffer = NULL;
 		response->len = 0;
+		response->size = 0;
 	}
 
 	return response;
 }
 
+/* Point a response at storage owned by the caller. It must not be passed to net_response_destroy() */
+void net_response_init( net_response_t *response, unsigned char *buffer, size_t size )
+{
+	if( ! response ) return;
+
+	response->buffer = buffer;
+	response->len = 0;
+	response->size = ( buffer ? size : 0 );
+}
+
 void net_response_destroy( net_response_t **response )
 {
 	if( ! *response ) return;
@@ -61,6 +87,6 @@ void net_response_destroy( net_response_t **response )
 		(*response)->buffer = NULL;
 	}
 
-	free( *response );
+	pool_free( net_response_pool, *response );
 	*response = NULL;
 }
@@ -31,6 +31,11 @@
 #include <net/if.h>
 
 #include <pthread.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
 
 #include <errno.h>
 extern int errno;
@@ -41,10 +46,12 @@ extern int errno;
 #include "net_response.h"
 #include "net_socket.h"
 #include "net_connection.h"
+#include "net_handoff.h"
 
 #include "cmd_inv_handler.h"
 #include "cmd_sync_handler.h"
 #include "cmd_feedback_handler.h"
+#include "cmd_bitrate_handler.h"
 #include "cmd_end_handler.h"
 
 #include "midi_note.h"
@@ -54,13 +61,28 @@ extern int errno;
 #include "rtp_packet.h"
 #include "midi_command.h"
 #include "midi_payload.h"
+#include "arena.h"
+#include "pool.h"
+#include "pipeline.h"
+#include "realtime.h"
+#include "timer_wheel.h"
 #include "utils.h"
 
 #include "raveloxmidi_config.h"
+#include "raveloxmidi_probes.h"
+#include "packet_capture.h"
 #include "logging.h"
 
 #include "raveloxmidi_alsa.h"
 
+#ifdef HAVE_ALSA
+#include "ring.h"
+#endif
+
+#ifdef HAVE_IO_URING
+#include "uring.h"
+#endif
+
 static int num_sockets = 0;
 static int *sockets = NULL;
 static int net_socket_shutdown;
@@ -69,18 +91,110 @@ static unsigned char *packet = NULL;
 static size_t packet_size = 0;
 #ifdef HAVE_ALSA
 static size_t alsa_buffer_size = 0;
+/* ALSA input is one byte stream so running status carries from one read to the next.
+   Only the thread handling ALSA input touches it */
+static unsigned char alsa_running_status = 0;
 #endif
 
 static fd_set read_fds;
+static fd_set write_fds;
 static int max_fd = 0;
 
 static pthread_mutex_t shutdown_lock;
 static pthread_mutex_t socket_mutex;
+
+static volatile sig_atomic_t reload_requested = 0;
+
+/* Listens for a new instance to hand the sockets and sessions over to. Only when handoff.socket is set */
+static int handoff_fd = -1;
+
+#ifdef HAVE_ALSA
+static int alsa_listener_running = 0;
+static volatile int alsa_listener_stop = 0;
+
+/* The ALSA listener only reads the input device. What it reads is passed to the
+   main loop through alsa_ring and alsa_event_fd wakes select() */
+static ring_t *alsa_ring = NULL;
+static int alsa_event_fd = -1;
+static unsigned char *alsa_read_buffer = NULL;
+static uint32_t alsa_overflows_reported = 0;
+#endif
 pthread_t alsa_listener_thread;
 int socket_timeout = 0;
 int pipe_fd[2];
 
+/* A packet on its way to a pipeline stage. from_addr is only set for network packets */
+typedef struct net_socket_message_t {
+	int			fd;
+	struct sockaddr_storage	from_addr;
+	socklen_t		from_len;
+	size_t			len;
+	unsigned char		data[];
+} net_socket_message_t;
+
+/* Only created when pipeline.enabled is set. Otherwise packets are handled by the thread that reads them */
+static pool_t *message_pool = NULL;
+static pipeline_stage_t *control_stage = NULL;
+static pipeline_stage_t *egress_stage = NULL;
+static pipeline_stage_t *inbound_stage = NULL;
+static int ingress_cpu = PIPELINE_CPU_ANY;
+
+/* Data port workers. Only created when network.data.workers is more than 1.
+   The data port is opened once per worker with SO_REUSEPORT and the kernel spreads
+   datagrams across the sockets by source address. Worker 0 uses the socket at DATA_PORT,
+   which is also the one that outbound RTP is sent from */
+#define NET_SOCKET_MAX_DATA_WORKERS	64
+
+/* Owners already looked up by a worker. Most sessions are found here without taking the table lock */
+#define NET_SOCKET_WORKER_OWNERS	16
+
+typedef struct net_socket_owner_t {
+	uint32_t	ssrc;
+	int		owner;
+} net_socket_owner_t;
+
+typedef struct net_socket_worker_t {
+	int		id;
+	int		fd;
+	int		event_fd;
+	char		name[ 16 ];
+	queue_t		*inbox;
+	pthread_t	thread;
+	int		running;
+	uint32_t	owners_generation;
+	uint32_t	num_owners;
+	net_socket_owner_t	owners[ NET_SOCKET_WORKER_OWNERS ];
+	uint32_t	packets;
+	uint32_t	handed_off;
+	uint32_t	dropped;
+	unsigned char	buffer[ NET_APPLEMIDI_UDPSIZE + 1 ];
+} net_socket_worker_t;
+
+/* Housekeeping timers. Only added, cancelled and run on the main loop thread */
+static timer_wheel_t *timers = NULL;
+static int timer_fd = -1;
+static int timer_fd_armed = 0;
+
+/* Milliseconds between feedback packets to each session, or 0 for feedback to every RTP packet. Read by any thread */
+static int feedback_interval = 0;
+
+/* Counted by any thread and reported by the stats timer */
+static uint32_t stats_packets = 0;
+static uint32_t stats_rtp_in = 0;
+static uint32_t stats_rtp_out = 0;
+
+static net_socket_worker_t *data_workers = NULL;
+static int num_data_workers = 0;
+static int data_workers_running = 0;
+static int data_workers_stop = 0;
+
 static void set_shutdown_lock( int i );
+static void net_socket_check_reload( void );
+static void net_socket_workers_stop( void );
+static int net_socket_uring_send( int fd, unsigned char *buffer, size_t len, struct sockaddr_storage *to_addr, socklen_t to_len );
+#ifdef HAVE_ALSA
+static void net_socket_alsa_ring_destroy( void );
+#endif
 
 void net_socket_add( int new_socket )
 {
@@ -98,19 +212,21 @@ void net_socket_add( int new_socket )
 	sockets[num_sockets - 1 ] = new_socket;
 }
 
-int net_socket_create(int family, char *bind_address, unsigned int port )
+/* Returns the bound socket, or -1 with errno set. With reuse_port set, other sockets can be bound to the same port */
+static int net_socket_open( int family, char *bind_address, unsigned int port, int reuse_port )
 {
 	int new_socket;
 	struct sockaddr_in6 socket_address;
 	socklen_t addr_len = 0;
 	int optionvalue = 0;
+	int saved_errno = 0;
 
-	logging_printf(LOGGING_DEBUG, "net_socket_create: Creating socket for [%s]:%u, family=%d\n", bind_address, port, family);
+	logging_printf(LOGGING_DEBUG, "net_socket_open: Creating socket for [%s]:%u, family=%d, reuse_port=%d\n", bind_address, port, family, reuse_port);
 
 	new_socket = socket(family, SOCK_DGRAM, 0);
 	if( new_socket < 0 )
 	{
-		return errno;
+		return -1;
 	}
 
 	switch( family )
@@ -122,17 +238,172 @@ int net_socket_create(int family, char *bind_address, unsigned int port )
 		default:
 			break;
 	}
+
+	optionvalue = 1;
+	if( reuse_port && setsockopt( new_socket, SOL_SOCKET, SO_REUSEPORT, (char *)&optionvalue, sizeof( optionvalue ) ) < 0 )
+	{
+		saved_errno = errno;
+		close( new_socket );
+		errno = saved_errno;
+		return -1;
+	}
 			
 	get_sock_addr( bind_address, port, (struct sockaddr *)&socket_address, &addr_len);
 
 	if ( bind(new_socket, (struct sockaddr *)&socket_address, addr_len) < 0 )
 	{       
-		return errno;
+		saved_errno = errno;
+		close( new_socket );
+		errno = saved_errno;
+		return -1;
         } 
 
+	fcntl(new_socket, F_SETFL, O_NONBLOCK);
+
+	return new_socket;
+}
+
+int net_socket_create(int family, char *bind_address, unsigned int port )
+{
+	int new_socket;
+
+	new_socket = net_socket_open( family, bind_address, port, 0 );
+	if( new_socket < 0 )
+	{
+		return errno;
+	}
+
 	net_socket_add( new_socket );
 
-	fcntl(new_socket, F_SETFL, O_NONBLOCK);
+	return 0;
+}
+
+/* The data port is opened once for each worker. The first socket goes into the socket list as DATA_PORT */
+static int net_socket_data_create( int family, char *bind_address, unsigned int port )
+{
+	long workers = 0;
+	int new_socket = -1;
+	int i = 0;
+
+	workers = config_long_get("network.data.workers");
+	if( workers > NET_SOCKET_MAX_DATA_WORKERS ) workers = NET_SOCKET_MAX_DATA_WORKERS;
+	if( workers < 2 ) return net_socket_create( family, bind_address, port );
+
+	data_workers = ( net_socket_worker_t * ) calloc( workers, sizeof( net_socket_worker_t ) );
+	if( ! data_workers )
+	{
+		logging_printf(LOGGING_ERROR, "net_socket_data_create: Insufficient memory for %ld data workers\n", workers );
+		return net_socket_create( family, bind_address, port );
+	}
+
+	for( i = 0; i < workers; i++ )
+	{
+		new_socket = net_socket_open( family, bind_address, port, 1 );
+		if( new_socket < 0 ) break;
+
+		data_workers[i].id = i;
+		data_workers[i].fd = new_socket;
+		data_workers[i].event_fd = -1;
+		if( i == 0 ) net_socket_add( new_socket );
+	}
+	num_data_workers = i;
+
+	if( num_data_workers < workers )
+	{
+		logging_printf(LOGGING_WARN, "net_socket_data_create: Only %d of %ld data sockets opened: %s\n", num_data_workers, workers, strerror( errno ) );
+	}
+
+	// SO_REUSEPORT isn't available. The data port is read by the main loop as usual
+	if( num_data_workers == 0 )
+	{
+		FREENULL( "net_socket_data_create: data_workers", (void **)&data_workers );
+		return net_socket_create( family, bind_address, port );
+	}
+
+	return 0;
+}
+
+static int net_socket_port( int fd )
+{
+	struct sockaddr_storage address;
+	socklen_t addr_len = sizeof( address );
+
+	memset( &address, 0, sizeof( address ) );
+	if( getsockname( fd, (struct sockaddr *)&address, &addr_len ) != 0 ) return -1;
+
+	return ntohs( ((struct sockaddr_in *)&address)->sin_port );
+}
+
+/* Sockets passed over by the instance this one has taken over from. They are only used if they are bound to the
+   configured ports, and every data socket it had is read. Returns -1 if new sockets must be opened */
+static int net_socket_adopt( int control_port, int data_port, int local_port )
+{
+	int *fds = NULL;
+	int num_fds = 0;
+	long workers = 0;
+	int port = 0;
+	int i = 0;
+
+	num_fds = net_handoff_fds( &fds );
+	if( num_fds <= NET_HANDOFF_FD_DATA ) return -1;
+
+	for( i = 0; i < num_fds; i++ )
+	{
+		switch( i )
+		{
+			case NET_HANDOFF_FD_CONTROL:
+				port = control_port;
+				break;
+			case NET_HANDOFF_FD_LOCAL:
+				port = local_port;
+				break;
+			default:
+				port = data_port;
+				break;
+		}
+
+		if( net_socket_port( fds[i] ) != port )
+		{
+			logging_printf(LOGGING_WARN, "net_socket_adopt: Socket passed over is not on port %d. Opening new sockets\n", port );
+			net_handoff_fds_refused();
+			return -1;
+		}
+	}
+
+	workers = num_fds - NET_HANDOFF_FD_DATA;
+	if( workers > 1 )
+	{
+		data_workers = ( net_socket_worker_t * ) calloc( workers, sizeof( net_socket_worker_t ) );
+		if( ! data_workers )
+		{
+			// The kernel stops giving datagrams to the sockets that are closed
+			logging_printf(LOGGING_ERROR, "net_socket_adopt: Insufficient memory for %ld data workers\n", workers );
+			for( i = NET_HANDOFF_FD_DATA + 1; i < num_fds; i++ ) close( fds[i] );
+			workers = 1;
+		}
+	}
+
+	net_socket_add( fds[ NET_HANDOFF_FD_CONTROL ] );
+	net_socket_add( fds[ NET_HANDOFF_FD_DATA ] );
+	net_socket_add( fds[ NET_HANDOFF_FD_LOCAL ] );
+
+	for( i = 0; data_workers && i < workers; i++ )
+	{
+		data_workers[i].id = i;
+		data_workers[i].fd = fds[ NET_HANDOFF_FD_DATA + i ];
+		data_workers[i].event_fd = -1;
+	}
+	num_data_workers = ( data_workers ? workers : 0 );
+
+	net_handoff_fds_taken();
+
+	if( MIN( MAX( config_long_get("network.data.workers"), 1 ), NET_SOCKET_MAX_DATA_WORKERS ) != workers )
+	{
+		logging_printf(LOGGING_WARN, "net_socket_adopt: Using the %ld data sockets passed over. network.data.workers needs a restart without a handoff\n", workers );
+	}
+
+	logging_printf(LOGGING_INFO, "net_socket_adopt: control=%d data=%d local=%d data_sockets=%ld\n",
+		fds[ NET_HANDOFF_FD_CONTROL ], fds[ NET_HANDOFF_FD_DATA ], fds[ NET_HANDOFF_FD_LOCAL ], workers );
 
 	return 0;
 }
@@ -141,6 +412,9 @@ int net_socket_teardown( void )
 {
 	int socket;
 
+	// Closes the extra data sockets if the workers were never started
+	net_socket_workers_stop();
+
 	for(socket = 0 ; socket < num_sockets ; socket++ )
 	{
 #ifdef HAVE_ALSA
@@ -154,385 +428,1925 @@ int net_socket_teardown( void )
 	if( inbound_midi_fd >= 0 ) close(inbound_midi_fd);
 	if( packet ) FREENULL( "net_socket_teardown: packet", (void **)&packet );
 
+#ifdef HAVE_ALSA
+	// alsa_event_fd is in the socket list so it has already been closed
+	net_socket_alsa_ring_destroy();
+	alsa_event_fd = -1;
+#endif
+
+	arena_thread_release();
+
+	midi_note_pool_teardown();
+	midi_control_pool_teardown();
+	midi_program_pool_teardown();
+	rtp_packet_pool_teardown();
+	net_response_pool_teardown();
+
 	return 0;
 }
 
-int net_socket_read( int fd )
+static void net_socket_peer( struct sockaddr_storage *from_addr, char *ip_address, int *from_port )
 {
-	int recv_len;
-	unsigned from_len = 0;
-	struct sockaddr_storage from_addr;
-	int output_enabled = 0;
+	memset( ip_address, 0, INET6_ADDRSTRLEN );
+	get_ip_string( (struct sockaddr *)from_addr, ip_address, INET6_ADDRSTRLEN );
+	*from_port = ntohs( ((struct sockaddr_in *)from_addr)->sin_port );
+}
+
+static void net_socket_reply( int fd, unsigned char *buffer, size_t len, struct sockaddr_storage *from_addr, socklen_t from_len )
+{
+	ssize_t bytes_written = 0;
 	char ip_address[ INET6_ADDRSTRLEN ];
 	int from_port = 0;
 
-	net_applemidi_command *command;
-	int ret = 0;
-
-	memset( ip_address, 0, INET6_ADDRSTRLEN );
-	from_len = sizeof( from_addr );
+	net_socket_peer( from_addr, ip_address, &from_port );
 
-	while( 1 )
+	// Sends handed to io_uring are captured when they complete
+	if( net_socket_uring_send( fd, buffer, len, from_addr, from_len ) == 0 )
 	{
-		memset( packet, 0, packet_size + 1 );
-#ifdef HAVE_ALSA
-		if( fd == RAVELOXMIDI_ALSA_INPUT )
+		bytes_written = len;
+	} else {
+		pthread_mutex_lock( &socket_mutex );
+		bytes_written = sendto( fd, buffer, len , 0 , (void *)from_addr, from_len);
+		pthread_mutex_unlock( &socket_mutex );
+
+		if( bytes_written < 0 )
 		{
-			recv_len = raveloxmidi_alsa_read( packet, alsa_buffer_size);
-		} else {
-#endif
-			recv_len = recvfrom( fd, packet, NET_APPLEMIDI_UDPSIZE, 0, (struct sockaddr *)&from_addr, &from_len );
-			logging_printf(LOGGING_DEBUG, "net_socket_read: from_len=%u\n", from_len );
-			get_ip_string( (struct sockaddr *)&from_addr, ip_address, INET6_ADDRSTRLEN );
-			from_port = ntohs( ((struct sockaddr_in *)&from_addr)->sin_port );
-#ifdef HAVE_ALSA
+			logging_printf( LOGGING_ERROR, "net_socket_reply: Failed to send %u bytes to [%s]:%u\t%s\n", len, ip_address, from_port, strerror( errno ) );
+			return;
 		}
-#endif
-		if ( recv_len <= 0)
-		{   
-			if ( errno == EAGAIN )
-			{
-				logging_printf( LOGGING_DEBUG, "EAGAIN\n");
-				break;
-			}
-			logging_printf(LOGGING_ERROR, "net_socket_read: Socket error (%d) on socket (%d)\n", errno , fd );
+
+		packet_capture_record( CAPTURE_OUTBOUND, fd, (struct sockaddr *)from_addr, buffer, bytes_written );
+	}
+
+	logging_printf( LOGGING_DEBUG, "net_socket_reply: write(bytes=%u,socket=%d,host=%s,port=%u)\n", bytes_written, fd, ip_address, from_port );
+}
+
+// Apple MIDI command on the control or data port
+static void net_socket_applemidi( int fd, unsigned char *buffer, size_t len, struct sockaddr_storage *from_addr, socklen_t from_len )
+{
+	unsigned char response_buffer[ NET_APPLEMIDI_UDPSIZE ];
+	net_response_t response;
+	net_applemidi_view_t applemidi;
+	char ip_address[ INET6_ADDRSTRLEN ];
+	int from_port = 0;
+
+	net_socket_peer( from_addr, ip_address, &from_port );
+
+	// Replies are serialised straight into the stack buffer
+	net_response_init( &response, response_buffer, sizeof( response_buffer ) );
+
+	// The command is decoded in place and only lives as long as the packet buffer
+	if( net_applemidi_view( buffer, len, &applemidi ) != NET_APPLEMIDI_DONE )
+	{
+		logging_printf( LOGGING_DEBUG, "net_socket_applemidi: Short AppleMIDI command (bytes=%u,host=%s,port=%u)\n", len, ip_address, from_port );
+		return;
+	}
+
+	net_applemidi_view_dump( &applemidi );
+	RAVELOXMIDI_PROBE3( applemidi_dispatch, fd, applemidi.command, net_applemidi_view_ssrc( &applemidi ) );
+
+	net_ctx_lock();
+	switch( applemidi.command )
+	{
+		case NET_APPLEMIDI_CMD_INV:
+			cmd_inv_handler( ip_address, from_port, &( applemidi.inv ), &response );
 			break;
-		}
+		case NET_APPLEMIDI_CMD_ACCEPT:
+			break;
+		case NET_APPLEMIDI_CMD_REJECT:
+			break;
+		case NET_APPLEMIDI_CMD_END:
+			cmd_end_handler( &( applemidi.inv ) );
+			break;
+		case NET_APPLEMIDI_CMD_SYNC:
+			cmd_sync_handler( &( applemidi.sync ), &response );
+			break;
+		case NET_APPLEMIDI_CMD_FEEDBACK:
+			cmd_feedback_handler( &( applemidi.feedback ) );
+			break;
+		case NET_APPLEMIDI_CMD_BITRATE:
+			cmd_bitrate_handler( &( applemidi.bitrate ) );
+			break;
+	}
+	net_ctx_unlock();
+
+	if( response.len > 0 )
+	{
+		net_socket_reply( fd, response.buffer, response.len, from_addr, from_len );
+	}
+}
+
+// MIDI note on internal socket or ALSA rawmidi device. The buffer holds MIDI bytes only
+static void net_socket_midi_out( int fd, unsigned char *buffer, size_t len, arena_t *arena )
+{
+	rtp_packet_t *rtp_packet = NULL;
+	unsigned char *packed_rtp_buffer = NULL;
+	size_t packed_rtp_buffer_len = 0;
+
+	midi_note_t *midi_note = NULL;
+	midi_control_t *midi_control = NULL;
+	midi_program_t *midi_program = NULL;
+
+	arena_mark_t command_mark;
+	arena_mark_t ctx_mark;
+
+	struct sockaddr_storage send_address;
+	socklen_t send_address_len = 0;
+
+	midi_command_list_t midi_command_list;
+	midi_command_t midi_command;
+	size_t midi_command_index = 0;
+
+	unsigned char packed_journal[ MAX_JOURNAL_PACKED_SIZE ];
+	size_t packed_journal_len = 0;
+	enum midi_message_type_t message_type = 0;
+	int tx_kind = NET_CTX_TX_OTHER;
+	uint16_t tx_key = 0;
+	int charged = 0;
+
+	unsigned char *stream_status = NULL;
 
 #ifdef HAVE_ALSA
-		if( fd != RAVELOXMIDI_ALSA_INPUT )
-		{
+	// Only ALSA input keeps running status between calls
+	if( fd == RAVELOXMIDI_ALSA_INPUT ) stream_status = &alsa_running_status;
 #endif
-			logging_printf( LOGGING_DEBUG, "net_socket_read: read socket=%d, bytes=%u, host=%s, port=%u, first_byte=%02x)\n", fd, recv_len,ip_address, from_port, packet[0]);
 
-#ifdef HAVE_ALSA
-		} else {
-			logging_printf( LOGGING_DEBUG, "net_socket_read: read socket=ALSA bytes=%u first_byte=%02x\n", recv_len, packet[0] );
+	// Convert the buffer into a set of commands that point into it
+	midi_command_list_parse( &midi_command_list, buffer, len, MIDI_PAYLOAD_STREAM, 0, stream_status );
+
+	for( midi_command_index = 0 ; midi_command_index < midi_command_list.num_commands ; midi_command_index++ )
+	{
+		midi_payload_t *single_midi_payload = NULL;
+		unsigned char *packed_payload = NULL;
+		size_t packed_payload_len = 0;
+
+		midi_command_from_view( &( midi_command_list.commands[ midi_command_index ] ), &midi_command );
+
+		/* Temporaries for this command are released before the next one */
+		arena_mark( arena, &command_mark );
+
+		/* Extract a single command as a midi payload */
+		midi_command_to_payload( &midi_command, &single_midi_payload, arena );
+		if( ! single_midi_payload )
+		{
+			arena_rewind( arena, &command_mark );
+			continue;
 		}
-#endif
-		
-		hex_dump( packet, recv_len );
 
-		// Apple MIDI command
-		if( packet[0] == 0xff )
+		message_type = MIDI_STATUS( midi_command.status )->type;
+		midi_command_dump( &midi_command );
+		RAVELOXMIDI_PROBE3( midi_dispatch, fd, midi_command.status, midi_command.data_len );
+
+		// Used if the packet has to wait in a session's transmit queue
+		tx_kind = NET_CTX_TX_OTHER;
+		tx_key = 0;
+
+		switch( message_type )
+		{
+			case MIDI_NOTE_OFF:
+			case MIDI_NOTE_ON:
+				midi_note_from_command( &midi_command, &midi_note, arena );
+				midi_note_dump( midi_note );
+				break;
+			case MIDI_CONTROL_CHANGE:	
+				midi_control_from_command( &midi_command, &midi_control, arena );
+				midi_control_dump( midi_control );
+				if( midi_control )
+				{
+					tx_kind = NET_CTX_TX_CONTROL;
+					tx_key = ( midi_control->channel << 8 ) | midi_control->controller_number;
+				}
+				break;
+			case MIDI_TIMING_CLOCK:
+			case MIDI_ACTIVE_SENSING:
+				tx_kind = NET_CTX_TX_REALTIME;
+				tx_key = midi_command.status;
+				break;
+			case MIDI_PROGRAM_CHANGE:
+				midi_program_from_command( &midi_command, &midi_program, arena );
+				midi_program_dump( midi_program );
+				break;
+			default:
+				break;
+		}
+
+		// Build the RTP packet
+		net_ctx_lock();
+		for( net_ctx_iter_start_head() ; net_ctx_iter_has_current(); net_ctx_iter_next())
 		{
-			net_response_t *response = NULL;
+			net_ctx_t *current_ctx = net_ctx_iter_current();
+
+			logging_printf( LOGGING_DEBUG, "net_ctx_iter_current()=%p\n", current_ctx );
+			if(! current_ctx ) continue;
+
+			arena_mark( arena, &ctx_mark );
+
+			// Get a journal if there is one
+			pthread_mutex_lock( &socket_mutex );
+			net_ctx_journal_pack( current_ctx , packed_journal, sizeof( packed_journal ), &packed_journal_len);
+			pthread_mutex_unlock( &socket_mutex );
+
+			if( packed_journal_len > 0 )
+			{
+				midi_payload_set_j( single_midi_payload );
+			} else {
+				midi_payload_unset_j( single_midi_payload );
+			}
 
-			ret = net_applemidi_unpack( &command, packet, recv_len );
-			net_applemidi_command_dump( command );
+			// We have to pack the payload again each time because some connections may not have a journal
+			// and the flag to indicate the journal being present is in the payload
+			midi_payload_pack( single_midi_payload, &packed_payload, &packed_payload_len );
+			logging_printf(LOGGING_DEBUG, "packed_payload: buffer=%p,packed_payload_len=%u packed_journal_len=%u\n", packed_payload, packed_payload_len, packed_journal_len);
 
-			switch( command->command )
+			rtp_packet = rtp_packet_create( arena );
+			if( ! rtp_packet )
 			{
-				case NET_APPLEMIDI_CMD_INV:
-					response = cmd_inv_handler( ip_address, from_port, command->data );
-					break;
-				case NET_APPLEMIDI_CMD_ACCEPT:
-					break;
-				case NET_APPLEMIDI_CMD_REJECT:
-					break;
-				case NET_APPLEMIDI_CMD_END:
-					response = cmd_end_handler( command->data );
-					break;
-				case NET_APPLEMIDI_CMD_SYNC:
-					response = cmd_sync_handler( command->data );
-					break;
-				case NET_APPLEMIDI_CMD_FEEDBACK:
-					response = cmd_feedback_handler( command->data );
-					break;
-				case NET_APPLEMIDI_CMD_BITRATE:
-					break;
-					;;
+				arena_rewind( arena, &ctx_mark );
+				continue;
+			}
+			net_ctx_increment_seq( current_ctx );
+
+			// Transfer the connection details to the RTP packet
+			net_ctx_update_rtp_fields( current_ctx , rtp_packet );
+
+			// Join the packed MIDI payload and the journal together as the RTP payload
+			rtp_packet->payload_len = packed_payload_len + packed_journal_len;
+			rtp_packet->payload = (unsigned char *)arena_alloc( arena, rtp_packet->payload_len );
+			if( rtp_packet->payload )
+			{
+				memcpy( rtp_packet->payload, packed_payload , packed_payload_len );
+				memcpy( (unsigned char *)rtp_packet->payload + packed_payload_len , packed_journal, packed_journal_len );
+			} else {
+				rtp_packet->payload_len = 0;
 			}
+			rtp_packet_dump( rtp_packet );
 
-			if( response )
+			// Pack the RTP data
+			rtp_packet_pack( rtp_packet, &packed_rtp_buffer, &packed_rtp_buffer_len );
+			RAVELOXMIDI_PROBE4( rtp_send, rtp_packet->header.ssrc, rtp_packet->header.seq, packed_payload_len, packed_journal_len );
+
+			// In io_uring mode the main loop queues the send for every session and they all go to the kernel together.
+			// A session with packets in its transmit queue, or over its rate limit, has to wait behind them
+			net_ctx_address( current_ctx, &send_address, &send_address_len );
+			// The tokens for the packet are only taken once. net_ctx_send() is told if they were taken here
+			charged = ( current_ctx->tx_depth == 0 && net_ctx_tx_allow( current_ctx, packed_rtp_buffer_len ) );
+			if( ! charged || net_socket_uring_send( sockets[ DATA_PORT ], packed_rtp_buffer, packed_rtp_buffer_len, &send_address, send_address_len ) != 0 )
 			{
-				size_t bytes_written = 0;
 				pthread_mutex_lock( &socket_mutex );
-				bytes_written = sendto( fd, response->buffer, response->len , 0 , (void *)&from_addr, from_len);
+				net_ctx_send( sockets[ DATA_PORT ], current_ctx, packed_rtp_buffer, packed_rtp_buffer_len, tx_kind, tx_key, charged );
 				pthread_mutex_unlock( &socket_mutex );
-				logging_printf( LOGGING_DEBUG, "net_socket_read: write(bytes=%u,socket=%d,host=%s,port=%u)\n", bytes_written, fd,ip_address, from_port );	
-				net_response_destroy( &response );
 			}
 
-			net_applemidi_cmd_destroy( &command );
-		} else if( (packet[0]==0xaa) && (recv_len == 5) && ( strncmp( &(packet[1]),"STAT",4)==0) )
-		// Heartbeat request
+			__atomic_add_fetch( &stats_rtp_out, 1, __ATOMIC_RELAXED );
+			arena_rewind( arena, &ctx_mark );
+
+			switch( message_type )
+			{
+				case MIDI_NOTE_OFF:
+				case MIDI_NOTE_ON:
+					net_ctx_add_journal_note( current_ctx , midi_note );
+					break;
+				case MIDI_CONTROL_CHANGE:
+					net_ctx_add_journal_control( current_ctx, midi_control );
+					break;
+				case MIDI_PROGRAM_CHANGE:	
+					net_ctx_add_journal_program( current_ctx, midi_program );
+					break;
+				default:
+					continue;
+			}
+		}
+		net_ctx_unlock();
+
+		// Clean up
+		midi_note_destroy( &midi_note );
+		midi_control_destroy( &midi_control );
+		midi_program_destroy( &midi_program );
+		arena_rewind( arena, &command_mark );
+	}
+}
+
+// RTP MIDI inbound from remote socket
+static void net_socket_rtp_in( int fd, unsigned char *buffer, size_t len, struct sockaddr_storage *from_addr, socklen_t from_len )
+{
+	rtp_packet_t rtp_packet;
+	midi_payload_header_t midi_payload_header;
+	midi_command_list_t midi_command_list;
+	unsigned char *midi_list = NULL;
+	size_t midi_list_len = 0;
+	unsigned char response_buffer[ NET_APPLEMIDI_COMMAND_SIZE + NET_APPLEMIDI_FEEDBACK_SIZE ];
+	net_response_t response;
+	size_t midi_command_index = 0;
+	int output_enabled = 0;
+
+	// The RTP packet, MIDI payload and commands all refer to the receive buffer
+	memset( &rtp_packet, 0, sizeof( rtp_packet ) );
+	if( rtp_packet_view( buffer, len, &rtp_packet ) != 0 ) return;
+	logging_printf(LOGGING_DEBUG, "net_socket_rtp_in: inbound MIDI received\n");
+	rtp_packet_dump( &rtp_packet );
+
+	midi_command_list.num_commands = 0;
+	if( midi_payload_view( rtp_packet.payload, rtp_packet.payload_len, &midi_payload_header, &midi_list, &midi_list_len ) == 0 )
+	{
+		midi_payload_header_dump( &midi_payload_header );
+
+		// Read all the commands in the packet into the list
+		midi_command_list_parse( &midi_command_list, midi_list, midi_list_len, MIDI_PAYLOAD_RTP, midi_payload_header.Z, NULL );
+	}
+	RAVELOXMIDI_PROBE4( rtp_receive, rtp_packet.header.ssrc, rtp_packet.header.seq, rtp_packet.payload_len, midi_command_list.num_commands );
+
+	__atomic_add_fetch( &stats_rtp_in, 1, __ATOMIC_RELAXED );
+
+	// Sent a FEEBACK packet back to the originating host to ack the MIDI packet.
+	// With network.feedback_interval set, the feedback timer acks the latest packet of each session instead
+	if( net_ctx_received( rtp_packet.header.ssrc, rtp_packet.header.seq ) != 0 || __atomic_load_n( &feedback_interval, __ATOMIC_RELAXED ) == 0 )
+	{
+		net_response_init( &response, response_buffer, sizeof( response_buffer ) );
+		if( cmd_feedback_create( rtp_packet.header.ssrc, rtp_packet.header.seq, &response ) == 0 )
 		{
-			unsigned char *buffer="OK";
-			size_t bytes_written = 0;
-			pthread_mutex_lock( &socket_mutex );
-			bytes_written = sendto( fd, buffer, strlen(buffer), 0 , (void *)&from_addr, from_len);
-			pthread_mutex_unlock( &socket_mutex );
-			logging_printf(LOGGING_DEBUG, "net_socket_read: Heartbeat request. Response written: %u\n", bytes_written);
-		
-		} else if( (packet[0]==0xaa) && (recv_len == 5) && ( strncmp( &(packet[1]),"QUIT",4)==0) )
-		// Shutdown request
+			net_socket_reply( fd, response.buffer, response.len, from_addr, from_len );
+		}
+	}
+
+	// Determine if the MIDI commands need to be written out
+	output_enabled = ( inbound_midi_fd >= 0 );
+#ifdef HAVE_ALSA
+	output_enabled |= raveloxmidi_alsa_out_available();
+#endif
+	if( ! output_enabled ) return;
+
+	logging_printf(LOGGING_DEBUG, "net_socket_rtp_in: output_enabled\n");
+	for( midi_command_index = 0 ; midi_command_index < midi_command_list.num_commands ; midi_command_index++ )
+	{
+		unsigned char *raw_buffer = NULL;
+		size_t raw_buffer_len = 0;
+
+		midi_command_view_raw( &( midi_command_list.commands[ midi_command_index ] ), &raw_buffer, &raw_buffer_len );
+
+		if( raw_buffer )
 		{
-			unsigned char *buffer="QT";
 			size_t bytes_written = 0;
+
+			if( inbound_midi_fd >= 0 )
+			{
+				pthread_mutex_lock( &socket_mutex );
+				bytes_written = write( inbound_midi_fd, raw_buffer, raw_buffer_len );
+				pthread_mutex_unlock( &socket_mutex );
+				logging_printf( LOGGING_DEBUG, "net_socket_rtp_in: inbound MIDI write(bytes=%u)\n", bytes_written );
+			}
+
+#ifdef HAVE_ALSA
 			pthread_mutex_lock( &socket_mutex );
-			bytes_written = sendto( fd, buffer, strlen(buffer), 0 , (void *)&from_addr, from_len);
+			raveloxmidi_alsa_write( raw_buffer, raw_buffer_len );
 			pthread_mutex_unlock( &socket_mutex );
-			logging_printf(LOGGING_DEBUG, "net_socket_read: Shutdown request. Response written: %u\n", bytes_written);
-			logging_printf(LOGGING_NORMAL, "Shutdown request received on local socket\n");
-			set_shutdown_lock(1);
-#ifdef HAVE_ALSA
-		} else if( (packet[0]==0xaa) || (fd==RAVELOXMIDI_ALSA_INPUT) )
-#else
-		} else if( packet[0] == 0xaa )
 #endif
-		// MIDI note on internal socket or ALSA rawmidi device
-		{
-			rtp_packet_t *rtp_packet = NULL;
-			unsigned char *packed_rtp_buffer = NULL;
-			size_t packed_rtp_buffer_len = 0;
-
-			midi_note_t *midi_note = NULL;
-			midi_control_t *midi_control = NULL;
-			midi_program_t *midi_program = NULL;
-			midi_payload_t *initial_midi_payload = NULL;
+		}
+	}
+}
+
+/* Pipeline mode. The thread that reads a packet copies it into a message for the stage that handles it */
+
+static void net_socket_message_release( void *item )
+{
+	pool_free( message_pool, item );
+}
+
+static int net_socket_forward( pipeline_stage_t *stage, int fd, unsigned char *buffer, size_t len, struct sockaddr_storage *from_addr, socklen_t from_len )
+{
+	net_socket_message_t *message = NULL;
+
+	message = ( net_socket_message_t * ) pool_alloc( message_pool, sizeof( net_socket_message_t ) + len );
+	if( ! message )
+	{
+		logging_printf( LOGGING_ERROR, "net_socket_forward: Insufficient memory for %s message\n", stage->name );
+		return -1;
+	}
+
+	message->fd = fd;
+	message->len = len;
+	message->from_len = from_len;
+	if( from_addr ) memcpy( &( message->from_addr ), from_addr, sizeof( struct sockaddr_storage ) );
+	memcpy( message->data, buffer, len );
+
+	if( pipeline_stage_push( stage, message ) != 0 )
+	{
+		logging_printf( LOGGING_DEBUG, "net_socket_forward: %s queue full. Message dropped\n", stage->name );
+		net_socket_message_release( message );
+		return -1;
+	}
+
+	return 0;
+}
+
+static void net_socket_control_stage( void *item )
+{
+	net_socket_message_t *message = ( net_socket_message_t * ) item;
+
+	net_socket_applemidi( message->fd, message->data, message->len, &( message->from_addr ), message->from_len );
+	net_socket_message_release( message );
+}
+
+static void net_socket_egress_stage( void *item )
+{
+	net_socket_message_t *message = ( net_socket_message_t * ) item;
+	arena_t *arena = arena_thread();
+
+	arena_reset( arena );
+	net_socket_midi_out( message->fd, message->data, message->len, arena );
+	net_socket_message_release( message );
+}
+
+static void net_socket_inbound_stage( void *item )
+{
+	net_socket_message_t *message = ( net_socket_message_t * ) item;
+
+	net_socket_rtp_in( message->fd, message->data, message->len, &( message->from_addr ), message->from_len );
+	net_socket_message_release( message );
+}
+
+/* Handle one datagram read from fd. The buffer is only read */
+static void net_socket_packet( int fd, unsigned char *buffer, size_t len, struct sockaddr_storage *from_addr, socklen_t from_len, arena_t *arena )
+{
+	char ip_address[ INET6_ADDRSTRLEN ];
+	int from_port = 0;
+
+	net_socket_peer( from_addr, ip_address, &from_port );
+	logging_printf( LOGGING_DEBUG, "net_socket_packet: read socket=%d, bytes=%u, host=%s, port=%u, first_byte=%02x)\n", fd, len, ip_address, from_port, buffer[0]);
+
+	RAVELOXMIDI_PROBE3( packet_receive, fd, len, buffer[0] );
+	__atomic_add_fetch( &stats_packets, 1, __ATOMIC_RELAXED );
+
+	packet_capture_record( CAPTURE_INBOUND, fd, (struct sockaddr *)from_addr, buffer, len );
+	
+	hex_dump( buffer, len );
+
+	// Apple MIDI command
+	if( buffer[0] == 0xff )
+	{
+		if( control_stage )
+		{
+			net_socket_forward( control_stage, fd, buffer, len, from_addr, from_len );
+		} else {
+			net_socket_applemidi( fd, buffer, len, from_addr, from_len );
+		}
+	} else if( (buffer[0]==0xaa) && (len == 5) && ( strncmp( &(buffer[1]),"STAT",4)==0) )
+	// Heartbeat request
+	{
+		unsigned char *reply="OK";
+		net_socket_reply( fd, reply, strlen(reply), from_addr, from_len );
+		logging_printf(LOGGING_DEBUG, "net_socket_packet: Heartbeat request\n");
+	
+	} else if( (buffer[0]==0xaa) && (len == 5) && ( strncmp( &(buffer[1]),"QUIT",4)==0) )
+	// Shutdown request
+	{
+		unsigned char *reply="QT";
+		net_socket_reply( fd, reply, strlen(reply), from_addr, from_len );
+		logging_printf(LOGGING_DEBUG, "net_socket_packet: Shutdown request\n");
+		logging_printf(LOGGING_NORMAL, "Shutdown request received on local socket\n");
+		set_shutdown_lock(1);
+	} else if( (buffer[0]==0xaa) && (len == 5) && ( strncmp( &(buffer[1]),"DUMP",4)==0) )
+	// Capture dump request
+	{
+		char *reply = NULL;
+		reply = ( packet_capture_dump() >= 0 ? "OK" : "NO" );
+		net_socket_reply( fd, (unsigned char *)reply, strlen(reply), from_addr, from_len );
+		logging_printf(LOGGING_DEBUG, "net_socket_packet: Capture dump request\n");
+	} else if( buffer[0] == 0xaa )
+	// MIDI note on internal socket
+	{
+		// The 0xaa marker isn't part of the MIDI data
+		if( egress_stage )
+		{
+			net_socket_forward( egress_stage, fd, buffer + 1, len - 1, NULL, 0 );
+		} else {
+			net_socket_midi_out( fd, buffer + 1, len - 1, arena );
+		}
+	} else {
+	// RTP MIDI inbound from remote socket
+		if( inbound_stage )
+		{
+			net_socket_forward( inbound_stage, fd, buffer, len, from_addr, from_len );
+		} else {
+			net_socket_rtp_in( fd, buffer, len, from_addr, from_len );
+		}
+	}
+}
+
+int net_socket_read( int fd )
+{
+	int recv_len;
+	unsigned from_len = 0;
+	struct sockaddr_storage from_addr;
+
+	int ret = 0;
+	arena_t *arena = NULL;
+
+	memset( &from_addr, 0, sizeof( from_addr ) );
+	from_len = sizeof( from_addr );
+
+	// Per-packet temporaries come from this thread's arena and are released after each datagram
+	arena = arena_thread();
+	if( ! arena )
+	{
+		logging_printf( LOGGING_ERROR, "net_socket_read: Unable to create packet arena\n");
+		return -1;
+	}
+
+	while( 1 )
+	{
+		// Everything allocated while handling the previous datagram is released in one go
+		arena_reset( arena );
+
+		memset( packet, 0, packet_size + 1 );
+		recv_len = recvfrom( fd, packet, NET_APPLEMIDI_UDPSIZE, 0, (struct sockaddr *)&from_addr, &from_len );
+		logging_printf(LOGGING_DEBUG, "net_socket_read: from_len=%u\n", from_len );
+		if ( recv_len <= 0)
+		{   
+			if ( errno == EAGAIN )
+			{
+				logging_printf( LOGGING_DEBUG, "EAGAIN\n");
+				break;
+			}
+			logging_printf(LOGGING_ERROR, "net_socket_read: Socket error (%d) on socket (%d)\n", errno , fd );
+			break;
+		}
+
+		net_socket_packet( fd, packet, recv_len, &from_addr, from_len, arena );
+	}
+	return ret;
+}
+
+#ifdef HAVE_ALSA
+/* Send on whatever the ALSA listener has read */
+static void net_socket_alsa_ring_drain( void )
+{
+	uint32_t overflows = 0;
+	int len = 0;
+	arena_t *arena = NULL;
+
+	arena = arena_thread();
+	if( ! arena ) return;
+
+	while( ( len = ring_pop( alsa_ring, packet, packet_size ) ) != 0 )
+	{
+		if( len < 0 ) continue;
+
+		logging_printf( LOGGING_DEBUG, "net_socket_alsa_ring_drain: read socket=ALSA bytes=%d first_byte=%02x\n", len, packet[0] );
+		RAVELOXMIDI_PROBE3( packet_receive, RAVELOXMIDI_ALSA_INPUT, len, packet[0] );
+		hex_dump( packet, len );
+
+		arena_reset( arena );
+
+		if( egress_stage )
+		{
+			net_socket_forward( egress_stage, RAVELOXMIDI_ALSA_INPUT, packet, len, NULL, 0 );
+		} else {
+			net_socket_midi_out( RAVELOXMIDI_ALSA_INPUT, packet, len, arena );
+		}
+	}
+
+	// Overflows are counted by the listener but reported here so the listener never waits on the log
+	overflows = __atomic_load_n( &alsa_ring->overflows, __ATOMIC_RELAXED );
+	if( overflows != alsa_overflows_reported )
+	{
+		logging_printf( LOGGING_WARN, "net_socket_alsa_ring_drain: ALSA input ring full. %u reads (%u bytes) dropped so far\n",
+			overflows, __atomic_load_n( &alsa_ring->overflow_bytes, __ATOMIC_RELAXED ) );
+		RAVELOXMIDI_PROBE2( alsa_overflow, overflows, __atomic_load_n( &alsa_ring->overflow_bytes, __ATOMIC_RELAXED ) );
+		alsa_overflows_reported = overflows;
+	}
+}
+
+/* Called from the main loop when alsa_event_fd is readable */
+static void net_socket_alsa_drain( void )
+{
+	uint64_t count = 0;
+
+	if( read( alsa_event_fd, &count, sizeof( count ) ) < 0 && errno != EAGAIN )
+	{
+		logging_printf( LOGGING_WARN, "net_socket_alsa_drain: Unable to read event: %s\n", strerror( errno ) );
+	}
+
+	net_socket_alsa_ring_drain();
+}
+
+static int net_socket_alsa_ring_create( void )
+{
+	uint32_t ring_size = 0;
+
+	// There must be room for at least two full reads
+	ring_size = MAX( config_long_get("alsa.ring_size"), 2 * ( alsa_buffer_size + RING_HEADER_SIZE ) );
+
+	alsa_ring = ring_create( "alsa_input", ring_size );
+	alsa_overflows_reported = 0;
+
+	return ( alsa_ring ? 0 : -1 );
+}
+
+static void net_socket_alsa_ring_destroy( void )
+{
+	if( ! alsa_ring ) return;
+
+	logging_printf( LOGGING_INFO, "net_socket_alsa_ring_destroy: size=%u chunks=%u high_water=%u overflows=%u overflow_bytes=%u\n",
+		alsa_ring->size, alsa_ring->chunks, alsa_ring->high_water, alsa_ring->overflows, alsa_ring->overflow_bytes );
+	ring_destroy( &alsa_ring );
+}
+#endif
+
+static void set_shutdown_lock( int i )
+{
+	pthread_mutex_lock( &shutdown_lock );
+	net_socket_shutdown = i;
+	pthread_mutex_unlock( &shutdown_lock );
+}
+
+static void net_socket_pipeline_stop( void )
+{
+	pipeline_stage_destroy( &control_stage, net_socket_message_release );
+	pipeline_stage_destroy( &egress_stage, net_socket_message_release );
+	pipeline_stage_destroy( &inbound_stage, net_socket_message_release );
+
+	if( message_pool ) pool_destroy( &message_pool );
+
+	ingress_cpu = PIPELINE_CPU_ANY;
+}
+
+/* Session commands, outbound MIDI and inbound RTP each get their own thread.
+   The thread running net_socket_fd_loop() and the ALSA listener are the ingress stage:
+   they only read packets and pass them on */
+static void net_socket_pipeline_start( void )
+{
+	pipeline_stage_t *control = NULL;
+	pipeline_stage_t *egress = NULL;
+	pipeline_stage_t *inbound = NULL;
+	long queue_size = 0;
+
+	if( ! config_bool_get("pipeline.enabled") ) return;
+
+	queue_size = config_long_get("pipeline.queue_size");
+	if( queue_size <= 0 ) queue_size = QUEUE_DEFAULT_CAPACITY;
+	if( queue_size > QUEUE_MAX_CAPACITY ) queue_size = QUEUE_MAX_CAPACITY;
+
+	// Enough messages for every queue to be full. Past that they come from the heap
+	message_pool = pool_create( "net_socket_message", sizeof( net_socket_message_t ) + packet_size, MIN( queue_size * 3, POOL_MAX_CAPACITY ) );
+
+	control = pipeline_stage_create( "control", queue_size, config_int_get("pipeline.control.cpu"), net_socket_control_stage );
+	egress = pipeline_stage_create( "egress", queue_size, config_int_get("pipeline.egress.cpu"), net_socket_egress_stage );
+	inbound = pipeline_stage_create( "inbound", queue_size, config_int_get("pipeline.inbound.cpu"), net_socket_inbound_stage );
+
+	control_stage = control;
+	egress_stage = egress;
+	inbound_stage = inbound;
+
+	if( ! control || ! egress || ! inbound ||
+		pipeline_stage_start( control ) != 0 ||
+		pipeline_stage_start( egress ) != 0 ||
+		pipeline_stage_start( inbound ) != 0 )
+	{
+		logging_printf( LOGGING_WARN, "net_socket_pipeline_start: Unable to start pipeline. Packets will be handled by the reading thread\n");
+		net_socket_pipeline_stop();
+		return;
+	}
+
+	ingress_cpu = config_int_get("pipeline.ingress.cpu");
+	pipeline_set_affinity( pthread_self(), ingress_cpu, "ingress" );
+
+	logging_printf( LOGGING_NORMAL, "Pipeline mode: queue_size=%ld\n", queue_size );
+}
+
+/* Data port workers.
+   The first worker to receive RTP for a session becomes its owner. RTP for that session that arrives
+   on another worker's socket is passed to the owner so each session's MIDI is written out in order */
+
+static int net_socket_worker_owner( net_socket_worker_t *worker, unsigned char *buffer, size_t len )
+{
+	unsigned char *p = NULL;
+	size_t p_len = 0;
+	uint32_t ssrc = 0;
+	uint32_t generation = 0;
+	uint32_t i = 0;
+	int owner = NET_CTX_NO_OWNER;
+
+	// Not RTP. net_socket_rtp_in() rejects it
+	if( len < RTP_PACKET_HEADER_SIZE ) return worker->id;
+
+	p = buffer + RTP_PACKET_HEADER_SIZE - sizeof( uint32_t );
+	p_len = sizeof( uint32_t );
+	get_uint32( &ssrc, &p, &p_len );
+
+	// A session has been added or removed since the owners were looked up
+	generation = net_ctx_generation();
+	if( generation != worker->owners_generation )
+	{
+		worker->num_owners = 0;
+		worker->owners_generation = generation;
+	}
+
+	for( i = 0; i < worker->num_owners; i++ )
+	{
+		if( worker->owners[i].ssrc == ssrc ) return worker->owners[i].owner;
+	}
+
+	owner = net_ctx_claim_owner( ssrc, worker->id );
+
+	// No session. Handled here so that the feedback is still sent
+	if( owner == NET_CTX_NO_OWNER ) return worker->id;
+
+	if( worker->num_owners < NET_SOCKET_WORKER_OWNERS )
+	{
+		worker->owners[ worker->num_owners ].ssrc = ssrc;
+		worker->owners[ worker->num_owners ].owner = owner;
+		worker->num_owners++;
+	}
+
+	return owner;
+}
+
+static void net_socket_worker_handoff( net_socket_worker_t *worker, net_socket_worker_t *owner, unsigned char *buffer, size_t len, struct sockaddr_storage *from_addr, socklen_t from_len )
+{
+	net_socket_message_t *message = NULL;
+	uint64_t event = 1;
+
+	message = ( net_socket_message_t * ) pool_alloc( message_pool, sizeof( net_socket_message_t ) + len );
+	if( ! message )
+	{
+		worker->dropped++;
+		return;
+	}
+
+	message->fd = worker->fd;
+	message->len = len;
+	message->from_len = from_len;
+	memcpy( &( message->from_addr ), from_addr, sizeof( struct sockaddr_storage ) );
+	memcpy( message->data, buffer, len );
+
+	if( queue_push( owner->inbox, message ) != 0 )
+	{
+		logging_printf( LOGGING_DEBUG, "net_socket_worker_handoff: %s inbox full. Message dropped\n", owner->name );
+		net_socket_message_release( message );
+		worker->dropped++;
+		return;
+	}
+
+	worker->handed_off++;
+
+	if( write( owner->event_fd, &event, sizeof( event ) ) < 0 )
+	{
+		logging_printf( LOGGING_WARN, "net_socket_worker_handoff: Unable to wake %s: %s\n", owner->name, strerror( errno ) );
+	}
+}
+
+static void net_socket_worker_packet( net_socket_worker_t *worker, unsigned char *buffer, size_t len, struct sockaddr_storage *from_addr, socklen_t from_len )
+{
+	int owner = 0;
+
+	__atomic_add_fetch( &stats_packets, 1, __ATOMIC_RELAXED );
+
+	// Apple MIDI command
+	if( buffer[0] == 0xff )
+	{
+		if( control_stage )
+		{
+			net_socket_forward( control_stage, worker->fd, buffer, len, from_addr, from_len );
+		} else {
+			net_socket_applemidi( worker->fd, buffer, len, from_addr, from_len );
+		}
+		return;
+	}
+
+	// Local requests and MIDI are only taken from the local port
+	if( buffer[0] == 0xaa )
+	{
+		logging_printf( LOGGING_DEBUG, "net_socket_worker_packet: %s ignored local packet on the data port\n", worker->name );
+		return;
+	}
+
+	owner = net_socket_worker_owner( worker, buffer, len );
+	if( owner != worker->id && owner >= 0 && owner < num_data_workers )
+	{
+		net_socket_worker_handoff( worker, &( data_workers[ owner ] ), buffer, len, from_addr, from_len );
+		return;
+	}
+
+	net_socket_rtp_in( worker->fd, buffer, len, from_addr, from_len );
+}
+
+static void net_socket_worker_read( net_socket_worker_t *worker )
+{
+	struct sockaddr_storage from_addr;
+	socklen_t from_len = 0;
+	int recv_len = 0;
+
+	while( 1 )
+	{
+		memset( &from_addr, 0, sizeof( from_addr ) );
+		from_len = sizeof( from_addr );
+
+		recv_len = recvfrom( worker->fd, worker->buffer, NET_APPLEMIDI_UDPSIZE, 0, (struct sockaddr *)&from_addr, &from_len );
+		if( recv_len <= 0 )
+		{
+			if( recv_len < 0 && errno != EAGAIN )
+			{
+				logging_printf( LOGGING_ERROR, "net_socket_worker_read: Socket error (%d) on socket (%d)\n", errno, worker->fd );
+			}
+			break;
+		}
+
+		worker->packets++;
+
+		RAVELOXMIDI_PROBE3( packet_receive, worker->fd, recv_len, worker->buffer[0] );
+		packet_capture_record( CAPTURE_INBOUND, worker->fd, (struct sockaddr *)&from_addr, worker->buffer, recv_len );
+		hex_dump( worker->buffer, recv_len );
+
+		net_socket_worker_packet( worker, worker->buffer, recv_len, &from_addr, from_len );
+	}
+}
+
+static void *net_socket_worker_thread( void *data )
+{
+	net_socket_worker_t *worker = ( net_socket_worker_t * ) data;
+	net_socket_message_t *message = NULL;
+	struct pollfd fds[2];
+	uint64_t event = 0;
+
+	logging_printf( LOGGING_DEBUG, "net_socket_worker_thread: %s started on socket %d\n", worker->name, worker->fd );
+	realtime_prefault_stack();
+
+	fds[0].fd = worker->fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = worker->event_fd;
+	fds[1].events = POLLIN;
+
+	while( ! __atomic_load_n( &data_workers_stop, __ATOMIC_ACQUIRE ) )
+	{
+		if( poll( fds, 2, -1 ) <= 0 ) continue;
+
+		// RTP handed over by other workers for sessions this worker owns
+		if( fds[1].revents & POLLIN )
+		{
+			if( read( worker->event_fd, &event, sizeof( event ) ) < 0 && errno != EAGAIN )
+			{
+				logging_printf( LOGGING_WARN, "net_socket_worker_thread: %s unable to read event: %s\n", worker->name, strerror( errno ) );
+			}
+
+			while( ( message = ( net_socket_message_t * ) queue_pop( worker->inbox ) ) )
+			{
+				net_socket_rtp_in( message->fd, message->data, message->len, &( message->from_addr ), message->from_len );
+				net_socket_message_release( message );
+			}
+		}
+
+		if( fds[0].revents & POLLIN )
+		{
+			net_socket_worker_read( worker );
+		}
+	}
+
+	arena_thread_release();
+
+	logging_printf( LOGGING_DEBUG, "net_socket_worker_thread: %s stopped\n", worker->name );
+
+	return NULL;
+}
+
+static void net_socket_workers_stop( void )
+{
+	net_socket_message_t *message = NULL;
+	uint64_t event = 1;
+	int i = 0;
+
+	if( ! data_workers ) return;
+
+	data_workers_running = 0;
+	__atomic_store_n( &data_workers_stop, 1, __ATOMIC_RELEASE );
+
+	for( i = 0; i < num_data_workers; i++ )
+	{
+		if( ! data_workers[i].running ) continue;
+
+		if( write( data_workers[i].event_fd, &event, sizeof( event ) ) < 0 )
+		{
+			logging_printf( LOGGING_WARN, "net_socket_workers_stop: Unable to wake %s: %s\n", data_workers[i].name, strerror( errno ) );
+		}
+		pthread_join( data_workers[i].thread, NULL );
+		data_workers[i].running = 0;
+
+		logging_printf( LOGGING_INFO, "net_socket_workers_stop: %s packets=%u handed_off=%u dropped=%u\n",
+			data_workers[i].name, data_workers[i].packets, data_workers[i].handed_off, data_workers[i].dropped );
+	}
+
+	for( i = 0; i < num_data_workers; i++ )
+	{
+		if( data_workers[i].inbox )
+		{
+			// RTP handed over just before the owner stopped is still written out
+			while( ( message = ( net_socket_message_t * ) queue_pop( data_workers[i].inbox ) ) )
+			{
+				net_socket_rtp_in( message->fd, message->data, message->len, &( message->from_addr ), message->from_len );
+				net_socket_message_release( message );
+			}
+			queue_destroy( &( data_workers[i].inbox ) );
+		}
+
+		if( data_workers[i].event_fd >= 0 ) close( data_workers[i].event_fd );
+
+		// Worker 0's socket is DATA_PORT and is closed with the rest of the socket list
+		if( i > 0 ) close( data_workers[i].fd );
+	}
+
+	FREENULL( "net_socket_workers_stop: data_workers", (void **)&data_workers );
+	num_data_workers = 0;
+	data_workers_stop = 0;
+}
+
+static void net_socket_workers_start( void )
+{
+	net_socket_worker_t *worker = NULL;
+	int i = 0;
+
+	if( ! data_workers ) return;
+
+	if( num_data_workers < 2 )
+	{
+		logging_printf( LOGGING_WARN, "net_socket_workers_start: Only one data socket. The data port is read by the main loop\n");
+		net_socket_workers_stop();
+		return;
+	}
+
+	// Shared with the pipeline if that is enabled
+	if( ! message_pool )
+	{
+		message_pool = pool_create( "net_socket_message", sizeof( net_socket_message_t ) + packet_size, QUEUE_DEFAULT_CAPACITY );
+	}
+
+	for( i = 0; i < num_data_workers; i++ )
+	{
+		worker = &( data_workers[i] );
+
+		snprintf( worker->name, sizeof( worker->name ), "data%d", i );
+		worker->inbox = queue_create( worker->name, QUEUE_DEFAULT_CAPACITY );
+		worker->event_fd = eventfd( 0, EFD_NONBLOCK );
+
+		if( ! worker->inbox || worker->event_fd < 0 ||
+			pthread_create( &( worker->thread ), NULL, net_socket_worker_thread, worker ) != 0 )
+		{
+			logging_printf( LOGGING_WARN, "net_socket_workers_start: Unable to start %s. The data port is read by the main loop\n", worker->name );
+			net_socket_workers_stop();
+			return;
+		}
+
+		worker->running = 1;
+		realtime_thread_apply( worker->thread, "data" );
+	}
+
+	data_workers_running = 1;
+
+	logging_printf( LOGGING_NORMAL, "Data workers: %d sockets on the data port\n", num_data_workers );
+}
+
+/* Housekeeping. Periodic work is run from a timer wheel in the main loop. One timerfd ticks the wheel
+   while any timer is pending. Each task reads its period from the configuration when it starts and on reload */
+
+#define NET_SOCKET_TIMER_TICK_MAX	1000
+
+typedef struct net_socket_task_t {
+	char			*name;
+	uint64_t		(*period)( void );
+	void			(*run)( void );
+	uint64_t		period_ms;
+	timer_wheel_timer_t	timer;
+} net_socket_task_t;
+
+static uint32_t stats_last_packets = 0;
+static uint32_t stats_last_rtp_in = 0;
+static uint32_t stats_last_rtp_out = 0;
+static uint32_t feedback_sent = 0;
+static uint32_t syncs_sent = 0;
+static uint32_t journals_aged = 0;
+static uint32_t sessions_probed = 0;
+static uint32_t sessions_reaped = 0;
+
+static uint64_t net_socket_now_ms( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+
+	return ( (uint64_t)ts.tv_sec * 1000 ) + ( ts.tv_nsec / 1000000 );
+}
+
+static uint64_t net_socket_seconds( char *key )
+{
+	long seconds = config_long_get( key );
+
+	return ( seconds > 0 ? (uint64_t)seconds * 1000 : 0 );
+}
+
+static uint64_t net_socket_stats_period( void )
+{
+	return net_socket_seconds( "stats.interval" );
+}
+
+/* Counts since the last snapshot */
+static void net_socket_stats_run( void )
+{
+	uint32_t packets = __atomic_load_n( &stats_packets, __ATOMIC_RELAXED );
+	uint32_t rtp_in = __atomic_load_n( &stats_rtp_in, __ATOMIC_RELAXED );
+	uint32_t rtp_out = __atomic_load_n( &stats_rtp_out, __ATOMIC_RELAXED );
+	uint32_t sessions = 0;
+	net_ctx_t *ctx = NULL;
+
+	// Sessions that have had to queue are listed with their transmit queue
+	net_ctx_lock();
+	for( net_ctx_iter_start_head() ; net_ctx_iter_has_current(); net_ctx_iter_next() )
+	{
+		ctx = net_ctx_iter_current();
+		sessions++;
+
+		if( ! ctx || ctx->tx_queued == 0 ) continue;
+
+		logging_printf( LOGGING_NORMAL, "Stats: ssrc=0x%08x host=%s port=%u tx_depth=%u tx_high_water=%u tx_queued=%u tx_dropped=%u tx_coalesced=%u rate_limit=%u tx_limited=%u\n",
+			ctx->ssrc, ctx->ip_address, ctx->data_port, ctx->tx_depth, ctx->tx_high_water, ctx->tx_queued, ctx->tx_dropped, ctx->tx_coalesced,
+			ctx->rate_limit, ctx->tx_limited );
+	}
+	net_ctx_unlock();
+
+	logging_printf( LOGGING_NORMAL, "Stats: sessions=%u packets=%u rtp_in=%u rtp_out=%u feedback=%u syncs=%u journals_aged=%u probed=%u reaped=%u\n",
+		sessions, packets - stats_last_packets, rtp_in - stats_last_rtp_in, rtp_out - stats_last_rtp_out,
+		feedback_sent, syncs_sent, journals_aged, sessions_probed, sessions_reaped );
+
+	stats_last_packets = packets;
+	stats_last_rtp_in = rtp_in;
+	stats_last_rtp_out = rtp_out;
+}
+
+static uint64_t net_socket_feedback_period( void )
+{
+	int interval = __atomic_load_n( &feedback_interval, __ATOMIC_RELAXED );
+
+	return ( interval > 0 ? (uint64_t)interval : 0 );
+}
+
+/* One feedback packet for each session that has sent RTP since the last one */
+static void net_socket_feedback_run( void )
+{
+	unsigned char response_buffer[ NET_APPLEMIDI_COMMAND_SIZE + NET_APPLEMIDI_FEEDBACK_SIZE ];
+	net_response_t response;
+	struct sockaddr_storage send_address;
+	socklen_t send_address_len = 0;
+	net_ctx_t *ctx = NULL;
+
+	net_ctx_lock();
+	for( net_ctx_iter_start_head() ; net_ctx_iter_has_current(); net_ctx_iter_next() )
+	{
+		ctx = net_ctx_iter_current();
+		if( ! ctx || ! ctx->feedback_pending ) continue;
+
+		ctx->feedback_pending = 0;
+
+		net_response_init( &response, response_buffer, sizeof( response_buffer ) );
+		if( cmd_feedback_create( ctx->ssrc, ctx->received_seq, &response ) != 0 ) continue;
+
+		net_ctx_address( ctx, &send_address, &send_address_len );
+		net_socket_reply( sockets[ DATA_PORT ], response.buffer, response.len, &send_address, send_address_len );
+		feedback_sent++;
+	}
+	net_ctx_unlock();
+}
+
+static uint64_t net_socket_sync_period( void )
+{
+	return net_socket_seconds( "network.sync_interval" );
+}
+
+/* Called with the table locked */
+static int net_socket_sync_send( net_ctx_t *ctx )
+{
+	unsigned char response_buffer[ NET_APPLEMIDI_COMMAND_SIZE + NET_APPLEMIDI_SYNC_SIZE ];
+	net_response_t response;
+	struct sockaddr_storage send_address;
+	socklen_t send_address_len = 0;
+
+	net_response_init( &response, response_buffer, sizeof( response_buffer ) );
+	if( cmd_sync_create( ctx, &response ) != 0 ) return -1;
+
+	net_ctx_address( ctx, &send_address, &send_address_len );
+	net_socket_reply( sockets[ DATA_PORT ], response.buffer, response.len, &send_address, send_address_len );
+
+	return 0;
+}
+
+static void net_socket_sync_run( void )
+{
+	net_ctx_t *ctx = NULL;
+
+	net_ctx_lock();
+	for( net_ctx_iter_start_head() ; net_ctx_iter_has_current(); net_ctx_iter_next() )
+	{
+		ctx = net_ctx_iter_current();
+		if( ! ctx ) continue;
+
+		if( net_socket_sync_send( ctx ) == 0 ) syncs_sent++;
+	}
+	net_ctx_unlock();
+}
+
+/* Checked every second. A session that has been silent for half the timeout is sent CK0, which a
+   remote end that is still there answers. One that is silent for the whole timeout is removed */
+static uint64_t net_socket_session_period( void )
+{
+	return ( net_socket_seconds( "network.session_timeout" ) > 0 ? 1000 : 0 );
+}
+
+static void net_socket_session_run( void )
+{
+	long timeout = config_long_get( "network.session_timeout" );
+	time_t now = time( NULL );
+	time_t silent = 0;
+	net_ctx_t *ctx = NULL;
+
+	net_ctx_lock();
+	net_ctx_iter_start_head();
+	while( net_ctx_iter_has_current() )
+	{
+		ctx = net_ctx_iter_current();
+		net_ctx_iter_next();
+
+		if( ! ctx ) continue;
+
+		silent = now - ctx->last_heard;
+		if( silent >= timeout )
+		{
+			logging_printf( LOGGING_NORMAL, "Session ssrc=0x%08x host=%s port=%u not heard from for %ld seconds. Removed\n",
+				ctx->ssrc, ctx->ip_address, ctx->control_port, (long)silent );
+			RAVELOXMIDI_PROBE2( session_reap, ctx->ssrc, (uint32_t)silent );
+			net_ctx_destroy( &ctx );
+			sessions_reaped++;
+		} else if( silent >= ( timeout + 1 ) / 2 && ! ctx->probed ) {
+			logging_printf( LOGGING_DEBUG, "net_socket_session_run: ssrc=0x%08x not heard from for %ld seconds. Sending CK0\n", ctx->ssrc, (long)silent );
+			if( net_socket_sync_send( ctx ) == 0 ) sessions_probed++;
+			ctx->probed = 1;
+		}
+	}
+	net_ctx_unlock();
+}
+
+/* Checked every second. A journal is aged from the last time it was reset or seen empty */
+static uint64_t net_socket_journal_period( void )
+{
+	return ( net_socket_seconds( "journal.max_age" ) > 0 ? 1000 : 0 );
+}
+
+static void net_socket_journal_run( void )
+{
+	long max_age = config_long_get( "journal.max_age" );
+	time_t now = time( NULL );
+	net_ctx_t *ctx = NULL;
+
+	net_ctx_lock();
+	for( net_ctx_iter_start_head() ; net_ctx_iter_has_current(); net_ctx_iter_next() )
+	{
+		ctx = net_ctx_iter_current();
+		if( ! ctx ) continue;
+
+		pthread_mutex_lock( &socket_mutex );
+		if( ! journal_has_data( ctx->journal ) )
+		{
+			ctx->journal_time = now;
+		} else if( now - ctx->journal_time >= max_age ) {
+			logging_printf( LOGGING_DEBUG, "net_socket_journal_run: No feedback from ssrc=0x%08x for %ld seconds. Resetting journal\n", ctx->ssrc, (long)( now - ctx->journal_time ) );
+			net_ctx_journal_reset( ctx );
+			journals_aged++;
+		}
+		pthread_mutex_unlock( &socket_mutex );
+	}
+	net_ctx_unlock();
+}
+
+/* Runs every tick while a rate limit is in effect or packets are queued */
+static uint64_t net_socket_tx_period( void )
+{
+	if( ! timers ) return 0;
+
+	return ( net_ctx_tx_rate_limited() || net_ctx_tx_pending() > 0 ? timers->tick_ms : 0 );
+}
+
+static void net_socket_tx_run( void )
+{
+	if( net_ctx_tx_pending() > 0 ) net_ctx_tx_drain( sockets[ DATA_PORT ] );
+}
+
+static net_socket_task_t net_socket_tasks[] = {
+	{ "stats", net_socket_stats_period, net_socket_stats_run },
+	{ "feedback", net_socket_feedback_period, net_socket_feedback_run },
+	{ "sync", net_socket_sync_period, net_socket_sync_run },
+	{ "journal", net_socket_journal_period, net_socket_journal_run },
+	{ "session", net_socket_session_period, net_socket_session_run },
+	{ "tx", net_socket_tx_period, net_socket_tx_run },
+	{ NULL, NULL, NULL }
+};
+
+/* The timerfd only ticks while there is something to run */
+static void net_socket_timers_arm( void )
+{
+	struct itimerspec spec;
+	int armed = 0;
+
+	if( timer_fd < 0 ) return;
+
+	armed = ( timers->pending > 0 );
+	if( armed == timer_fd_armed ) return;
+
+	memset( &spec, 0, sizeof( spec ) );
+	if( armed )
+	{
+		spec.it_value.tv_sec = timers->tick_ms / 1000;
+		spec.it_value.tv_nsec = ( timers->tick_ms % 1000 ) * 1000000;
+		spec.it_interval = spec.it_value;
+	}
+
+	if( timerfd_settime( timer_fd, 0, &spec, NULL ) != 0 )
+	{
+		logging_printf( LOGGING_ERROR, "net_socket_timers_arm: Unable to set timer: %s\n", strerror( errno ) );
+		return;
+	}
+
+	timer_fd_armed = armed;
+}
+
+static void net_socket_task_fire( void *data )
+{
+	net_socket_task_t *task = ( net_socket_task_t * ) data;
+
+	task->run();
+
+	if( task->period_ms > 0 ) timer_wheel_add( timers, &( task->timer ), task->period_ms );
+}
+
+static void net_socket_tasks_schedule( void )
+{
+	net_socket_task_t *task = NULL;
+	uint64_t period_ms = 0;
+
+	if( ! timers ) return;
+
+	// The wheel doesn't move while the timerfd is stopped
+	timer_wheel_advance( timers, net_socket_now_ms() );
+
+	for( task = net_socket_tasks; task->name; task++ )
+	{
+		period_ms = task->period();
+		if( period_ms == task->period_ms ) continue;
+
+		task->period_ms = period_ms;
+		if( period_ms > 0 )
+		{
+			timer_wheel_add( timers, &( task->timer ), period_ms );
+		} else {
+			timer_wheel_cancel( timers, &( task->timer ) );
+		}
+
+		logging_printf( LOGGING_DEBUG, "net_socket_tasks_schedule: task=%s period_ms=%llu\n", task->name, (unsigned long long)period_ms );
+	}
+
+	net_socket_timers_arm();
+}
+
+/* Called from the main loop when the timerfd has ticked. Tasks whose work has come or gone are started or stopped */
+static void net_socket_timers_expire( void )
+{
+	net_socket_tasks_schedule();
+}
+
+static void net_socket_timers_read( void )
+{
+	uint64_t count = 0;
+
+	if( read( timer_fd, &count, sizeof( count ) ) < 0 && errno != EAGAIN )
+	{
+		logging_printf( LOGGING_WARN, "net_socket_timers_read: Unable to read timer: %s\n", strerror( errno ) );
+	}
+
+	net_socket_timers_expire();
+}
+
+static void net_socket_timers_reload( void )
+{
+	__atomic_store_n( &feedback_interval, config_int_get( "network.feedback_interval" ), __ATOMIC_RELAXED );
+
+	net_socket_tasks_schedule();
+}
+
+static void net_socket_timers_create( void )
+{
+	net_socket_task_t *task = NULL;
+	long tick_ms = 0;
+
+	tick_ms = config_long_get( "timer.tick" );
+	if( tick_ms < 1 ) tick_ms = 1;
+	if( tick_ms > NET_SOCKET_TIMER_TICK_MAX ) tick_ms = NET_SOCKET_TIMER_TICK_MAX;
+
+	timer_fd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+	if( timer_fd < 0 )
+	{
+		logging_printf( LOGGING_ERROR, "net_socket_timers_create: Unable to create timer: %s. Housekeeping is disabled\n", strerror( errno ) );
+		return;
+	}
+
+	timers = timer_wheel_create( tick_ms, net_socket_now_ms() );
+	if( ! timers )
+	{
+		close( timer_fd );
+		timer_fd = -1;
+		return;
+	}
+	timer_fd_armed = 0;
+
+	for( task = net_socket_tasks; task->name; task++ )
+	{
+		timer_wheel_timer_init( &( task->timer ), task->name, net_socket_task_fire, task );
+		task->period_ms = 0;
+	}
+
+	net_socket_timers_reload();
+}
+
+static void net_socket_timers_destroy( void )
+{
+	net_socket_task_t *task = NULL;
+
+	if( ! timers ) return;
+
+	for( task = net_socket_tasks; task->name; task++ )
+	{
+		timer_wheel_cancel( timers, &( task->timer ) );
+		task->period_ms = 0;
+	}
+
+	timer_wheel_dump( timers );
+	logging_printf( LOGGING_INFO, "net_socket_timers_destroy: expired=%u feedback=%u syncs=%u journals_aged=%u probed=%u reaped=%u\n",
+		timers->expired, feedback_sent, syncs_sent, journals_aged, sessions_probed, sessions_reaped );
+
+	timer_wheel_destroy( &timers );
+	close( timer_fd );
+	timer_fd = -1;
+	timer_fd_armed = 0;
+}
+
+/* The main loop was woken because the data socket has filled up or a rate limit has been set. It waits for the
+   socket to be writable next time round and the timer that sends packets held back by a limit is started */
+static void net_socket_tx_event_read( void )
+{
+	uint64_t count = 0;
+
+	if( read( net_ctx_tx_event_fd(), &count, sizeof( count ) ) < 0 && errno != EAGAIN )
+	{
+		logging_printf( LOGGING_WARN, "net_socket_tx_event_read: Unable to read event: %s\n", strerror( errno ) );
+	}
+
+	net_socket_tasks_schedule();
+}
+
+/* A new instance has connected to handoff.socket. The main loop stops and the sockets and sessions are passed over
+   once nothing is using them. Until the new instance reads the sockets, datagrams wait in their receive buffers */
+static void net_socket_handoff_accept( void )
+{
+	int fds[ NET_HANDOFF_MAX_FDS ];
+	int num_fds = NET_HANDOFF_FD_DATA;
+	unsigned char wake = 0;
+	int i = 0;
+
+	fds[ NET_HANDOFF_FD_CONTROL ] = sockets[ CONTROL_PORT ];
+	fds[ NET_HANDOFF_FD_LOCAL ] = sockets[ LOCAL_PORT ];
+
+	if( data_workers )
+	{
+		for( i = 0; i < num_data_workers; i++ )
+		{
+			fds[ num_fds++ ] = data_workers[i].fd;
+		}
+	} else {
+		fds[ num_fds++ ] = sockets[ DATA_PORT ];
+	}
+
+	if( net_handoff_accept( fds, num_fds ) != 0 ) return;
+
+	set_shutdown_lock( 1 );
+
+	// The byte on the pipe wakes the ALSA listener from poll() so that it sees the shutdown
+	if( write( pipe_fd[1], &wake, 1 ) < 0 )
+	{
+		logging_printf( LOGGING_WARN, "net_socket_handoff_accept: Unable to wake ALSA listener: %s\n", strerror( errno ) );
+	}
+}
+
+/* io_uring backend for the main loop. Only used when network.io_uring is set and the running kernel supports it.
+   Every socket the main loop reads has a multishot receive outstanding that fills buffers from a registered ring.
+   Replies and outbound RTP sent from the main loop are queued and reach the kernel in the same system call as the
+   next wait, so a burst of packets and the fan-out to every session cost one io_uring_enter() between them */
+
+#ifdef HAVE_IO_URING
+
+#define NET_SOCKET_URING_ENTRIES	256
+#define NET_SOCKET_URING_BUFFERS	256
+#define NET_SOCKET_URING_SENDS		256
+
+// Each receive buffer holds the io_uring_recvmsg_out header and the sender's address ahead of the datagram
+#define NET_SOCKET_URING_BUFFER_SIZE	( sizeof( struct io_uring_recvmsg_out ) + sizeof( struct sockaddr_storage ) + NET_APPLEMIDI_UDPSIZE )
+
+// The type of operation is in the top half of user_data. The bottom half is the socket or the send slot
+#define NET_SOCKET_URING_RECV		1
+#define NET_SOCKET_URING_SEND		2
+#define NET_SOCKET_URING_EVENT		3
+#define NET_SOCKET_URING_CANCEL		4
+#define NET_SOCKET_URING_TIMER		5
+#define NET_SOCKET_URING_TX_EVENT	6
+#define NET_SOCKET_URING_TX_POLL	7
+#define NET_SOCKET_URING_HANDOFF	8
+
+#define NET_SOCKET_URING_DATA( type, value )	( ( (uint64_t)(type) << 32 ) | (uint32_t)(value) )
+
+/* A send stays here until the kernel has completed it */
+typedef struct net_socket_send_t {
+	struct msghdr		msg;
+	struct iovec		iov;
+	struct sockaddr_storage	addr;
+	int			fd;
+	int			next;
+	unsigned char		data[ NET_APPLEMIDI_UDPSIZE ];
+} net_socket_send_t;
+
+static uring_t *uring = NULL;
+static pthread_t uring_thread;
+static net_socket_send_t *uring_sends = NULL;
+static int uring_free_send = -1;
+static struct msghdr uring_recv_msg;
+#ifdef HAVE_ALSA
+static uint64_t uring_event_count = 0;
+#endif
+static uint64_t uring_timer_count = 0;
+static uint64_t uring_tx_count = 0;
+static int uring_tx_poll_armed = 0;
+
+// Operations that haven't had their last completion yet
+static uint32_t uring_in_flight = 0;
+static uint32_t uring_received = 0;
+static uint32_t uring_sent = 0;
+static int uring_stopping = 0;
+static int uring_unsupported = 0;
+
+static struct io_uring_sqe *net_socket_uring_sqe( void )
+{
+	struct io_uring_sqe *sqe = NULL;
+
+	sqe = uring_get_sqe( uring );
+	if( sqe ) return sqe;
+
+	// The submission queue is full. Hand what's queued to the kernel now
+	uring_submit( uring, 0, 0 );
+	return uring_get_sqe( uring );
+}
+
+static void net_socket_uring_arm_recv( int fd )
+{
+	struct io_uring_sqe *sqe = NULL;
+
+	sqe = net_socket_uring_sqe();
+	if( ! sqe )
+	{
+		logging_printf( LOGGING_ERROR, "net_socket_uring_arm_recv: No submission entry for socket %d\n", fd );
+		return;
+	}
+
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = fd;
+	sqe->addr = ( uint64_t )( uintptr_t ) &uring_recv_msg;
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = 0;
+	sqe->user_data = NET_SOCKET_URING_DATA( NET_SOCKET_URING_RECV, fd );
+
+	uring_in_flight++;
+}
+
+/* The ALSA eventfd and the timerfd are read through the ring. The count isn't used */
+static void net_socket_uring_arm_read( int fd, uint32_t type, uint64_t *count )
+{
+	struct io_uring_sqe *sqe = NULL;
+
+	sqe = net_socket_uring_sqe();
+	if( ! sqe )
+	{
+		logging_printf( LOGGING_ERROR, "net_socket_uring_arm_read: No submission entry for fd %d\n", fd );
+		return;
+	}
+
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = ( uint64_t )( uintptr_t ) count;
+	sqe->len = sizeof( uint64_t );
+	sqe->user_data = NET_SOCKET_URING_DATA( type, fd );
+
+	uring_in_flight++;
+}
+
+/* Returns -1 if the send must be made directly: not the main loop thread, no free slot or not in io_uring mode */
+static int net_socket_uring_send( int fd, unsigned char *buffer, size_t len, struct sockaddr_storage *to_addr, socklen_t to_len )
+{
+	net_socket_send_t *send = NULL;
+	struct io_uring_sqe *sqe = NULL;
+	int slot = 0;
+
+	// uring_thread is set before any other thread is started
+	if( ! pthread_equal( pthread_self(), uring_thread ) ) return -1;
+	if( ! uring || uring_stopping ) return -1;
+	if( len > NET_APPLEMIDI_UDPSIZE ) return -1;
+	if( to_len > sizeof( struct sockaddr_storage ) ) return -1;
+	if( uring_free_send < 0 ) return -1;
+
+	sqe = net_socket_uring_sqe();
+	if( ! sqe ) return -1;
+
+	slot = uring_free_send;
+	send = &( uring_sends[ slot ] );
+	uring_free_send = send->next;
+
+	memcpy( send->data, buffer, len );
+	memcpy( &( send->addr ), to_addr, to_len );
+	send->fd = fd;
+	send->iov.iov_base = send->data;
+	send->iov.iov_len = len;
+
+	memset( &( send->msg ), 0, sizeof( struct msghdr ) );
+	send->msg.msg_name = &( send->addr );
+	send->msg.msg_namelen = to_len;
+	send->msg.msg_iov = &( send->iov );
+	send->msg.msg_iovlen = 1;
+
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = fd;
+	sqe->addr = ( uint64_t )( uintptr_t ) &( send->msg );
+	sqe->len = 1;
+	sqe->user_data = NET_SOCKET_URING_DATA( NET_SOCKET_URING_SEND, slot );
+
+	uring_in_flight++;
+	uring_sent++;
+
+	return 0;
+}
+
+/* Only while a transmit queue has packets */
+static void net_socket_uring_arm_tx_poll( void )
+{
+	struct io_uring_sqe *sqe = NULL;
+
+	if( uring_tx_poll_armed || uring_stopping ) return;
+	if( ! net_ctx_tx_blocked() ) return;
+
+	sqe = net_socket_uring_sqe();
+	if( ! sqe )
+	{
+		logging_printf( LOGGING_ERROR, "net_socket_uring_arm_tx_poll: No submission entry for the data socket\n");
+		return;
+	}
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = sockets[ DATA_PORT ];
+	sqe->poll32_events = POLLOUT;
+	sqe->user_data = NET_SOCKET_URING_DATA( NET_SOCKET_URING_TX_POLL, sockets[ DATA_PORT ] );
+
+	uring_in_flight++;
+	uring_tx_poll_armed = 1;
+}
+
+/* handoff.socket is polled rather than read so that the connection is accepted on the main loop thread */
+static void net_socket_uring_arm_handoff( void )
+{
+	struct io_uring_sqe *sqe = NULL;
+
+	if( handoff_fd < 0 || uring_stopping ) return;
+
+	sqe = net_socket_uring_sqe();
+	if( ! sqe )
+	{
+		logging_printf( LOGGING_ERROR, "net_socket_uring_arm_handoff: No submission entry for the handoff socket\n");
+		return;
+	}
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = handoff_fd;
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = NET_SOCKET_URING_DATA( NET_SOCKET_URING_HANDOFF, handoff_fd );
+
+	uring_in_flight++;
+}
+
+static void net_socket_uring_receive( int fd, int32_t res, uint32_t flags, arena_t *arena )
+{
+	struct io_uring_recvmsg_out *out = NULL;
+	struct sockaddr_storage from_addr;
+	unsigned char *buffer = NULL;
+	unsigned char *payload = NULL;
+	size_t len = 0;
+	uint16_t id = 0;
+
+	// The receive has finished and must be submitted again
+	if( ! ( flags & IORING_CQE_F_MORE ) )
+	{
+		uring_in_flight--;
+
+		// Multishot receives need 6.0
+		if( res == -EINVAL )
+		{
+			uring_unsupported = 1;
+		} else if( res != -ECANCELED && ! uring_stopping ) {
+			net_socket_uring_arm_recv( fd );
+		}
+	}
+
+	if( res < 0 )
+	{
+		if( res != -ECANCELED && res != -ENOBUFS && res != -EINVAL )
+		{
+			logging_printf( LOGGING_ERROR, "net_socket_uring_receive: Socket error (%d) on socket (%d)\n", -res, fd );
+		}
+		return;
+	}
+
+	if( ! ( flags & IORING_CQE_F_BUFFER ) ) return;
+
+	id = flags >> IORING_CQE_BUFFER_SHIFT;
+	buffer = uring_buffer( uring, id );
+	if( ! buffer ) return;
+
+	out = ( struct io_uring_recvmsg_out * ) buffer;
+	payload = buffer + sizeof( struct io_uring_recvmsg_out ) + uring_recv_msg.msg_namelen + uring_recv_msg.msg_controllen;
+	len = MIN( out->payloadlen, (size_t)res - ( payload - buffer ) );
+
+	memset( &from_addr, 0, sizeof( from_addr ) );
+	memcpy( &from_addr, buffer + sizeof( struct io_uring_recvmsg_out ), MIN( out->namelen, sizeof( from_addr ) ) );
+
+	if( len > 0 )
+	{
+		uring_received++;
+		arena_reset( arena );
+		net_socket_packet( fd, payload, len, &from_addr, out->namelen, arena );
+	}
+
+	uring_buffer_return( uring, id );
+}
+
+static void net_socket_uring_complete( uint64_t user_data, int32_t res, uint32_t flags, arena_t *arena )
+{
+	uint32_t type = user_data >> 32;
+	uint32_t value = ( uint32_t ) user_data;
+	net_socket_send_t *send = NULL;
+
+	switch( type )
+	{
+		case NET_SOCKET_URING_RECV:
+			net_socket_uring_receive( (int)value, res, flags, arena );
+			break;
+		case NET_SOCKET_URING_SEND:
+			uring_in_flight--;
+			send = &( uring_sends[ value ] );
+			// RTP MIDI refused because the socket was full is queued for its session
+			if( ( res == -EAGAIN || res == -ENOBUFS ) && send->fd == sockets[ DATA_PORT ] && send->data[0] == 0x80
+				&& net_ctx_tx_requeue( &( send->addr ), send->msg.msg_namelen, send->data, send->iov.iov_len ) == 0 )
+			{
+				logging_printf( LOGGING_DEBUG, "net_socket_uring_complete: Socket full. Queued %u bytes\n", send->iov.iov_len );
+			} else if( res < 0 && res != -ECANCELED ) {
+				logging_printf( LOGGING_ERROR, "net_socket_uring_complete: Failed to send %u bytes on socket %d: %s\n", send->iov.iov_len, send->fd, strerror( -res ) );
+			} else if( res >= 0 ) {
+				packet_capture_record( CAPTURE_OUTBOUND, send->fd, (struct sockaddr *)&( send->addr ), send->data, res );
+			}
+			send->next = uring_free_send;
+			uring_free_send = value;
+			break;
+#ifdef HAVE_ALSA
+		case NET_SOCKET_URING_EVENT:
+			uring_in_flight--;
+			if( res > 0 ) net_socket_alsa_ring_drain();
+			if( res != -ECANCELED && ! uring_stopping ) net_socket_uring_arm_read( alsa_event_fd, NET_SOCKET_URING_EVENT, &uring_event_count );
+			break;
+#endif
+		case NET_SOCKET_URING_TIMER:
+			uring_in_flight--;
+			if( res > 0 ) net_socket_timers_expire();
+			if( res != -ECANCELED && ! uring_stopping ) net_socket_uring_arm_read( timer_fd, NET_SOCKET_URING_TIMER, &uring_timer_count );
+			break;
+		case NET_SOCKET_URING_TX_EVENT:
+			// The poll for the data socket is added once the completions have been handled
+			uring_in_flight--;
+			if( res > 0 ) net_socket_tasks_schedule();
+			if( res != -ECANCELED && ! uring_stopping ) net_socket_uring_arm_read( net_ctx_tx_event_fd(), NET_SOCKET_URING_TX_EVENT, &uring_tx_count );
+			break;
+		case NET_SOCKET_URING_TX_POLL:
+			uring_in_flight--;
+			uring_tx_poll_armed = 0;
+			if( res > 0 ) net_ctx_tx_drain( sockets[ DATA_PORT ] );
+			break;
+		case NET_SOCKET_URING_HANDOFF:
+			uring_in_flight--;
+			if( res > 0 ) net_socket_handoff_accept();
+			if( res != -ECANCELED && ! uring_stopping && net_socket_shutdown == 0 ) net_socket_uring_arm_handoff();
+			break;
+		case NET_SOCKET_URING_CANCEL:
+			uring_in_flight--;
+			break;
+		default:
+			break;
+	}
+}
 
+static void net_socket_uring_reap( arena_t *arena )
+{
+	struct io_uring_cqe *cqe = NULL;
+	uint64_t user_data = 0;
+	int32_t res = 0;
+	uint32_t flags = 0;
 
-			unsigned char *packed_rtp_payload = NULL;
+	while( ( cqe = uring_peek_cqe( uring ) ) )
+	{
+		// The entry is released before it's handled so that the completion queue has room for what that causes
+		user_data = cqe->user_data;
+		res = cqe->res;
+		flags = cqe->flags;
+		uring_cqe_seen( uring );
 
-			midi_command_t *midi_commands=NULL;
-			size_t num_midi_commands=0;
-			size_t midi_command_index = 0;
+		net_socket_uring_complete( user_data, res, flags, arena );
+	}
+}
 
-			char *packed_journal = NULL;
-			size_t packed_journal_len = 0;
-			char *description = NULL;
-			enum midi_message_type_t message_type = 0;
-			size_t midi_payload_len = 0;
+static void net_socket_uring_create( void )
+{
+	int i = 0;
 
+	if( ! config_bool_get("network.io_uring") ) return;
 
-			// Convert the buffer into a set of commands
-			midi_payload_len = recv_len - 1;
-			initial_midi_payload = midi_payload_create();
-			midi_payload_set_buffer( initial_midi_payload, packet + 1 , &midi_payload_len );
-			midi_payload_to_commands( initial_midi_payload, MIDI_PAYLOAD_STREAM, &midi_commands, &num_midi_commands );
-			midi_payload_destroy( &initial_midi_payload );
+	uring = uring_create( "net_socket", NET_SOCKET_URING_ENTRIES, NET_SOCKET_URING_BUFFERS, NET_SOCKET_URING_BUFFER_SIZE );
+	if( ! uring )
+	{
+		logging_printf( LOGGING_WARN, "net_socket_uring_create: io_uring isn't supported by this kernel. Using select()\n");
+		return;
+	}
 
-			for( midi_command_index = 0 ; midi_command_index < num_midi_commands ; midi_command_index++ )
-			{
-				midi_payload_t *single_midi_payload = NULL;
-				unsigned char *packed_payload = NULL;
-				size_t packed_payload_len = 0;
+	uring_sends = ( net_socket_send_t * ) calloc( NET_SOCKET_URING_SENDS, sizeof( net_socket_send_t ) );
+	if( ! uring_sends )
+	{
+		logging_printf( LOGGING_ERROR, "net_socket_uring_create: Insufficient memory for send slots. Using select()\n");
+		uring_destroy( &uring );
+		return;
+	}
 
-				/* Extract a single command as a midi payload */
-				midi_command_to_payload( &(midi_commands[ midi_command_index ]), &single_midi_payload );
-				if( ! single_midi_payload ) continue;
+	for( i = 0; i < NET_SOCKET_URING_SENDS; i++ )
+	{
+		uring_sends[i].next = ( i + 1 < NET_SOCKET_URING_SENDS ? i + 1 : -1 );
+	}
+	uring_free_send = 0;
 
-				midi_command_map( &(midi_commands[ midi_command_index ]), &description, &message_type );
-				midi_command_dump( &(midi_commands[ midi_command_index ]) );
-				switch( message_type )
-				{
-					case MIDI_NOTE_OFF:
-					case MIDI_NOTE_ON:
-						ret = midi_note_from_command( &(midi_commands[midi_command_index]), &midi_note);
-						midi_note_dump( midi_note );
-						break;
-					case MIDI_CONTROL_CHANGE:	
-						ret = midi_control_from_command( &(midi_commands[midi_command_index]), &midi_control);
-						midi_control_dump( midi_control );
-						break;
-					case MIDI_PROGRAM_CHANGE:
-						ret = midi_program_from_command( &(midi_commands[midi_command_index]), &midi_program);
-						midi_program_dump( midi_program );
-						break;
-					default:
-						break;
-				}
+	memset( &uring_recv_msg, 0, sizeof( uring_recv_msg ) );
+	uring_recv_msg.msg_namelen = sizeof( struct sockaddr_storage );
 
-				// Build the RTP packet
-				for( net_ctx_iter_start_head() ; net_ctx_iter_has_current(); net_ctx_iter_next())
-				{
-					net_ctx_t *current_ctx = net_ctx_iter_current();
+	uring_in_flight = 0;
+	uring_received = 0;
+	uring_sent = 0;
+	uring_stopping = 0;
+	uring_tx_poll_armed = 0;
+	uring_unsupported = 0;
+	uring_thread = pthread_self();
 
-					logging_printf( LOGGING_DEBUG, "net_ctx_iter_current()=%p\n", current_ctx );
-					if(! current_ctx ) continue;
+	logging_printf( LOGGING_NORMAL, "io_uring mode: entries=%u receive_buffers=%u send_slots=%u\n", uring->sq_entries, uring->buffer_count, NET_SOCKET_URING_SENDS );
+}
 
-					// Get a journal if there is one
-					pthread_mutex_lock( &socket_mutex );
-					net_ctx_journal_pack( current_ctx , &packed_journal, &packed_journal_len);
-					pthread_mutex_unlock( &socket_mutex );
+/* Everything outstanding is cancelled and waited for, as the kernel may still be using the buffers and send slots */
+static void net_socket_uring_destroy( void )
+{
+	struct io_uring_sqe *sqe = NULL;
+	arena_t *arena = NULL;
+	int tries = 0;
 
-					if( packed_journal_len > 0 )
-					{
-						midi_payload_set_j( single_midi_payload );
-					} else {
-						midi_payload_unset_j( single_midi_payload );
-					}
+	if( ! uring ) return;
 
-					// We have to pack the payload again each time because some connections may not have a journal
-					// and the flag to indicate the journal being present is in the payload
-					midi_payload_pack( single_midi_payload, &packed_payload, &packed_payload_len );
-					logging_printf(LOGGING_DEBUG, "packed_payload: buffer=%p,packed_payload_len=%u packed_journal_len=%u\n", packed_payload, packed_payload_len, packed_journal_len);
+	uring_stopping = 1;
+	arena = arena_thread();
 
-					// Join the packed MIDI payload and the journal together
-					packed_rtp_payload = (unsigned char *)malloc( packed_payload_len + packed_journal_len );
-					memset( packed_rtp_payload, 0, packed_payload_len + packed_journal_len );
-					memcpy( packed_rtp_payload, packed_payload , packed_payload_len );
-					memcpy( packed_rtp_payload + packed_payload_len , packed_journal, packed_journal_len );
-					logging_printf(LOGGING_DEBUG, "packed_rtp_payload\n");
+	sqe = net_socket_uring_sqe();
+	if( sqe )
+	{
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+		sqe->user_data = NET_SOCKET_URING_DATA( NET_SOCKET_URING_CANCEL, 0 );
+		uring_in_flight++;
+	}
 
-					rtp_packet = rtp_packet_create();
-					net_ctx_increment_seq( current_ctx );
+	for( tries = 0; uring_in_flight > 0 && tries < 100; tries++ )
+	{
+		uring_submit( uring, 1, 10 );
+		net_socket_uring_reap( arena );
+	}
 
-					// Transfer the connection details to the RTP packet
-					net_ctx_update_rtp_fields( current_ctx , rtp_packet );
+	if( uring_in_flight > 0 )
+	{
+		logging_printf( LOGGING_WARN, "net_socket_uring_destroy: %u operations still in flight\n", uring_in_flight );
+	}
 
-					// Add the MIDI data to the RTP packet
-					rtp_packet->payload_len = packed_payload_len + packed_journal_len;
+	logging_printf( LOGGING_INFO, "net_socket_uring_destroy: enters=%u submitted=%u completed=%u received=%u sent=%u\n",
+		uring->enters, uring->submitted, uring->completed, uring_received, uring_sent );
 
-					rtp_packet->payload = (unsigned char *)malloc( rtp_packet->payload_len );
-					memcpy( rtp_packet->payload, packed_rtp_payload, rtp_packet->payload_len );
-					rtp_packet_dump( rtp_packet );
+	uring_destroy( &uring );
+	FREENULL( "net_socket_uring_destroy: uring_sends", (void **)&uring_sends );
+	uring_free_send = -1;
+}
 
-					// Pack the RTP data
-					rtp_packet_pack( rtp_packet, &packed_rtp_buffer, &packed_rtp_buffer_len );
+/* Returns -1 if io_uring isn't in use or the kernel turned out not to support multishot receives.
+   The caller carries on with select() */
+static int net_socket_uring_loop( void )
+{
+	arena_t *arena = NULL;
+	int ret = 0;
+	int i = 0;
 
-					pthread_mutex_lock( &socket_mutex );
-					net_ctx_send( sockets[ DATA_PORT ], current_ctx, packed_rtp_buffer, packed_rtp_buffer_len );
-					pthread_mutex_unlock( &socket_mutex );
+	if( ! uring ) return -1;
 
-					FREENULL( "packed_rtp_buffer", (void **)&packed_rtp_buffer );
-					rtp_packet_destroy( &rtp_packet );
+	arena = arena_thread();
+	if( ! arena )
+	{
+		logging_printf( LOGGING_ERROR, "net_socket_uring_loop: Unable to create packet arena\n");
+		return -1;
+	}
 
-					FREENULL( "packed_rtp_payload", (void **)&packed_rtp_payload );
-					FREENULL( "packed_journal", (void **)&packed_journal );
+	for( i = 0; i < num_sockets; i++ )
+	{
+		// The data workers read the data port themselves
+		if( data_workers_running && i == DATA_PORT ) continue;
+#ifdef HAVE_ALSA
+		if( sockets[i] == alsa_event_fd )
+		{
+			net_socket_uring_arm_read( alsa_event_fd, NET_SOCKET_URING_EVENT, &uring_event_count );
+			continue;
+		}
+#endif
+		net_socket_uring_arm_recv( sockets[i] );
+	}
 
-					switch( message_type )
-					{
-						case MIDI_NOTE_OFF:
-						case MIDI_NOTE_ON:
-							net_ctx_add_journal_note( current_ctx , midi_note );
-							break;
-						case MIDI_CONTROL_CHANGE:
-							net_ctx_add_journal_control( current_ctx, midi_control );
-							break;
-						case MIDI_PROGRAM_CHANGE:	
-							net_ctx_add_journal_program( current_ctx, midi_program );
-							break;
-						default:
-							continue;
-					}
-				}
+	if( timer_fd >= 0 ) net_socket_uring_arm_read( timer_fd, NET_SOCKET_URING_TIMER, &uring_timer_count );
+	if( net_ctx_tx_event_fd() >= 0 ) net_socket_uring_arm_read( net_ctx_tx_event_fd(), NET_SOCKET_URING_TX_EVENT, &uring_tx_count );
+	net_socket_uring_arm_handoff();
 
-				// Clean up
-				FREENULL( "packed_payload", (void **)&packed_payload );
-				midi_payload_destroy( &single_midi_payload );
-				switch( message_type )
-				{
-					case MIDI_NOTE_OFF:
-					case MIDI_NOTE_ON:
-						midi_note_destroy( &midi_note );
-						break;
-					case MIDI_CONTROL_CHANGE:
-						midi_control_destroy( &midi_control );
-						break;
-					case MIDI_PROGRAM_CHANGE:
-						midi_program_destroy( &midi_program );
-						break;
-					default:
-						break;
-				}
+	do {
+		// Queued sends and receives go to the kernel here, then this waits for the next completion
+		ret = uring_submit( uring, 1, socket_timeout * 1000 );
+		if( ret < 0 && ret != -EINTR && ret != -ETIME && ret != -EBUSY )
+		{
+			logging_printf( LOGGING_ERROR, "net_socket_uring_loop: io_uring_enter failed: %s\n", strerror( -ret ) );
+		}
 
-				midi_command_reset( &(midi_commands[midi_command_index]) );
-			}
+		packet_capture_check_signal();
+		net_socket_check_reload();
 
-			free( midi_commands );
+		net_socket_uring_reap( arena );
+		net_socket_uring_arm_tx_poll();
 
-		} else {
-		// RTP MIDI inbound from remote socket
-			rtp_packet_t *rtp_packet = NULL;
-			midi_payload_t *midi_payload=NULL;
-			midi_command_t *midi_commands=NULL;
-			size_t num_midi_commands=0;
-			net_response_t *response = NULL;
-			size_t midi_command_index = 0;
-
-			rtp_packet = rtp_packet_create();
-			rtp_packet_unpack( packet, recv_len, rtp_packet );
-			logging_printf(LOGGING_DEBUG, "net_socket_read: inbound MIDI received\n");
-			rtp_packet_dump( rtp_packet );
+		if( uring_unsupported )
+		{
+			logging_printf( LOGGING_WARN, "net_socket_uring_loop: Multishot receives aren't supported by this kernel. Using select()\n");
+			net_socket_uring_destroy();
+			return -1;
+		}
+	} while( net_socket_shutdown == 0 );
 
-			midi_payload_unpack( &midi_payload, rtp_packet->payload, recv_len );
+	net_socket_uring_destroy();
 
-			// Read all the commands in the packet into an array
-			midi_payload_to_commands( midi_payload, MIDI_PAYLOAD_RTP, &midi_commands, &num_midi_commands );
+	return 0;
+}
 
-			// Sent a FEEBACK packet back to the originating host to ack the MIDI packet
-			response = cmd_feedback_create( rtp_packet->header.ssrc, rtp_packet->header.seq );
-			if( response )
-			{
-				size_t bytes_written = 0;
-				pthread_mutex_lock( &socket_mutex );
-				bytes_written = sendto( fd, response->buffer, response->len , 0 , (void *)&from_addr, from_len);
-				pthread_mutex_unlock( &socket_mutex );
-				logging_printf( LOGGING_DEBUG, "net_socket_read: feedback write(bytes=%u,socket=%d,host=%s,port=%u)\n", bytes_written, fd,ip_address, from_port);
-				net_response_destroy( &response );
-			}
+#else
 
-			// Determine if the MIDI commands need to be written out
-			output_enabled = ( inbound_midi_fd >= 0 );
-#ifdef HAVE_ALSA
-			output_enabled |= raveloxmidi_alsa_out_available();
-#endif
-			if( output_enabled )
-			{
-				logging_printf(LOGGING_DEBUG, "net_socket_read: output_enabled\n");
-				for( midi_command_index = 0 ; midi_command_index < num_midi_commands ; midi_command_index++ )
-				{
-					unsigned char *raw_buffer = (unsigned char *)malloc( 2 + midi_commands[midi_command_index].data_len );
+static int net_socket_uring_send( int fd, unsigned char *buffer, size_t len, struct sockaddr_storage *to_addr, socklen_t to_len )
+{
+	return -1;
+}
 
-					if( raw_buffer )
-					{
-						size_t bytes_written = 0;
-						raw_buffer[0]=midi_commands[midi_command_index].status;
-						if( midi_commands[midi_command_index].data_len > 0 )
-						{
-							memcpy( raw_buffer + 1, midi_commands[midi_command_index].data, midi_commands[midi_command_index].data_len );
-						}
-
-						if( inbound_midi_fd >= 0 )
-						{
-							pthread_mutex_lock( &socket_mutex );
-							bytes_written = write( inbound_midi_fd, raw_buffer, 1 + midi_commands[midi_command_index].data_len );
-							pthread_mutex_unlock( &socket_mutex );
-							logging_printf( LOGGING_DEBUG, "net_socket_read: inbound MIDI write(bytes=%u)\n", bytes_written );
-						}
+static void net_socket_uring_create( void )
+{
+	if( ! config_bool_get("network.io_uring") ) return;
 
-#ifdef HAVE_ALSA
-						pthread_mutex_lock( &socket_mutex );
-						raveloxmidi_alsa_write( raw_buffer, 1 + midi_commands[midi_command_index].data_len );
-						pthread_mutex_unlock( &socket_mutex );
-#endif
-						free( raw_buffer );
-					}
-				}
-			}
+	logging_printf( LOGGING_WARN, "net_socket_uring_create: raveloxmidi was built without io_uring support. Using select()\n");
+}
 
-			// Clean up
-			midi_payload_destroy( &midi_payload );
-			for( ; num_midi_commands >= 1 ; num_midi_commands-- )
-			{
-				midi_command_reset( &(midi_commands[num_midi_commands - 1]) );
-			}
-			free( midi_commands );
-			rtp_packet_destroy( &rtp_packet );
-		}
-	}
-	return ret;
+static void net_socket_uring_destroy( void )
+{
 }
 
-static void set_shutdown_lock( int i )
+static int net_socket_uring_loop( void )
 {
-	pthread_mutex_lock( &shutdown_lock );
-	net_socket_shutdown = i;
-	pthread_mutex_unlock( &shutdown_lock );
+	return -1;
 }
 
+#endif
+
 void net_socket_loop_init()
 {
 	int err = 0;
@@ -551,10 +2365,33 @@ void net_socket_loop_init()
 		logging_printf(LOGGING_DEBUG, "net_socket_loop_init: pipe0=%d pipe1=%d\n", pipe_fd[0], pipe_fd[1]);
 		FD_SET( pipe_fd[1], &read_fds );
 	}
+
+	net_socket_timers_create();
+	handoff_fd = net_handoff_listen();
+
+	// Before any other thread is started so that they all see which thread owns the ring
+	net_socket_uring_create();
+
+	net_socket_pipeline_start();
+	net_socket_workers_start();
 }
 
 void net_socket_loop_teardown()
 {
+	// Only left if the main loop never ran
+	net_socket_uring_destroy();
+
+	// The workers pass session commands to the control stage so they are stopped first
+	net_socket_workers_stop();
+
+	// Anything still queued is handled before the stages stop
+	net_socket_pipeline_stop();
+
+	net_socket_timers_destroy();
+
+	// Closed by net_handoff_teardown() once the sockets have been passed over
+	handoff_fd = -1;
+
 	pthread_mutex_destroy( &shutdown_lock );
 	pthread_mutex_destroy( &socket_mutex );
 }
@@ -565,19 +2402,51 @@ int net_socket_fd_loop()
 	struct timeval tv; 
 	int fd = 0;
 
+	// select() is only used if io_uring isn't
+	if( net_socket_uring_loop() == 0 ) return 0;
 
         do {
 		net_socket_set_fds();
 		memset( &tv, 0, sizeof( struct timeval ) );
 		tv.tv_sec = socket_timeout; 
-                ret = select( max_fd + 1 , &read_fds, NULL , NULL , &tv );
+                ret = select( max_fd + 1 , &read_fds, &write_fds , NULL , &tv );
+
+		packet_capture_check_signal();
+		net_socket_check_reload();
 
 		if( ret > 0 )
 		{
 			for( fd = 0; fd <= max_fd; fd++ )
 			{
+				if( FD_ISSET( fd, &write_fds ) )
+				{
+					net_ctx_tx_drain( fd );
+				}
+
 				if( FD_ISSET( fd, &read_fds ) )
 				{
+					if( fd == timer_fd )
+					{
+						net_socket_timers_read();
+						continue;
+					}
+					if( fd == net_ctx_tx_event_fd() )
+					{
+						net_socket_tx_event_read();
+						continue;
+					}
+					if( fd == handoff_fd )
+					{
+						net_socket_handoff_accept();
+						continue;
+					}
+#ifdef HAVE_ALSA
+					if( fd == alsa_event_fd )
+					{
+						net_socket_alsa_drain();
+						continue;
+					}
+#endif
 					net_socket_read(fd);
 				}
 			}
@@ -596,9 +2465,36 @@ void net_socket_loop_shutdown(int signal)
 	close( pipe_fd[1] );
 }
 
-int net_socket_init( void )
+// If a file name is defined, open up the file handle to write inbound MIDI events
+static int net_socket_inbound_open( void )
 {
 	char *inbound_midi_filename = NULL;
+	int fd = -1;
+
+	inbound_midi_filename = config_string_get("inbound_midi");
+
+	if( ! inbound_midi_filename )
+	{
+		logging_printf(LOGGING_WARN, "net_socket_setup: No filename defined for inbound_midi\n");
+	} else if( ! check_file_security( inbound_midi_filename ) ) {
+		logging_printf(LOGGING_WARN, "net_socket_setup: %s fails security check\n", inbound_midi_filename );
+		logging_printf(LOGGING_WARN, "net_socket_setup: File mode=%s\n", config_string_get("file_mode") );
+	} else {
+		long file_mode_param = strtol( config_string_get("file_mode") , NULL, 8 );
+		fd = open( inbound_midi_filename, O_RDWR | O_CREAT , (mode_t)file_mode_param);
+		
+		if( fd < 0 )
+		{
+			logging_printf(LOGGING_WARN, "net_socket_setup: Unable to open %s : %s\n", inbound_midi_filename, strerror( errno ) );
+			fd = -1;
+		}
+	}
+
+	return fd;
+}
+
+int net_socket_init( void )
+{
 	char *bind_address = NULL;
 	int address_family = 0;
 	int control_port, data_port, local_port;
@@ -607,6 +2503,13 @@ int net_socket_init( void )
 	max_fd = 0;
 	FD_ZERO( &read_fds );
 
+	// Fixed size objects on the packet path are taken from pools rather than the heap
+	midi_note_pool_init( POOL_DEFAULT_CAPACITY );
+	midi_control_pool_init( POOL_DEFAULT_CAPACITY );
+	midi_program_pool_init( POOL_DEFAULT_CAPACITY );
+	rtp_packet_pool_init( POOL_DEFAULT_CAPACITY );
+	net_response_pool_init( POOL_DEFAULT_CAPACITY );
+
 	control_port = config_int_get("network.control.port");
 	data_port = config_int_get("network.data.port");
 	local_port = config_int_get("network.local.port");
@@ -615,55 +2518,42 @@ int net_socket_init( void )
 	address_family = get_addr_family( bind_address , control_port );
 	logging_printf(LOGGING_DEBUG, "net_socket_init: network.bind_address=[%s], family=%d\n", bind_address, address_family);
 
-	switch( address_family )
-	{
-		case AF_INET: 
-		case AF_INET6:
-			if(
-				net_socket_create( address_family, bind_address, control_port ) ||
-				net_socket_create( address_family, bind_address, data_port ) ||
-				net_socket_create( address_family, bind_address, local_port ) )
-			{
-				logging_printf(LOGGING_ERROR, "net_socket_init: Cannot create socket: %s\n", strerror( errno ) );
-				return -1;
-			}
-			break;
-		default:
-			logging_printf(LOGGING_ERROR, "net_socket_init: Invalid address family [%s][%d]\n", bind_address, address_family);
-			return -1;
-	}
-
-	// If a file name is defined, open up the file handle to write inbound MIDI events
-	inbound_midi_filename = config_string_get("inbound_midi");
-
-	if( ! inbound_midi_filename )
+	// Taking over from a running instance. Its sockets are used as they are
+	if( net_socket_adopt( control_port, data_port, local_port ) != 0 )
 	{
-		logging_printf(LOGGING_WARN, "net_socket_setup: No filename defined for inbound_midi\n");
-	} else if( ! check_file_security( inbound_midi_filename ) ) {
-		logging_printf(LOGGING_WARN, "net_socket_setup: %s fails security check\n", inbound_midi_filename );
-		logging_printf(LOGGING_WARN, "net_socket_setup: File mode=%s\n", config_string_get("file_mode") );
-	} else {
-		long file_mode_param = strtol( config_string_get("file_mode") , NULL, 8 );
-		inbound_midi_fd = open( inbound_midi_filename, O_RDWR | O_CREAT , (mode_t)file_mode_param);
-		
-		if( inbound_midi_fd < 0 )
+		switch( address_family )
 		{
-			logging_printf(LOGGING_WARN, "net_socket_setup: Unable to open %s : %s\n", inbound_midi_filename, strerror( errno ) );
-			inbound_midi_fd = -1;
+			case AF_INET: 
+			case AF_INET6:
+				if(
+					net_socket_create( address_family, bind_address, control_port ) ||
+					net_socket_data_create( address_family, bind_address, data_port ) ||
+					net_socket_create( address_family, bind_address, local_port ) )
+				{
+					logging_printf(LOGGING_ERROR, "net_socket_init: Cannot create socket: %s\n", strerror( errno ) );
+					return -1;
+				}
+				break;
+			default:
+				logging_printf(LOGGING_ERROR, "net_socket_init: Invalid address family [%s][%d]\n", bind_address, address_family);
+				return -1;
 		}
 	}
 
-#ifdef HAVE_ALSA
-/* Add a dummy socket identifier to indicate that the listener loop should read from the ALSA input device */
-	if( raveloxmidi_alsa_in_available() )
-	{
-		net_socket_add( RAVELOXMIDI_ALSA_INPUT );
-	}
-#endif
+	inbound_midi_fd = net_socket_inbound_open();
 
 #ifdef HAVE_ALSA
 	alsa_buffer_size = config_int_get("alsa.input_buffer_size");
 	packet_size = MAX( NET_APPLEMIDI_UDPSIZE, alsa_buffer_size );
+
+	// Created even if there's no input device so that a reload can open one later
+	alsa_event_fd = eventfd( 0, EFD_NONBLOCK );
+	if( alsa_event_fd < 0 || net_socket_alsa_ring_create() != 0 )
+	{
+		logging_printf(LOGGING_ERROR, "net_socket_init: Unable to create ALSA input ring: %s\n", strerror( errno ) );
+		return -1;
+	}
+	net_socket_add( alsa_event_fd );
 #else
 	packet_size = NET_APPLEMIDI_UDPSIZE;
 #endif
@@ -679,17 +2569,39 @@ int net_socket_init( void )
 }
 
 #ifdef HAVE_ALSA
+/* Reads are pushed into alsa_ring and nothing else is done here, so the device
+   is read again as soon as possible however long the network side takes */
 static void * net_socket_alsa_listener( void *data )
 {
+	uint64_t event = 1;
+	int recv_len = 0;
+	int pushed = 0;
+
 	logging_printf(LOGGING_DEBUG, "net_socket_alsa_listener: Thread started\n");
+	realtime_prefault_stack();
 	raveloxmidi_alsa_set_poll_fds( pipe_fd[0] );
 	do {
 		// Set poll timeout to be milliseconds
 		if( raveloxmidi_alsa_poll( socket_timeout * 1000 ) == 1 )
 		{
-			net_socket_read( RAVELOXMIDI_ALSA_INPUT );
+			pushed = 0;
+			while( ( recv_len = raveloxmidi_alsa_read( alsa_read_buffer, alsa_buffer_size ) ) > 0 )
+			{
+				// The first byte is the 0xaa origin marker. Only the MIDI data goes into the ring
+				if( recv_len > 1 )
+				{
+					ring_push( alsa_ring, alsa_read_buffer + 1, recv_len - 1 );
+					pushed = 1;
+				}
+			}
+
+			// One wake up for everything read. Overflows also wake the main loop so that they are reported
+			if( pushed && write( alsa_event_fd, &event, sizeof( event ) ) < 0 )
+			{
+				logging_printf(LOGGING_WARN, "net_socket_alsa_listener: Unable to signal main loop: %s\n", strerror( errno ) );
+			}
 		}
-	} while (net_socket_shutdown == 0 );
+	} while ( ( net_socket_shutdown == 0 ) && ( alsa_listener_stop == 0 ) );
 	logging_printf(LOGGING_DEBUG, "net_socket_alsa_listener: Thread stopped\n");
 
 	return NULL;
@@ -700,21 +2612,147 @@ int net_socket_alsa_loop()
 	// Only start the thread if the input handle is available
 	if( raveloxmidi_alsa_in_available() )
 	{
-		pthread_create( &alsa_listener_thread, NULL, net_socket_alsa_listener, NULL );
+		alsa_read_buffer = ( unsigned char * ) malloc( alsa_buffer_size + 1 );
+		if( ! alsa_read_buffer )
+		{
+			logging_printf(LOGGING_ERROR, "net_socket_alsa_loop: Unable to allocate memory for ALSA read buffer\n");
+			return -1;
+		}
+
+		if( pthread_create( &alsa_listener_thread, NULL, net_socket_alsa_listener, NULL ) == 0 )
+		{
+			alsa_listener_running = 1;
+			pipeline_set_affinity( alsa_listener_thread, ingress_cpu, "ALSA listener" );
+			realtime_thread_apply( alsa_listener_thread, "alsa" );
+		}
 	}
 	return 0;
 }
 
 void net_socket_wait_for_alsa(void)
 {
-	if( raveloxmidi_alsa_in_available() )
+	if( alsa_listener_running )
 	{
 		pthread_join( alsa_listener_thread, NULL );
+		alsa_listener_running = 0;
+	}
+
+	if( alsa_read_buffer ) FREENULL( "net_socket_wait_for_alsa: alsa_read_buffer", (void **)&alsa_read_buffer );
+}
+
+/* Reopen the ALSA devices if any of their settings have changed.
+   The listener thread is stopped first so that nothing reads from the old input handle */
+static void net_socket_alsa_reload( void )
+{
+	size_t new_packet_size = 0;
+	unsigned char *new_packet = NULL;
+	unsigned char wake = 0;
+
+	if( ! config_changed("alsa.input_device") && ! config_changed("alsa.output_device") &&
+		! config_changed("alsa.input_buffer_size") && ! config_changed("alsa.ring_size") ) return;
+
+	logging_printf(LOGGING_INFO, "net_socket_alsa_reload: Reopening ALSA devices\n");
+
+	if( alsa_listener_running )
+	{
+		// The byte on the pipe wakes the listener from poll()
+		alsa_listener_stop = 1;
+		if( write( pipe_fd[1], &wake, 1 ) < 0 )
+		{
+			logging_printf(LOGGING_WARN, "net_socket_alsa_reload: Unable to wake listener: %s\n", strerror( errno ) );
+		}
+		net_socket_wait_for_alsa();
+		if( read( pipe_fd[0], &wake, 1 ) < 0 )
+		{
+			logging_printf(LOGGING_WARN, "net_socket_alsa_reload: Unable to clear pipe: %s\n", strerror( errno ) );
+		}
+		alsa_listener_stop = 0;
+	}
+
+	pthread_mutex_lock( &socket_mutex );
+	raveloxmidi_alsa_teardown();
+	raveloxmidi_alsa_init( config_string_get("alsa.input_device") , config_string_get("alsa.output_device") , config_int_get("alsa.input_buffer_size") );
+	pthread_mutex_unlock( &socket_mutex );
+
+	// Whatever the old listener read is sent on before the ring is replaced
+	net_socket_alsa_drain();
+
+	// The drain buffer must hold the biggest read the listener can push
+	alsa_buffer_size = config_int_get("alsa.input_buffer_size");
+	new_packet_size = MAX( NET_APPLEMIDI_UDPSIZE, alsa_buffer_size );
+	if( new_packet_size > packet_size )
+	{
+		new_packet = ( unsigned char * ) realloc( packet, new_packet_size + 1 );
+		if( new_packet )
+		{
+			packet = new_packet;
+			packet_size = new_packet_size;
+		} else {
+			logging_printf(LOGGING_WARN, "net_socket_alsa_reload: Unable to grow read buffer. alsa.input_buffer_size limited to %zu\n", packet_size );
+			alsa_buffer_size = packet_size;
+		}
 	}
+
+	// Nothing is using the ring while the listener is stopped
+	net_socket_alsa_ring_destroy();
+	if( net_socket_alsa_ring_create() != 0 )
+	{
+		logging_printf(LOGGING_ERROR, "net_socket_alsa_reload: Unable to create ALSA input ring. ALSA input is disabled\n");
+		return;
+	}
+
+	net_socket_alsa_loop();
+}
+
+#endif
+
+/* Signal handler: only flag the request. The reload is done from the main loop */
+void net_socket_reload_signal( int signal )
+{
+	reload_requested = 1;
+}
+
+/* Swap inbound_midi_fd under the lock used for writes to it */
+static void net_socket_inbound_reload( void )
+{
+	int new_fd = -1;
+	int old_fd = -1;
+
+	new_fd = net_socket_inbound_open();
+
+	pthread_mutex_lock( &socket_mutex );
+	old_fd = inbound_midi_fd;
+	inbound_midi_fd = new_fd;
+	pthread_mutex_unlock( &socket_mutex );
+
+	if( old_fd >= 0 ) close( old_fd );
 }
 
+/* Apply a new config snapshot. Connections and their journals are left as they are */
+static void net_socket_check_reload( void )
+{
+	if( ! reload_requested ) return;
+
+	reload_requested = 0;
+
+	logging_printf(LOGGING_NORMAL, "Reloading configuration\n");
+
+	if( config_reload() != 0 ) return;
+
+	socket_timeout = config_long_get("network.socket_timeout");
+	logging_printf(LOGGING_DEBUG, "net_socket_check_reload: network.socket_timeout=%d\n", socket_timeout );
+
+	net_socket_inbound_reload();
+
+#ifdef HAVE_ALSA
+	net_socket_alsa_reload();
 #endif
 
+	net_socket_timers_reload();
+
+	logging_printf(LOGGING_NORMAL, "Configuration reloaded\n");
+}
+
 void net_socket_set_fds(void)
 {
 	int i = 0;
@@ -724,10 +2762,39 @@ void net_socket_set_fds(void)
 	FD_ZERO( &read_fds );
 	for( i = 0; i < num_sockets; i++ )
 	{
+		// The data workers read the data port themselves
+		if( data_workers_running && i == DATA_PORT ) continue;
+
 		if( sockets[i] > 0 )
 		{
 			FD_SET( sockets[i], &read_fds );
 			max_fd = MAX( max_fd, sockets[i] );
 		}
 	}
+
+	if( timer_fd >= 0 )
+	{
+		FD_SET( timer_fd, &read_fds );
+		max_fd = MAX( max_fd, timer_fd );
+	}
+
+	if( handoff_fd >= 0 )
+	{
+		FD_SET( handoff_fd, &read_fds );
+		max_fd = MAX( max_fd, handoff_fd );
+	}
+
+	// Sessions with packets waiting in their transmit queue need the data socket to be writable
+	FD_ZERO( &write_fds );
+	if( net_ctx_tx_event_fd() >= 0 )
+	{
+		FD_SET( net_ctx_tx_event_fd(), &read_fds );
+		max_fd = MAX( max_fd, net_ctx_tx_event_fd() );
+
+		if( net_ctx_tx_blocked() )
+		{
+			FD_SET( sockets[ DATA_PORT ], &write_fds );
+			max_fd = MAX( max_fd, sockets[ DATA_PORT ] );
+		}
+	}
 }
@@ -0,0 +1,488 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <pthread.h>
+
+#include <errno.h>
+extern int errno;
+
+#include "config.h"
+
+#include "packet_capture.h"
+#include "utils.h"
+
+#include "raveloxmidi_config.h"
+#include "logging.h"
+
+#define CAPTURE_MAX_FDS	64
+
+typedef struct capture_local_t {
+	uint8_t		family;
+	uint16_t	port;
+	uint8_t		addr[16];
+} capture_local_t;
+
+static pthread_mutex_t capture_mutex;
+static capture_header_t *capture = NULL;
+static size_t capture_map_size = 0;
+static int capture_anonymous = 0;
+static capture_local_t local_addresses[ CAPTURE_MAX_FDS ];
+static volatile sig_atomic_t dump_requested = 0;
+
+static size_t capture_map_length( uint32_t slot_count )
+{
+	return sizeof( capture_header_t ) + ( (size_t)slot_count * sizeof( capture_record_t ) );
+}
+
+static capture_record_t *capture_slot( capture_header_t *header, uint64_t index )
+{
+	capture_record_t *records = (capture_record_t *)( header + 1 );
+
+	return &( records[ index % header->slot_count ] );
+}
+
+static void capture_sockaddr_split( struct sockaddr *sa, uint8_t *family, uint8_t *addr, uint16_t *port )
+{
+	*family = 0;
+	*port = 0;
+	memset( addr, 0, 16 );
+
+	if( ! sa ) return;
+
+	switch( sa->sa_family )
+	{
+		case AF_INET:
+			*family = AF_INET;
+			memcpy( addr, &( ((struct sockaddr_in *)sa)->sin_addr ), 4 );
+			*port = ntohs( ((struct sockaddr_in *)sa)->sin_port );
+			break;
+		case AF_INET6:
+			*family = AF_INET6;
+			memcpy( addr, &( ((struct sockaddr_in6 *)sa)->sin6_addr ), 16 );
+			*port = ntohs( ((struct sockaddr_in6 *)sa)->sin6_port );
+			break;
+	}
+}
+
+static void capture_local_lookup( int fd, capture_local_t *local )
+{
+	struct sockaddr_storage local_addr;
+	socklen_t local_len = sizeof( local_addr );
+
+	if( ( fd >= 0 ) && ( fd < CAPTURE_MAX_FDS ) && ( local_addresses[fd].family != 0 ) )
+	{
+		memcpy( local, &( local_addresses[fd] ), sizeof( capture_local_t ) );
+		return;
+	}
+
+	memset( local, 0, sizeof( capture_local_t ) );
+	memset( &local_addr, 0, sizeof( local_addr ) );
+	if( getsockname( fd, (struct sockaddr *)&local_addr, &local_len ) != 0 ) return;
+
+	capture_sockaddr_split( (struct sockaddr *)&local_addr, &(local->family), local->addr, &(local->port) );
+
+	if( ( fd >= 0 ) && ( fd < CAPTURE_MAX_FDS ) )
+	{
+		memcpy( &( local_addresses[fd] ), local, sizeof( capture_local_t ) );
+	}
+}
+
+int packet_capture_init( void )
+{
+	char *capture_filename = NULL;
+	long slot_count = 0;
+	int capture_fd = -1;
+	struct stat capture_stat;
+	int reuse = 0;
+	void *map = NULL;
+
+	capture = NULL;
+	capture_map_size = 0;
+	capture_anonymous = 0;
+	dump_requested = 0;
+	memset( local_addresses, 0, sizeof( local_addresses ) );
+
+	if( ! is_yes( config_string_get("capture.enabled") ) ) return 0;
+
+	slot_count = config_long_get("capture.packets");
+	if( slot_count <= 0 )
+	{
+		logging_printf( LOGGING_WARN, "packet_capture_init: Invalid capture.packets value, capture disabled\n");
+		return -1;
+	}
+
+	capture_map_size = capture_map_length( slot_count );
+	capture_filename = config_string_get("capture.file");
+
+	// The ring is kept in memory only if nothing may be written to disk
+	if( is_yes( config_string_get("readonly") ) || ! capture_filename )
+	{
+		map = mmap( NULL, capture_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+		capture_anonymous = 1;
+	} else {
+		if( is_yes( config_string_get("security.check") ) && ! check_file_security( capture_filename ) )
+		{
+			logging_printf( LOGGING_ERROR, "packet_capture_init: %s fails security check\n", capture_filename );
+			return -1;
+		}
+
+		capture_fd = open( capture_filename, O_RDWR | O_CREAT, (mode_t)strtol( config_string_get("file_mode"), NULL, 8 ) );
+		if( capture_fd < 0 )
+		{
+			logging_printf( LOGGING_ERROR, "packet_capture_init: Unable to open %s: %s\n", capture_filename, strerror( errno ) );
+			return -1;
+		}
+
+		if( ( fstat( capture_fd, &capture_stat ) == 0 ) && ( (size_t)capture_stat.st_size == capture_map_size ) )
+		{
+			reuse = 1;
+		} else if( ftruncate( capture_fd, capture_map_size ) != 0 ) {
+			logging_printf( LOGGING_ERROR, "packet_capture_init: Unable to size %s: %s\n", capture_filename, strerror( errno ) );
+			close( capture_fd );
+			return -1;
+		}
+
+		map = mmap( NULL, capture_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, capture_fd, 0 );
+		close( capture_fd );
+	}
+
+	if( map == MAP_FAILED )
+	{
+		logging_printf( LOGGING_ERROR, "packet_capture_init: Unable to map capture ring: %s\n", strerror( errno ) );
+		return -1;
+	}
+
+	capture = (capture_header_t *)map;
+
+	// Keep the records from a previous run if the ring has the same shape
+	if( reuse && ( memcmp( capture->magic, CAPTURE_MAGIC, sizeof( capture->magic ) ) == 0 ) &&
+		( capture->version == CAPTURE_VERSION ) && ( capture->slot_count == slot_count ) &&
+		( capture->slot_size == CAPTURE_SLOT_SIZE ) )
+	{
+		logging_printf( LOGGING_INFO, "packet_capture_init: Reusing capture ring %s (records=%llu)\n", capture_filename, capture->next );
+	} else {
+		memset( capture, 0, sizeof( capture_header_t ) );
+		memcpy( capture->magic, CAPTURE_MAGIC, sizeof( capture->magic ) );
+		capture->version = CAPTURE_VERSION;
+		capture->slot_count = slot_count;
+		capture->slot_size = CAPTURE_SLOT_SIZE;
+		capture->next = 0;
+	}
+
+	pthread_mutex_init( &capture_mutex, NULL );
+
+	logging_printf( LOGGING_INFO, "Packet capture enabled: packets=%ld file=%s\n", slot_count, ( capture_anonymous ? "(memory)" : capture_filename ) );
+
+	return 0;
+}
+
+void packet_capture_teardown( void )
+{
+	if( ! capture ) return;
+
+	pthread_mutex_lock( &capture_mutex );
+	if( ! capture_anonymous )
+	{
+		msync( capture, capture_map_size, MS_SYNC );
+	}
+	munmap( capture, capture_map_size );
+	capture = NULL;
+	capture_map_size = 0;
+	pthread_mutex_unlock( &capture_mutex );
+
+	pthread_mutex_destroy( &capture_mutex );
+}
+
+int packet_capture_enabled( void )
+{
+	return ( capture != NULL );
+}
+
+void packet_capture_record( int direction, int fd, struct sockaddr *peer, unsigned char *buffer, size_t len )
+{
+	capture_record_t *record = NULL;
+	capture_local_t local;
+	struct timeval now;
+
+	if( ! capture ) return;
+	if( ! buffer ) return;
+
+	gettimeofday( &now, NULL );
+
+	pthread_mutex_lock( &capture_mutex );
+
+	capture_local_lookup( fd, &local );
+
+	record = capture_slot( capture, capture->next );
+
+	record->tv_sec = now.tv_sec;
+	record->tv_usec = now.tv_usec;
+	record->direction = direction;
+	record->local_port = local.port;
+	memcpy( record->local_addr, local.addr, sizeof( record->local_addr ) );
+	capture_sockaddr_split( peer, &(record->family), record->peer_addr, &(record->peer_port) );
+	record->len = len;
+	record->caplen = MIN( len, CAPTURE_SLOT_SIZE );
+	memcpy( record->data, buffer, record->caplen );
+
+	capture->next++;
+
+	pthread_mutex_unlock( &capture_mutex );
+}
+
+static uint16_t capture_ip_checksum( unsigned char *header, size_t len )
+{
+	uint32_t sum = 0;
+	size_t i = 0;
+
+	for( i = 0; i + 1 < len; i += 2 )
+	{
+		sum += ( header[i] << 8 ) | header[i+1];
+	}
+
+	while( sum >> 16 )
+	{
+		sum = ( sum & 0xffff ) + ( sum >> 16 );
+	}
+
+	return (uint16_t)( ~sum );
+}
+
+/* Build the IP and UDP headers that would have carried the datagram */
+static size_t capture_ip_udp_header( capture_record_t *record, unsigned char *header )
+{
+	unsigned char *p = header;
+	size_t len = 0;
+	size_t ip_len = 0;
+	uint16_t udp_len = 8 + record->caplen;
+	uint8_t *src_addr, *dst_addr;
+	uint16_t src_port, dst_port;
+
+	if( record->direction == CAPTURE_INBOUND )
+	{
+		src_addr = record->peer_addr;
+		src_port = record->peer_port;
+		dst_addr = record->local_addr;
+		dst_port = record->local_port;
+	} else {
+		src_addr = record->local_addr;
+		src_port = record->local_port;
+		dst_addr = record->peer_addr;
+		dst_port = record->peer_port;
+	}
+
+	if( record->family == AF_INET6 )
+	{
+		ip_len = 40;
+		memset( p, 0, ip_len );
+		p[0] = 0x60;
+		p[4] = ( udp_len >> 8 ) & 0xff;
+		p[5] = udp_len & 0xff;
+		p[6] = IPPROTO_UDP;
+		p[7] = 64;
+		memcpy( p + 8, src_addr, 16 );
+		memcpy( p + 24, dst_addr, 16 );
+	} else {
+		uint16_t total_len = 20 + udp_len;
+		uint16_t checksum = 0;
+
+		ip_len = 20;
+		memset( p, 0, ip_len );
+		p[0] = 0x45;
+		p[2] = ( total_len >> 8 ) & 0xff;
+		p[3] = total_len & 0xff;
+		p[6] = 0x40;
+		p[8] = 64;
+		p[9] = IPPROTO_UDP;
+		memcpy( p + 12, src_addr, 4 );
+		memcpy( p + 16, dst_addr, 4 );
+		checksum = capture_ip_checksum( p, ip_len );
+		p[10] = ( checksum >> 8 ) & 0xff;
+		p[11] = checksum & 0xff;
+	}
+
+	p += ip_len;
+	len += ip_len;
+
+	// UDP header. A zero checksum means "not calculated"
+	put_uint16( &p, src_port, &len );
+	put_uint16( &p, dst_port, &len );
+	put_uint16( &p, udp_len, &len );
+	put_uint16( &p, 0, &len );
+
+	return len;
+}
+
+static int capture_write_pcap( capture_header_t *header, char *pcap_filename )
+{
+	FILE *pcap_file = NULL;
+	pcap_file_header_t file_header;
+	pcap_record_header_t record_header;
+	capture_record_t *record = NULL;
+	unsigned char ip_udp_header[48];
+	size_t ip_udp_len = 0;
+	uint64_t first = 0, index = 0;
+	int written = 0;
+
+	if( ! header ) return -1;
+	if( ! pcap_filename ) return -1;
+
+	pcap_file = fopen( pcap_filename, "w" );
+	if( ! pcap_file )
+	{
+		logging_printf( LOGGING_ERROR, "packet_capture: Unable to open %s: %s\n", pcap_filename, strerror( errno ) );
+		return -1;
+	}
+
+	memset( &file_header, 0, sizeof( file_header ) );
+	file_header.magic = PCAP_MAGIC;
+	file_header.version_major = PCAP_VERSION_MAJOR;
+	file_header.version_minor = PCAP_VERSION_MINOR;
+	file_header.snaplen = 65535;
+	file_header.linktype = PCAP_LINKTYPE_RAW;
+	fwrite( &file_header, sizeof( file_header ), 1, pcap_file );
+
+	// Write out the oldest record first
+	first = ( header->next > header->slot_count ? header->next - header->slot_count : 0 );
+
+	for( index = first; index < header->next; index++ )
+	{
+		record = capture_slot( header, index );
+
+		if( ( record->family != AF_INET ) && ( record->family != AF_INET6 ) ) continue;
+		if( record->caplen > CAPTURE_SLOT_SIZE ) continue;
+
+		ip_udp_len = capture_ip_udp_header( record, ip_udp_header );
+
+		record_header.ts_sec = record->tv_sec;
+		record_header.ts_usec = record->tv_usec;
+		record_header.incl_len = ip_udp_len + record->caplen;
+		record_header.orig_len = ip_udp_len + record->len;
+
+		fwrite( &record_header, sizeof( record_header ), 1, pcap_file );
+		fwrite( ip_udp_header, ip_udp_len, 1, pcap_file );
+		fwrite( record->data, record->caplen, 1, pcap_file );
+		written++;
+	}
+
+	fclose( pcap_file );
+
+	logging_printf( LOGGING_NORMAL, "packet_capture: Wrote %d packets to %s\n", written, pcap_filename );
+
+	return written;
+}
+
+int packet_capture_dump( void )
+{
+	int ret = 0;
+
+	if( ! capture ) return -1;
+
+	if( is_yes( config_string_get("readonly") ) )
+	{
+		logging_printf( LOGGING_WARN, "packet_capture_dump: Not writing pcap file in readonly mode\n");
+		return -1;
+	}
+
+	pthread_mutex_lock( &capture_mutex );
+	ret = capture_write_pcap( capture, config_string_get("capture.pcap_file") );
+	pthread_mutex_unlock( &capture_mutex );
+
+	return ret;
+}
+
+/* Convert a capture file left behind by a previous (possibly crashed) process */
+int packet_capture_dump_file( void )
+{
+	char *capture_filename = NULL;
+	int capture_fd = -1;
+	struct stat capture_stat;
+	capture_header_t *header = NULL;
+	int ret = -1;
+
+	capture_filename = config_string_get("capture.file");
+	if( ! capture_filename ) return -1;
+
+	capture_fd = open( capture_filename, O_RDONLY );
+	if( capture_fd < 0 )
+	{
+		logging_printf( LOGGING_ERROR, "packet_capture_dump_file: Unable to open %s: %s\n", capture_filename, strerror( errno ) );
+		return -1;
+	}
+
+	if( ( fstat( capture_fd, &capture_stat ) != 0 ) || ( (size_t)capture_stat.st_size < sizeof( capture_header_t ) ) )
+	{
+		logging_printf( LOGGING_ERROR, "packet_capture_dump_file: %s is not a capture file\n", capture_filename );
+		close( capture_fd );
+		return -1;
+	}
+
+	header = (capture_header_t *)mmap( NULL, capture_stat.st_size, PROT_READ, MAP_SHARED, capture_fd, 0 );
+	close( capture_fd );
+
+	if( (void *)header == MAP_FAILED )
+	{
+		logging_printf( LOGGING_ERROR, "packet_capture_dump_file: Unable to map %s: %s\n", capture_filename, strerror( errno ) );
+		return -1;
+	}
+
+	if( ( memcmp( header->magic, CAPTURE_MAGIC, sizeof( header->magic ) ) != 0 ) ||
+		( header->version != CAPTURE_VERSION ) || ( header->slot_size != CAPTURE_SLOT_SIZE ) ||
+		( header->slot_count == 0 ) || ( capture_map_length( header->slot_count ) != (size_t)capture_stat.st_size ) )
+	{
+		logging_printf( LOGGING_ERROR, "packet_capture_dump_file: %s is not a capture file\n", capture_filename );
+	} else {
+		ret = capture_write_pcap( header, config_string_get("capture.pcap_file") );
+	}
+
+	munmap( header, capture_stat.st_size );
+
+	return ret;
+}
+
+/* Signal handler: only flag the request. The dump is written from the main loop */
+void packet_capture_signal( int signal )
+{
+	dump_requested = 1;
+}
+
+void packet_capture_check_signal( void )
+{
+	if( ! dump_requested ) return;
+
+	dump_requested = 0;
+	packet_capture_dump();
+}
@@ -0,0 +1,221 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+
+#include <errno.h>
+extern int errno;
+
+#include "config.h"
+
+#include "pipeline.h"
+#include "queue.h"
+#include "arena.h"
+#include "realtime.h"
+#include "utils.h"
+
+#include "logging.h"
+
+pipeline_stage_t *pipeline_stage_create( char *name, uint32_t capacity, int cpu, pipeline_handler_t handler )
+{
+	pipeline_stage_t *stage = NULL;
+
+	if( ! handler ) return NULL;
+
+	stage = ( pipeline_stage_t * ) malloc( sizeof( pipeline_stage_t ) );
+	if( ! stage )
+	{
+		logging_printf( LOGGING_ERROR, "pipeline_stage_create: Insufficient memory to create stage\n");
+		return NULL;
+	}
+
+	memset( stage, 0, sizeof( pipeline_stage_t ) );
+
+	stage->name = ( name ? name : "stage" );
+	stage->cpu = cpu;
+	stage->handler = handler;
+	stage->queue = queue_create( stage->name, capacity );
+
+	if( ! stage->queue )
+	{
+		logging_printf( LOGGING_ERROR, "pipeline_stage_create: Unable to create queue for stage %s\n", stage->name );
+		FREENULL( "pipeline_stage_create: stage", (void **)&stage );
+		return NULL;
+	}
+
+	if( sem_init( &stage->ready, 0, 0 ) != 0 )
+	{
+		logging_printf( LOGGING_ERROR, "pipeline_stage_create: Unable to create semaphore for stage %s: %s\n", stage->name, strerror( errno ) );
+		queue_destroy( &stage->queue );
+		FREENULL( "pipeline_stage_create: stage", (void **)&stage );
+		return NULL;
+	}
+
+	return stage;
+}
+
+void pipeline_stage_destroy( pipeline_stage_t **stage, pipeline_handler_t release )
+{
+	void *item = NULL;
+
+	if( ! stage ) return;
+	if( ! *stage ) return;
+
+	pipeline_stage_stop( *stage );
+
+	while( ( item = queue_pop( (*stage)->queue ) ) )
+	{
+		if( release ) release( item );
+	}
+
+	queue_destroy( &( (*stage)->queue ) );
+	sem_destroy( &( (*stage)->ready ) );
+
+	FREENULL( "pipeline_stage_destroy: stage", (void **)stage );
+}
+
+int pipeline_set_affinity( pthread_t thread, int cpu, char *name )
+{
+	cpu_set_t cpu_set;
+	int ret = 0;
+
+	if( cpu < 0 ) return 0;
+
+	CPU_ZERO( &cpu_set );
+	CPU_SET( cpu, &cpu_set );
+
+	ret = pthread_setaffinity_np( thread, sizeof( cpu_set ), &cpu_set );
+	if( ret != 0 )
+	{
+		logging_printf( LOGGING_WARN, "pipeline_set_affinity: Unable to pin %s to CPU %d: %s\n", name, cpu, strerror( ret ) );
+		return -1;
+	}
+
+	logging_printf( LOGGING_INFO, "pipeline_set_affinity: %s pinned to CPU %d\n", name, cpu );
+	return 0;
+}
+
+static void *pipeline_stage_thread( void *data )
+{
+	pipeline_stage_t *stage = ( pipeline_stage_t * ) data;
+	void *item = NULL;
+
+	logging_printf( LOGGING_DEBUG, "pipeline_stage_thread: %s started\n", stage->name );
+	realtime_prefault_stack();
+
+	for( ;; )
+	{
+		while( sem_wait( &stage->ready ) != 0 && errno == EINTR );
+
+		/* One post may find several items ready if producers finished out of order */
+		while( ( item = queue_pop( stage->queue ) ) )
+		{
+			stage->handler( item );
+			__atomic_add_fetch( &stage->processed, 1, __ATOMIC_RELAXED );
+		}
+
+		if( __atomic_load_n( &stage->stop, __ATOMIC_ACQUIRE ) ) break;
+	}
+
+	// Temporaries made by the handler came from this thread's arena
+	arena_thread_release();
+
+	logging_printf( LOGGING_DEBUG, "pipeline_stage_thread: %s stopped\n", stage->name );
+
+	return NULL;
+}
+
+int pipeline_stage_start( pipeline_stage_t *stage )
+{
+	int ret = 0;
+
+	if( ! stage ) return -1;
+	if( stage->running ) return 0;
+
+	stage->stop = 0;
+
+	ret = pthread_create( &stage->thread, NULL, pipeline_stage_thread, stage );
+	if( ret != 0 )
+	{
+		logging_printf( LOGGING_ERROR, "pipeline_stage_start: Unable to start %s: %s\n", stage->name, strerror( ret ) );
+		return -1;
+	}
+
+	stage->running = 1;
+	pipeline_set_affinity( stage->thread, stage->cpu, stage->name );
+	realtime_thread_apply( stage->thread, stage->name );
+
+	return 0;
+}
+
+/* Work already queued is finished before the thread exits */
+void pipeline_stage_stop( pipeline_stage_t *stage )
+{
+	if( ! stage ) return;
+	if( ! stage->running ) return;
+
+	__atomic_store_n( &stage->stop, 1, __ATOMIC_RELEASE );
+	sem_post( &stage->ready );
+
+	pthread_join( stage->thread, NULL );
+	stage->running = 0;
+
+	logging_printf( LOGGING_INFO, "pipeline_stage_stop: %s processed=%u dropped=%u queue_high_water=%u\n",
+		stage->name, stage->processed, stage->dropped, __atomic_load_n( &stage->queue->high_water, __ATOMIC_RELAXED ) );
+}
+
+int pipeline_stage_push( pipeline_stage_t *stage, void *item )
+{
+	if( ! stage ) return -1;
+
+	if( queue_push( stage->queue, item ) != 0 )
+	{
+		__atomic_add_fetch( &stage->dropped, 1, __ATOMIC_RELAXED );
+		return -1;
+	}
+
+	sem_post( &stage->ready );
+
+	return 0;
+}
+
+void pipeline_stage_dump( pipeline_stage_t *stage )
+{
+	DEBUG_ONLY;
+	if( ! stage ) return;
+
+	logging_printf( LOGGING_DEBUG, "pipeline_stage_dump: name=%s,cpu=%d,running=%d,processed=%u,dropped=%u\n",
+		stage->name, stage->cpu, stage->running,
+		__atomic_load_n( &stage->processed, __ATOMIC_RELAXED ),
+		__atomic_load_n( &stage->dropped, __ATOMIC_RELAXED ) );
+	queue_dump( stage->queue );
+}
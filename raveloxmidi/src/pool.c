@@ -0,0 +1,184 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+
+#include "pool.h"
+#include "utils.h"
+
+#include "logging.h"
+
+/* The head and next entries hold an object index plus one so that 0 can end the list.
+   Objects that have never been used stay at the end of the list in index order, so the
+   highest index handed out is also the most objects that have been in use at once */
+
+pool_t *pool_create( char *name, size_t object_size, uint32_t capacity )
+{
+	pool_t *pool = NULL;
+	uint32_t i = 0;
+
+	if( object_size == 0 ) return NULL;
+	if( capacity == 0 ) return NULL;
+	if( capacity > POOL_MAX_CAPACITY ) capacity = POOL_MAX_CAPACITY;
+
+	pool = ( pool_t * ) malloc( sizeof( pool_t ) );
+	if( ! pool )
+	{
+		logging_printf( LOGGING_ERROR, "pool_create: Insufficient memory to create pool\n");
+		return NULL;
+	}
+
+	memset( pool, 0, sizeof( pool_t ) );
+
+	pool->name = ( name ? name : "pool" );
+	pool->object_size = ( object_size + POOL_ALIGN - 1 ) & ~( (size_t)POOL_ALIGN - 1 );
+	pool->capacity = capacity;
+	pool->objects = ( unsigned char * ) malloc( pool->object_size * capacity );
+	pool->next = ( uint16_t * ) malloc( sizeof( uint16_t ) * capacity );
+
+	if( ! pool->objects || ! pool->next )
+	{
+		logging_printf( LOGGING_ERROR, "pool_create: Insufficient memory for %u objects in pool %s\n", capacity, pool->name );
+		pool_destroy( &pool );
+		return NULL;
+	}
+
+	/* Chain every object onto the free list in order */
+	for( i = 0; i < capacity; i++ )
+	{
+		pool->next[i] = ( i + 1 < capacity ? i + 2 : 0 );
+	}
+	pool->head = 1;
+
+	logging_printf( LOGGING_DEBUG, "pool_create: name=%s object_size=%zu capacity=%u\n", pool->name, pool->object_size, capacity );
+
+	return pool;
+}
+
+void pool_destroy( pool_t **pool )
+{
+	if( ! pool ) return;
+	if( ! *pool ) return;
+
+	if( (*pool)->objects && (*pool)->next && pool_in_use( *pool ) > 0 )
+	{
+		logging_printf( LOGGING_WARN, "pool_destroy: %s still has %u objects in use\n", (*pool)->name, pool_in_use( *pool ) );
+	}
+
+	FREENULL( "pool_destroy: objects", (void **)&( (*pool)->objects ) );
+	FREENULL( "pool_destroy: next", (void **)&( (*pool)->next ) );
+	FREENULL( "pool_destroy: pool", (void **)pool );
+}
+
+int pool_owns( pool_t *pool, void *object )
+{
+	unsigned char *p = ( unsigned char * ) object;
+
+	if( ! pool ) return 0;
+	if( ! pool->objects ) return 0;
+	if( ! object ) return 0;
+
+	return ( p >= pool->objects ) && ( p < pool->objects + ( pool->object_size * pool->capacity ) );
+}
+
+/* Counts the free list, so only call this when no other thread is using the pool */
+uint32_t pool_in_use( pool_t *pool )
+{
+	uint32_t index = 0;
+	uint32_t free_count = 0;
+
+	if( ! pool ) return 0;
+
+	for( index = pool->head & POOL_INDEX_MASK; index != 0 && free_count < pool->capacity; index = pool->next[ index - 1 ] )
+	{
+		free_count++;
+	}
+
+	return pool->capacity - free_count;
+}
+
+void *pool_alloc( pool_t *pool, size_t size )
+{
+	uint32_t head = 0;
+	uint32_t new_head = 0;
+	uint32_t index = 0;
+	uint32_t high_water = 0;
+
+	if( ! pool ) return malloc( size );
+	if( size > pool->object_size ) return malloc( size );
+
+	head = __atomic_load_n( &pool->head, __ATOMIC_ACQUIRE );
+	do {
+		index = head & POOL_INDEX_MASK;
+		if( index == 0 )
+		{
+			__atomic_add_fetch( &pool->exhausted, 1, __ATOMIC_RELAXED );
+			return malloc( size );
+		}
+
+		/* If another thread takes this object first, the tag in the head has changed and the swap fails */
+		new_head = ( ( head + POOL_TAG_STEP ) & POOL_TAG_MASK ) | __atomic_load_n( &pool->next[ index - 1 ], __ATOMIC_RELAXED );
+	} while( ! __atomic_compare_exchange_n( &pool->head, &head, new_head, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE ) );
+
+	high_water = __atomic_load_n( &pool->high_water, __ATOMIC_RELAXED );
+	while( index > high_water && ! __atomic_compare_exchange_n( &pool->high_water, &high_water, index, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) );
+
+	return pool->objects + ( ( index - 1 ) * pool->object_size );
+}
+
+void pool_free( pool_t *pool, void *object )
+{
+	uint32_t head = 0;
+	uint32_t new_head = 0;
+	uint32_t index = 0;
+
+	if( ! object ) return;
+
+	if( ! pool_owns( pool, object ) )
+	{
+		free( object );
+		return;
+	}
+
+	index = ( ( ( unsigned char * ) object - pool->objects ) / pool->object_size ) + 1;
+
+	head = __atomic_load_n( &pool->head, __ATOMIC_RELAXED );
+	do {
+		__atomic_store_n( &pool->next[ index - 1 ], (uint16_t)( head & POOL_INDEX_MASK ), __ATOMIC_RELAXED );
+		new_head = ( ( head + POOL_TAG_STEP ) & POOL_TAG_MASK ) | index;
+	} while( ! __atomic_compare_exchange_n( &pool->head, &head, new_head, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED ) );
+}
+
+void pool_dump( pool_t *pool )
+{
+	DEBUG_ONLY;
+	if( ! pool ) return;
+
+	logging_printf( LOGGING_DEBUG, "pool_dump: name=%s,object_size=%zu,capacity=%u,in_use=%u,high_water=%u,exhausted=%u\n",
+		pool->name, pool->object_size, pool->capacity,
+		pool_in_use( pool ),
+		__atomic_load_n( &pool->high_water, __ATOMIC_RELAXED ),
+		__atomic_load_n( &pool->exhausted, __ATOMIC_RELAXED ) );
+}
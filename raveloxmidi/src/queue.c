@@ -0,0 +1,194 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+
+#include "queue.h"
+#include "utils.h"
+
+#include "logging.h"
+
+/* A cell is free for the producer at position pos when its sequence is pos,
+   and holds data for the consumer at position pos when its sequence is pos + 1.
+   Positions are 32 bit and wrap, so they are only ever compared by difference */
+
+queue_t *queue_create( char *name, uint32_t capacity )
+{
+	queue_t *queue = NULL;
+	uint32_t size = 1;
+	uint32_t i = 0;
+
+	if( capacity == 0 ) return NULL;
+	if( capacity > QUEUE_MAX_CAPACITY ) capacity = QUEUE_MAX_CAPACITY;
+
+	while( size < capacity ) size <<= 1;
+
+	queue = ( queue_t * ) malloc( sizeof( queue_t ) );
+	if( ! queue )
+	{
+		logging_printf( LOGGING_ERROR, "queue_create: Insufficient memory to create queue\n");
+		return NULL;
+	}
+
+	memset( queue, 0, sizeof( queue_t ) );
+
+	queue->name = ( name ? name : "queue" );
+	queue->capacity = size;
+	queue->mask = size - 1;
+	queue->cells = ( queue_cell_t * ) malloc( sizeof( queue_cell_t ) * size );
+
+	if( ! queue->cells )
+	{
+		logging_printf( LOGGING_ERROR, "queue_create: Insufficient memory for %u cells in queue %s\n", size, queue->name );
+		FREENULL( "queue_create: queue", (void **)&queue );
+		return NULL;
+	}
+
+	for( i = 0; i < size; i++ )
+	{
+		queue->cells[i].sequence = i;
+		queue->cells[i].data = NULL;
+	}
+
+	logging_printf( LOGGING_DEBUG, "queue_create: name=%s capacity=%u\n", queue->name, size );
+
+	return queue;
+}
+
+void queue_destroy( queue_t **queue )
+{
+	if( ! queue ) return;
+	if( ! *queue ) return;
+
+	if( queue_depth( *queue ) > 0 )
+	{
+		logging_printf( LOGGING_WARN, "queue_destroy: %s still has %u entries\n", (*queue)->name, queue_depth( *queue ) );
+	}
+
+	FREENULL( "queue_destroy: cells", (void **)&( (*queue)->cells ) );
+	FREENULL( "queue_destroy: queue", (void **)queue );
+}
+
+/* Only a snapshot when other threads are using the queue */
+uint32_t queue_depth( queue_t *queue )
+{
+	uint32_t enqueue_pos = 0;
+	uint32_t dequeue_pos = 0;
+
+	if( ! queue ) return 0;
+
+	dequeue_pos = __atomic_load_n( &queue->dequeue_pos, __ATOMIC_RELAXED );
+	enqueue_pos = __atomic_load_n( &queue->enqueue_pos, __ATOMIC_RELAXED );
+
+	return enqueue_pos - dequeue_pos;
+}
+
+int queue_push( queue_t *queue, void *data )
+{
+	queue_cell_t *cell = NULL;
+	uint32_t pos = 0;
+	uint32_t sequence = 0;
+	uint32_t depth = 0;
+	uint32_t high_water = 0;
+	int32_t diff = 0;
+
+	if( ! queue ) return -1;
+
+	pos = __atomic_load_n( &queue->enqueue_pos, __ATOMIC_RELAXED );
+	for( ;; )
+	{
+		cell = &( queue->cells[ pos & queue->mask ] );
+		sequence = __atomic_load_n( &cell->sequence, __ATOMIC_ACQUIRE );
+		diff = (int32_t)( sequence - pos );
+
+		if( diff == 0 )
+		{
+			/* The cell is free. Claim it by moving the position on */
+			if( __atomic_compare_exchange_n( &queue->enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) ) break;
+		} else if( diff < 0 ) {
+			/* The consumer hasn't emptied this cell since the last time round */
+			__atomic_add_fetch( &queue->full, 1, __ATOMIC_RELAXED );
+			return -1;
+		} else {
+			pos = __atomic_load_n( &queue->enqueue_pos, __ATOMIC_RELAXED );
+		}
+	}
+
+	cell->data = data;
+	__atomic_store_n( &cell->sequence, pos + 1, __ATOMIC_RELEASE );
+
+	depth = pos + 1 - __atomic_load_n( &queue->dequeue_pos, __ATOMIC_RELAXED );
+	high_water = __atomic_load_n( &queue->high_water, __ATOMIC_RELAXED );
+	while( depth > high_water && depth <= queue->capacity && ! __atomic_compare_exchange_n( &queue->high_water, &high_water, depth, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) );
+
+	return 0;
+}
+
+void *queue_pop( queue_t *queue )
+{
+	queue_cell_t *cell = NULL;
+	uint32_t pos = 0;
+	uint32_t sequence = 0;
+	int32_t diff = 0;
+	void *data = NULL;
+
+	if( ! queue ) return NULL;
+
+	pos = __atomic_load_n( &queue->dequeue_pos, __ATOMIC_RELAXED );
+	for( ;; )
+	{
+		cell = &( queue->cells[ pos & queue->mask ] );
+		sequence = __atomic_load_n( &cell->sequence, __ATOMIC_ACQUIRE );
+		diff = (int32_t)( sequence - ( pos + 1 ) );
+
+		if( diff == 0 )
+		{
+			if( __atomic_compare_exchange_n( &queue->dequeue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) ) break;
+		} else if( diff < 0 ) {
+			/* Nothing has been pushed into this cell yet */
+			return NULL;
+		} else {
+			pos = __atomic_load_n( &queue->dequeue_pos, __ATOMIC_RELAXED );
+		}
+	}
+
+	data = cell->data;
+
+	/* Hand the cell back to the producer for its next time round */
+	__atomic_store_n( &cell->sequence, pos + queue->mask + 1, __ATOMIC_RELEASE );
+
+	return data;
+}
+
+void queue_dump( queue_t *queue )
+{
+	DEBUG_ONLY;
+	if( ! queue ) return;
+
+	logging_printf( LOGGING_DEBUG, "queue_dump: name=%s,capacity=%u,depth=%u,high_water=%u,full=%u\n",
+		queue->name, queue->capacity, queue_depth( queue ),
+		__atomic_load_n( &queue->high_water, __ATOMIC_RELAXED ),
+		__atomic_load_n( &queue->full, __ATOMIC_RELAXED ) );
+}
@@ -30,12 +30,17 @@
 #include "net_applemidi.h"
 #include "net_socket.h"
 #include "net_connection.h"
+#include "net_handoff.h"
+#include "net_response.h"
+#include "cmd_inv_handler.h"
 #include "utils.h"
 
 #include "dns_service_publisher.h"
 
 #include "raveloxmidi_config.h"
 #include "daemon.h"
+#include "packet_capture.h"
+#include "realtime.h"
 
 #include "logging.h"
 
@@ -55,6 +60,19 @@ int main(int argc, char *argv[])
 	logging_init();
 	logging_printf( LOGGING_INFO, "%s (%s)\n", PACKAGE, VERSION);
 
+	/* Convert the capture ring from a previous run and exit */
+	if( is_yes( config_string_get("capture.dump") ) )
+	{
+		ret = packet_capture_dump_file();
+		config_teardown();
+		logging_teardown();
+		return ( ret < 0 ? 1 : 0 );
+	}
+
+	/* Take the sockets and sessions over from a running instance, if there is one. This waits for it to exit
+	   so that the ALSA devices, the service name and the pid file are free */
+	net_handoff_receive();
+
 #ifdef HAVE_ALSA
 	raveloxmidi_alsa_init( config_string_get("alsa.input_device") , config_string_get("alsa.output_device") , config_int_get("alsa.input_buffer_size") );
 #endif
@@ -72,10 +90,15 @@ int main(int argc, char *argv[])
 	}
 
 	net_ctx_init();
+	net_handoff_restore();
+	cmd_inv_handler_init();
+	packet_capture_init();
 
         signal( SIGINT , net_socket_loop_shutdown);
         signal( SIGTERM , net_socket_loop_shutdown);
         signal( SIGUSR2 , net_socket_loop_shutdown);
+        signal( SIGUSR1 , packet_capture_signal);
+        signal( SIGHUP , net_socket_reload_signal);
 
 	service_desc.name = config_string_get("service.name");
 	service_desc.service = "_apple-midi._udp";
@@ -91,15 +114,20 @@ int main(int argc, char *argv[])
 #ifdef HAVE_ALSA
 		net_socket_alsa_loop();
 #endif
+		realtime_start();
 		net_socket_fd_loop();
 #ifdef HAVE_ALSA
 		net_socket_wait_for_alsa();
 #endif
 		net_socket_loop_teardown();
+
+		// Only if a new instance is taking over
+		net_handoff_send();
 	}
 
 	net_socket_teardown();
 	net_ctx_teardown();
+	packet_capture_teardown();
 
 #ifdef HAVE_ALSA
 	raveloxmidi_alsa_teardown();
@@ -112,6 +140,9 @@ daemon_stop:
 		daemon_teardown();
 	}
 
+	// The new instance waits for this to close before it carries on
+	net_handoff_teardown();
+
 	config_teardown();
 
 	logging_teardown();
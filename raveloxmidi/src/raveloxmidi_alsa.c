@@ -32,6 +32,7 @@
 #include <signal.h>
 
 #include "raveloxmidi_alsa.h"
+#include "raveloxmidi_probes.h"
 #include "utils.h"
 #include "logging.h"
 
@@ -151,6 +152,7 @@ int raveloxmidi_alsa_write( unsigned char *buffer, size_t buffer_size )
 	if( output_handle ) 
 	{
 		bytes_written = snd_rawmidi_write( output_handle, buffer, buffer_size );
+		RAVELOXMIDI_PROBE2( alsa_write, buffer_size, bytes_written );
 		logging_printf(LOGGING_DEBUG,"raveloxmidi_alsa_write: bytes_written=%u\n", bytes_written );
 	}
 
@@ -174,6 +176,7 @@ int raveloxmidi_alsa_read( unsigned char *buffer, size_t buffer_size )
 	if( input_handle )
 	{
 		bytes_read = snd_rawmidi_read( input_handle, buffer + 1, buffer_size - 1 );
+		RAVELOXMIDI_PROBE2( alsa_read, buffer_size - 1, bytes_read );
 
 		if( bytes_read > 0 )
 		{
@@ -0,0 +1,683 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+/* Microbenchmarks for the MIDI/RTP/AppleMIDI codec functions.
+   Built and run with "make bench". Reports ns/op and allocations/op */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+
+#include "net_applemidi.h"
+#include "rtp_packet.h"
+#include "midi_command.h"
+#include "midi_payload.h"
+#include "midi_journal.h"
+#include "midi_note.h"
+#include "arena.h"
+#include "pool.h"
+#include "queue.h"
+#include "ring.h"
+#include "timer_wheel.h"
+#include "utils.h"
+
+#include "raveloxmidi_config.h"
+#include "logging.h"
+
+#define BENCH_DEFAULT_ITERATIONS	100000
+#define BENCH_WARMUP_ITERATIONS		1000
+
+static volatile uint64_t bench_allocs = 0;
+
+/* Count allocations by wrapping the glibc allocator */
+#ifdef __GLIBC__
+extern void *__libc_malloc( size_t size );
+extern void *__libc_calloc( size_t nmemb, size_t size );
+extern void *__libc_realloc( void *ptr, size_t size );
+extern void __libc_free( void *ptr );
+
+void *malloc( size_t size )
+{
+	bench_allocs++;
+	return __libc_malloc( size );
+}
+
+void *calloc( size_t nmemb, size_t size )
+{
+	bench_allocs++;
+	return __libc_calloc( nmemb, size );
+}
+
+void *realloc( void *ptr, size_t size )
+{
+	bench_allocs++;
+	return __libc_realloc( ptr, size );
+}
+
+void free( void *ptr )
+{
+	__libc_free( ptr );
+}
+#define BENCH_COUNT_ALLOCS	1
+#else
+#define BENCH_COUNT_ALLOCS	0
+#endif
+
+typedef struct bench_t {
+	const char *name;
+	void (*setup)( void );
+	void (*op)( void );
+	void (*teardown)( void );
+} bench_t;
+
+/* Wire format test data */
+
+// Note On, Control Change and Program Change with delta times
+static unsigned char payload_short[] = { 0x0a, 0x90, 0x3c, 0x7f, 0x00, 0xb0, 0x07, 0x64, 0x00, 0xc0, 0x05 };
+// Five Note On commands using running status
+static unsigned char payload_running[] = { 0x0f, 0x90, 0x3c, 0x7f, 0x00, 0x3d, 0x7f, 0x00, 0x3e, 0x7f, 0x00, 0x3f, 0x7f, 0x00, 0x40, 0x7f };
+// 32 byte SysEx block
+static unsigned char payload_sysex[] = { 0x80, 0x20,
+	0xf0, 0x7e, 0x7f, 0x06, 0x01, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a,
+	0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xf7 };
+
+static unsigned char rtp_wire[] = {
+	0x80, 0x61, 0x12, 0x34, 0x00, 0x00, 0x10, 0x00, 0xde, 0xad, 0xbe, 0xef,
+	0x43, 0x90, 0x3c, 0x7f,
+	0x20, 0x12, 0x34, 0x00, 0x00, 0x08, 0x08, 0x00, 0x02, 0x01, 0x00, 0x00, 0x3c, 0x7f };
+
+static unsigned char applemidi_inv_wire[] = {
+	0xff, 0xff, 0x49, 0x4e, 0x00, 0x00, 0x00, 0x02, 0x12, 0x34, 0x56, 0x78, 0xde, 0xad, 0xbe, 0xef,
+	'r', 'a', 'v', 'e', 'l', 'o', 'x', 'm', 'i', 'd', 'i', 0x00 };
+
+static unsigned char applemidi_sync_wire[] = {
+	0xff, 0xff, 0x43, 0x4b, 0xde, 0xad, 0xbe, 0xef, 0x01, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+
+/* Shared state for the current benchmark */
+static midi_payload_t *bench_payload = NULL;
+static rtp_packet_t *bench_rtp_packet = NULL;
+static net_applemidi_command *bench_command = NULL;
+static journal_t *bench_journal = NULL;
+static arena_t *bench_arena = NULL;
+static unsigned char *bench_wire = NULL;
+static size_t bench_wire_len = 0;
+
+static void payload_setup( unsigned char *wire, size_t wire_len )
+{
+	bench_wire = wire;
+	bench_wire_len = wire_len;
+	midi_payload_unpack( &bench_payload, wire, wire_len, NULL );
+}
+
+static void payload_short_setup( void )
+{
+	payload_setup( payload_short, sizeof( payload_short ) );
+}
+
+static void payload_running_setup( void )
+{
+	payload_setup( payload_running, sizeof( payload_running ) );
+}
+
+static void payload_sysex_setup( void )
+{
+	payload_setup( payload_sysex, sizeof( payload_sysex ) );
+}
+
+static void payload_teardown( void )
+{
+	midi_payload_destroy( &bench_payload );
+}
+
+static void payload_to_commands_op( void )
+{
+	midi_command_t *commands = NULL;
+	size_t num_commands = 0;
+
+	midi_payload_to_commands( bench_payload, MIDI_PAYLOAD_RTP, &commands, &num_commands );
+
+	for( ; num_commands >= 1 ; num_commands-- )
+	{
+		midi_command_reset( &(commands[num_commands - 1]) );
+	}
+	free( commands );
+}
+
+static void command_list_parse_op( void )
+{
+	static midi_command_list_t list;
+
+	midi_command_list_parse( &list, bench_payload->buffer, bench_payload->header->len, MIDI_PAYLOAD_RTP, bench_payload->header->Z, NULL );
+}
+
+static void payload_pack_op( void )
+{
+	unsigned char *buffer = NULL;
+	size_t buffer_size = 0;
+
+	midi_payload_pack( bench_payload, &buffer, &buffer_size );
+	free( buffer );
+}
+
+static void payload_unpack_op( void )
+{
+	midi_payload_t *payload = NULL;
+
+	midi_payload_unpack( &payload, bench_wire, bench_wire_len, NULL );
+	midi_payload_destroy( &payload );
+}
+
+static void rtp_setup( void )
+{
+	bench_rtp_packet = rtp_packet_create( NULL );
+	rtp_packet_unpack( rtp_wire, sizeof( rtp_wire ), bench_rtp_packet );
+}
+
+static void rtp_teardown( void )
+{
+	rtp_packet_destroy( &bench_rtp_packet );
+}
+
+static void rtp_pack_op( void )
+{
+	unsigned char *buffer = NULL;
+	size_t buffer_size = 0;
+
+	rtp_packet_pack( bench_rtp_packet, &buffer, &buffer_size );
+	free( buffer );
+}
+
+static void rtp_unpack_op( void )
+{
+	rtp_packet_t rtp_packet;
+
+	memset( &rtp_packet, 0, sizeof( rtp_packet ) );
+	rtp_packet_unpack( rtp_wire, sizeof( rtp_wire ), &rtp_packet );
+	free( rtp_packet.payload );
+}
+
+/* Inbound RTP-MIDI handling as done by net_socket_read, with and without a packet arena */
+static void packet_path_op( arena_t *arena )
+{
+	rtp_packet_t *rtp_packet = NULL;
+	midi_payload_t *midi_payload = NULL;
+	midi_command_t *commands = NULL;
+	size_t num_commands = 0;
+
+	rtp_packet = rtp_packet_create( arena );
+	rtp_packet_unpack( rtp_wire, sizeof( rtp_wire ), rtp_packet );
+	midi_payload_unpack( &midi_payload, rtp_packet->payload, rtp_packet->payload_len, arena );
+	midi_payload_to_commands( midi_payload, MIDI_PAYLOAD_RTP, &commands, &num_commands );
+
+	if( arena )
+	{
+		arena_reset( arena );
+		return;
+	}
+
+	for( ; num_commands >= 1 ; num_commands-- )
+	{
+		midi_command_reset( &(commands[num_commands - 1]) );
+	}
+	free( commands );
+	midi_payload_destroy( &midi_payload );
+	rtp_packet_destroy( &rtp_packet );
+}
+
+static void packet_path_view_op( void )
+{
+	static midi_command_list_t list;
+	rtp_packet_t rtp_packet;
+	midi_payload_header_t header;
+	unsigned char *commands = NULL;
+	size_t commands_len = 0;
+
+	rtp_packet_view( rtp_wire, sizeof( rtp_wire ), &rtp_packet );
+	midi_payload_view( rtp_packet.payload, rtp_packet.payload_len, &header, &commands, &commands_len );
+	midi_command_list_parse( &list, commands, commands_len, MIDI_PAYLOAD_RTP, header.Z, NULL );
+}
+
+static void packet_path_heap_op( void )
+{
+	packet_path_op( NULL );
+}
+
+static void arena_setup( void )
+{
+	bench_arena = arena_create( ARENA_DEFAULT_SIZE );
+}
+
+static void arena_teardown( void )
+{
+	arena_destroy( &bench_arena );
+}
+
+static void packet_path_arena_op( void )
+{
+	packet_path_op( bench_arena );
+}
+
+static void applemidi_inv_setup( void )
+{
+	bench_wire = applemidi_inv_wire;
+	bench_wire_len = sizeof( applemidi_inv_wire );
+	net_applemidi_unpack( &bench_command, bench_wire, bench_wire_len );
+}
+
+static void applemidi_sync_setup( void )
+{
+	bench_wire = applemidi_sync_wire;
+	bench_wire_len = sizeof( applemidi_sync_wire );
+	net_applemidi_unpack( &bench_command, bench_wire, bench_wire_len );
+}
+
+static void applemidi_teardown( void )
+{
+	net_applemidi_cmd_destroy( &bench_command );
+}
+
+static void applemidi_pack_op( void )
+{
+	unsigned char *buffer = NULL;
+	size_t buffer_size = 0;
+
+	net_applemidi_pack( bench_command, &buffer, &buffer_size );
+	free( buffer );
+}
+
+/* The reply path used by the CK and RS handlers */
+static void applemidi_sync_write_op( void )
+{
+	unsigned char buffer[ NET_APPLEMIDI_UDPSIZE ];
+
+	net_applemidi_sync_write( bench_command->data, buffer, sizeof( buffer ) );
+}
+
+static void applemidi_unpack_op( void )
+{
+	net_applemidi_command *command = NULL;
+
+	net_applemidi_unpack( &command, bench_wire, bench_wire_len );
+	net_applemidi_cmd_destroy( &command );
+}
+
+static void applemidi_view_op( void )
+{
+	net_applemidi_view_t view;
+
+	net_applemidi_view( bench_wire, bench_wire_len, &view );
+}
+
+static void journal_notes_setup( int num_notes )
+{
+	midi_note_t midi_note;
+	int i = 0;
+
+	journal_init( &bench_journal );
+
+	for( i = 0; i < num_notes; i++ )
+	{
+		midi_note.channel = 0;
+		midi_note.command = MIDI_COMMAND_NOTE_ON;
+		midi_note.note = i;
+		midi_note.velocity = 100;
+		midi_journal_add_note( bench_journal, i + 1, &midi_note );
+	}
+}
+
+static void journal_notes_1_setup( void )
+{
+	journal_notes_setup( 1 );
+}
+
+static void journal_notes_16_setup( void )
+{
+	journal_notes_setup( 16 );
+}
+
+static void journal_notes_127_setup( void )
+{
+	journal_notes_setup( 127 );
+}
+
+static void journal_chapter_c_setup( void )
+{
+	midi_control_t midi_control;
+	int i = 0;
+
+	journal_init( &bench_journal );
+
+	for( i = 0; i < MAX_CHAPTER_C_CONTROLLERS; i++ )
+	{
+		midi_control.channel = 0;
+		midi_control.command = MIDI_COMMAND_CONTROL_CHANGE;
+		midi_control.controller_number = i;
+		midi_control.controller_value = i & 0x7f;
+		midi_journal_add_control( bench_journal, i + 1, &midi_control );
+	}
+}
+
+static void journal_teardown( void )
+{
+	journal_destroy( &bench_journal );
+}
+
+static void journal_empty_setup( void )
+{
+	journal_init( &bench_journal );
+}
+
+static void journal_pack_op( void )
+{
+	static unsigned char buffer[ MAX_JOURNAL_PACKED_SIZE ];
+	size_t buffer_size = 0;
+
+	journal_pack( bench_journal, buffer, sizeof( buffer ), &buffer_size );
+}
+
+// Release and strike a note while the rest of the channel is held
+static void journal_note_off_on_op( void )
+{
+	midi_note_t midi_note;
+
+	midi_note.channel = 0;
+	midi_note.command = MIDI_COMMAND_NOTE_OFF;
+	midi_note.note = 64;
+	midi_note.velocity = 0;
+	midi_journal_add_note( bench_journal, 1, &midi_note );
+
+	midi_note.command = MIDI_COMMAND_NOTE_ON;
+	midi_note.velocity = 100;
+	midi_journal_add_note( bench_journal, 2, &midi_note );
+}
+
+static void journal_add_reset_op( void )
+{
+	midi_note_t midi_note;
+
+	midi_note.channel = 0;
+	midi_note.command = MIDI_COMMAND_NOTE_ON;
+	midi_note.note = 60;
+	midi_note.velocity = 100;
+
+	midi_journal_add_note( bench_journal, 1, &midi_note );
+	journal_reset( bench_journal );
+}
+
+static unsigned char bench_note_data[] = { 0x3c, 0x7f };
+
+/* Create and destroy a Note On as the local path does for every command */
+static void midi_note_from_command_op( void )
+{
+	midi_command_t midi_command;
+	midi_note_t *midi_note = NULL;
+
+	memset( &midi_command, 0, sizeof( midi_command ) );
+	midi_command.status = 0x90;
+	midi_command.data = bench_note_data;
+	midi_command.data_len = sizeof( bench_note_data );
+
+	midi_note_from_command( &midi_command, &midi_note, NULL );
+	midi_note_destroy( &midi_note );
+}
+
+static void note_pool_setup( void )
+{
+	midi_note_pool_init( POOL_DEFAULT_CAPACITY );
+}
+
+static void note_pool_teardown( void )
+{
+	midi_note_pool_teardown();
+}
+
+static queue_t *bench_queue = NULL;
+
+static void queue_setup( void )
+{
+	bench_queue = queue_create( "bench", QUEUE_DEFAULT_CAPACITY );
+}
+
+static void queue_teardown( void )
+{
+	queue_destroy( &bench_queue );
+}
+
+/* One hand-off between pipeline stages, without the wake up */
+static void queue_push_pop_op( void )
+{
+	queue_push( bench_queue, bench_note_data );
+	queue_pop( bench_queue );
+}
+
+static ring_t *bench_ring = NULL;
+
+static void ring_setup( void )
+{
+	bench_ring = ring_create( "bench", RING_DEFAULT_SIZE );
+}
+
+static void ring_teardown( void )
+{
+	ring_destroy( &bench_ring );
+}
+
+/* A three byte ALSA read passed from the listener to the main loop */
+static void ring_push_pop_op( void )
+{
+	unsigned char buffer[ 16 ];
+
+	ring_push( bench_ring, payload_short + 1, 3 );
+	ring_pop( bench_ring, buffer, sizeof( buffer ) );
+}
+
+#define BENCH_TIMERS	1024
+
+static timer_wheel_t *bench_wheel = NULL;
+static timer_wheel_timer_t *bench_timers = NULL;
+static timer_wheel_timer_t bench_timer;
+static uint64_t bench_wheel_ms = 0;
+
+/* Each timer puts itself back, so the number pending stays the same */
+static void timer_wheel_bench_fire( void *data )
+{
+	timer_wheel_add( bench_wheel, ( timer_wheel_timer_t * ) data, 1000 );
+}
+
+/* Timers from 1ms to about 17 minutes so that every level has some */
+static void timer_wheel_setup( void )
+{
+	int i = 0;
+
+	bench_wheel_ms = 0;
+	bench_wheel = timer_wheel_create( 1, bench_wheel_ms );
+	bench_timers = ( timer_wheel_timer_t * ) calloc( BENCH_TIMERS, sizeof( timer_wheel_timer_t ) );
+	if( ! bench_wheel || ! bench_timers ) return;
+
+	for( i = 0; i < BENCH_TIMERS; i++ )
+	{
+		timer_wheel_timer_init( &( bench_timers[i] ), "bench", timer_wheel_bench_fire, &( bench_timers[i] ) );
+		timer_wheel_add( bench_wheel, &( bench_timers[i] ), 1 + ( ( (uint64_t)i * 997 ) % 1000000 ) );
+	}
+
+	timer_wheel_timer_init( &bench_timer, "bench", NULL, NULL );
+}
+
+static void timer_wheel_teardown( void )
+{
+	timer_wheel_destroy( &bench_wheel );
+	FREENULL( "timer_wheel_teardown: bench_timers", (void **)&bench_timers );
+}
+
+/* A timer that's cancelled before it's due, like a session timeout reset by traffic */
+static void timer_wheel_add_cancel_op( void )
+{
+	timer_wheel_add( bench_wheel, &bench_timer, 30000 );
+	timer_wheel_cancel( bench_wheel, &bench_timer );
+}
+
+static void timer_wheel_tick_op( void )
+{
+	bench_wheel_ms++;
+	timer_wheel_advance( bench_wheel, bench_wheel_ms );
+}
+
+static config_handle_t bench_config_handle = CONFIG_HANDLE_INVALID;
+
+static void config_string_get_op( void )
+{
+	config_string_get( "service.name" );
+}
+
+static void config_handle_setup( void )
+{
+	bench_config_handle = config_handle_get( "network.socket_timeout" );
+}
+
+static void config_handle_long_op( void )
+{
+	config_handle_long( bench_config_handle );
+}
+
+static bench_t benchmarks[] = {
+	{ "midi_payload_to_commands/short", payload_short_setup, payload_to_commands_op, payload_teardown },
+	{ "midi_payload_to_commands/running_status", payload_running_setup, payload_to_commands_op, payload_teardown },
+	{ "midi_payload_to_commands/sysex", payload_sysex_setup, payload_to_commands_op, payload_teardown },
+	{ "midi_command_list_parse/short", payload_short_setup, command_list_parse_op, payload_teardown },
+	{ "midi_command_list_parse/running_status", payload_running_setup, command_list_parse_op, payload_teardown },
+	{ "midi_command_list_parse/sysex", payload_sysex_setup, command_list_parse_op, payload_teardown },
+	{ "midi_payload_pack", payload_short_setup, payload_pack_op, payload_teardown },
+	{ "midi_payload_unpack", payload_short_setup, payload_unpack_op, payload_teardown },
+	{ "rtp_packet_pack", rtp_setup, rtp_pack_op, rtp_teardown },
+	{ "rtp_packet_unpack", rtp_setup, rtp_unpack_op, rtp_teardown },
+	{ "packet_path/heap", NULL, packet_path_heap_op, NULL },
+	{ "packet_path/arena", arena_setup, packet_path_arena_op, arena_teardown },
+	{ "packet_path/view", NULL, packet_path_view_op, NULL },
+	{ "midi_note_from_command/heap", NULL, midi_note_from_command_op, NULL },
+	{ "midi_note_from_command/pool", note_pool_setup, midi_note_from_command_op, note_pool_teardown },
+	{ "queue_push_pop", queue_setup, queue_push_pop_op, queue_teardown },
+	{ "ring_push_pop", ring_setup, ring_push_pop_op, ring_teardown },
+	{ "timer_wheel_add_cancel", timer_wheel_setup, timer_wheel_add_cancel_op, timer_wheel_teardown },
+	{ "timer_wheel_tick", timer_wheel_setup, timer_wheel_tick_op, timer_wheel_teardown },
+	{ "net_applemidi_pack/inv", applemidi_inv_setup, applemidi_pack_op, applemidi_teardown },
+	{ "net_applemidi_unpack/inv", applemidi_inv_setup, applemidi_unpack_op, applemidi_teardown },
+	{ "net_applemidi_view/inv", applemidi_inv_setup, applemidi_view_op, applemidi_teardown },
+	{ "net_applemidi_pack/sync", applemidi_sync_setup, applemidi_pack_op, applemidi_teardown },
+	{ "net_applemidi_sync_write", applemidi_sync_setup, applemidi_sync_write_op, applemidi_teardown },
+	{ "net_applemidi_unpack/sync", applemidi_sync_setup, applemidi_unpack_op, applemidi_teardown },
+	{ "net_applemidi_view/sync", applemidi_sync_setup, applemidi_view_op, applemidi_teardown },
+	{ "journal_pack/notes_1", journal_notes_1_setup, journal_pack_op, journal_teardown },
+	{ "journal_pack/notes_16", journal_notes_16_setup, journal_pack_op, journal_teardown },
+	{ "journal_pack/notes_127", journal_notes_127_setup, journal_pack_op, journal_teardown },
+	{ "journal_pack/chapter_c_full", journal_chapter_c_setup, journal_pack_op, journal_teardown },
+	{ "journal_add_note/off_on_1", journal_notes_1_setup, journal_note_off_on_op, journal_teardown },
+	{ "journal_add_note/off_on_127", journal_notes_127_setup, journal_note_off_on_op, journal_teardown },
+	{ "journal_add_reset/note", journal_empty_setup, journal_add_reset_op, journal_teardown },
+	{ "config_string_get", NULL, config_string_get_op, NULL },
+	{ "config_handle_long", config_handle_setup, config_handle_long_op, NULL },
+	{ NULL, NULL, NULL, NULL }
+};
+
+static uint64_t bench_now_ns( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ( (uint64_t)ts.tv_sec * 1000000000ULL ) + ts.tv_nsec;
+}
+
+static void bench_run( bench_t *bench, unsigned long iterations )
+{
+	unsigned long i = 0;
+	uint64_t start_ns, end_ns;
+	uint64_t start_allocs, end_allocs;
+
+	if( bench->setup ) bench->setup();
+
+	for( i = 0; i < BENCH_WARMUP_ITERATIONS; i++ )
+	{
+		bench->op();
+	}
+
+	start_allocs = bench_allocs;
+	start_ns = bench_now_ns();
+
+	for( i = 0; i < iterations; i++ )
+	{
+		bench->op();
+	}
+
+	end_ns = bench_now_ns();
+	end_allocs = bench_allocs;
+
+	if( bench->teardown ) bench->teardown();
+
+	if( BENCH_COUNT_ALLOCS )
+	{
+		printf( "%-42s %10lu %12.1f %10.2f\n", bench->name, iterations,
+			(double)( end_ns - start_ns ) / iterations,
+			(double)( end_allocs - start_allocs ) / iterations );
+	} else {
+		printf( "%-42s %10lu %12.1f %10s\n", bench->name, iterations,
+			(double)( end_ns - start_ns ) / iterations, "n/a" );
+	}
+}
+
+int main( int argc, char *argv[] )
+{
+	unsigned long iterations = BENCH_DEFAULT_ITERATIONS;
+	char *filter = NULL;
+	int i = 0;
+
+	if( argc > 1 )
+	{
+		iterations = strtoul( argv[1], NULL, 10 );
+		if( iterations == 0 ) iterations = BENCH_DEFAULT_ITERATIONS;
+	}
+
+	if( argc > 2 )
+	{
+		filter = argv[2];
+	}
+
+	// Use the default configuration so that logging behaves as it would in the daemon
+	config_init( 1, argv );
+	logging_init();
+
+	printf( "%-42s %10s %12s %10s\n", "benchmark", "iterations", "ns/op", "allocs/op" );
+
+	for( i = 0; benchmarks[i].name; i++ )
+	{
+		if( filter && ! strstr( benchmarks[i].name, filter ) ) continue;
+		bench_run( &(benchmarks[i]), iterations );
+	}
+
+	logging_teardown();
+	config_teardown();
+
+	return 0;
+}
@@ -24,6 +24,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <getopt.h>
+#include <pthread.h>
 
 #include <errno.h>
 extern int errno;
@@ -31,38 +32,98 @@ extern int errno;
 #include "config.h"
 
 #include "raveloxmidi_config.h"
+#include "utils.h"
 #include "logging.h"
 
-static int num_items = 0;
-static raveloxmidi_config_t **config_items = NULL;
-
-static void config_set_defaults( void )
-{
-	config_add_item("network.control.port", "5004");
-	config_add_item("network.data.port", "5005");
-	config_add_item("network.local.port", "5006");
-	config_add_item("network.socket_timeout" , "30" );
-	config_add_item("network.max_connections", "8");
-	config_add_item("service.name", "raveloxmidi");
-	config_add_item("run_as_daemon", "yes");
-	config_add_item("daemon.pid_file","raveloxmidi.pid");
-	config_add_item("logging.enabled", "yes");
-	config_add_item("logging.log_file", NULL);
-	config_add_item("logging.log_level", "normal");
-	config_add_item("security.check", "yes");
-	config_add_item("readonly","no");
-	config_add_item("inbound_midi","/dev/sequencer");
-	config_add_item("file_mode", "0640");
+/* The published snapshot. Readers load the pointer once per call and config_reload() swaps it */
+static config_store_t *config_store = NULL;
+
+/* Items set on the command line. They are applied again over the defaults on every reload */
+static config_store_t *config_overrides = NULL;
+
+/* Every distinct key and value that has been set. Snapshots point into this rather than holding copies,
+   so a reload only adds the strings it hasn't seen before */
+static char **config_values = NULL;
+static int config_num_values = 0;
+static pthread_mutex_t config_values_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static config_store_t *config_store_create( void );
+static void config_store_destroy( config_store_t **store );
+static config_handle_t config_store_add( config_store_t *store, char *key, char *value );
+static raveloxmidi_config_t *config_store_item( config_store_t *store, char *key );
+
+static config_store_t *config_current( void )
+{
+	return __atomic_load_n( &config_store, __ATOMIC_ACQUIRE );
+}
+
+static void config_set_defaults( config_store_t *store )
+{
+	config_store_add( store, "network.control.port", "5004");
+	config_store_add( store, "network.data.port", "5005");
+	config_store_add( store, "network.data.workers", "1");
+	config_store_add( store, "network.io_uring", "no");
+	config_store_add( store, "network.local.port", "5006");
+	config_store_add( store, "network.socket_timeout" , "30" );
+	config_store_add( store, "network.max_connections", "8");
+	config_store_add( store, "network.feedback_interval", "0");
+	config_store_add( store, "network.sync_interval", "0");
+	config_store_add( store, "network.session_timeout", "120");
+	config_store_add( store, "network.tx_queue_size", "64");
+	config_store_add( store, "network.tx_queue.drop_realtime", "yes");
+	config_store_add( store, "network.tx_queue.coalesce_cc", "yes");
+	config_store_add( store, "network.tx_rate_limit", "0");
+	config_store_add( store, "journal.max_age", "0");
+	config_store_add( store, "timer.tick", "100");
+	config_store_add( store, "stats.interval", "0");
+	config_store_add( store, "service.name", "raveloxmidi");
+	config_store_add( store, "run_as_daemon", "yes");
+	config_store_add( store, "daemon.pid_file","raveloxmidi.pid");
+	config_store_add( store, "handoff.socket", NULL);
+	config_store_add( store, "logging.enabled", "yes");
+	config_store_add( store, "logging.log_file", NULL);
+	config_store_add( store, "logging.log_level", "normal");
+	config_store_add( store, "security.check", "yes");
+	config_store_add( store, "readonly","no");
+	config_store_add( store, "inbound_midi","/dev/sequencer");
+	config_store_add( store, "file_mode", "0640");
+	config_store_add( store, "capture.enabled", "no");
+	config_store_add( store, "capture.file", "raveloxmidi.capture");
+	config_store_add( store, "capture.packets", "1024");
+	config_store_add( store, "capture.pcap_file", "raveloxmidi.pcap");
+	config_store_add( store, "pipeline.enabled", "no");
+	config_store_add( store, "pipeline.queue_size", "256");
+	config_store_add( store, "pipeline.ingress.cpu", "-1");
+	config_store_add( store, "pipeline.control.cpu", "-1");
+	config_store_add( store, "pipeline.egress.cpu", "-1");
+	config_store_add( store, "pipeline.inbound.cpu", "-1");
+	config_store_add( store, "realtime.enabled", "no");
+	config_store_add( store, "realtime.lock_memory", "yes");
+	config_store_add( store, "realtime.stack_prefault", "131072");
+	config_store_add( store, "realtime.main.priority", "60");
+	config_store_add( store, "realtime.alsa.priority", "70");
+	config_store_add( store, "realtime.control.priority", "50");
+	config_store_add( store, "realtime.egress.priority", "65");
+	config_store_add( store, "realtime.inbound.priority", "60");
+	config_store_add( store, "realtime.data.priority", "60");
+	config_store_add( store, "realtime.main.cpu", "-1");
+	config_store_add( store, "realtime.alsa.cpu", "-1");
+	config_store_add( store, "realtime.control.cpu", "-1");
+	config_store_add( store, "realtime.egress.cpu", "-1");
+	config_store_add( store, "realtime.inbound.cpu", "-1");
 
 #ifdef HAVE_ALSA
-	config_add_item("alsa.input_buffer_size", "4096" );
+	config_store_add( store, "alsa.input_buffer_size", "4096" );
+	config_store_add( store, "alsa.ring_size", "65536" );
 #endif
 
 }
 
 static raveloxmidi_config_t *config_get_item( char *key );
+static uint32_t config_hash( const char *key );
+static config_handle_t config_find( config_store_t *store, char *key, uint32_t hash );
 
-static void config_load_file( char *filename )
+static int config_load_file( config_store_t *store, char *filename )
 {
 
 	FILE *config_file = NULL;
@@ -70,14 +131,14 @@ static void config_load_file( char *filename )
 	char *p1,*p2;
 	char *key, *value;
 
-	if( ! filename ) return;
+	if( ! filename ) return 0;
 
 	config_file = fopen( filename, "r" );
 
 	if( ! config_file )
 	{
 		fprintf( stderr, "Unable to open configuration file [%s]:%s\n", filename, strerror( errno ) );
-		return;
+		return -1;
 	}
 
 	while( 1 )
@@ -120,10 +181,19 @@ static void config_load_file( char *filename )
 		while( *p2 && ( isspace( *p2 ) || *p2=='=' ))  p2++;
 		value = p2;
 
-		config_add_item( key, value );
+		config_store_add( store, key, value );
 	}
 
 	if( config_file) fclose( config_file );
+
+	return 0;
+}
+
+/* Set an item in the published snapshot and remember it so that a reload does not lose it */
+static void config_override( char *key, char *value )
+{
+	config_store_add( config_store, key, value );
+	config_store_add( config_overrides, key, value );
 }
 
 void config_init( int argc, char *argv[] )
@@ -137,6 +207,7 @@ void config_init( int argc, char *argv[] )
 		{"pidfile", required_argument, NULL, 'P'},
 		{"readonly", no_argument, NULL, 'R'},
 		{"dumpconfig", no_argument, NULL, 'C'},
+		{"dumpcapture", no_argument, NULL, 'D'},
 #ifdef HAVE_ALSA
 		{"listinterfaces", no_argument, NULL, 'L'},
 #endif
@@ -144,14 +215,23 @@ void config_init( int argc, char *argv[] )
 		{0,0,0,0}
 	};
 #ifdef HAVE_ALSA
-	const char *short_options = "c:dIhNP:RLC";
+	const char *short_options = "c:dIhNP:RLCD";
 #else
-	const char *short_options = "c:dIhNP:RC";
+	const char *short_options = "c:dIhNP:RCD";
 #endif
 	int c;
-	config_items = NULL;
 
-	config_set_defaults();
+	config_teardown();
+
+	config_store = config_store_create();
+	config_overrides = config_store_create();
+	if( ! config_store || ! config_overrides )
+	{
+		fprintf( stderr, "config_init: Insufficient memory to create config store\n");
+		exit(1);
+	}
+
+	config_set_defaults( config_store );
 
 	while(1)
 	{
@@ -164,15 +244,15 @@ void config_init( int argc, char *argv[] )
 			case '?':
 				exit(0);
 			case 'c':
-				config_add_item("config.file", optarg);
+				config_override("config.file", optarg);
 				break;
 			case 'I':
-				config_add_item("logging.enabled", "yes");
-				config_add_item("logging.log_level", "info");
+				config_override("logging.enabled", "yes");
+				config_override("logging.log_level", "info");
 				break;
 			case 'd':
-				config_add_item("logging.enabled", "yes");
-				config_add_item("logging.log_level", "debug");
+				config_override("logging.enabled", "yes");
+				config_override("logging.log_level", "debug");
 				dump_config = 1;
 				break;
 			/* This option exits */
@@ -180,21 +260,24 @@ void config_init( int argc, char *argv[] )
 				config_usage();
 				exit(0);
 			case 'N':
-				config_add_item("run_as_daemon", "no");
+				config_override("run_as_daemon", "no");
 				break;
 			case 'P':
-				config_add_item("daemon.pid_file", optarg);
+				config_override("daemon.pid_file", optarg);
 				break;
 			case 'R':
-				config_add_item("readonly", "yes");
+				config_override("readonly", "yes");
 				break;
 			case 'C':
 				dump_config = 1;
 				break;
+			case 'D':
+				config_override("capture.dump", "yes");
+				break;
 		}
 	} 
 
-	config_load_file( config_string_get("config.file") );
+	config_load_file( config_store, config_string_get("config.file") );
 
 	if( dump_config == 1 )
 	{
@@ -204,23 +287,165 @@ void config_init( int argc, char *argv[] )
 
 void config_teardown( void )
 {
+	config_store_t *store = NULL;
+	config_store_t *previous = NULL;
+
+	store = config_current();
+	logging_printf( LOGGING_DEBUG, "config_teardown config_store=%p num_items=%d\n", store, ( store ? store->num_items : 0 ) );
+
+	__atomic_store_n( &config_store, NULL, __ATOMIC_RELEASE );
+
+	while( store )
+	{
+		previous = store->previous;
+		config_store_destroy( &store );
+		store = previous;
+	}
+
+	config_store_destroy( &config_overrides );
+
+	pthread_mutex_lock( &config_values_lock );
+	while( config_num_values > 0 )
+	{
+		config_num_values--;
+		free( config_values[ config_num_values ] );
+	}
+	if( config_values ) free( config_values );
+	config_values = NULL;
+	pthread_mutex_unlock( &config_values_lock );
+}
+
+/* Changes to these items are only picked up at startup */
+static char *config_restart_items[] = {
+	"network.control.port",
+	"network.data.port",
+	"network.data.workers",
+	"network.io_uring",
+	"network.local.port",
+	"network.bind_address",
+	"network.max_connections",
+	"timer.tick",
+	"network.tx_queue_size",
+	"service.name",
+	"run_as_daemon",
+	"daemon.pid_file",
+	"handoff.socket",
+	"capture.enabled",
+	"capture.file",
+	"capture.packets",
+	"pipeline.enabled",
+	"pipeline.queue_size",
+	"pipeline.ingress.cpu",
+	"pipeline.control.cpu",
+	"pipeline.egress.cpu",
+	"pipeline.inbound.cpu",
+	"realtime.enabled",
+	"realtime.lock_memory",
+	"realtime.stack_prefault",
+	"realtime.main.priority",
+	"realtime.alsa.priority",
+	"realtime.control.priority",
+	"realtime.egress.priority",
+	"realtime.inbound.priority",
+	"realtime.data.priority",
+	"realtime.main.cpu",
+	"realtime.alsa.cpu",
+	"realtime.control.cpu",
+	"realtime.egress.cpu",
+	"realtime.inbound.cpu",
+	NULL
+};
+
+/* Build a new snapshot from the defaults, the command line options and the config file, then publish it.
+   The current snapshot is left in place if the config file cannot be read */
+int config_reload( void )
+{
+	config_store_t *current = NULL;
+	config_store_t *new_store = NULL;
+	raveloxmidi_config_t *config_file = NULL;
 	int i = 0;
 
-	logging_printf( LOGGING_DEBUG, "config_teardown config_items=%p num_items=%u\n", config_items, num_items - 1 );
-	if( ! config_items ) return;
-	if( num_items == 0 ) return;
+	current = config_current();
+	if( ! current ) return -1;
+
+	new_store = config_store_create();
+	if( ! new_store )
+	{
+		logging_printf( LOGGING_ERROR, "config_reload: Insufficient memory to create config store\n");
+		return -1;
+	}
+
+	/* Every known key is added first and in the same order so that existing handles stay valid */
+	for( i = 0; i < current->num_items; i++ )
+	{
+		if( config_store_add( new_store, current->items[i]->key, NULL ) != i ) goto reload_fail;
+	}
+
+	config_set_defaults( new_store );
+
+	if( config_overrides )
+	{
+		for( i = 0; i < config_overrides->num_items; i++ )
+		{
+			config_store_add( new_store, config_overrides->items[i]->key, config_overrides->items[i]->value );
+		}
+	}
+
+	config_file = config_store_item( new_store, "config.file" );
+	if( config_file && config_load_file( new_store, config_file->value ) != 0 )
+	{
+		logging_printf( LOGGING_WARN, "config_reload: Unable to read %s. Configuration not changed\n", config_file->value );
+		goto reload_fail;
+	}
+
+	/* Readers don't say when they have finished with a snapshot, so replaced ones are kept until teardown.
+	   Keys and values are interned, so each one only holds its items and index */
+	new_store->previous = current;
+	__atomic_store_n( &config_store, new_store, __ATOMIC_RELEASE );
+
+	/* Logging goes first so that the rest of the reload is logged with the new settings */
+	logging_reload();
 
-	for( i = 0 ; i < num_items ; i++ )
+	for( i = 0; config_restart_items[i]; i++ )
 	{
-		if( config_items[i]->value )  free( config_items[i]->value );
-		if( config_items[i]->key ) free( config_items[i]->key );
-		if( config_items[i] ) free( config_items[i] );
+		if( config_changed( config_restart_items[i] ) )
+		{
+			logging_printf( LOGGING_WARN, "config_reload: %s has changed. A restart is needed to apply it\n", config_restart_items[i] );
+		}
 	}
 
-	if( config_items ) free( config_items );
+	logging_printf( LOGGING_DEBUG, "config_reload: config_store=%p num_items=%d\n", new_store, new_store->num_items );
+
+	return 0;
 
-	num_items = 0;
-	config_items = NULL;
+reload_fail:
+	config_store_destroy( &new_store );
+	return -1;
+}
+
+/* Returns 1 if the value of key differs between the current snapshot and the one it replaced */
+int config_changed( char *key )
+{
+	config_store_t *current = NULL;
+	raveloxmidi_config_t *new_item = NULL;
+	raveloxmidi_config_t *old_item = NULL;
+	char *new_value = NULL;
+	char *old_value = NULL;
+
+	current = config_current();
+	if( ! current ) return 0;
+	if( ! current->previous ) return 0;
+
+	new_item = config_store_item( current, key );
+	old_item = config_store_item( current->previous, key );
+
+	if( new_item ) new_value = new_item->value;
+	if( old_item ) old_value = old_item->value;
+
+	if( ! new_value && ! old_value ) return 0;
+	if( ! new_value || ! old_value ) return 1;
+
+	return ( strcmp( new_value, old_value ) != 0 );
 }
 
 /* Public version */
@@ -236,102 +461,346 @@ char *config_string_get( char *key )
 
 int config_int_get( char *key )
 {
-	char *item_string = NULL;
+	raveloxmidi_config_t *item = NULL;
 
-	item_string = config_string_get( key );
-	if(! item_string ) return 0;
-	if( strlen( item_string ) == 0 ) return 0;
-	return atoi( item_string );
+	item = config_get_item( key );
+
+	if( ! item ) return 0;
+	return (int) item->long_value;
 }
 	
 long config_long_get( char *key )
 {
-	char *item_string = NULL;
+	raveloxmidi_config_t *item = NULL;
+
+	item = config_get_item( key );
+
+	if( ! item ) return 0;
+	return item->long_value;
+}
+
+int config_bool_get( char *key )
+{
+	raveloxmidi_config_t *item = NULL;
+
+	item = config_get_item( key );
+
+	if( ! item ) return 0;
+	return item->bool_value;
+}
+
+/* Case insensitive FNV-1a so that lookups match the strcasecmp() comparison */
+static uint32_t config_hash( const char *key )
+{
+	uint32_t hash = 2166136261u;
+
+	while( key && *key )
+	{
+		hash ^= (uint32_t) tolower( (unsigned char) *key );
+		hash *= 16777619u;
+		key++;
+	}
+
+	return hash;
+}
+
+static config_store_t *config_store_create( void )
+{
+	config_store_t *store = NULL;
+
+	store = ( config_store_t * ) malloc( sizeof( config_store_t ) );
+	if( ! store ) return NULL;
+
+	memset( store, 0, sizeof( config_store_t ) );
+
+	return store;
+}
+
+static void config_store_destroy( config_store_t **store )
+{
+	int i = 0;
+
+	if( ! store ) return;
+	if( ! *store ) return;
+
+	for( i = 0 ; i < (*store)->num_items ; i++ )
+	{
+		free( (*store)->items[i] );
+	}
+
+	if( (*store)->items ) free( (*store)->items );
+	if( (*store)->index ) free( (*store)->index );
+
+	free( *store );
+	*store = NULL;
+}
+
+static config_handle_t config_find( config_store_t *store, char *key, uint32_t hash )
+{
+	size_t slot = 0;
+	config_handle_t handle = CONFIG_HANDLE_INVALID;
 
-	item_string = config_string_get( key );
-	if( ! item_string ) return 0;
-	if( strlen( item_string ) == 0 ) return 0;
-	return atol( item_string );
+	if( ! key ) return CONFIG_HANDLE_INVALID;
+	if( ! store ) return CONFIG_HANDLE_INVALID;
+	if( ! store->index ) return CONFIG_HANDLE_INVALID;
+
+	for( slot = hash & ( store->index_size - 1 ); ; slot = ( slot + 1 ) & ( store->index_size - 1 ) )
+	{
+		handle = store->index[ slot ];
+		if( handle == CONFIG_HANDLE_INVALID ) return CONFIG_HANDLE_INVALID;
+		if( store->items[ handle ]->hash == hash && strcasecmp( key, store->items[ handle ]->key ) == 0 ) return handle;
+	}
+}
+
+static void config_index_insert( config_store_t *store, config_handle_t handle )
+{
+	size_t slot = 0;
+
+	for( slot = store->items[ handle ]->hash & ( store->index_size - 1 ); store->index[ slot ] != CONFIG_HANDLE_INVALID; slot = ( slot + 1 ) & ( store->index_size - 1 ) );
+
+	store->index[ slot ] = handle;
+}
+
+/* Keep the index no more than half full */
+static int config_index_grow( config_store_t *store )
+{
+	size_t new_size = 0;
+	size_t i = 0;
+	config_handle_t *new_index = NULL;
+
+	if( store->index && ( (size_t)( store->num_items + 1 ) * 2 <= store->index_size ) ) return 0;
+
+	new_size = ( store->index_size == 0 ? CONFIG_INDEX_INITIAL_SIZE : store->index_size * 2 );
+	new_index = ( config_handle_t * ) malloc( sizeof( config_handle_t ) * new_size );
+	if( ! new_index ) return -1;
+
+	for( i = 0; i < new_size; i++ )
+	{
+		new_index[i] = CONFIG_HANDLE_INVALID;
+	}
+
+	if( store->index ) free( store->index );
+	store->index = new_index;
+	store->index_size = new_size;
+
+	for( i = 0; i < (size_t) store->num_items; i++ )
+	{
+		config_index_insert( store, i );
+	}
+
+	return 0;
+}
+
+static raveloxmidi_config_t *config_store_item( config_store_t *store, char *key )
+{
+	config_handle_t handle = CONFIG_HANDLE_INVALID;
+
+	if( ! store ) return NULL;
+	if( store->num_items <= 0 ) return NULL;
+
+	handle = config_find( store, key, config_hash( key ) );
+	if( handle == CONFIG_HANDLE_INVALID ) return NULL;
+
+	return store->items[ handle ];
 }
 
 static raveloxmidi_config_t *config_get_item( char *key )
 {
-	int i = 0 ;
+	return config_store_item( config_current(), key );
+}
+
+/* Returns the shared copy of value, adding it if it hasn't been seen before */
+static char *config_intern( char *value )
+{
+	char **new_values = NULL;
+	char *interned = NULL;
+	int i = 0;
 
-	if( num_items <= 0 ) return NULL;
-	if( ! config_items ) return NULL;
+	pthread_mutex_lock( &config_values_lock );
 
-	for( i=0; i < num_items ; i ++ )
+	for( i = 0; i < config_num_values; i++ )
 	{
-		if( strcasecmp( key, config_items[i]->key ) == 0 )
+		if( strcmp( config_values[i], value ) == 0 )
 		{
-			return config_items[i];
+			interned = config_values[i];
+			goto intern_end;
 		}
 	}
 
-	return NULL;
+	new_values = (char **)realloc( config_values, sizeof( char * ) * ( config_num_values + 1 ) );
+	if( ! new_values ) goto intern_end;
+	config_values = new_values;
+
+	interned = (char *)strdup( value );
+	if( ! interned ) goto intern_end;
+	config_values[ config_num_values ] = interned;
+	config_num_values++;
+
+intern_end:
+	pthread_mutex_unlock( &config_values_lock );
+	return interned;
 }
 
-void config_add_item(char *key, char *value )
+/* Parse the value once so that the typed accessors do no string work */
+static void config_item_set_value( raveloxmidi_config_t *item, char *value )
 {
-	raveloxmidi_config_t *new_item, *found_item;
-	raveloxmidi_config_t **new_config_item_list = NULL;
+	item->value = NULL;
+	item->long_value = 0;
+	item->bool_value = 0;
+
+	if( ! value ) return;
 
-	found_item = config_get_item( key );
-	if( ! found_item )
+	item->value = config_intern( value );
+	if( ! item->value ) return;
+	if( strlen( value ) > 0 )
 	{
-		new_item = ( raveloxmidi_config_t *)malloc( sizeof( raveloxmidi_config_t ));
-		if( new_item )
-		{
-			new_item->key = (char *)strdup( key );
-			if( value )
-			{
-				new_item->value = ( char *)strdup( value );
-			} else {
-				new_item->value = NULL;
-			}
-
-			new_config_item_list = (raveloxmidi_config_t **)realloc(config_items, sizeof( raveloxmidi_config_t * ) * (num_items + 1) );
-			if( ! new_config_item_list )
-			{
-				fprintf(stderr, "config_add_item: Insufficient memory to create new config item\n");
-				free( new_item );
-				return;
-			}
-			config_items = new_config_item_list;
-			config_items[ num_items ] = new_item;
-			num_items++;
-		}
+		item->long_value = atol( value );
+	}
+	item->bool_value = is_yes( value );
+}
+
+static config_handle_t config_store_add( config_store_t *store, char *key, char *value )
+{
+	raveloxmidi_config_t *new_item = NULL;
+	raveloxmidi_config_t **new_config_item_list = NULL;
+	config_handle_t handle = CONFIG_HANDLE_INVALID;
+	uint32_t hash = 0;
+
+	if( ! store ) return CONFIG_HANDLE_INVALID;
+	if( ! key ) return CONFIG_HANDLE_INVALID;
+
+	hash = config_hash( key );
+	handle = config_find( store, key, hash );
+
 	/* Overwrite any existing item that has the same key */
-	} else {
-		if( found_item->value ) free(found_item->value);
-		if( value )
-		{
-			found_item->value = ( char *)strdup( value );
-		} else {
-			found_item->value = NULL;
-		}
+	if( handle != CONFIG_HANDLE_INVALID )
+	{
+		config_item_set_value( store->items[ handle ], value );
+		return handle;
 	}
+
+	if( config_index_grow( store ) != 0 )
+	{
+		fprintf(stderr, "config_add_item: Insufficient memory to index new config item\n");
+		return CONFIG_HANDLE_INVALID;
+	}
+
+	new_item = ( raveloxmidi_config_t *)malloc( sizeof( raveloxmidi_config_t ));
+	if( ! new_item ) return CONFIG_HANDLE_INVALID;
+
+	memset( new_item, 0, sizeof( raveloxmidi_config_t ) );
+	new_item->key = config_intern( key );
+	if( ! new_item->key )
+	{
+		free( new_item );
+		return CONFIG_HANDLE_INVALID;
+	}
+	new_item->hash = hash;
+	config_item_set_value( new_item, value );
+
+	new_config_item_list = (raveloxmidi_config_t **)realloc(store->items, sizeof( raveloxmidi_config_t * ) * (store->num_items + 1) );
+	if( ! new_config_item_list )
+	{
+		fprintf(stderr, "config_add_item: Insufficient memory to create new config item\n");
+		config_item_set_value( new_item, NULL );
+		free( new_item );
+		return CONFIG_HANDLE_INVALID;
+	}
+	store->items = new_config_item_list;
+	handle = store->num_items;
+	store->items[ handle ] = new_item;
+	store->num_items++;
+
+	config_index_insert( store, handle );
+
+	return handle;
+}
+
+void config_add_item(char *key, char *value )
+{
+	config_store_add( config_current(), key, value );
+}
+
+/* Resolve a key to a handle. Unset keys are added with no value so that the handle is always valid */
+config_handle_t config_handle_get( char *key )
+{
+	config_handle_t handle = CONFIG_HANDLE_INVALID;
+	config_store_t *store = NULL;
+
+	store = config_current();
+
+	handle = config_find( store, key, config_hash( key ) );
+	if( handle != CONFIG_HANDLE_INVALID ) return handle;
+
+	return config_store_add( store, key, NULL );
+}
+
+static raveloxmidi_config_t *config_handle_item( config_handle_t handle )
+{
+	config_store_t *store = NULL;
+
+	store = config_current();
+
+	if( ! store ) return NULL;
+	if( handle < 0 || handle >= store->num_items ) return NULL;
+
+	return store->items[ handle ];
+}
+
+char *config_handle_string( config_handle_t handle )
+{
+	raveloxmidi_config_t *item = config_handle_item( handle );
+
+	if( ! item ) return NULL;
+	return item->value;
+}
+
+int config_handle_int( config_handle_t handle )
+{
+	raveloxmidi_config_t *item = config_handle_item( handle );
+
+	if( ! item ) return 0;
+	return (int) item->long_value;
+}
+
+long config_handle_long( config_handle_t handle )
+{
+	raveloxmidi_config_t *item = config_handle_item( handle );
+
+	if( ! item ) return 0;
+	return item->long_value;
+}
+
+int config_handle_bool( config_handle_t handle )
+{
+	raveloxmidi_config_t *item = config_handle_item( handle );
+
+	if( ! item ) return 0;
+	return item->bool_value;
 }
 
 void config_dump( void )
 {
 	int i = 0;
-	if( ! config_items ) return;
-	if( num_items == 0 ) return;
+	config_store_t *store = NULL;
+
+	store = config_current();
+
+	if( ! store ) return;
+	if( store->num_items == 0 ) return;
 
-	for( i = 0 ; i < num_items; i++ )
+	for( i = 0 ; i < store->num_items; i++ )
 	{
-		fprintf( stderr, "%s = %s\n", config_items[i]->key, config_items[i]->value );
+		fprintf( stderr, "%s = %s\n", store->items[i]->key, store->items[i]->value );
 	}
 }
 
 void config_usage( void )
 {
 	fprintf( stderr, "Usage:\n");
-	fprintf( stderr, "\traveloxmidi [-c filename] [-d] [-I] [-R] [-N] [-P filename] [-C] [-h]");
+	fprintf( stderr, "\traveloxmidi [-c filename] [-d] [-I] [-R] [-N] [-P filename] [-C] [-D] [-h]");
 	fprintf( stderr, "\n");
-	fprintf( stderr, "\traveloxmidi [--config filename] [--debug] [--info] [--readonly] [--nodaemon] [--pidfile filename] [--dumpconfig] [--help]");
+	fprintf( stderr, "\traveloxmidi [--config filename] [--debug] [--info] [--readonly] [--nodaemon] [--pidfile filename] [--dumpconfig] [--dumpcapture] [--help]");
 	fprintf( stderr, "\n");
 	fprintf( stderr, "\n");
 	fprintf( stderr, "-c filename\tName of config file to use\n");
@@ -340,6 +809,7 @@ void config_usage( void )
 	fprintf( stderr, "-N\t\tDo not run in the background\n");
 	fprintf( stderr, "-P filename\tName of file to write background pid\n");
 	fprintf( stderr, "-C\t\tDump the current config to stderr\n");
+	fprintf( stderr, "-D\t\tWrite the packet capture file out as a pcap file and exit\n");
 	fprintf( stderr, "-h\t\tThis output\n");
 	fprintf( stderr, "\nThe following configuration file items are default:\n");
 	config_dump();
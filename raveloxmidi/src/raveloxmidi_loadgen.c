@@ -0,0 +1,498 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+/* End-to-end latency and throughput harness.
+
+   Connects a number of simulated AppleMIDI peers to a running daemon, injects
+   Note On events through the local port at a fixed rate and timestamps their
+   arrival as RTP-MIDI on each peer's data socket. The rate is doubled until
+   the loss or the 99th percentile latency goes over the limits. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <getopt.h>
+#include <signal.h>
+
+#include <sys/socket.h>
+
+#include "config.h"
+
+#include "applemidi_peer.h"
+#include "utils.h"
+
+#include "logging.h"
+
+/* Each note carries an 18 bit id in its channel, note number and velocity */
+#define LOADGEN_ID_BITS		18
+#define LOADGEN_ID_SPACE	( 1 << LOADGEN_ID_BITS )
+#define LOADGEN_ID_MASK		( LOADGEN_ID_SPACE - 1 )
+
+/* Latency histogram: 1us buckets up to 10ms then 1ms buckets up to 10s */
+#define HISTOGRAM_FINE_BUCKETS		10000
+#define HISTOGRAM_COARSE_BUCKETS	10000
+#define HISTOGRAM_BUCKETS		( HISTOGRAM_FINE_BUCKETS + HISTOGRAM_COARSE_BUCKETS )
+
+#define LOADGEN_MAX_PEERS	255
+#define LOADGEN_DRAIN_US	500000
+
+typedef struct loadgen_peer_t {
+	applemidi_peer_t	*peer;
+	uint8_t			*seen;
+	uint32_t		since_feedback;
+} loadgen_peer_t;
+
+typedef struct loadgen_result_t {
+	uint64_t	sent;
+	uint64_t	expected;
+	uint64_t	received;
+	uint64_t	duplicates;
+	uint64_t	feedback;
+	double		loss_percent;
+	uint64_t	p50_us;
+	uint64_t	p90_us;
+	uint64_t	p99_us;
+	uint64_t	p999_us;
+	uint64_t	max_us;
+	double		achieved_rate;
+} loadgen_result_t;
+
+static char *host = "127.0.0.1";
+static int control_port = 5004;
+static int data_port = 5005;
+static int local_port = 5006;
+static char *peer_list = "1,8,64";
+static unsigned long start_rate = 1000;
+static unsigned long max_rate = 256000;
+static double step_duration = 2.0;
+static double latency_limit_ms = 10.0;
+static double loss_limit_percent = 1.0;
+static unsigned int feedback_interval = 8;
+
+static uint64_t sent_us[ LOADGEN_ID_SPACE ];
+static uint64_t histogram[ HISTOGRAM_BUCKETS ];
+static uint64_t latency_max = 0;
+
+static volatile sig_atomic_t loadgen_stop = 0;
+
+static void loadgen_signal( int signal )
+{
+	loadgen_stop = 1;
+}
+
+static void histogram_add( uint64_t latency_us )
+{
+	uint64_t bucket = 0;
+
+	if( latency_us < HISTOGRAM_FINE_BUCKETS )
+	{
+		bucket = latency_us;
+	} else {
+		bucket = HISTOGRAM_FINE_BUCKETS + ( ( latency_us - HISTOGRAM_FINE_BUCKETS ) / 1000 );
+		if( bucket >= HISTOGRAM_BUCKETS ) bucket = HISTOGRAM_BUCKETS - 1;
+	}
+
+	histogram[bucket]++;
+	latency_max = MAX( latency_max, latency_us );
+}
+
+static uint64_t histogram_percentile( uint64_t total, double percentile )
+{
+	uint64_t target = 0;
+	uint64_t count = 0;
+	int i = 0;
+
+	if( total == 0 ) return 0;
+
+	target = (uint64_t)( ( percentile / 100.0 ) * total );
+	if( target == 0 ) target = 1;
+
+	for( i = 0; i < HISTOGRAM_BUCKETS; i++ )
+	{
+		count += histogram[i];
+		if( count >= target )
+		{
+			if( i < HISTOGRAM_FINE_BUCKETS ) return i;
+			return HISTOGRAM_FINE_BUCKETS + ( (uint64_t)( i - HISTOGRAM_FINE_BUCKETS ) * 1000 );
+		}
+	}
+
+	return latency_max;
+}
+
+static void loadgen_send_note( int local_fd, uint32_t id )
+{
+	unsigned char buffer[4];
+
+	buffer[0] = 0xaa;
+	buffer[1] = 0x90 | ( ( id >> 14 ) & 0x0f );
+	buffer[2] = id & 0x7f;
+	buffer[3] = ( id >> 7 ) & 0x7f;
+
+	send( local_fd, buffer, sizeof( buffer ), 0 );
+}
+
+static void loadgen_receive( loadgen_peer_t *lpeer, uint32_t first_id, uint64_t sent, loadgen_result_t *result )
+{
+	applemidi_peer_rtp_t rtp;
+	uint32_t id = 0;
+	uint64_t now = 0;
+	int ret = 0;
+
+	while( ( ret = applemidi_peer_read( lpeer->peer, &rtp ) ) > APPLEMIDI_PEER_READ_NONE )
+	{
+		if( ret != APPLEMIDI_PEER_READ_RTP ) continue;
+
+		now = applemidi_peer_now_us();
+
+		lpeer->since_feedback++;
+		if( ( feedback_interval > 0 ) && ( lpeer->since_feedback >= feedback_interval ) )
+		{
+			applemidi_peer_feedback( lpeer->peer, rtp.seq );
+			lpeer->since_feedback = 0;
+			result->feedback++;
+		}
+
+		if( rtp.midi_len < 3 ) continue;
+		if( ( rtp.midi[0] & 0xf0 ) != 0x90 ) continue;
+
+		id = ( ( rtp.midi[0] & 0x0f ) << 14 ) | ( ( rtp.midi[2] & 0x7f ) << 7 ) | ( rtp.midi[1] & 0x7f );
+
+		// Ignore anything that wasn't sent in this step
+		if( ( ( id - first_id ) & LOADGEN_ID_MASK ) >= sent ) continue;
+
+		if( lpeer->seen[ id >> 3 ] & ( 1 << ( id & 7 ) ) )
+		{
+			result->duplicates++;
+			continue;
+		}
+		lpeer->seen[ id >> 3 ] |= ( 1 << ( id & 7 ) );
+
+		result->received++;
+		histogram_add( now - sent_us[id] );
+	}
+}
+
+static void loadgen_step( loadgen_peer_t *lpeers, int num_peers, int local_fd, unsigned long rate, uint32_t *next_id, loadgen_result_t *result )
+{
+	struct pollfd *pfds = NULL;
+	uint64_t total = 0;
+	uint64_t interval_ns = 0;
+	uint64_t start_us = 0, next_send_ns = 0, now_us = 0, now_ns = 0;
+	uint64_t drain_deadline = 0, last_send_us = 0;
+	uint64_t wait_ns = 0;
+	uint32_t first_id = *next_id;
+	int i = 0;
+
+	memset( result, 0, sizeof( loadgen_result_t ) );
+	memset( histogram, 0, sizeof( histogram ) );
+	latency_max = 0;
+
+	for( i = 0; i < num_peers; i++ )
+	{
+		memset( lpeers[i].seen, 0, LOADGEN_ID_SPACE / 8 );
+		lpeers[i].since_feedback = 0;
+	}
+
+	total = (uint64_t)( rate * step_duration );
+	if( total >= LOADGEN_ID_SPACE ) total = LOADGEN_ID_SPACE - 1;
+	if( total == 0 ) total = 1;
+
+	interval_ns = 1000000000ULL / rate;
+
+	pfds = ( struct pollfd * )malloc( sizeof( struct pollfd ) * num_peers );
+	if( ! pfds ) return;
+
+	for( i = 0; i < num_peers; i++ )
+	{
+		pfds[i].fd = lpeers[i].peer->data_fd;
+		pfds[i].events = POLLIN;
+	}
+
+	start_us = applemidi_peer_now_us();
+	next_send_ns = start_us * 1000;
+
+	while( ! loadgen_stop )
+	{
+		now_us = applemidi_peer_now_us();
+		now_ns = now_us * 1000;
+
+		while( ( result->sent < total ) && ( now_ns >= next_send_ns ) )
+		{
+			uint32_t id = ( first_id + result->sent ) & LOADGEN_ID_MASK;
+
+			sent_us[id] = applemidi_peer_now_us();
+			loadgen_send_note( local_fd, id );
+			result->sent++;
+			next_send_ns += interval_ns;
+			last_send_us = sent_us[id];
+		}
+
+		if( result->sent == total )
+		{
+			if( drain_deadline == 0 ) drain_deadline = now_us + LOADGEN_DRAIN_US;
+			if( now_us >= drain_deadline ) break;
+			wait_ns = ( drain_deadline - now_us ) * 1000;
+		} else {
+			wait_ns = ( next_send_ns > now_ns ? next_send_ns - now_ns : 0 );
+		}
+
+		// Sub-millisecond waits spin so that high rates are paced accurately
+		if( poll( pfds, num_peers, (int)( wait_ns / 1000000ULL ) ) <= 0 ) continue;
+
+		for( i = 0; i < num_peers; i++ )
+		{
+			if( pfds[i].revents & POLLIN )
+			{
+				loadgen_receive( &(lpeers[i]), first_id, result->sent, result );
+			}
+		}
+
+		// Stop draining early once everything has arrived
+		if( ( result->sent == total ) && ( result->received + result->duplicates >= total * num_peers ) ) break;
+	}
+
+	free( pfds );
+
+	*next_id = ( first_id + result->sent ) & LOADGEN_ID_MASK;
+
+	result->expected = result->sent * num_peers;
+	result->loss_percent = ( result->expected > 0 ? ( 100.0 * ( result->expected - result->received ) ) / result->expected : 0 );
+	result->p50_us = histogram_percentile( result->received, 50.0 );
+	result->p90_us = histogram_percentile( result->received, 90.0 );
+	result->p99_us = histogram_percentile( result->received, 99.0 );
+	result->p999_us = histogram_percentile( result->received, 99.9 );
+	result->max_us = latency_max;
+	result->achieved_rate = ( last_send_us > start_us ? ( 1000000.0 * result->sent ) / ( last_send_us - start_us ) : 0 );
+}
+
+static int loadgen_run( int num_peers, int local_fd )
+{
+	loadgen_peer_t *lpeers = NULL;
+	loadgen_result_t result;
+	unsigned long rate = 0;
+	unsigned long sustainable = 0;
+	uint32_t next_id = 0;
+	uint32_t ssrc_base = 0;
+	uint64_t rtt_us = 0;
+	int connected = 0;
+	int i = 0;
+	char name[32];
+
+	lpeers = ( loadgen_peer_t * )malloc( sizeof( loadgen_peer_t ) * num_peers );
+	if( ! lpeers ) return -1;
+	memset( lpeers, 0, sizeof( loadgen_peer_t ) * num_peers );
+
+	ssrc_base = ( (uint32_t)getpid() << 16 ) ^ (uint32_t)time( NULL );
+
+	for( i = 0; i < num_peers; i++ )
+	{
+		snprintf( name, sizeof( name ), "loadgen-%d", i );
+		lpeers[i].peer = applemidi_peer_create( host, control_port, data_port, ssrc_base + ( i * 0x101 ), name );
+		lpeers[i].seen = ( uint8_t * )malloc( LOADGEN_ID_SPACE / 8 );
+
+		if( ! lpeers[i].peer || ! lpeers[i].seen ) goto loadgen_run_cleanup;
+
+		if( applemidi_peer_invite( lpeers[i].peer, 1000 ) != 0 )
+		{
+			fprintf( stderr, "peer %d: invitation failed\n", i );
+			goto loadgen_run_cleanup;
+		}
+
+		if( applemidi_peer_sync( lpeers[i].peer, 1000, &rtt_us ) != 0 )
+		{
+			fprintf( stderr, "peer %d: CK sync failed\n", i );
+			goto loadgen_run_cleanup;
+		}
+		connected++;
+	}
+
+	printf( "\npeers=%d\n", num_peers );
+	printf( "%10s %10s %10s %8s %9s %9s %9s %9s %9s %9s\n", "rate", "achieved", "sent", "loss%", "p50(us)", "p90(us)", "p99(us)", "p99.9(us)", "max(us)", "dups" );
+
+	for( rate = start_rate; ( rate <= max_rate ) && ! loadgen_stop; rate *= 2 )
+	{
+		loadgen_step( lpeers, num_peers, local_fd, rate, &next_id, &result );
+
+		printf( "%10lu %10.0f %10llu %8.3f %9llu %9llu %9llu %9llu %9llu %9llu\n", rate, result.achieved_rate,
+			(unsigned long long)result.sent, result.loss_percent,
+			(unsigned long long)result.p50_us, (unsigned long long)result.p90_us,
+			(unsigned long long)result.p99_us, (unsigned long long)result.p999_us,
+			(unsigned long long)result.max_us, (unsigned long long)result.duplicates );
+		fflush( stdout );
+
+		if( ( result.loss_percent > loss_limit_percent ) || ( result.p99_us > ( latency_limit_ms * 1000 ) ) ) break;
+		sustainable = rate;
+	}
+
+	printf( "max sustainable rate for %d peers: %lu notes/s (loss <= %.2f%%, p99 <= %.1fms)\n", num_peers, sustainable, loss_limit_percent, latency_limit_ms );
+
+loadgen_run_cleanup:
+	for( i = 0; i < num_peers; i++ )
+	{
+		if( lpeers[i].peer )
+		{
+			if( i < connected ) applemidi_peer_end( lpeers[i].peer );
+			applemidi_peer_destroy( &(lpeers[i].peer) );
+		}
+		if( lpeers[i].seen ) free( lpeers[i].seen );
+	}
+	free( lpeers );
+
+	// Give the daemon time to tear down the sessions
+	usleep( 200000 );
+
+	return ( connected == num_peers ? 0 : -1 );
+}
+
+static void loadgen_usage( void )
+{
+	fprintf( stderr, "Usage:\n");
+	fprintf( stderr, "\traveloxmidi_loadgen [-H host] [-c control_port] [-D data_port] [-l local_port] [-p peers] [-r start_rate] [-R max_rate] [-d seconds] [-t latency_ms] [-L loss_percent] [-f feedback_interval] [-h]\n");
+	fprintf( stderr, "\n");
+	fprintf( stderr, "-H host\t\tAddress of the daemon (default %s)\n", host );
+	fprintf( stderr, "-c port\t\tControl port (default %d)\n", control_port );
+	fprintf( stderr, "-D port\t\tData port (default %d)\n", data_port );
+	fprintf( stderr, "-l port\t\tLocal MIDI port (default %d)\n", local_port );
+	fprintf( stderr, "-p list\t\tComma separated list of peer counts (default %s)\n", peer_list );
+	fprintf( stderr, "-r rate\t\tFirst rate in notes per second (default %lu)\n", start_rate );
+	fprintf( stderr, "-R rate\t\tHighest rate to try (default %lu)\n", max_rate );
+	fprintf( stderr, "-d seconds\tDuration of each rate step (default %.1f)\n", step_duration );
+	fprintf( stderr, "-t ms\t\t99th percentile latency limit (default %.1f)\n", latency_limit_ms );
+	fprintf( stderr, "-L percent\tLoss limit (default %.2f)\n", loss_limit_percent );
+	fprintf( stderr, "-f packets\tSend RS feedback every n packets per peer, 0 to disable (default %u)\n", feedback_interval );
+}
+
+int main( int argc, char *argv[] )
+{
+	static struct option long_options[] = {
+		{"host", required_argument, NULL, 'H'},
+		{"control", required_argument, NULL, 'c'},
+		{"data", required_argument, NULL, 'D'},
+		{"local", required_argument, NULL, 'l'},
+		{"peers", required_argument, NULL, 'p'},
+		{"rate", required_argument, NULL, 'r'},
+		{"maxrate", required_argument, NULL, 'R'},
+		{"duration", required_argument, NULL, 'd'},
+		{"latency", required_argument, NULL, 't'},
+		{"loss", required_argument, NULL, 'L'},
+		{"feedback", required_argument, NULL, 'f'},
+		{"help", no_argument, NULL, 'h'},
+		{0,0,0,0}
+	};
+	const char *short_options = "H:c:D:l:p:r:R:d:t:L:f:h";
+	char *peers_copy = NULL;
+	char *token = NULL;
+	char *saveptr = NULL;
+	int local_fd = -1;
+	int num_peers = 0;
+	int ret = 0;
+	int c;
+
+	while( 1 )
+	{
+		c = getopt_long( argc, argv, short_options, long_options, NULL );
+
+		if( c == -1 ) break;
+
+		switch( c )
+		{
+			case 'H':
+				host = optarg;
+				break;
+			case 'c':
+				control_port = atoi( optarg );
+				data_port = control_port + 1;
+				break;
+			case 'D':
+				data_port = atoi( optarg );
+				break;
+			case 'l':
+				local_port = atoi( optarg );
+				break;
+			case 'p':
+				peer_list = optarg;
+				break;
+			case 'r':
+				start_rate = strtoul( optarg, NULL, 10 );
+				break;
+			case 'R':
+				max_rate = strtoul( optarg, NULL, 10 );
+				break;
+			case 'd':
+				step_duration = atof( optarg );
+				break;
+			case 't':
+				latency_limit_ms = atof( optarg );
+				break;
+			case 'L':
+				loss_limit_percent = atof( optarg );
+				break;
+			case 'f':
+				feedback_interval = strtoul( optarg, NULL, 10 );
+				break;
+			case 'h':
+			default:
+				loadgen_usage();
+				exit( c == 'h' ? 0 : 1 );
+		}
+	}
+
+	if( ( start_rate == 0 ) || ( step_duration <= 0 ) )
+	{
+		loadgen_usage();
+		exit( 1 );
+	}
+
+	signal( SIGINT, loadgen_signal );
+	signal( SIGTERM, loadgen_signal );
+
+	local_fd = applemidi_local_open( host, local_port );
+	if( local_fd < 0 )
+	{
+		fprintf( stderr, "Unable to open local port [%s]:%d\n", host, local_port );
+		exit( 1 );
+	}
+
+	printf( "raveloxmidi_loadgen host=%s control=%d data=%d local=%d step=%.1fs feedback=%u\n", host, control_port, data_port, local_port, step_duration, feedback_interval );
+
+	peers_copy = strdup( peer_list );
+	for( token = strtok_r( peers_copy, ",", &saveptr ); token && ! loadgen_stop; token = strtok_r( NULL, ",", &saveptr ) )
+	{
+		num_peers = atoi( token );
+		if( ( num_peers <= 0 ) || ( num_peers > LOADGEN_MAX_PEERS ) )
+		{
+			fprintf( stderr, "Invalid number of peers: %s\n", token );
+			ret = 1;
+			continue;
+		}
+
+		if( loadgen_run( num_peers, local_fd ) != 0 ) ret = 1;
+	}
+
+	free( peers_copy );
+	close( local_fd );
+
+	return ret;
+}
@@ -0,0 +1,597 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+/* Multi-peer session simulator.
+
+   Brings up a number of simulated AppleMIDI peers against a running daemon,
+   each with its own SSRC and sockets. Every peer runs the IN handshake, keeps
+   a periodic CK sync going, sends RS feedback with a configurable loss and
+   checks the recovery journal on every RTP-MIDI packet it receives. Notes
+   are injected through the local port so that each one fans out to every
+   session. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <getopt.h>
+#include <signal.h>
+
+#include <sys/socket.h>
+
+#include "config.h"
+
+#include "applemidi_peer.h"
+#include "midi_journal.h"
+#include "utils.h"
+
+#include "logging.h"
+
+#define PEERSIM_MAX_PEERS	1024
+#define PEERSIM_DRAIN_US	500000
+#define PEERSIM_VELOCITY	100
+
+typedef struct peersim_peer_t {
+	applemidi_peer_t	*peer;
+	int			connected;
+	int			have_seq;
+	uint16_t		last_seq;
+	int			last_channel;
+	int			last_note;
+	int			rs_sent;
+	uint16_t		rs_seq;
+	uint32_t		since_feedback;
+	int			sync_pending;
+	uint64_t		next_sync_us;
+	uint64_t		packets;
+	uint64_t		gaps;
+	uint64_t		oversize;
+	uint64_t		syncs;
+	uint64_t		sync_failures;
+	uint64_t		sync_rtt_max_us;
+	uint64_t		feedback_sent;
+	uint64_t		feedback_dropped;
+	uint64_t		journals;
+	uint64_t		journal_errors;
+	uint64_t		missing;
+} peersim_peer_t;
+
+static char *host = "127.0.0.1";
+static int control_port = 5004;
+static int data_port = 5005;
+static int local_port = 5006;
+static int num_peers = 8;
+static double duration = 10.0;
+static unsigned long note_rate = 100;
+static unsigned int rs_loss_percent = 10;
+static unsigned int feedback_interval = 1;
+static double sync_interval = 2.0;
+static unsigned int seed = 1;
+
+static volatile sig_atomic_t peersim_stop = 0;
+
+static void peersim_signal( int signal )
+{
+	peersim_stop = 1;
+}
+
+static void peersim_send_note( int local_fd, int channel, int note )
+{
+	unsigned char buffer[4];
+
+	buffer[0] = 0xaa;
+	buffer[1] = 0x90 | ( channel & 0x0f );
+	buffer[2] = note & 0x7f;
+	buffer[3] = PEERSIM_VELOCITY;
+
+	send( local_fd, buffer, sizeof( buffer ), 0 );
+}
+
+/* Walk the recovery journal and check that it is well formed.
+   Only chapters P, C and N are expected from the daemon.
+   Returns -1 if the structure is broken, 0 otherwise.
+   *found is set when the channel/note pair is present in chapter N */
+static int peersim_check_journal( unsigned char *journal, size_t len, uint16_t packet_seq, int channel, int note, int *found )
+{
+	size_t offset = 0;
+	size_t chapter = 0;
+	size_t channel_end = 0;
+	uint16_t checkpoint = 0;
+	uint16_t channel_header = 0;
+	uint16_t seen_channels = 0;
+	int totchan = 0;
+	int chan = 0;
+	int i = 0, j = 0;
+
+	*found = 0;
+
+	if( ! journal ) return -1;
+	if( len < JOURNAL_HEADER_PACKED_SIZE ) return -1;
+
+	// Only channel journals are produced
+	if( ( journal[0] >> 4 ) & JOURNAL_HEADER_Y_FLAG ) return -1;
+	if( ! ( ( journal[0] >> 4 ) & JOURNAL_HEADER_A_FLAG ) ) return -1;
+
+	totchan = ( journal[0] & 0x0f ) + 1;
+	checkpoint = ( journal[1] << 8 ) | journal[2];
+
+	// The checkpoint can't be ahead of the packet carrying it
+	if( (uint16_t)( packet_seq - checkpoint ) >= 0x8000 ) return -1;
+
+	offset = JOURNAL_HEADER_PACKED_SIZE;
+
+	for( i = 0; i < totchan; i++ )
+	{
+		if( offset + CHANNEL_HEADER_PACKED_SIZE > len ) return -1;
+
+		channel_header = ( journal[offset] << 8 ) | journal[offset + 1];
+		chan = ( channel_header >> 11 ) & 0x0f;
+		channel_end = offset + ( channel_header & 0x03ff );
+
+		if( ( channel_header & 0x03ff ) < CHANNEL_HEADER_PACKED_SIZE ) return -1;
+		if( channel_end > len ) return -1;
+		if( seen_channels & ( 1 << chan ) ) return -1;
+		seen_channels |= ( 1 << chan );
+
+		if( journal[offset + 2] & ~( CHAPTER_P | CHAPTER_C | CHAPTER_N ) ) return -1;
+
+		chapter = offset + CHANNEL_HEADER_PACKED_SIZE;
+
+		// The order of chapters is: PCMWNETA
+		if( journal[offset + 2] & CHAPTER_P )
+		{
+			chapter += 3;
+		}
+
+		if( journal[offset + 2] & CHAPTER_C )
+		{
+			if( chapter >= channel_end ) return -1;
+			chapter += 1 + ( 2 * ( ( journal[chapter] & 0x7f ) + 1 ) );
+		}
+
+		if( journal[offset + 2] & CHAPTER_N )
+		{
+			int num_notes = 0;
+			int low = 0, high = 0;
+
+			if( chapter + 2 > channel_end ) return -1;
+
+			num_notes = journal[chapter] & 0x7f;
+			low = ( journal[chapter + 1] >> 4 ) & 0x0f;
+			high = journal[chapter + 1] & 0x0f;
+			chapter += 2;
+
+			// LEN=127 LOW=15 HIGH=0 is 128 note logs and no offbits
+			if( ( num_notes == 127 ) && ( low == 15 ) && ( high == 0 ) ) num_notes = 128;
+
+			if( chapter + ( 2 * num_notes ) > channel_end ) return -1;
+
+			for( j = 0; j < num_notes; j++ )
+			{
+				if( ( chan == channel ) && ( ( journal[chapter] & 0x7f ) == note ) ) *found = 1;
+				chapter += 2;
+			}
+
+			if( low <= high ) chapter += ( high - low ) + 1;
+		}
+
+		if( chapter != channel_end ) return -1;
+
+		offset = channel_end;
+	}
+
+	if( offset != len ) return -1;
+
+	return 0;
+}
+
+static void peersim_receive( peersim_peer_t *ppeer )
+{
+	applemidi_peer_rtp_t rtp;
+	int found = 0;
+	int ret = 0;
+
+	while( ( ret = applemidi_peer_read( ppeer->peer, &rtp ) ) > APPLEMIDI_PEER_READ_NONE )
+	{
+		if( ret == APPLEMIDI_PEER_READ_SYNC )
+		{
+			ppeer->sync_pending = 0;
+			ppeer->syncs++;
+			ppeer->sync_rtt_max_us = MAX( ppeer->sync_rtt_max_us, ppeer->peer->sync_rtt_us );
+			continue;
+		}
+
+		if( ret != APPLEMIDI_PEER_READ_RTP ) continue;
+
+		ppeer->packets++;
+
+		// Larger than a single Ethernet frame can carry
+		if( rtp.packet_len > NET_APPLEMIDI_UDPSIZE ) ppeer->oversize++;
+
+		if( ppeer->have_seq && ( rtp.seq != (uint16_t)( ppeer->last_seq + 1 ) ) ) ppeer->gaps++;
+
+		if( rtp.journal_len > 0 )
+		{
+			ppeer->journals++;
+
+			if( peersim_check_journal( rtp.journal, rtp.journal_len, rtp.seq, ppeer->last_channel, ppeer->last_note, &found ) != 0 )
+			{
+				ppeer->journal_errors++;
+			}
+		} else {
+			found = 0;
+		}
+
+		// The note from the previous packet must be journaled unless an RS acknowledging it has been sent
+		if( ppeer->have_seq && ( rtp.seq == (uint16_t)( ppeer->last_seq + 1 ) ) && ( ppeer->last_note > 0 )
+			&& ! ( ppeer->rs_sent && ( ppeer->rs_seq == ppeer->last_seq ) )
+			&& ! found )
+		{
+			ppeer->missing++;
+		}
+
+		ppeer->have_seq = 1;
+		ppeer->last_seq = rtp.seq;
+		ppeer->last_note = 0;
+
+		if( ( rtp.midi_len >= 3 ) && ( ( rtp.midi[0] & 0xf0 ) == 0x90 ) )
+		{
+			ppeer->last_channel = rtp.midi[0] & 0x0f;
+			ppeer->last_note = rtp.midi[1] & 0x7f;
+		}
+
+		ppeer->since_feedback++;
+		if( ( feedback_interval > 0 ) && ( ppeer->since_feedback >= feedback_interval ) )
+		{
+			ppeer->since_feedback = 0;
+
+			if( (unsigned int)( rand_r( &seed ) % 100 ) < rs_loss_percent )
+			{
+				ppeer->feedback_dropped++;
+			} else {
+				applemidi_peer_feedback( ppeer->peer, rtp.seq );
+				ppeer->rs_sent = 1;
+				ppeer->rs_seq = rtp.seq;
+				ppeer->feedback_sent++;
+			}
+		}
+	}
+}
+
+static void peersim_sync( peersim_peer_t *ppeers, uint64_t now_us )
+{
+	int i = 0;
+
+	if( sync_interval <= 0 ) return;
+
+	for( i = 0; i < num_peers; i++ )
+	{
+		if( now_us < ppeers[i].next_sync_us ) continue;
+
+		// The previous exchange never completed
+		if( ppeers[i].sync_pending ) ppeers[i].sync_failures++;
+
+		ppeers[i].sync_pending = ( applemidi_peer_sync_start( ppeers[i].peer ) == 0 );
+		if( ! ppeers[i].sync_pending ) ppeers[i].sync_failures++;
+
+		ppeers[i].next_sync_us = now_us + (uint64_t)( sync_interval * 1000000 );
+	}
+}
+
+static int peersim_run( peersim_peer_t *ppeers, int local_fd )
+{
+	struct pollfd *pfds = NULL;
+	uint64_t start_us = 0, end_us = 0, now_us = 0;
+	uint64_t next_send_us = 0, interval_us = 0;
+	uint64_t next_event_us = 0;
+	uint64_t notes_sent = 0;
+	int channel = 0, note = 0;
+	int timeout = 0;
+	int i = 0;
+
+	pfds = ( struct pollfd * )malloc( sizeof( struct pollfd ) * num_peers );
+	if( ! pfds ) return -1;
+
+	for( i = 0; i < num_peers; i++ )
+	{
+		pfds[i].fd = ppeers[i].peer->data_fd;
+		pfds[i].events = POLLIN;
+	}
+
+	start_us = applemidi_peer_now_us();
+	end_us = start_us + (uint64_t)( duration * 1000000 );
+	interval_us = ( note_rate > 0 ? 1000000 / note_rate : 0 );
+	next_send_us = start_us;
+
+	// Stagger the syncs so they don't all land at once
+	for( i = 0; i < num_peers; i++ )
+	{
+		ppeers[i].next_sync_us = start_us + (uint64_t)( ( sync_interval * 1000000 * i ) / num_peers );
+	}
+
+	while( ! peersim_stop )
+	{
+		now_us = applemidi_peer_now_us();
+
+		if( now_us >= end_us + PEERSIM_DRAIN_US ) break;
+
+		if( now_us < end_us )
+		{
+			while( ( interval_us > 0 ) && ( now_us >= next_send_us ) )
+			{
+				// Cycle through notes 1-127 on every channel in turn
+				note = ( note % 127 ) + 1;
+				if( note == 1 ) channel = ( channel + 1 ) & 0x0f;
+
+				peersim_send_note( local_fd, channel, note );
+				notes_sent++;
+				next_send_us += interval_us;
+			}
+
+			peersim_sync( ppeers, now_us );
+		}
+
+		next_event_us = end_us + PEERSIM_DRAIN_US;
+		if( ( now_us < end_us ) && ( interval_us > 0 ) ) next_event_us = MIN( next_event_us, next_send_us );
+		if( ( now_us < end_us ) && ( sync_interval > 0 ) )
+		{
+			for( i = 0; i < num_peers; i++ ) next_event_us = MIN( next_event_us, ppeers[i].next_sync_us );
+		}
+
+		timeout = ( next_event_us > now_us ? (int)( ( next_event_us - now_us ) / 1000 ) : 0 );
+
+		if( poll( pfds, num_peers, timeout ) <= 0 ) continue;
+
+		for( i = 0; i < num_peers; i++ )
+		{
+			if( pfds[i].revents & POLLIN ) peersim_receive( &(ppeers[i]) );
+		}
+	}
+
+	// Anything still outstanding at the end is counted as a failed sync
+	for( i = 0; i < num_peers; i++ )
+	{
+		if( ppeers[i].sync_pending ) ppeers[i].sync_failures++;
+	}
+
+	free( pfds );
+
+	printf( "notes sent: %llu over %.1fs\n", (unsigned long long)notes_sent, ( now_us - start_us ) / 1000000.0 );
+
+	return 0;
+}
+
+static int peersim_report( peersim_peer_t *ppeers )
+{
+	peersim_peer_t total;
+	int i = 0;
+
+	memset( &total, 0, sizeof( peersim_peer_t ) );
+
+	printf( "%6s %10s %10s %6s %8s %6s %7s %10s %8s %8s %10s %8s %8s\n", "peer", "ssrc", "packets", "gaps", "oversize", "syncs", "ckfail", "ckrtt(us)", "rs_sent", "rs_drop", "journals", "jerrors", "missing" );
+
+	for( i = 0; i < num_peers; i++ )
+	{
+		printf( "%6d 0x%08x %10llu %6llu %8llu %6llu %7llu %10llu %8llu %8llu %10llu %8llu %8llu\n", i, ppeers[i].peer->ssrc,
+			(unsigned long long)ppeers[i].packets, (unsigned long long)ppeers[i].gaps, (unsigned long long)ppeers[i].oversize,
+			(unsigned long long)ppeers[i].syncs, (unsigned long long)ppeers[i].sync_failures,
+			(unsigned long long)ppeers[i].sync_rtt_max_us,
+			(unsigned long long)ppeers[i].feedback_sent, (unsigned long long)ppeers[i].feedback_dropped,
+			(unsigned long long)ppeers[i].journals, (unsigned long long)ppeers[i].journal_errors,
+			(unsigned long long)ppeers[i].missing );
+
+		total.packets += ppeers[i].packets;
+		total.gaps += ppeers[i].gaps;
+		total.oversize += ppeers[i].oversize;
+		total.syncs += ppeers[i].syncs;
+		total.sync_failures += ppeers[i].sync_failures;
+		total.sync_rtt_max_us = MAX( total.sync_rtt_max_us, ppeers[i].sync_rtt_max_us );
+		total.feedback_sent += ppeers[i].feedback_sent;
+		total.feedback_dropped += ppeers[i].feedback_dropped;
+		total.journals += ppeers[i].journals;
+		total.journal_errors += ppeers[i].journal_errors;
+		total.missing += ppeers[i].missing;
+	}
+
+	printf( "%6s %10s %10llu %6llu %8llu %6llu %7llu %10llu %8llu %8llu %10llu %8llu %8llu\n", "total", "",
+		(unsigned long long)total.packets, (unsigned long long)total.gaps, (unsigned long long)total.oversize,
+		(unsigned long long)total.syncs, (unsigned long long)total.sync_failures,
+		(unsigned long long)total.sync_rtt_max_us,
+		(unsigned long long)total.feedback_sent, (unsigned long long)total.feedback_dropped,
+		(unsigned long long)total.journals, (unsigned long long)total.journal_errors,
+		(unsigned long long)total.missing );
+
+	if( ( total.journal_errors > 0 ) || ( total.missing > 0 ) )
+	{
+		printf( "FAIL: journal validation errors\n" );
+		return -1;
+	}
+
+	printf( "PASS\n" );
+	return 0;
+}
+
+static void peersim_usage( void )
+{
+	fprintf( stderr, "Usage:\n");
+	fprintf( stderr, "\traveloxmidi_peersim [-H host] [-c control_port] [-D data_port] [-l local_port] [-n peers] [-d seconds] [-r rate] [-L loss_percent] [-f feedback_interval] [-s sync_seconds] [-S seed] [-h]\n");
+	fprintf( stderr, "\n");
+	fprintf( stderr, "-H host\t\tAddress of the daemon (default %s)\n", host );
+	fprintf( stderr, "-c port\t\tControl port (default %d)\n", control_port );
+	fprintf( stderr, "-D port\t\tData port (default %d)\n", data_port );
+	fprintf( stderr, "-l port\t\tLocal MIDI port (default %d)\n", local_port );
+	fprintf( stderr, "-n peers\tNumber of simulated peers (default %d)\n", num_peers );
+	fprintf( stderr, "-d seconds\tDuration of the run (default %.1f)\n", duration );
+	fprintf( stderr, "-r rate\t\tNotes per second sent through the local port, 0 for none (default %lu)\n", note_rate );
+	fprintf( stderr, "-L percent\tPercentage of RS feedback to drop (default %u)\n", rs_loss_percent );
+	fprintf( stderr, "-f packets\tSend RS feedback every n packets per peer, 0 to disable (default %u)\n", feedback_interval );
+	fprintf( stderr, "-s seconds\tCK sync interval per peer, 0 to disable (default %.1f)\n", sync_interval );
+	fprintf( stderr, "-S seed\t\tSeed for the RS loss (default %u)\n", seed );
+}
+
+int main( int argc, char *argv[] )
+{
+	static struct option long_options[] = {
+		{"host", required_argument, NULL, 'H'},
+		{"control", required_argument, NULL, 'c'},
+		{"data", required_argument, NULL, 'D'},
+		{"local", required_argument, NULL, 'l'},
+		{"peers", required_argument, NULL, 'n'},
+		{"duration", required_argument, NULL, 'd'},
+		{"rate", required_argument, NULL, 'r'},
+		{"loss", required_argument, NULL, 'L'},
+		{"feedback", required_argument, NULL, 'f'},
+		{"sync", required_argument, NULL, 's'},
+		{"seed", required_argument, NULL, 'S'},
+		{"help", no_argument, NULL, 'h'},
+		{0,0,0,0}
+	};
+	const char *short_options = "H:c:D:l:n:d:r:L:f:s:S:h";
+	peersim_peer_t *ppeers = NULL;
+	uint32_t ssrc_base = 0;
+	int local_fd = -1;
+	int connected = 0;
+	int ret = 1;
+	int i = 0;
+	int c;
+	char name[32];
+
+	while( 1 )
+	{
+		c = getopt_long( argc, argv, short_options, long_options, NULL );
+
+		if( c == -1 ) break;
+
+		switch( c )
+		{
+			case 'H':
+				host = optarg;
+				break;
+			case 'c':
+				control_port = atoi( optarg );
+				data_port = control_port + 1;
+				break;
+			case 'D':
+				data_port = atoi( optarg );
+				break;
+			case 'l':
+				local_port = atoi( optarg );
+				break;
+			case 'n':
+				num_peers = atoi( optarg );
+				break;
+			case 'd':
+				duration = atof( optarg );
+				break;
+			case 'r':
+				note_rate = strtoul( optarg, NULL, 10 );
+				break;
+			case 'L':
+				rs_loss_percent = strtoul( optarg, NULL, 10 );
+				break;
+			case 'f':
+				feedback_interval = strtoul( optarg, NULL, 10 );
+				break;
+			case 's':
+				sync_interval = atof( optarg );
+				break;
+			case 'S':
+				seed = strtoul( optarg, NULL, 10 );
+				break;
+			case 'h':
+			default:
+				peersim_usage();
+				exit( c == 'h' ? 0 : 1 );
+		}
+	}
+
+	if( ( num_peers <= 0 ) || ( num_peers > PEERSIM_MAX_PEERS ) || ( duration <= 0 ) || ( rs_loss_percent > 100 ) || ( note_rate > 1000000 ) )
+	{
+		peersim_usage();
+		exit( 1 );
+	}
+
+	signal( SIGINT, peersim_signal );
+	signal( SIGTERM, peersim_signal );
+
+	local_fd = applemidi_local_open( host, local_port );
+	if( local_fd < 0 )
+	{
+		fprintf( stderr, "Unable to open local port [%s]:%d\n", host, local_port );
+		exit( 1 );
+	}
+
+	printf( "raveloxmidi_peersim host=%s control=%d data=%d local=%d peers=%d duration=%.1fs rate=%lu rs_loss=%u%% feedback=%u sync=%.1fs seed=%u\n",
+		host, control_port, data_port, local_port, num_peers, duration, note_rate, rs_loss_percent, feedback_interval, sync_interval, seed );
+
+	ppeers = ( peersim_peer_t * )malloc( sizeof( peersim_peer_t ) * num_peers );
+	if( ! ppeers ) goto peersim_cleanup;
+	memset( ppeers, 0, sizeof( peersim_peer_t ) * num_peers );
+
+	ssrc_base = ( (uint32_t)getpid() << 16 ) ^ (uint32_t)time( NULL );
+
+	for( i = 0; i < num_peers && ! peersim_stop; i++ )
+	{
+		snprintf( name, sizeof( name ), "peersim-%d", i );
+		ppeers[i].peer = applemidi_peer_create( host, control_port, data_port, ssrc_base + ( i * 0x101 ), name );
+
+		if( ! ppeers[i].peer )
+		{
+			fprintf( stderr, "peer %d: unable to create sockets\n", i );
+			goto peersim_cleanup;
+		}
+
+		if( applemidi_peer_invite( ppeers[i].peer, 1000 ) != 0 )
+		{
+			fprintf( stderr, "peer %d: invitation failed\n", i );
+			goto peersim_cleanup;
+		}
+
+		ppeers[i].connected = 1;
+		connected++;
+	}
+
+	if( connected != num_peers ) goto peersim_cleanup;
+
+	printf( "%d sessions established\n", connected );
+
+	if( peersim_run( ppeers, local_fd ) != 0 ) goto peersim_cleanup;
+
+	ret = ( peersim_report( ppeers ) == 0 ? 0 : 1 );
+
+peersim_cleanup:
+	if( ppeers )
+	{
+		for( i = 0; i < num_peers; i++ )
+		{
+			if( ! ppeers[i].peer ) continue;
+			if( ppeers[i].connected ) applemidi_peer_end( ppeers[i].peer );
+			applemidi_peer_destroy( &(ppeers[i].peer) );
+		}
+		free( ppeers );
+	}
+
+	close( local_fd );
+
+	return ret;
+}
@@ -0,0 +1,197 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <alloca.h>
+#include <malloc.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include <errno.h>
+extern int errno;
+
+#include "config.h"
+
+#include "realtime.h"
+#include "pipeline.h"
+#include "utils.h"
+
+#include "raveloxmidi_config.h"
+#include "logging.h"
+
+/* Counted for the summary logged by realtime_start() */
+static uint32_t threads_applied = 0;
+static uint32_t threads_scheduled = 0;
+static uint32_t threads_pinned = 0;
+
+static int realtime_enabled( void )
+{
+	return config_bool_get("realtime.enabled");
+}
+
+static long realtime_role_long( char *role, char *setting, long default_value )
+{
+	char key[ 64 ];
+	char *value = NULL;
+
+	snprintf( key, sizeof( key ), "realtime.%s.%s", role, setting );
+
+	value = config_string_get( key );
+	if( ! value ) return default_value;
+
+	return config_long_get( key );
+}
+
+int realtime_thread_apply( pthread_t thread, char *role )
+{
+	struct sched_param param;
+	long priority = 0;
+	long cpu = PIPELINE_CPU_ANY;
+	int min_priority = 0;
+	int max_priority = 0;
+	int ret = 0;
+	int failed = 0;
+
+	if( ! realtime_enabled() ) return 0;
+	if( ! role ) return -1;
+
+	__atomic_add_fetch( &threads_applied, 1, __ATOMIC_RELAXED );
+
+	priority = realtime_role_long( role, "priority", 0 );
+	cpu = realtime_role_long( role, "cpu", PIPELINE_CPU_ANY );
+
+	// A priority of 0 leaves the thread with the normal scheduler
+	if( priority > 0 )
+	{
+		min_priority = sched_get_priority_min( SCHED_FIFO );
+		max_priority = sched_get_priority_max( SCHED_FIFO );
+
+		if( priority < min_priority || priority > max_priority )
+		{
+			logging_printf( LOGGING_WARN, "realtime_thread_apply: realtime.%s.priority=%ld is outside %d to %d\n", role, priority, min_priority, max_priority );
+			failed = 1;
+		} else {
+			memset( &param, 0, sizeof( param ) );
+			param.sched_priority = priority;
+
+			ret = pthread_setschedparam( thread, SCHED_FIFO, &param );
+			if( ret != 0 )
+			{
+				logging_printf( LOGGING_WARN, "realtime_thread_apply: Unable to set SCHED_FIFO priority %ld for %s thread: %s\n", priority, role, strerror( ret ) );
+				if( ret == EPERM )
+				{
+					logging_printf( LOGGING_WARN, "realtime_thread_apply: Run as root, or give raveloxmidi CAP_SYS_NICE or an RLIMIT_RTPRIO of at least %ld\n", priority );
+				}
+				failed = 1;
+			} else {
+				__atomic_add_fetch( &threads_scheduled, 1, __ATOMIC_RELAXED );
+				logging_printf( LOGGING_NORMAL, "Realtime: %s thread is SCHED_FIFO priority %ld\n", role, priority );
+			}
+		}
+	}
+
+	if( cpu >= 0 )
+	{
+		if( pipeline_set_affinity( thread, (int)cpu, role ) == 0 )
+		{
+			__atomic_add_fetch( &threads_pinned, 1, __ATOMIC_RELAXED );
+			logging_printf( LOGGING_NORMAL, "Realtime: %s thread is pinned to CPU %ld\n", role, cpu );
+		} else {
+			failed = 1;
+		}
+	}
+
+	return ( failed ? -1 : 0 );
+}
+
+/* Touch the top of the stack now so that a page fault doesn't happen later while MIDI is being handled */
+void realtime_prefault_stack( void )
+{
+	volatile unsigned char *stack = NULL;
+	long size = 0;
+	long page_size = 0;
+	long i = 0;
+
+	if( ! realtime_enabled() ) return;
+
+	size = config_long_get("realtime.stack_prefault");
+	if( size <= 0 ) return;
+	if( size > REALTIME_MAX_STACK_PREFAULT ) size = REALTIME_MAX_STACK_PREFAULT;
+
+	page_size = sysconf( _SC_PAGESIZE );
+	if( page_size <= 0 ) page_size = 4096;
+
+	stack = ( volatile unsigned char * ) alloca( size );
+	for( i = 0; i < size; i += page_size )
+	{
+		stack[i] = 0;
+	}
+
+	logging_printf( LOGGING_DEBUG, "realtime_prefault_stack: %ld bytes\n", size );
+}
+
+static int realtime_lock_memory( void )
+{
+	if( ! config_bool_get("realtime.lock_memory") ) return 0;
+
+	// Freed memory stays with the process so that a later allocation doesn't need a new, unlocked, page
+	mallopt( M_TRIM_THRESHOLD, -1 );
+	mallopt( M_MMAP_MAX, 0 );
+
+	if( mlockall( MCL_CURRENT | MCL_FUTURE ) != 0 )
+	{
+		logging_printf( LOGGING_WARN, "realtime_lock_memory: Unable to lock memory: %s\n", strerror( errno ) );
+		if( errno == EPERM || errno == ENOMEM )
+		{
+			logging_printf( LOGGING_WARN, "realtime_lock_memory: Run as root, or give raveloxmidi CAP_IPC_LOCK or a larger RLIMIT_MEMLOCK\n");
+		}
+		return -1;
+	}
+
+	logging_printf( LOGGING_NORMAL, "Realtime: Memory is locked\n");
+	return 1;
+}
+
+void realtime_start( void )
+{
+	int locked = 0;
+
+	if( ! realtime_enabled() ) return;
+
+	realtime_thread_apply( pthread_self(), "main" );
+	realtime_prefault_stack();
+	locked = realtime_lock_memory();
+
+	logging_printf( LOGGING_NORMAL, "Realtime mode: threads=%u sched_fifo=%u pinned=%u memory_locked=%s\n",
+		__atomic_load_n( &threads_applied, __ATOMIC_RELAXED ),
+		__atomic_load_n( &threads_scheduled, __ATOMIC_RELAXED ),
+		__atomic_load_n( &threads_pinned, __ATOMIC_RELAXED ),
+		( locked > 0 ? "yes" : "no" ) );
+}
@@ -0,0 +1,186 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+
+#include "ring.h"
+#include "utils.h"
+
+#include "logging.h"
+
+/* head and tail are free running byte counts. Only their difference, and their
+   position masked to the ring size, are ever used, so they can wrap */
+
+ring_t *ring_create( char *name, uint32_t size )
+{
+	ring_t *ring = NULL;
+	uint32_t ring_size = RING_MIN_SIZE;
+
+	if( size > RING_MAX_SIZE ) size = RING_MAX_SIZE;
+
+	while( ring_size < size ) ring_size <<= 1;
+
+	ring = ( ring_t * ) malloc( sizeof( ring_t ) );
+	if( ! ring )
+	{
+		logging_printf( LOGGING_ERROR, "ring_create: Insufficient memory to create ring\n");
+		return NULL;
+	}
+
+	memset( ring, 0, sizeof( ring_t ) );
+
+	ring->name = ( name ? name : "ring" );
+	ring->size = ring_size;
+	ring->mask = ring_size - 1;
+	ring->data = ( unsigned char * ) malloc( ring_size );
+
+	if( ! ring->data )
+	{
+		logging_printf( LOGGING_ERROR, "ring_create: Insufficient memory for %u bytes in ring %s\n", ring_size, ring->name );
+		FREENULL( "ring_create: ring", (void **)&ring );
+		return NULL;
+	}
+
+	logging_printf( LOGGING_DEBUG, "ring_create: name=%s size=%u\n", ring->name, ring_size );
+
+	return ring;
+}
+
+void ring_destroy( ring_t **ring )
+{
+	if( ! ring ) return;
+	if( ! *ring ) return;
+
+	FREENULL( "ring_destroy: data", (void **)&( (*ring)->data ) );
+	FREENULL( "ring_destroy: ring", (void **)ring );
+}
+
+/* Only a snapshot when the other side is running */
+uint32_t ring_used( ring_t *ring )
+{
+	if( ! ring ) return 0;
+
+	return __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE ) - __atomic_load_n( &ring->tail, __ATOMIC_ACQUIRE );
+}
+
+static void ring_write( ring_t *ring, uint32_t pos, unsigned char *src, uint32_t len )
+{
+	uint32_t offset = pos & ring->mask;
+	uint32_t first = MIN( len, ring->size - offset );
+
+	memcpy( ring->data + offset, src, first );
+	memcpy( ring->data, src + first, len - first );
+}
+
+static void ring_read( ring_t *ring, uint32_t pos, unsigned char *dest, uint32_t len )
+{
+	uint32_t offset = pos & ring->mask;
+	uint32_t first = MIN( len, ring->size - offset );
+
+	memcpy( dest, ring->data + offset, first );
+	memcpy( dest + first, ring->data, len - first );
+}
+
+int ring_push( ring_t *ring, unsigned char *chunk, uint32_t len )
+{
+	uint32_t head = 0;
+	uint32_t tail = 0;
+	uint32_t used = 0;
+	uint32_t needed = 0;
+
+	if( ! ring ) return -1;
+	if( ! chunk || len == 0 ) return 0;
+
+	head = __atomic_load_n( &ring->head, __ATOMIC_RELAXED );
+	tail = __atomic_load_n( &ring->tail, __ATOMIC_ACQUIRE );
+
+	used = head - tail;
+	needed = len + RING_HEADER_SIZE;
+
+	if( len > ring->size || needed > ring->size - used )
+	{
+		__atomic_store_n( &ring->overflows, ring->overflows + 1, __ATOMIC_RELAXED );
+		__atomic_store_n( &ring->overflow_bytes, ring->overflow_bytes + len, __ATOMIC_RELAXED );
+		return -1;
+	}
+
+	ring_write( ring, head, (unsigned char *)&len, RING_HEADER_SIZE );
+	ring_write( ring, head + RING_HEADER_SIZE, chunk, len );
+
+	/* The consumer can't see the chunk until the head has moved past it */
+	__atomic_store_n( &ring->head, head + needed, __ATOMIC_RELEASE );
+
+	__atomic_store_n( &ring->chunks, ring->chunks + 1, __ATOMIC_RELAXED );
+	if( used + needed > ring->high_water )
+	{
+		__atomic_store_n( &ring->high_water, used + needed, __ATOMIC_RELAXED );
+	}
+
+	return 0;
+}
+
+int ring_pop( ring_t *ring, unsigned char *buffer, uint32_t buffer_size )
+{
+	uint32_t head = 0;
+	uint32_t tail = 0;
+	uint32_t len = 0;
+	int ret = 0;
+
+	if( ! ring ) return 0;
+
+	tail = __atomic_load_n( &ring->tail, __ATOMIC_RELAXED );
+	head = __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE );
+
+	if( head == tail ) return 0;
+
+	ring_read( ring, tail, (unsigned char *)&len, RING_HEADER_SIZE );
+
+	if( ! buffer || len > buffer_size )
+	{
+		logging_printf( LOGGING_WARN, "ring_pop: %s chunk of %u bytes is too big for a %u byte buffer. Discarded\n", ring->name, len, buffer_size );
+		ret = -1;
+	} else {
+		ring_read( ring, tail + RING_HEADER_SIZE, buffer, len );
+		ret = (int)len;
+	}
+
+	/* Hand the space back to the producer */
+	__atomic_store_n( &ring->tail, tail + RING_HEADER_SIZE + len, __ATOMIC_RELEASE );
+
+	return ret;
+}
+
+void ring_dump( ring_t *ring )
+{
+	DEBUG_ONLY;
+	if( ! ring ) return;
+
+	logging_printf( LOGGING_DEBUG, "ring_dump: name=%s,size=%u,used=%u,chunks=%u,high_water=%u,overflows=%u,overflow_bytes=%u\n",
+		ring->name, ring->size, ring_used( ring ),
+		__atomic_load_n( &ring->chunks, __ATOMIC_RELAXED ),
+		__atomic_load_n( &ring->high_water, __ATOMIC_RELAXED ),
+		__atomic_load_n( &ring->overflows, __ATOMIC_RELAXED ),
+		__atomic_load_n( &ring->overflow_bytes, __ATOMIC_RELAXED ) );
+}
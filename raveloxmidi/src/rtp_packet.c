@@ -31,16 +31,37 @@
 
 #include "logging.h"
 
-rtp_packet_t * rtp_packet_create( void )
+/* Packets created without an arena come from this pool */
+static pool_t *rtp_packet_pool = NULL;
+
+void rtp_packet_pool_init( uint32_t capacity )
+{
+	if( rtp_packet_pool ) return;
+	rtp_packet_pool = pool_create( "rtp_packet", sizeof( rtp_packet_t ), capacity );
+}
+
+void rtp_packet_pool_teardown( void )
+{
+	pool_dump( rtp_packet_pool );
+	pool_destroy( &rtp_packet_pool );
+}
+
+rtp_packet_t * rtp_packet_create( arena_t *arena )
 {
 	rtp_packet_t *new;
 
-	new = ( rtp_packet_t * ) malloc( sizeof( rtp_packet_t ) );
+	if( arena )
+	{
+		new = ( rtp_packet_t * ) arena_alloc( arena, sizeof( rtp_packet_t ) );
+	} else {
+		new = ( rtp_packet_t * ) pool_alloc( rtp_packet_pool, sizeof( rtp_packet_t ) );
+	}
 
 	if( new )
 	{
 		memset( new, 0 , sizeof( rtp_packet_t ) );
 		new->payload = NULL;
+		new->arena = arena;
 
 		// Initialise the standard fields
 
@@ -60,19 +81,28 @@ void rtp_packet_destroy( rtp_packet_t **packet )
 	if( ! packet ) return ;
 	if( ! *packet ) return ;
 
+	/* Packets from an arena are released by arena_reset() */
+	if( (*packet)->arena )
+	{
+		*packet = NULL;
+		return;
+	}
+
 	if( (*packet)->payload ) {
 		free( (*packet)->payload );
 	}
 	(*packet)->payload = NULL;
 	(*packet)->payload_len = 0;
 
-	FREENULL( "rtp_packet", (void **)packet);
+	pool_free( rtp_packet_pool, *packet );
+	*packet = NULL;
 }
 
 int rtp_packet_pack( rtp_packet_t *packet, unsigned char **out_buffer, size_t *out_buffer_len )
 {
 	unsigned char *p;
 	size_t packed_header_buffer_size = 0;
+	size_t packed_payload_size = 0;
 	uint16_t temp_header = 0;
 
 	*out_buffer = NULL;
@@ -84,14 +114,19 @@ int rtp_packet_pack( rtp_packet_t *packet, unsigned char **out_buffer, size_t *o
 	}
 
 	packed_header_buffer_size = ( sizeof(uint16_t) + sizeof(uint16_t) + sizeof(uint32_t) + sizeof(uint32_t) );
-	*out_buffer = (unsigned char *)malloc( packed_header_buffer_size );
-	memset( *out_buffer, 0, packed_header_buffer_size );
+	if( packet->payload )
+	{
+		packed_payload_size = packet->payload_len;
+	}
+
+	*out_buffer = (unsigned char *)arena_alloc( packet->arena, packed_header_buffer_size + packed_payload_size );
 
 	if( ! *out_buffer )
 	{
 		return 1;
 	}
-	
+	memset( *out_buffer, 0, packed_header_buffer_size );
+
 	p = *out_buffer;
 
 	temp_header |= ( packet->header.v << 6 ) << 8;
@@ -106,27 +141,34 @@ int rtp_packet_pack( rtp_packet_t *packet, unsigned char **out_buffer, size_t *o
 	put_uint32( &p , packet->header.timestamp, out_buffer_len );
 	put_uint32( &p , packet->header.ssrc, out_buffer_len );
 
-	if( packet->payload && (packet->payload_len > 0) )
+	if( packed_payload_size > 0 )
 	{
-		*out_buffer = (unsigned char *)realloc( *out_buffer, *out_buffer_len + packet->payload_len );
-		if( *out_buffer )
-		{
-			p = *out_buffer + *out_buffer_len;
-			memcpy( p , packet->payload, packet->payload_len );
-			*out_buffer_len += packet->payload_len;
-		}
+		memcpy( p , packet->payload, packed_payload_size );
+		*out_buffer_len += packed_payload_size;
 	}
 
 	return 0;
 }
 
-void rtp_packet_unpack( unsigned char *buffer, size_t buffer_len, rtp_packet_t *rtp_packet )
+/* Parse the RTP header and point the payload into buffer without copying it.
+   A packet filled in this way must not be passed to rtp_packet_destroy() */
+int rtp_packet_view( unsigned char *buffer, size_t buffer_len, rtp_packet_t *rtp_packet )
 {
 	uint16_t temp_header;
 	unsigned char *p;
 	size_t current_buffer_len;
 
-	if( ! buffer ) return;
+	if( ! buffer ) return -1;
+	if( ! rtp_packet ) return -1;
+
+	rtp_packet->payload = NULL;
+	rtp_packet->payload_len = 0;
+
+	if( buffer_len < RTP_PACKET_HEADER_SIZE )
+	{
+		logging_printf( LOGGING_DEBUG, "rtp_packet_view: Packet too short (%zu bytes)\n", buffer_len );
+		return -1;
+	}
 
 	p = buffer;
 	current_buffer_len = buffer_len;
@@ -146,14 +188,35 @@ void rtp_packet_unpack( unsigned char *buffer, size_t buffer_len, rtp_packet_t *
 	get_uint32( &(rtp_packet->header.timestamp), &p, &current_buffer_len );
 	get_uint32( &(rtp_packet->header.ssrc), &p, &current_buffer_len );	
 
-	/* Get the payload */
-	rtp_packet->payload = NULL;
-	rtp_packet->payload_len = 0;
 	if( current_buffer_len > 0 )
 	{
-		rtp_packet->payload = ( unsigned char * ) malloc( current_buffer_len );
+		rtp_packet->payload = p;
 		rtp_packet->payload_len = current_buffer_len;
-		memcpy( rtp_packet->payload, p, current_buffer_len );
+	}
+
+	return 0;
+}
+
+void rtp_packet_unpack( unsigned char *buffer, size_t buffer_len, rtp_packet_t *rtp_packet )
+{
+	unsigned char *payload = NULL;
+	size_t payload_len = 0;
+
+	if( ! buffer ) return;
+
+	if( rtp_packet_view( buffer, buffer_len, rtp_packet ) != 0 ) return;
+
+	/* Take a copy of the payload */
+	payload = rtp_packet->payload;
+	payload_len = rtp_packet->payload_len;
+	rtp_packet->payload = NULL;
+	rtp_packet->payload_len = 0;
+	if( payload_len > 0 )
+	{
+		rtp_packet->payload = ( unsigned char * ) arena_alloc( rtp_packet->arena, payload_len );
+		if( ! rtp_packet->payload ) return;
+		rtp_packet->payload_len = payload_len;
+		memcpy( rtp_packet->payload, payload, payload_len );
 	}
 }
 
@@ -0,0 +1,268 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+
+#include "timer_wheel.h"
+#include "utils.h"
+
+#include "logging.h"
+
+/* Each slot is the head of a circular list, so a timer can be unlinked without knowing which slot it's in */
+
+static void timer_wheel_list_init( timer_wheel_timer_t *head )
+{
+	head->next = head;
+	head->prev = head;
+}
+
+static void timer_wheel_link( timer_wheel_timer_t *head, timer_wheel_timer_t *timer )
+{
+	timer->prev = head->prev;
+	timer->next = head;
+	head->prev->next = timer;
+	head->prev = timer;
+}
+
+static void timer_wheel_unlink( timer_wheel_timer_t *timer )
+{
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->next = NULL;
+	timer->prev = NULL;
+}
+
+timer_wheel_t *timer_wheel_create( uint32_t tick_ms, uint64_t now_ms )
+{
+	timer_wheel_t *wheel = NULL;
+	int level = 0;
+	int slot = 0;
+
+	wheel = ( timer_wheel_t * ) malloc( sizeof( timer_wheel_t ) );
+	if( ! wheel )
+	{
+		logging_printf( LOGGING_ERROR, "timer_wheel_create: Insufficient memory to create timer wheel\n");
+		return NULL;
+	}
+
+	memset( wheel, 0, sizeof( timer_wheel_t ) );
+
+	wheel->tick_ms = ( tick_ms > 0 ? tick_ms : 1 );
+	wheel->start_ms = now_ms;
+
+	for( level = 0; level < TIMER_WHEEL_LEVELS; level++ )
+	{
+		for( slot = 0; slot < TIMER_WHEEL_SLOTS; slot++ )
+		{
+			timer_wheel_list_init( &( wheel->slots[level][slot] ) );
+		}
+	}
+
+	logging_printf( LOGGING_DEBUG, "timer_wheel_create: tick_ms=%u levels=%u slots=%u\n", wheel->tick_ms, TIMER_WHEEL_LEVELS, TIMER_WHEEL_SLOTS );
+
+	return wheel;
+}
+
+/* Timers belong to their callers. Any still pending are only marked as not pending */
+void timer_wheel_destroy( timer_wheel_t **wheel )
+{
+	timer_wheel_timer_t *head = NULL;
+	int level = 0;
+	int slot = 0;
+
+	if( ! wheel ) return;
+	if( ! *wheel ) return;
+
+	for( level = 0; level < TIMER_WHEEL_LEVELS; level++ )
+	{
+		for( slot = 0; slot < TIMER_WHEEL_SLOTS; slot++ )
+		{
+			head = &( (*wheel)->slots[level][slot] );
+			while( head->next != head )
+			{
+				timer_wheel_unlink( head->next );
+			}
+		}
+	}
+
+	FREENULL( "timer_wheel_destroy: wheel", (void **)wheel );
+}
+
+void timer_wheel_dump( timer_wheel_t *wheel )
+{
+	DEBUG_ONLY;
+	if( ! wheel ) return;
+
+	logging_printf( LOGGING_DEBUG, "timer_wheel_dump: tick_ms=%u,now=%llu,pending=%u,added=%u,cancelled=%u,expired=%u,cascaded=%u\n",
+		wheel->tick_ms, (unsigned long long)wheel->now, wheel->pending, wheel->added, wheel->cancelled, wheel->expired, wheel->cascaded );
+}
+
+void timer_wheel_timer_init( timer_wheel_timer_t *timer, char *name, timer_wheel_callback_t callback, void *data )
+{
+	if( ! timer ) return;
+
+	memset( timer, 0, sizeof( timer_wheel_timer_t ) );
+	timer->name = ( name ? name : "timer" );
+	timer->callback = callback;
+	timer->data = data;
+}
+
+int timer_wheel_timer_pending( timer_wheel_timer_t *timer )
+{
+	if( ! timer ) return 0;
+
+	return ( timer->next != NULL );
+}
+
+/* Link the timer into the slot for its expiry at the lowest level that reaches it */
+static void timer_wheel_place( timer_wheel_t *wheel, timer_wheel_timer_t *timer )
+{
+	uint64_t ticks = 0;
+	int level = 0;
+	int slot = 0;
+
+	// Timers moved down when their slot comes round may be due on this tick
+	if( timer->expires < wheel->now )
+	{
+		timer->expires = wheel->now;
+	}
+
+	ticks = timer->expires - wheel->now;
+	if( ticks > TIMER_WHEEL_MAX_TICKS )
+	{
+		ticks = TIMER_WHEEL_MAX_TICKS;
+		timer->expires = wheel->now + ticks;
+	}
+
+	for( level = 0; level < TIMER_WHEEL_LEVELS - 1; level++ )
+	{
+		if( ticks < ( 1ULL << ( TIMER_WHEEL_BITS * ( level + 1 ) ) ) ) break;
+	}
+
+	slot = ( timer->expires >> ( TIMER_WHEEL_BITS * level ) ) & TIMER_WHEEL_MASK;
+
+	timer_wheel_link( &( wheel->slots[level][slot] ), timer );
+}
+
+void timer_wheel_add( timer_wheel_t *wheel, timer_wheel_timer_t *timer, uint64_t delay_ms )
+{
+	uint64_t ticks = 0;
+
+	if( ! wheel ) return;
+	if( ! timer ) return;
+
+	timer_wheel_cancel( wheel, timer );
+
+	// The slot for this tick has already been run
+	ticks = ( delay_ms + wheel->tick_ms - 1 ) / wheel->tick_ms;
+	if( ticks == 0 ) ticks = 1;
+	if( ticks > TIMER_WHEEL_MAX_TICKS ) ticks = TIMER_WHEEL_MAX_TICKS;
+
+	timer->expires = wheel->now + ticks;
+	timer_wheel_place( wheel, timer );
+
+	wheel->pending++;
+	wheel->added++;
+}
+
+void timer_wheel_cancel( timer_wheel_t *wheel, timer_wheel_timer_t *timer )
+{
+	if( ! wheel ) return;
+	if( ! timer ) return;
+	if( ! timer->next ) return;
+
+	timer_wheel_unlink( timer );
+
+	wheel->pending--;
+	wheel->cancelled++;
+}
+
+/* Move every timer in a slot down to the level below */
+static void timer_wheel_cascade( timer_wheel_t *wheel, int level, int slot )
+{
+	timer_wheel_timer_t *head = &( wheel->slots[level][slot] );
+	timer_wheel_timer_t *timer = NULL;
+
+	while( head->next != head )
+	{
+		timer = head->next;
+		timer_wheel_unlink( timer );
+		timer_wheel_place( wheel, timer );
+		wheel->cascaded++;
+	}
+}
+
+uint32_t timer_wheel_advance( timer_wheel_t *wheel, uint64_t now_ms )
+{
+	timer_wheel_timer_t due;
+	timer_wheel_timer_t *timer = NULL;
+	uint64_t target = 0;
+	uint32_t fired = 0;
+	int level = 0;
+	int slot = 0;
+
+	if( ! wheel ) return 0;
+	if( now_ms < wheel->start_ms ) return 0;
+
+	target = ( now_ms - wheel->start_ms ) / wheel->tick_ms;
+
+	while( wheel->now < target )
+	{
+		wheel->now++;
+
+		// Each time a level comes round, the next slot of the level above is due to be moved down
+		slot = wheel->now & TIMER_WHEEL_MASK;
+		for( level = 1; slot == 0 && level < TIMER_WHEEL_LEVELS; level++ )
+		{
+			slot = ( wheel->now >> ( TIMER_WHEEL_BITS * level ) ) & TIMER_WHEEL_MASK;
+			timer_wheel_cascade( wheel, level, slot );
+		}
+
+		if( wheel->pending == 0 ) continue;
+
+		// The slot is moved to a list of its own so that callbacks can add timers to it for the next round
+		slot = wheel->now & TIMER_WHEEL_MASK;
+		if( wheel->slots[0][slot].next == &( wheel->slots[0][slot] ) ) continue;
+
+		due.next = wheel->slots[0][slot].next;
+		due.prev = wheel->slots[0][slot].prev;
+		due.next->prev = &due;
+		due.prev->next = &due;
+		timer_wheel_list_init( &( wheel->slots[0][slot] ) );
+
+		while( due.next != &due )
+		{
+			timer = due.next;
+			timer_wheel_unlink( timer );
+			wheel->pending--;
+			wheel->expired++;
+			fired++;
+
+			if( timer->callback ) timer->callback( timer->data );
+		}
+	}
+
+	return fired;
+}
@@ -0,0 +1,351 @@
+/*
+   This file is part of raveloxmidi.
+
+   Copyright (C) 2018 Dave Kelly
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <errno.h>
+extern int errno;
+
+#include "config.h"
+
+#include "uring.h"
+#include "utils.h"
+
+#include "logging.h"
+
+#ifdef HAVE_IO_URING
+
+static int uring_sys_setup( uint32_t entries, struct io_uring_params *params )
+{
+	return ( int ) syscall( __NR_io_uring_setup, entries, params );
+}
+
+static int uring_sys_enter( int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags, void *arg, size_t arg_size )
+{
+	return ( int ) syscall( __NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size );
+}
+
+static int uring_sys_register( int fd, uint32_t opcode, void *arg, uint32_t nr_args )
+{
+	return ( int ) syscall( __NR_io_uring_register, fd, opcode, arg, nr_args );
+}
+
+/* Receives, sends and reads on an eventfd are all that's used */
+static int uring_probe( uring_t *uring )
+{
+	struct io_uring_probe *probe = NULL;
+	size_t probe_size = 0;
+	int ops[] = { IORING_OP_RECVMSG, IORING_OP_SENDMSG, IORING_OP_READ, IORING_OP_ASYNC_CANCEL };
+	int ret = 0;
+	size_t i = 0;
+
+	probe_size = sizeof( struct io_uring_probe ) + 256 * sizeof( struct io_uring_probe_op );
+	probe = ( struct io_uring_probe * ) calloc( 1, probe_size );
+	if( ! probe ) return -1;
+
+	if( uring_sys_register( uring->fd, IORING_REGISTER_PROBE, probe, 256 ) < 0 )
+	{
+		logging_printf( LOGGING_INFO, "uring_probe: %s: Unable to probe operations: %s\n", uring->name, strerror( errno ) );
+		free( probe );
+		return -1;
+	}
+
+	for( i = 0; i < sizeof( ops ) / sizeof( ops[0] ); i++ )
+	{
+		if( ops[i] > probe->last_op || ! ( probe->ops[ ops[i] ].flags & IO_URING_OP_SUPPORTED ) )
+		{
+			logging_printf( LOGGING_INFO, "uring_probe: %s: Operation %d is not supported\n", uring->name, ops[i] );
+			ret = -1;
+		}
+	}
+
+	free( probe );
+	return ret;
+}
+
+static int uring_buffers_create( uring_t *uring, uint16_t buffer_count, uint32_t buffer_size )
+{
+	struct io_uring_buf_reg reg;
+	uint16_t i = 0;
+
+	uring->buf_ring_size = buffer_count * sizeof( struct io_uring_buf );
+	uring->buf_ring = ( struct io_uring_buf_ring * ) mmap( NULL, uring->buf_ring_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0 );
+	if( uring->buf_ring == MAP_FAILED )
+	{
+		uring->buf_ring = NULL;
+		return -1;
+	}
+
+	uring->buffers = ( unsigned char * ) malloc( (size_t)buffer_count * buffer_size );
+	if( ! uring->buffers ) return -1;
+
+	uring->buffer_count = buffer_count;
+	uring->buffer_size = buffer_size;
+
+	memset( &reg, 0, sizeof( reg ) );
+	reg.ring_addr = ( uint64_t )( uintptr_t ) uring->buf_ring;
+	reg.ring_entries = buffer_count;
+	reg.bgid = 0;
+
+	// Needs 5.19
+	if( uring_sys_register( uring->fd, IORING_REGISTER_PBUF_RING, &reg, 1 ) < 0 )
+	{
+		logging_printf( LOGGING_INFO, "uring_buffers_create: %s: Unable to register buffer ring: %s\n", uring->name, strerror( errno ) );
+		return -1;
+	}
+
+	for( i = 0; i < buffer_count; i++ )
+	{
+		uring_buffer_return( uring, i );
+	}
+
+	return 0;
+}
+
+uring_t *uring_create( char *name, uint32_t entries, uint16_t buffer_count, uint32_t buffer_size )
+{
+	uring_t *uring = NULL;
+	struct io_uring_params params;
+	size_t sq_size = 0;
+	size_t cq_size = 0;
+	uint32_t i = 0;
+
+	// The buffer ring is indexed with a mask
+	if( buffer_count > 0 && ( buffer_count & ( buffer_count - 1 ) ) != 0 ) return NULL;
+
+	uring = ( uring_t * ) calloc( 1, sizeof( uring_t ) );
+	if( ! uring )
+	{
+		logging_printf( LOGGING_ERROR, "uring_create: Insufficient memory for %s\n", name );
+		return NULL;
+	}
+
+	uring->name = ( name ? name : "uring" );
+	uring->fd = -1;
+
+	// Multishot receives can complete many times for one submission
+	memset( &params, 0, sizeof( params ) );
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = entries * 4;
+
+	uring->fd = uring_sys_setup( entries, &params );
+	if( uring->fd < 0 )
+	{
+		logging_printf( LOGGING_INFO, "uring_create: %s: io_uring is not available: %s\n", uring->name, strerror( errno ) );
+		goto uring_create_fail;
+	}
+
+	// Needs 5.11
+	if( ! ( params.features & IORING_FEAT_SINGLE_MMAP ) || ! ( params.features & IORING_FEAT_NODROP ) || ! ( params.features & IORING_FEAT_EXT_ARG ) )
+	{
+		logging_printf( LOGGING_INFO, "uring_create: %s: Kernel io_uring is too old (features=0x%08x)\n", uring->name, params.features );
+		goto uring_create_fail;
+	}
+
+	uring->sq_entries = params.sq_entries;
+	uring->cq_entries = params.cq_entries;
+
+	sq_size = params.sq_off.array + params.sq_entries * sizeof( uint32_t );
+	cq_size = params.cq_off.cqes + params.cq_entries * sizeof( struct io_uring_cqe );
+	uring->ring_map_size = MAX( sq_size, cq_size );
+
+	uring->ring_map = mmap( NULL, uring->ring_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING );
+	if( uring->ring_map == MAP_FAILED )
+	{
+		uring->ring_map = NULL;
+		logging_printf( LOGGING_INFO, "uring_create: %s: Unable to map rings: %s\n", uring->name, strerror( errno ) );
+		goto uring_create_fail;
+	}
+
+	uring->sqes_size = params.sq_entries * sizeof( struct io_uring_sqe );
+	uring->sqes = ( struct io_uring_sqe * ) mmap( NULL, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES );
+	if( uring->sqes == MAP_FAILED )
+	{
+		uring->sqes = NULL;
+		logging_printf( LOGGING_INFO, "uring_create: %s: Unable to map submission entries: %s\n", uring->name, strerror( errno ) );
+		goto uring_create_fail;
+	}
+
+	uring->sq_head = ( uint32_t * )( ( unsigned char * )uring->ring_map + params.sq_off.head );
+	uring->sq_tail = ( uint32_t * )( ( unsigned char * )uring->ring_map + params.sq_off.tail );
+	uring->sq_mask = ( uint32_t * )( ( unsigned char * )uring->ring_map + params.sq_off.ring_mask );
+	uring->sq_array = ( uint32_t * )( ( unsigned char * )uring->ring_map + params.sq_off.array );
+	uring->cq_head = ( uint32_t * )( ( unsigned char * )uring->ring_map + params.cq_off.head );
+	uring->cq_tail = ( uint32_t * )( ( unsigned char * )uring->ring_map + params.cq_off.tail );
+	uring->cq_mask = ( uint32_t * )( ( unsigned char * )uring->ring_map + params.cq_off.ring_mask );
+	uring->cqes = ( struct io_uring_cqe * )( ( unsigned char * )uring->ring_map + params.cq_off.cqes );
+
+	// Each slot in the submission ring always refers to the entry with the same index
+	for( i = 0; i < uring->sq_entries; i++ )
+	{
+		uring->sq_array[i] = i;
+	}
+	uring->sq_local_tail = *( uring->sq_tail );
+	uring->sq_flushed = uring->sq_local_tail;
+
+	if( uring_probe( uring ) != 0 ) goto uring_create_fail;
+
+	if( buffer_count > 0 && uring_buffers_create( uring, buffer_count, buffer_size ) != 0 ) goto uring_create_fail;
+
+	logging_printf( LOGGING_DEBUG, "uring_create: name=%s sq_entries=%u cq_entries=%u buffers=%u buffer_size=%u\n",
+		uring->name, uring->sq_entries, uring->cq_entries, uring->buffer_count, uring->buffer_size );
+
+	return uring;
+
+uring_create_fail:
+	uring_destroy( &uring );
+	return NULL;
+}
+
+/* Closing the ring cancels anything still in flight */
+void uring_destroy( uring_t **uring )
+{
+	if( ! uring ) return;
+	if( ! *uring ) return;
+
+	if( (*uring)->fd >= 0 ) close( (*uring)->fd );
+	if( (*uring)->sqes ) munmap( (*uring)->sqes, (*uring)->sqes_size );
+	if( (*uring)->ring_map ) munmap( (*uring)->ring_map, (*uring)->ring_map_size );
+	if( (*uring)->buf_ring ) munmap( (*uring)->buf_ring, (*uring)->buf_ring_size );
+	if( (*uring)->buffers ) free( (*uring)->buffers );
+
+	FREENULL( "uring_destroy: uring", (void **)uring );
+}
+
+void uring_dump( uring_t *uring )
+{
+	DEBUG_ONLY;
+
+	if( ! uring ) return;
+
+	logging_printf( LOGGING_DEBUG, "uring: name=%s fd=%d sq_entries=%u cq_entries=%u buffers=%u enters=%u submitted=%u completed=%u\n",
+		uring->name, uring->fd, uring->sq_entries, uring->cq_entries, uring->buffer_count, uring->enters, uring->submitted, uring->completed );
+}
+
+struct io_uring_sqe *uring_get_sqe( uring_t *uring )
+{
+	struct io_uring_sqe *sqe = NULL;
+	uint32_t head = 0;
+
+	if( ! uring ) return NULL;
+
+	head = __atomic_load_n( uring->sq_head, __ATOMIC_ACQUIRE );
+	if( uring->sq_local_tail - head >= uring->sq_entries ) return NULL;
+
+	sqe = &( uring->sqes[ uring->sq_local_tail & *( uring->sq_mask ) ] );
+	uring->sq_local_tail++;
+
+	memset( sqe, 0, sizeof( struct io_uring_sqe ) );
+
+	return sqe;
+}
+
+int uring_submit( uring_t *uring, uint32_t wait_nr, int timeout_ms )
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	uint32_t to_submit = 0;
+	uint32_t flags = 0;
+	int ret = 0;
+
+	if( ! uring ) return -EINVAL;
+
+	to_submit = uring->sq_local_tail - uring->sq_flushed;
+	__atomic_store_n( uring->sq_tail, uring->sq_local_tail, __ATOMIC_RELEASE );
+	uring->sq_flushed = uring->sq_local_tail;
+
+	if( to_submit == 0 && wait_nr == 0 ) return 0;
+
+	memset( &arg, 0, sizeof( arg ) );
+	if( wait_nr > 0 )
+	{
+		flags |= IORING_ENTER_GETEVENTS;
+		if( timeout_ms >= 0 )
+		{
+			ts.tv_sec = timeout_ms / 1000;
+			ts.tv_nsec = ( timeout_ms % 1000 ) * 1000000L;
+			arg.ts = ( uint64_t )( uintptr_t ) &ts;
+		}
+	}
+	flags |= IORING_ENTER_EXT_ARG;
+
+	uring->enters++;
+	ret = uring_sys_enter( uring->fd, to_submit, wait_nr, flags, &arg, sizeof( arg ) );
+	if( ret < 0 ) return -errno;
+
+	uring->submitted += ret;
+	return 0;
+}
+
+struct io_uring_cqe *uring_peek_cqe( uring_t *uring )
+{
+	uint32_t head = 0;
+	uint32_t tail = 0;
+
+	if( ! uring ) return NULL;
+
+	head = *( uring->cq_head );
+	tail = __atomic_load_n( uring->cq_tail, __ATOMIC_ACQUIRE );
+	if( head == tail ) return NULL;
+
+	return &( uring->cqes[ head & *( uring->cq_mask ) ] );
+}
+
+void uring_cqe_seen( uring_t *uring )
+{
+	if( ! uring ) return;
+
+	uring->completed++;
+	__atomic_store_n( uring->cq_head, *( uring->cq_head ) + 1, __ATOMIC_RELEASE );
+}
+
+unsigned char *uring_buffer( uring_t *uring, uint16_t id )
+{
+	if( ! uring ) return NULL;
+	if( id >= uring->buffer_count ) return NULL;
+
+	return uring->buffers + (size_t)id * uring->buffer_size;
+}
+
+void uring_buffer_return( uring_t *uring, uint16_t id )
+{
+	struct io_uring_buf *buf = NULL;
+
+	if( ! uring ) return;
+	if( id >= uring->buffer_count ) return;
+
+	buf = &( uring->buf_ring->bufs[ uring->buf_tail & ( uring->buffer_count - 1 ) ] );
+	buf->addr = ( uint64_t )( uintptr_t ) uring_buffer( uring, id );
+	buf->len = uring->buffer_size;
+	buf->bid = id;
+
+	uring->buf_tail++;
+	__atomic_store_n( &( uring->buf_ring->tail ), uring->buf_tail, __ATOMIC_RELEASE );
+}
+
+#endif
@@ -43,24 +43,17 @@ extern int errno;
 
 uint64_t ntohll(const uint64_t value)
 {
-	enum { TYP_INIT, TYP_SMLE, TYP_BIGE };
       	union
 	{
 		uint64_t ull;
 		uint8_t  c[8];
 	} x;
 
-	// Test if on Big Endian system.
-	static int typ = TYP_INIT;
-
-	if (typ == TYP_INIT)
-	{
-		x.ull = 0x01;
-		typ = (x.c[7] == 0x01) ? TYP_BIGE : TYP_SMLE;
-	}
+	// Test if on Big Endian system. Not cached, as the main loop and the pipeline stages can get here first at the same time
+	x.ull = 0x01;
 
 	// System is Big Endian; return value as is.
-	if (typ == TYP_BIGE)
+	if (x.c[7] == 0x01)
 	{
 		return value;
 	}